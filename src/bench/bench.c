@@ -0,0 +1,877 @@
+#include <arpa/inet.h>
+#include <errno.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "../server/utils/utils.h"
+#include "../common/common.h"
+#include "../common/params.h"
+
+// First file descriptor number assigned to the virtual connections, far from the ones used by the process
+#define SIM_FD_BASE (1 << 20)
+// Virtual time that elapses for every frame injected by the driver
+#define SIM_TICK_NS 1000000ULL
+// Default size of the largest population of the scaling sweep
+#define DEFAULT_MAX_CLIENTS 4096
+// Default size of the smallest population of the scaling sweep
+#define DEFAULT_MIN_CLIENTS 16
+// Number of events recorded to measure the cost of the flight recorder
+#define FLIGHT_BENCH_EVENTS 1000000
+// Number of timers scheduled by the timer wheel measurement
+#define TIMER_BENCH_TIMERS 131072
+// Players whose games are written to the log replayed by the recovery measurement
+#define WAL_BENCH_PLAYERS 65536
+// Frames handled by a simulation thread between two passes on the rankings it owns, like an event-loop iteration
+#define SIM_BATCH 64
+
+/**
+ * @brief Connection of a virtual client, whose data never leaves the process
+ *
+ * The inbox contains the frames injected by the driver and not yet consumed by the server,
+ * while the outbox collects the frames written by the server.
+ */
+typedef struct SimConnection
+{
+    char *inbox;            /**< Bytes waiting to be read by the server. */
+    size_t inbox_length;    /**< Number of valid bytes in the inbox. */
+    size_t inbox_offset;    /**< Position of the next byte to be read by the server. */
+    size_t inbox_capacity;  /**< Allocated size of the inbox. */
+    char *outbox;           /**< Bytes written by the server and not yet collected. */
+    size_t outbox_length;   /**< Number of valid bytes in the outbox. */
+    size_t outbox_capacity; /**< Allocated size of the outbox. */
+    bool open;              /**< False once the server has closed the connection. */
+    Client *client;         /**< Client created by the server for this connection. */
+} SimConnection;
+
+/**
+ * @brief Phases of a simulated game session, executed in order by every simulation thread
+ */
+typedef enum SimPhase
+{
+    PHASE_CONNECT,
+    PHASE_LOGIN,
+    PHASE_QUIZ_LIST,
+    PHASE_SELECT,
+    PHASE_ANSWER,
+    PHASE_RANKING,
+    PHASE_DISCONNECT,
+    PHASES_COUNT
+} SimPhase;
+
+// Names of the phases, as printed in the report
+static const char *phase_names[PHASES_COUNT] = {"connect", "login", "quiz-list", "select", "answer", "ranking", "disconnect"};
+// Allocation scope of each phase: the handler of the message type injected, or the connection setup
+static const int phase_scopes[PHASES_COUNT] = {ALLOC_SCOPE_OTHER, MSG_SET_NICKNAME, MSG_REQ_QUIZ_LIST, MSG_QUIZ_SELECT,
+                                               MSG_QUIZ_ANSWER, MSG_REQ_RANKING, MSG_DISCONNECT};
+
+/**
+ * @brief Cost measured for one phase of the simulation
+ */
+typedef struct PhaseStats
+{
+    size_t operations;     /**< Number of frames handled by the server. */
+    uint64_t elapsed_ns;   /**< Time spent by the server handling them. */
+    size_t frames;         /**< Frames sent by the server in response. */
+    size_t bytes;          /**< Bytes sent by the server in response. */
+} PhaseStats;
+
+/**
+ * @brief Barrier that lets the waiting simulation threads keep serving the rankings they own
+ *
+ * A thread blocked on a full ranking queue waits for its owner to consume it, so the owner cannot sleep
+ * in a pthread barrier while the other threads are still running the phase.
+ */
+typedef struct SimBarrier
+{
+    unsigned int parties;    /**< Number of threads that must reach the barrier. */
+    unsigned int waiting;    /**< Number of threads that have reached it in the current generation. */
+    unsigned int generation; /**< Incremented every time all the threads have reached the barrier. */
+} SimBarrier;
+
+/**
+ * @brief Simulation thread, acting as a worker of the server that owns a slice of the virtual connections
+ */
+typedef struct SimThread
+{
+    Context context;                  /**< Context of the worker driven by the thread. */
+    pthread_t thread;                 /**< Thread running the simulation. */
+    size_t first_connection;          /**< Index of the first connection of the slice. */
+    size_t total_connections;         /**< Number of connections of the slice. */
+    uint32_t random_state;            /**< State of the generator of the simulated answers. */
+    uint64_t output_digest;           /**< Digest of every byte sent by the server on the slice. */
+    PhaseStats phases[PHASES_COUNT];  /**< Cost measured for each phase. */
+} SimThread;
+
+static SimConnection *connections = NULL;
+static size_t total_connections = 0;
+// Virtual clock of each simulation thread
+static __thread uint64_t virtual_now = 0;
+// Synchronizes the threads at the beginning and at the end of each phase, together with the main thread
+static SimBarrier phase_barrier;
+
+/**
+ * @brief Waits until all the threads have reached the barrier
+ *
+ * While waiting, a simulation thread applies the changes submitted to the rankings it owns; once the barrier
+ * is open it applies the last ones, which have all been submitted before the other threads reached the barrier.
+ *
+ * @param barrier pointer to the barrier
+ * @param context pointer to the context of the simulation thread, NULL for the main thread
+ */
+void sim_barrier_wait(SimBarrier *barrier, Context *context)
+{
+    unsigned int generation = __atomic_load_n(&barrier->generation, __ATOMIC_ACQUIRE);
+    if (__atomic_add_fetch(&barrier->waiting, 1, __ATOMIC_ACQ_REL) == barrier->parties)
+    {
+        __atomic_store_n(&barrier->waiting, 0, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&barrier->generation, 1, __ATOMIC_RELEASE);
+    }
+    else
+    {
+        while (__atomic_load_n(&barrier->generation, __ATOMIC_ACQUIRE) == generation)
+        {
+            if (context)
+                process_ranking_events(context);
+            sched_yield();
+        }
+    }
+    if (context)
+        process_ranking_events(context);
+}
+
+/**
+ * @brief Returns the connection associated with a virtual file descriptor
+ */
+SimConnection *sim_connection(int fd)
+{
+    if (fd < SIM_FD_BASE || (size_t)(fd - SIM_FD_BASE) >= total_connections)
+        return NULL;
+    return &connections[fd - SIM_FD_BASE];
+}
+
+/**
+ * @brief Appends bytes to a growable buffer
+ */
+void sim_append(char **buffer, size_t *length, size_t *capacity, const void *data, size_t data_length)
+{
+    if (*length + data_length > *capacity)
+    {
+        size_t new_capacity = *capacity ? *capacity : DEFAULT_PAYLOAD_SIZE;
+        while (new_capacity < *length + data_length)
+            new_capacity *= 2;
+        char *new_buffer = realloc(*buffer, new_capacity);
+        handle_malloc_error(new_buffer, "Memory allocation error for a simulated connection");
+        *buffer = new_buffer;
+        *capacity = new_capacity;
+    }
+    memcpy(*buffer + *length, data, data_length);
+    *length += data_length;
+}
+
+/**
+ * @brief Transport primitive that stores the data sent by the server in the outbox of the connection
+ */
+ssize_t sim_send(int fd, const void *buffer, size_t length)
+{
+    SimConnection *connection = sim_connection(fd);
+    if (!connection || !connection->open)
+        return -1;
+    // The growth of the outbox is a cost of the harness, not of the handler being measured
+    int previous_scope = alloc_stats_enter(ALLOC_SCOPE_OTHER);
+    sim_append(&connection->outbox, &connection->outbox_length, &connection->outbox_capacity, buffer, length);
+    alloc_stats_enter(previous_scope);
+    return length;
+}
+
+/**
+ * @brief Transport primitive that lets the server read the frames injected in the inbox of the connection
+ *
+ * As the server connections do, it fails with EAGAIN once the injected frames have all been read.
+ */
+ssize_t sim_recv(int fd, void *buffer, size_t length)
+{
+    SimConnection *connection = sim_connection(fd);
+    if (!connection || !connection->open)
+        return -1;
+    size_t available = connection->inbox_length - connection->inbox_offset;
+    if (available == 0)
+    {
+        errno = EAGAIN;
+        return -1;
+    }
+    if (length > available)
+        length = available;
+    memcpy(buffer, connection->inbox + connection->inbox_offset, length);
+    connection->inbox_offset += length;
+    if (connection->inbox_offset == connection->inbox_length)
+        connection->inbox_offset = connection->inbox_length = 0;
+    return length;
+}
+
+/**
+ * @brief Transport primitive invoked when the server closes the connection
+ */
+int sim_close(int fd)
+{
+    SimConnection *connection = sim_connection(fd);
+    if (!connection || !connection->open)
+        return -1;
+    connection->open = false;
+    connection->client = NULL;
+    return 0;
+}
+
+// Transport that keeps all the traffic in memory
+const Transport sim_transport = {sim_send, sim_recv, sim_close};
+
+/**
+ * @brief Virtual clock of the simulation, advanced by the driver
+ */
+uint64_t sim_clock()
+{
+    return virtual_now;
+}
+
+void sim_io_init(Context *context) {}
+void sim_io_watch(Context *context, int fd) {}
+void sim_io_unwatch(Context *context, int fd) {}
+int sim_io_wait(Context *context, int timeout_ms) { return 0; }
+bool sim_io_is_ready(Context *context, int fd) { return false; }
+int sim_io_accept(Context *context)
+{
+    errno = EAGAIN;
+    return -1;
+}
+void sim_io_receive(Context *context, int fd) {}
+void sim_io_flush(Context *context) {}
+void sim_io_destroy(Context *context) {}
+bool sim_io_quiesce(Context *context) { return false; }
+void sim_io_pause_accepts(Context *context, bool paused) {}
+
+// I/O backend of the simulation: readiness is decided by the driver, so nothing has to be monitored
+const IoBackend sim_backend = {"simulation", sim_io_init, sim_io_watch, sim_io_unwatch, sim_io_wait, sim_io_is_ready,
+                               sim_io_accept, sim_io_receive, sim_io_flush, sim_io_destroy, sim_io_quiesce,
+                               sim_io_pause_accepts};
+
+/**
+ * @brief Returns the time of the real monotonic clock, used to measure the cost of the handlers
+ */
+uint64_t real_time_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ * @brief Deterministic pseudo-random generator, so that every run with the same seed is identical
+ */
+uint32_t next_random(SimThread *sim)
+{
+    sim->random_state = sim->random_state * 1103515245 + 12345;
+    return sim->random_state >> 16;
+}
+
+/**
+ * @brief Collects the frames written by the server on a connection, updating the statistics of the phase
+ */
+void collect_output(SimThread *sim, SimConnection *connection, PhaseStats *stats)
+{
+    size_t offset = 0;
+    uint32_t net_payload_length;
+
+    while (offset + sizeof(uint8_t) + sizeof(uint32_t) <= connection->outbox_length)
+    {
+        memcpy(&net_payload_length, connection->outbox + offset + sizeof(uint8_t), sizeof(uint32_t));
+        offset += sizeof(uint8_t) + sizeof(uint32_t) + ntohl(net_payload_length);
+        stats->frames++;
+    }
+    for (size_t i = 0; i < connection->outbox_length; i++)
+        sim->output_digest = (sim->output_digest ^ (uint8_t)connection->outbox[i]) * 1099511628211ULL;
+    stats->bytes += connection->outbox_length;
+    connection->outbox_length = 0;
+}
+
+/**
+ * @brief Injects a frame in the inbox of a virtual connection and lets the server handle it
+ *
+ * Only the time spent inside handle_client is accounted to the phase.
+ */
+void inject_frame(SimThread *sim, SimConnection *connection, MessageType type, const char *payload, size_t payload_length, PhaseStats *stats)
+{
+    uint8_t net_type = type;
+    uint32_t net_payload_length = htonl(payload_length);
+
+    if (!connection->open || !connection->client)
+        return;
+
+    sim_append(&connection->inbox, &connection->inbox_length, &connection->inbox_capacity, &net_type, sizeof(net_type));
+    sim_append(&connection->inbox, &connection->inbox_length, &connection->inbox_capacity, &net_payload_length, sizeof(net_payload_length));
+    if (payload_length > 0)
+        sim_append(&connection->inbox, &connection->inbox_length, &connection->inbox_capacity, payload, payload_length);
+
+    virtual_now += SIM_TICK_NS;
+    uint64_t start = real_time_ns();
+    handle_client(connection->client, &sim->context);
+    stats->operations++;
+    // The rankings owned by the thread are updated periodically, as the server does after every iteration
+    if (stats->operations % SIM_BATCH == 0)
+        process_ranking_events(&sim->context);
+    stats->elapsed_ns += real_time_ns() - start;
+
+    collect_output(sim, connection, stats);
+}
+
+/**
+ * @brief Runs one phase of the game session on the connections of a simulation thread
+ *
+ * Every client logs in, requests the quiz list, selects a quiz, answers all of its questions,
+ * requests the ranking and finally disconnects.
+ */
+void run_phase(SimThread *sim, SimPhase phase)
+{
+    PhaseStats *stats = &sim->phases[phase];
+    QuizzesInfo *quizzesInfo = sim->context.quizzesInfo;
+    char buffer[DEFAULT_PAYLOAD_SIZE];
+    size_t first = sim->first_connection, last = sim->first_connection + sim->total_connections;
+
+    switch (phase)
+    {
+    case PHASE_CONNECT:
+        for (size_t i = first; i < last; i++)
+        {
+            uint64_t start = real_time_ns();
+            connections[i].client = register_client(SIM_FD_BASE + i, &sim->context);
+            stats->elapsed_ns += real_time_ns() - start;
+            stats->operations++;
+            collect_output(sim, &connections[i], stats);
+        }
+        break;
+    case PHASE_LOGIN:
+        for (size_t i = first; i < last; i++)
+        {
+            int length = snprintf(buffer, sizeof(buffer), "player%zu", i);
+            inject_frame(sim, &connections[i], MSG_SET_NICKNAME, buffer, length, stats);
+        }
+        break;
+    case PHASE_QUIZ_LIST:
+        for (size_t i = first; i < last; i++)
+            inject_frame(sim, &connections[i], MSG_REQ_QUIZ_LIST, "", 0, stats);
+        break;
+    case PHASE_SELECT:
+        for (size_t i = first; i < last; i++)
+        {
+            uint16_t net_quiz_number = htons(i % quizzesInfo->total_quizzes + 1);
+            inject_frame(sim, &connections[i], MSG_QUIZ_SELECT, (char *)&net_quiz_number, sizeof(net_quiz_number), stats);
+        }
+        break;
+    case PHASE_ANSWER:
+        // Answer one question at a time for every client, so that the rankings keep changing
+        for (unsigned int q = 0;; q++)
+        {
+            bool answered = false;
+            for (size_t i = first; i < last; i++)
+            {
+                Client *client = connections[i].client;
+                if (!client || client->state != PLAYING)
+                    continue;
+                Quiz *quiz = quizzesInfo->quizzes[client->current_quiz_id];
+                if (q >= quiz->total_questions)
+                    continue;
+                QuizQuestion *question = quiz->questions[q];
+                // Roughly half of the answers are correct
+                const char *reply = next_random(sim) % 2 ? question->answers[0] : "wrong answer";
+                inject_frame(sim, &connections[i], MSG_QUIZ_ANSWER, reply, strlen(reply), stats);
+                answered = true;
+            }
+            if (!answered)
+                break;
+        }
+        break;
+    case PHASE_RANKING:
+        for (size_t i = first; i < last; i++)
+            inject_frame(sim, &connections[i], MSG_REQ_RANKING, "", 0, stats);
+        break;
+    case PHASE_DISCONNECT:
+        for (size_t i = first; i < last; i++)
+            inject_frame(sim, &connections[i], MSG_DISCONNECT, "", 0, stats);
+        break;
+    default:
+        break;
+    }
+
+    // Release the clients disconnected by the phase, as the server does at the end of each iteration
+    uint64_t start = real_time_ns();
+    release_disconnected_clients(&sim->context);
+    stats->elapsed_ns += real_time_ns() - start;
+}
+
+/**
+ * @brief Body of a simulation thread, which runs every phase in lockstep with the other threads
+ */
+void *run_simulation_thread(void *arg)
+{
+    SimThread *sim = arg;
+    for (int phase = 0; phase < PHASES_COUNT; phase++)
+    {
+        sim_barrier_wait(&phase_barrier, &sim->context);
+        run_phase(sim, phase);
+        sim_barrier_wait(&phase_barrier, &sim->context);
+    }
+    return NULL;
+}
+
+/**
+ * @brief Runs a complete game session with the given number of virtual clients, split among the simulation threads
+ *
+ * The main thread measures the wall-clock time and the allocations of each phase, while the simulation threads
+ * measure the time spent in the handlers. The cost of each phase is printed per operation, together with
+ * the throughput of all the threads.
+ *
+ * @return number of memory allocations performed while handling the answers
+ */
+uint64_t run_simulation(SimThread *sims, unsigned int total_threads, size_t clients)
+{
+    uint64_t wall_ns[PHASES_COUNT];
+    AllocStats allocs[PHASES_COUNT];
+
+    connections = calloc(clients, sizeof(SimConnection));
+    handle_malloc_error(connections, "Memory allocation error for the simulated connections");
+    total_connections = clients;
+
+    for (size_t i = 0; i < clients; i++)
+    {
+        connections[i].open = true;
+        // Size the outbox in advance, so that only the allocations of the server are counted
+        connections[i].outbox_capacity = DEFAULT_PAYLOAD_SIZE;
+        connections[i].outbox = malloc(connections[i].outbox_capacity);
+        handle_malloc_error(connections[i].outbox, "Memory allocation error for a simulated connection");
+    }
+
+    // Split the connections in contiguous slices, one for each thread
+    for (unsigned int t = 0; t < total_threads; t++)
+    {
+        sims[t].first_connection = clients * t / total_threads;
+        sims[t].total_connections = clients * (t + 1) / total_threads - sims[t].first_connection;
+        memset(sims[t].phases, 0, sizeof(sims[t].phases));
+    }
+
+    phase_barrier = (SimBarrier){.parties = total_threads + 1, .waiting = 0, .generation = 0};
+    for (unsigned int t = 0; t < total_threads; t++)
+        pthread_create(&sims[t].thread, NULL, run_simulation_thread, &sims[t]);
+
+    for (int phase = 0; phase < PHASES_COUNT; phase++)
+    {
+        AllocStats allocs_before = alloc_stats_get(phase_scopes[phase]);
+        uint64_t start = real_time_ns();
+        sim_barrier_wait(&phase_barrier, NULL);
+        sim_barrier_wait(&phase_barrier, NULL);
+        wall_ns[phase] = real_time_ns() - start;
+        AllocStats allocs_after = alloc_stats_get(phase_scopes[phase]);
+        allocs[phase].allocations = allocs_after.allocations - allocs_before.allocations;
+        allocs[phase].bytes = allocs_after.bytes - allocs_before.bytes;
+    }
+
+    for (unsigned int t = 0; t < total_threads; t++)
+        pthread_join(sims[t].thread, NULL);
+
+    for (int phase = 0; phase < PHASES_COUNT; phase++)
+    {
+        PhaseStats total = {0, 0, 0, 0};
+        for (unsigned int t = 0; t < total_threads; t++)
+        {
+            total.operations += sims[t].phases[phase].operations;
+            total.elapsed_ns += sims[t].phases[phase].elapsed_ns;
+            total.frames += sims[t].phases[phase].frames;
+            total.bytes += sims[t].phases[phase].bytes;
+        }
+        if (!total.operations)
+            continue;
+        printf("%8zu  %-10s %10zu %12.1f %10.2f %12.1f %12.1f", clients, phase_names[phase], total.operations,
+               (double)total.elapsed_ns / total.operations, (double)total.frames / total.operations,
+               (double)total.bytes / total.operations, total.operations * 1e6 / (wall_ns[phase] ? wall_ns[phase] : 1));
+        if (alloc_stats_enabled())
+            printf(" %10.2f %12.1f", (double)allocs[phase].allocations / total.operations,
+                   (double)allocs[phase].bytes / total.operations);
+        printf("\n");
+    }
+
+    for (size_t i = 0; i < clients; i++)
+    {
+        free(connections[i].inbox);
+        free(connections[i].outbox);
+    }
+    free(connections);
+    connections = NULL;
+    total_connections = 0;
+    return allocs[PHASE_ANSWER].allocations;
+}
+
+/**
+ * @brief Prints the command line options accepted by the benchmark
+ */
+void print_usage(const char *program_name)
+{
+    printf("Usage: %s [-c] [-d quizzes_directory] [-m min_clients] [-n max_clients] [-s seed] [-t threads]\n", program_name);
+    printf("  -c                    fail if handling the answers allocates memory (instrumentation build only),\n"
+           "                        or if a player leaving a live quiz stays in its roster\n");
+    printf("  -d quizzes_directory  directory containing the quizzes (default ./quizzes)\n");
+    printf("  -m min_clients        smallest number of virtual clients of the sweep (default %d)\n", DEFAULT_MIN_CLIENTS);
+    printf("  -n max_clients        largest number of virtual clients of the sweep (default %d)\n", DEFAULT_MAX_CLIENTS);
+    printf("  -s seed               seed of the simulated answers (default 1)\n");
+    printf("  -t threads            number of simulation threads, each acting as a worker (default 1)\n");
+}
+
+/**
+ * @brief Records FLIGHT_BENCH_EVENTS events from a thread, in the ring of the thread
+ *
+ * The CPU time of the thread is measured, so that the threads preempted by the others are not charged for it.
+ *
+ * @param arg pointer to the location in which the time taken is stored, in nanoseconds
+ * @return NULL
+ */
+void *record_flight_events(void *arg)
+{
+    struct timespec start, end;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &start);
+    for (uint32_t i = 0; i < FLIGHT_BENCH_EVENTS; i++)
+        flight_record(FLIGHT_FRAME_IN, MSG_QUIZ_ANSWER, i, 0, i);
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &end);
+    *(uint64_t *)arg = (end.tv_sec - start.tv_sec) * 1000000000ULL + end.tv_nsec - start.tv_nsec;
+    return NULL;
+}
+
+/**
+ * @brief Measures the cost of recording an event in the flight recorder
+ *
+ * The real clock is used, since the virtual one does not advance while recording. The cost of reading the
+ * recorder clock is measured apart: it is most of the cost of an event, and depends on the machine, since
+ * a virtual machine can make the TSC several times slower to read than a physical one. With several threads
+ * the events are also recorded by all of them at the same time, as the workers do, each in its own ring.
+ *
+ * @param total_threads number of simulation threads
+ */
+void measure_flight_recorder(unsigned int total_threads)
+{
+    uint64_t elapsed, clock_elapsed;
+    volatile uint64_t ticks = 0;
+    record_flight_events(&elapsed);
+
+    uint64_t start = real_time_ns();
+    for (uint32_t i = 0; i < FLIGHT_BENCH_EVENTS; i++)
+        ticks += flight_clock();
+    clock_elapsed = real_time_ns() - start;
+    printf("Flight recorder: %.1f ns/event, of which %.1f ns reading the clock\n", (double)elapsed / FLIGHT_BENCH_EVENTS,
+           (double)clock_elapsed / FLIGHT_BENCH_EVENTS);
+    if (total_threads < 2)
+        return;
+
+    pthread_t *threads = malloc(total_threads * sizeof(pthread_t));
+    uint64_t *thread_elapsed = calloc(total_threads, sizeof(uint64_t));
+    handle_malloc_error(threads, "Memory allocation error for the flight recorder threads");
+    handle_malloc_error(thread_elapsed, "Memory allocation error for the flight recorder threads");
+    for (unsigned int t = 0; t < total_threads; t++)
+        pthread_create(&threads[t], NULL, record_flight_events, &thread_elapsed[t]);
+    elapsed = 0;
+    for (unsigned int t = 0; t < total_threads; t++)
+    {
+        pthread_join(threads[t], NULL);
+        elapsed += thread_elapsed[t];
+    }
+    printf("Flight recorder: %.1f ns/event with %u threads recording at the same time\n",
+           (double)elapsed / total_threads / FLIGHT_BENCH_EVENTS, total_threads);
+    free(threads);
+    free(thread_elapsed);
+}
+
+/**
+ * @brief Counts the expirations of the timer wheel measurement
+ */
+void count_timer_expiration(Timer *timer, Context *context)
+{
+    (*(uint64_t *)timer->data)++;
+}
+
+/**
+ * @brief Measures the cost of scheduling, rescheduling and expiring timers in a timer wheel
+ *
+ * The delays are spread over all the levels of the wheel, half of the timers are rescheduled as the idle timers
+ * are at every message, and the wheel is then advanced one second at a time until every timer has expired.
+ * The time of the wheel is independent of the real clock, which is only used to measure the cost.
+ */
+void measure_timer_wheel()
+{
+    TimerWheel wheel;
+    Timer *timers = malloc(TIMER_BENCH_TIMERS * sizeof(Timer));
+    handle_malloc_error(timers, "Memory allocation error for the timers");
+    uint64_t expired = 0, now_ns = 0;
+    struct timespec start, end;
+
+    init_timer_wheel(&wheel, now_ns);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (uint32_t i = 0; i < TIMER_BENCH_TIMERS; i++)
+    {
+        init_timer(&timers[i], count_timer_expiration, &expired);
+        schedule_timer(&wheel, &timers[i], (i * 7919U) % IDLE_TIMEOUT_MS);
+    }
+    uint64_t pending = wheel.pending;
+    for (uint32_t i = 0; i < TIMER_BENCH_TIMERS; i += 2)
+        schedule_timer(&wheel, &timers[i], IDLE_TIMEOUT_MS - (i * 7919U) % IDLE_TIMEOUT_MS);
+    while (wheel.pending)
+    {
+        now_ns += 1000000000ULL;
+        advance_timers(&wheel, now_ns, NULL);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    uint64_t elapsed = (end.tv_sec - start.tv_sec) * 1000000000ULL + end.tv_nsec - start.tv_nsec;
+    printf("Timer wheel: %.1f ns/timer with %llu pending, %llu expired\n", (double)elapsed / TIMER_BENCH_TIMERS,
+           (unsigned long long)pending, (unsigned long long)expired);
+    free(timers);
+}
+
+/**
+ * @brief Measures the time taken by the server to rebuild the rankings from the write-ahead log at startup
+ *
+ * A log of WAL_BENCH_PLAYERS complete games spread over the quizzes is written to a temporary file, a quarter
+ * of the players leaving afterwards, and replayed through wal_open as the server does. Closing the log forks
+ * the snapshot of the rankings, which is then loaded into empty rankings by opening the log again.
+ * The players are left in the rankings, which are deallocated with the quizzes.
+ *
+ * @param quizzesInfo pointer to the quizzes whose rankings are rebuilt
+ */
+void measure_wal_recovery(QuizzesInfo *quizzesInfo)
+{
+    char path[] = "/tmp/trivia-wal-XXXXXX", snapshot_path[sizeof(path) + 5];
+    char header[WAL_FILE_HEADER_SIZE];
+    size_t size = DEFAULT_PAYLOAD_SIZE, length = 0;
+    char *log = malloc(size), nickname[32], *pointer;
+    handle_malloc_error(log, "Memory allocation error for the log");
+    uint64_t events = 0;
+
+    int fd = mkstemp(path);
+    if (fd == -1)
+    {
+        perror("Error creating the log of the recovery measurement");
+        free(log);
+        return;
+    }
+    encode_wal_header(header, 0);
+    memcpy(log, header, sizeof(header));
+    length = sizeof(header);
+    for (uint32_t i = 0; i < WAL_BENCH_PLAYERS; i++)
+    {
+        uint16_t quiz_id = i % quizzesInfo->total_quizzes, total_questions = quizzesInfo->quizzes[quiz_id]->total_questions;
+        uint16_t nickname_length = snprintf(nickname, sizeof(nickname), "player%u", i);
+        size_t record_size = WAL_RECORD_HEADER_SIZE + nickname_length + WAL_CHECKSUM_SIZE;
+        uint16_t score = 0;
+
+        pointer = log + length;
+        ensure_capacity(&log, &pointer, &size, (total_questions + 3) * record_size);
+        length += encode_wal_record(log + length, WAL_JOIN, quiz_id, 0, nickname, nickname_length);
+        events++;
+        for (uint16_t question = 0; question < total_questions; question++)
+        {
+            if ((i + question) % 3 == 0)
+                continue;
+            length += encode_wal_record(log + length, WAL_SCORE, quiz_id, ++score, nickname, nickname_length);
+            events++;
+        }
+        length += encode_wal_record(log + length, WAL_COMPLETE, quiz_id, score, nickname, nickname_length);
+        events++;
+        if (i % 4)
+            continue;
+        length += encode_wal_record(log + length, WAL_LEAVE, quiz_id, score, nickname, nickname_length);
+        events++;
+    }
+    if (write(fd, log, length) != (ssize_t)length)
+        perror("Error writing the log of the recovery measurement");
+    close(fd);
+    free(log);
+
+    // The recovery runs before the workers start, on the real clock
+    set_time_source(NULL);
+    uint64_t start = real_time_ns();
+    if (wal_open(path, quizzesInfo) == -1)
+        perror("Error replaying the log of the recovery measurement");
+    uint64_t elapsed = real_time_ns() - start;
+    wal_close();
+
+    // Start again from empty rankings, as the server does
+    for (uint16_t i = 0; i < quizzesInfo->total_quizzes; i++)
+    {
+        deallocate_rankings(quizzesInfo->quizzes[i]);
+        quizzesInfo->quizzes[i]->total_clients = 0;
+    }
+    start = real_time_ns();
+    if (wal_open(path, quizzesInfo) == -1)
+        perror("Error loading the snapshot of the recovery measurement");
+    uint64_t snapshot_elapsed = real_time_ns() - start;
+    wal_close();
+    snprintf(snapshot_path, sizeof(snapshot_path), "%s.snap", path);
+    unlink(path);
+    unlink(snapshot_path);
+    printf("Log recovery: %.1f ns/event, %.1f MB of log\n", (double)elapsed / events, length / 1e6);
+    printf("Snapshot recovery: %.1f ms for %u players\n", snapshot_elapsed / 1e6, WAL_BENCH_PLAYERS * 3 / 4);
+}
+
+/**
+ * @brief Checks that a player leaving a live quiz before its end is no longer reachable from the live roster
+ *
+ * A player selects the first quiz, played live, then requests the quiz list and selects the second one
+ * before disconnecting: once the client has been released, the roster of the live quiz must be empty.
+ * The live game started by the player is never played, since the timers of the simulation do not advance.
+ *
+ * @param sim pointer to the simulation thread driving the player, after the simulation has ended
+ * @return true if the check passed
+ */
+bool check_live_departure(SimThread *sim)
+{
+    Context *context = &sim->context;
+    QuizzesInfo *quizzesInfo = context->quizzesInfo;
+    SimConnection connection = {.open = true};
+    PhaseStats stats = {0, 0, 0, 0};
+    uint16_t net_live_quiz = htons(1), net_other_quiz = htons(2);
+
+    if (quizzesInfo->total_quizzes < 2)
+        return true;
+    enable_live_quiz(quizzesInfo->quizzes[0]);
+    connections = &connection;
+    total_connections = 1;
+
+    connection.client = register_client(SIM_FD_BASE, context);
+    inject_frame(sim, &connection, MSG_SET_NICKNAME, "departing", strlen("departing"), &stats);
+    inject_frame(sim, &connection, MSG_QUIZ_SELECT, (char *)&net_live_quiz, sizeof(net_live_quiz), &stats);
+    inject_frame(sim, &connection, MSG_REQ_QUIZ_LIST, "", 0, &stats);
+    inject_frame(sim, &connection, MSG_QUIZ_SELECT, (char *)&net_other_quiz, sizeof(net_other_quiz), &stats);
+    inject_frame(sim, &connection, MSG_DISCONNECT, "", 0, &stats);
+    release_disconnected_clients(context);
+    bool passed = context->live_rosters[0] == NULL;
+
+    free(connection.inbox);
+    free(connection.outbox);
+    connections = NULL;
+    total_connections = 0;
+    return passed;
+}
+
+int main(int argc, char **argv)
+{
+    QuizzesInfo quizzesInfo;
+    NicknameRegistry nicknames;
+    SimThread *sims;
+    const char *quizzes_directory = "./quizzes";
+    size_t min_clients = DEFAULT_MIN_CLIENTS, max_clients = DEFAULT_MAX_CLIENTS;
+    unsigned int total_threads = 1;
+    uint32_t seed = 1;
+    int option;
+    bool check_allocations = false;
+    uint64_t answer_allocations = 0;
+    bool live_departure_passed = true;
+
+    while ((option = getopt(argc, argv, "cd:m:n:s:t:h")) != -1)
+    {
+        switch (option)
+        {
+        case 'c':
+            check_allocations = true;
+            break;
+        case 'd':
+            quizzes_directory = optarg;
+            break;
+        case 'm':
+            min_clients = strtoul(optarg, NULL, 10);
+            break;
+        case 'n':
+            max_clients = strtoul(optarg, NULL, 10);
+            break;
+        case 's':
+            seed = strtoul(optarg, NULL, 10);
+            break;
+        case 't':
+            total_threads = strtoul(optarg, NULL, 10);
+            break;
+        default:
+            print_usage(argv[0]);
+            exit(option == 'h' ? EXIT_SUCCESS : EXIT_FAILURE);
+        }
+    }
+    if (min_clients == 0 || min_clients > max_clients || total_threads == 0)
+    {
+        print_usage(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    if (check_allocations && !alloc_stats_enabled())
+    {
+        printf("The allocation check requires the instrumentation build (make %s)\n", "trivia-bench-alloc");
+        exit(EXIT_FAILURE);
+    }
+
+    set_transport(&sim_transport);
+    set_time_source(sim_clock);
+    // Sent frames go through the same observer as in the server, so the cost of the flight recorder is included
+    set_send_observer(handle_sent_frame);
+
+    load_quizzes_from_directory(quizzes_directory, &quizzesInfo);
+    init_nickname_registry(&nicknames);
+    sims = calloc(total_threads, sizeof(SimThread));
+    handle_malloc_error(sims, "Memory allocation error for the simulation threads");
+    for (unsigned int t = 0; t < total_threads; t++)
+    {
+        init_worker(&sims[t].context, t, total_threads, &quizzesInfo, &nicknames, NULL, &sim_backend);
+        sims[t].random_state = seed + t;
+        sims[t].output_digest = 14695981039346656037ULL;
+    }
+
+    printf("%8s  %-10s %10s %12s %10s %12s %12s", "clients", "phase", "ops", "ns/op", "frames/op", "bytes/op", "kops/s");
+    if (alloc_stats_enabled())
+        printf(" %10s %12s", "allocs/op", "alloc B/op");
+    printf("\n");
+    for (size_t clients = min_clients; clients <= max_clients; clients *= 2)
+        answer_allocations += run_simulation(sims, total_threads, clients);
+
+    // With several threads the rankings depend on the interleaving, so the output is only reproducible with one
+    if (total_threads == 1)
+        printf("\nOutput digest: %016llx\n", (unsigned long long)sims[0].output_digest);
+    else
+        printf("\nThreads: %u (the output digest is only computed with one thread)\n", total_threads);
+    measure_flight_recorder(total_threads);
+    measure_timer_wheel();
+    measure_wal_recovery(&quizzesInfo);
+    if (check_allocations)
+    {
+        live_departure_passed = check_live_departure(&sims[0]);
+        // Apply the ranking changes of the player, so that its nodes are deallocated with the rankings
+        for (unsigned int t = 0; t < total_threads; t++)
+            process_ranking_events(&sims[t].context);
+    }
+
+    for (unsigned int t = 0; t < total_threads; t++)
+        deallocate_worker(&sims[t].context);
+    free(sims);
+    deallocate_quizzes(&quizzesInfo);
+    deallocate_nickname_registry(&nicknames);
+
+    // The answer path is expected to run without allocating memory
+    if (check_allocations)
+    {
+        if (!live_departure_passed)
+        {
+            printf("Live departure check failed: a player that left a live quiz is still in its roster\n");
+            return EXIT_FAILURE;
+        }
+        if (answer_allocations > 0)
+        {
+            printf("Allocation budget exceeded: %llu allocations while handling answers, expected 0\n",
+                   (unsigned long long)answer_allocations);
+            return EXIT_FAILURE;
+        }
+        printf("Allocation budget respected: no allocations while handling answers\n");
+    }
+    return 0;
+}
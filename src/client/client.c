@@ -12,20 +12,24 @@
 int main(int argc, const char **argv)
 {
 
-    if (argc != 2)
+    // With -s the client watches the rankings of the given quizzes, or of all of them, instead of playing
+    bool spectator = argc > 2 && strcmp(argv[2], "-s") == 0;
+    if (argc < 2 || (argc > 2 && !spectator))
     {
-        printf("Usage: %s <port>\n", argv[0]);
+        printf("Usage: %s <port> [-s [quiz_number ...]]\n", argv[0]);
         exit(EXIT_FAILURE);
     }
 
     int server_fd;
-    struct sockaddr_in server_address;
+    int port = atoi(argv[1]);
     int choice;
 
     // Ignore the SIGPIPE signal that is sent when attempting to write
     // to a socket or pipe that no longer has active readers.
     // This prevents the client from crashing if the server closes the connection.
     signal(SIGPIPE, SIG_IGN);
+    // Refuse the frames larger than the ones announced to the server, before allocating them
+    set_payload_limit(server_payload_limit);
 
     while (1)
     {
@@ -45,66 +49,63 @@ int main(int argc, const char **argv)
             continue;
         }
 
-        // Create a TCP socket
-        if ((server_fd = socket(AF_INET, SOCK_STREAM, 0)) < 0)
-        {
-            printf("Error creating the socket\n");
-            exit(EXIT_FAILURE);
-        }
-
-        server_address.sin_family = AF_INET;
-        server_address.sin_port = htons(atoi(argv[1]));
-
-        // Convert the IP address to network format
-        if (inet_pton(AF_INET, SERVER_IP, &server_address.sin_addr) <= 0)
-        {
-            printf("Invalid address\n");
-            exit(EXIT_FAILURE);
-        }
-
         // Establish the connection to the server
-        if (connect(server_fd, (struct sockaddr *)&server_address, sizeof(server_address)) < 0)
+        if ((server_fd = connect_to_server(port)) == -1)
         {
             printf("Connection failed\n\n");
             continue;
         }
+        exchange_hello(server_fd);
 
         while (1)
         {
             // Receive the message from the server and act accordingly
-            ret = receive_msg(server_fd, &received_msg);
+            ret = receive_server_msg(server_fd, &received_msg);
             if (ret == 0)
-            {
                 printf("\nThe server has closed the connection\n");
-                break;
-            }
-
             else if (ret == -1)
             {
                 if (errno == ECONNRESET || errno == ETIMEDOUT || errno == EPIPE)
-                {
                     printf("The server closed the connection abnormally\n");
-                    break;
-                }
                 else
                 {
                     printf("Critical error\n");
                     exit(EXIT_FAILURE);
                 }
             }
+            if (ret <= 0)
+            {
+                // Resume the session on a new connection, if the server has issued a token
+                int resumed_fd = reconnect_to_server(port);
+                if (resumed_fd == -1)
+                    break;
+                close(server_fd);
+                server_fd = resumed_fd;
+                continue;
+            }
 
             switch (received_msg.type)
             {
             case MSG_REQ_NICKNAME:
-                handle_nickname_selection(server_fd, &received_msg);
+                if (spectator)
+                    request_spectator_updates(server_fd, argc - 3, argv + 3);
+                else if (!resume_session(server_fd))
+                    handle_nickname_selection(server_fd, &received_msg);
                 break;
             case MSG_OK_NICKNAME:
                 request_available_quizzes(server_fd);
                 break;
+            case MSG_SESSION_TOKEN:
+                handle_session_token(&received_msg);
+                break;
+            case MSG_SESSION_RESUMED:
+                handle_session_resumed(server_fd, &received_msg);
+                break;
             case MSG_RES_QUIZ_LIST:
                 handle_quiz_selection(server_fd, &received_msg);
                 break;
             case MSG_QUIZ_QUESTION:
+            case MSG_QUIZ_RESULT:
                 handle_quiz_question(server_fd, &received_msg);
                 break;
             case MSG_INFO:
@@ -113,9 +114,21 @@ int main(int argc, const char **argv)
             case MSG_QUIZ_SELECTED:
                 handle_selected_quiz(&received_msg);
                 break;
+            case MSG_HELLO:
+                handle_hello(&received_msg);
+                break;
             case MSG_RES_RANKING:
                 handle_rankings(&received_msg);
                 break;
+            case MSG_RANKING_UPDATE:
+                handle_ranking_update(&received_msg);
+                break;
+            case MSG_RANKING_RESYNC:
+                handle_ranking_resync(&received_msg);
+                break;
+            case MSG_RANKING_DELTA:
+                handle_ranking_delta(&received_msg);
+                break;
 
             default:
                 break;
@@ -123,6 +136,7 @@ int main(int argc, const char **argv)
             free(received_msg.payload);
         }
         close(server_fd);
+        reset_ranking_replicas();
         printf("\n");
     }
     return 0;
@@ -1,11 +1,96 @@
+#include <poll.h>
 #include <stdint.h>
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <netinet/in.h>
+#include <arpa/inet.h>
 #include "utils.h"
 #include "../../common/common.h"
 #include "../../common/params.h"
 
+// Local copies of the rankings of the quizzes, indexed by quiz number - 1
+static RankingReplica *replicas = NULL;
+static uint16_t total_replicas = 0;
+// The client has subscribed to the ranking changes of the current connection
+static bool subscribed = false;
+// The rankings are printed when the server sends the next prompt, after the ones requested have arrived
+static bool score_pending = false;
+// Frame received while looking for the pending ranking changes, handled by the next receive_server_msg
+static Message stashed_msg;
+static bool has_stashed_msg = false;
+// Capabilities negotiated with the server, which decide the encoding of the binary payloads and the optional messages used
+static Capabilities capabilities;
+// Token issued by the server to resume the session, and whether the current connection has to present it
+static uint8_t session_token[SESSION_TOKEN_SIZE];
+static bool has_session_token = false;
+static bool resume_pending = false;
+
+/**
+ * @brief Handles the MSG_HELLO message with which the server communicates the capabilities negotiated
+ *
+ * @param msg pointer to the received message
+ */
+void handle_hello(Message *msg)
+{
+    Capabilities local, peer;
+    init_capabilities(&local, CLIENT_MAX_FRAME);
+    if (decode_hello(msg, &peer))
+        negotiate_capabilities(&local, &peer, &capabilities);
+}
+
+/**
+ * @brief Returns the largest payload accepted from the server, the one announced in the MSG_HELLO
+ *
+ * @param type type of the message
+ * @return largest payload in bytes
+ */
+uint32_t server_payload_limit(MessageType type)
+{
+    return CLIENT_MAX_FRAME;
+}
+
+/**
+ * @brief Negotiates the capabilities of the connection, as soon as it is established
+ *
+ * The client announces everything it supports in a MSG_HELLO message and waits for the response of the server,
+ * up to HELLO_TIMEOUT_MS; the request of the nickname, sent by the server on connection, is set aside meanwhile.
+ * A server that refuses the negotiation, or does not respond, is treated as a version 1 server without optional
+ * messages.
+ *
+ * @param server_fd file descriptor of the server socket
+ */
+void exchange_hello(int server_fd)
+{
+    struct pollfd pollfd = {.fd = server_fd, .events = POLLIN};
+    char payload[HELLO_SIZE];
+    Capabilities local;
+    Message msg;
+
+    legacy_capabilities(&capabilities);
+    init_capabilities(&local, CLIENT_MAX_FRAME);
+    encode_hello(payload, &local);
+    send_msg(server_fd, MSG_HELLO, payload, sizeof(payload));
+
+    while (poll(&pollfd, 1, HELLO_TIMEOUT_MS) > 0 && receive_msg(server_fd, &msg) > 0)
+    {
+        if (msg.type == MSG_HELLO || msg.type == MSG_INFO)
+        {
+            if (msg.type == MSG_HELLO)
+                handle_hello(&msg);
+            free(msg.payload);
+            return;
+        }
+        if (has_stashed_msg)
+        {
+            // Only the request of the nickname precedes the response, so nothing else is expected here
+            free(msg.payload);
+            continue;
+        }
+        stashed_msg = msg;
+        has_stashed_msg = true;
+    }
+}
+
 /**
  * @brief Handles the user's nickname selection
  *
@@ -50,11 +135,33 @@ void request_available_quizzes(int server_fd)
  * The data regarding available quizzes is received according to this binary format:
  * (number of quizzes) [(name length)(name)] [(name length)(name)] [...]
  * where the parentheses indicate the level of nesting and are not actually part of the transmitted data.
+ * With the version 2 protocol the number of quizzes and the lengths are varints.
  *
  * @param msg pointer to the message whose payload contains the serialized list of quizzes
  */
 void display_quiz_list(Message *msg)
 {
+    if (capabilities.version >= PROTOCOL_V2)
+    {
+        const char *pointer = msg->payload, *end = msg->payload + msg->payload_length;
+        uint64_t total_quizzes = 0, string_len;
+        pointer += decode_varint(pointer, end, &total_quizzes);
+
+        printf("\nAvailable Quizzes\n");
+        printf("+++++++++++++++++++++++++++\n");
+        for (uint64_t i = 0; i < total_quizzes; i++)
+        {
+            size_t read = decode_varint(pointer, end, &string_len);
+            if (!read || string_len > (uint64_t)(end - pointer - read))
+                break;
+            pointer += read;
+            printf("%u - %.*s\n", (unsigned)(i + 1), (int)string_len, pointer);
+            pointer += string_len;
+        }
+        printf("+++++++++++++++++++++++++++\n");
+        return;
+    }
+
     // initialize data structures
     char *pointer = msg->payload;
     size_t string_len;
@@ -81,6 +188,64 @@ void display_quiz_list(Message *msg)
     printf("+++++++++++++++++++++++++++\n");
 }
 
+/**
+ * @brief Handles the deserialization and display of the ranking encoded with the version 2 protocol
+ *
+ * Every value is a varint and the nicknames are sent once, in a string table preceding the rankings:
+ * (number of strings) [(name length) (name)] (number of quizzes) {(number of users) [(name index) (score)]} {...}
+ *
+ * @param msg pointer to the message whose payload contains the serialized ranking
+ */
+void handle_compact_rankings(Message *msg)
+{
+    const char *pointer = msg->payload, *end = msg->payload + msg->payload_length;
+    uint64_t total_strings = 0, quizzes_num = 0, clients_per_quiz, index, score, string_len;
+    size_t read = decode_varint(pointer, end, &total_strings);
+    if (!read || total_strings > (uint64_t)(end - pointer))
+        return;
+    pointer += read;
+
+    // Keep where each string starts, so that the rankings can refer to them
+    const char **strings = malloc(total_strings * sizeof(char *) + 1);
+    uint32_t *lengths = malloc(total_strings * sizeof(uint32_t) + 1);
+    handle_malloc_error(strings, "Memory allocation error for the string table");
+    handle_malloc_error(lengths, "Memory allocation error for the string table");
+    for (uint64_t i = 0; i < total_strings; i++)
+    {
+        read = decode_varint(pointer, end, &string_len);
+        if (!read || string_len > (uint64_t)(end - pointer - read))
+        {
+            total_strings = i;
+            break;
+        }
+        strings[i] = pointer + read;
+        lengths[i] = string_len;
+        pointer += read + string_len;
+    }
+
+    pointer += decode_varint(pointer, end, &quizzes_num);
+    for (uint64_t i = 0; i < quizzes_num && pointer < end; i++)
+    {
+        clients_per_quiz = 0;
+        pointer += decode_varint(pointer, end, &clients_per_quiz);
+        printf("\nTheme %d score\n", (int)(i + 1));
+        for (uint64_t j = 0; j < clients_per_quiz; j++)
+        {
+            read = decode_varint(pointer, end, &index);
+            if (!read || index >= total_strings)
+                break;
+            pointer += read;
+            read = decode_varint(pointer, end, &score);
+            if (!read)
+                break;
+            pointer += read;
+            printf("- %.*s %d\n", (int)lengths[index], strings[index], (int)score);
+        }
+    }
+    free(strings);
+    free(lengths);
+}
+
 /**
  * @brief Handles the deserialization and display of the ranking
  *
@@ -93,11 +258,17 @@ void display_quiz_list(Message *msg)
  * The ranking data for the quizzes is received according to this binary protocol format:
  * (number of quizzes)  {(number of users participating in the quiz) [(name length) (name) (score)]} {...}
  * where the parentheses indicate the level of nesting and are not actually part of the transmitted data.
+ * With the version 2 protocol the ranking is decoded by handle_compact_rankings.
  *
  * @param msg pointer to the message whose payload contains the serialized ranking
  */
 void handle_rankings(Message *msg)
 {
+    if (capabilities.version >= PROTOCOL_V2)
+    {
+        handle_compact_rankings(msg);
+        return;
+    }
     char *pointer = msg->payload;
     uint16_t clients_per_quiz, quizzes_num, client_score, string_len;
     uint16_t net_string_len, net_client_score, net_clients_per_quiz, net_quizzes_num;
@@ -138,7 +309,7 @@ void handle_rankings(Message *msg)
  *
  * The function allows the user to make a choice; specifically, the behavior changes based on the value entered by the client:
  *  - ENDQUIZ: sends a MSG_DISCONNECT message that causes the server to deallocate the client's structures and close the connection
- *  - SHOWSCORE: sends a MSG_REQ_RANKING message that causes the server to respond with a MSG_RES_RANKING message, thus sending the ranking
+ *  - SHOWSCORE: displays the local copy of the rankings, subscribing to their changes the first time (see show_score)
  *  - ELSE: sends a MSG_QUIZ_SELECT message with a payload based on the entered value, allowing the client to select the quiz to participate in using the binary protocol
  *
  * @param server_fd file descriptor of the server socket
@@ -149,6 +320,7 @@ void handle_quiz_selection(int server_fd, Message *msg)
     char answer[DEFAULT_PAYLOAD_SIZE];
     char *endptr;
     uint16_t selected_quiz_number, net_selected_quiz_number;
+    print_pending_score();
     while (1)
     {
         display_quiz_list(msg);
@@ -159,12 +331,13 @@ void handle_quiz_selection(int server_fd, Message *msg)
 
         if (strcmp(answer, ENDQUIZ) == 0)
         {
-            send_msg(server_fd, MSG_DISCONNECT, "", 0);
+            leave_server(server_fd);
             break;
         }
         else if (strcmp(answer, SHOWSCORE) == 0)
         {
-            send_msg(server_fd, MSG_REQ_RANKING, "", 0);
+            if (show_score(server_fd))
+                continue;
             break;
         }
 
@@ -206,8 +379,13 @@ void handle_message(Message *msg)
  *
  * The function allows the user to make a choice; specifically, the behavior changes based on the value entered by the client:
  *  - ENDQUIZ: sends a MSG_DISCONNECT message that causes the server to deallocate the client's structures and close the connection
- *  - SHOWSCORE: sends a MSG_REQ_RANKING message that causes the server to respond with a MSG_RES_RANKING message, thus sending the ranking
- *  - ELSE: sends a MSG_QUIZ_ANSWER message with a payload based on the entered value, allowing the client to answer the question
+ *  - SHOWSCORE: displays the local copy of the rankings, subscribing to their changes the first time (see show_score)
+ *  - ELSE: sends a MSG_QUIZ_SUBMIT message with a payload based on the entered value, allowing the client to answer the question,
+ *    or a MSG_QUIZ_ANSWER message if the server has not negotiated FEATURE_QUIZ_RESULT
+ *
+ * It also handles the MSG_QUIZ_RESULT message with which the server responds to an answer, whose payload has this format:
+ * (flags) (score) (rank) (number of players) (next question, or the quiz list if the quiz is completed)
+ * The verdict is displayed before the next question; at the end of the quiz the quiz selection follows instead.
  *
  * @param server_fd file descriptor of the server socket
  * @param msg pointer to the received message
@@ -215,15 +393,515 @@ void handle_message(Message *msg)
 void handle_quiz_question(int server_fd, Message *msg)
 {
     char answer[DEFAULT_PAYLOAD_SIZE];
-    printf("\n%s\n", msg->payload);
-    do
-        printf("Answer: ");
-    while (get_console_input(answer, sizeof(answer)) == -1);
+    char *question = msg->payload;
+    int question_length = msg->payload_length;
+
+    if (msg->type == MSG_QUIZ_RESULT)
+    {
+        uint16_t fields[3];
+        uint8_t flags = msg->payload[0];
+        memcpy(fields, msg->payload + sizeof(uint8_t), sizeof(fields));
+        printf("\n%s - score %d, position %d of %d\n", flags & QUIZ_RESULT_CORRECT ? "Correct answer" : "Wrong answer",
+               ntohs(fields[0]), ntohs(fields[1]), ntohs(fields[2]));
+
+        question = msg->payload + QUIZ_RESULT_HEADER_SIZE;
+        question_length = msg->payload_length - QUIZ_RESULT_HEADER_SIZE;
+        if (flags & QUIZ_RESULT_COMPLETED)
+        {
+            Message quiz_list = {.type = MSG_RES_QUIZ_LIST, .payload_length = question_length, .payload = question};
+            printf("\nYou completed the quiz\n");
+            handle_quiz_selection(server_fd, &quiz_list);
+            return;
+        }
+    }
+
+    print_pending_score();
+    printf("\n%.*s\n", question_length, question);
+    while (1)
+    {
+        do
+            printf("Answer: ");
+        while (get_console_input(answer, sizeof(answer)) == -1);
+
+        if (strcmp(answer, ENDQUIZ) == 0)
+            leave_server(server_fd);
+        else if (strcmp(answer, SHOWSCORE) == 0)
+        {
+            if (show_score(server_fd))
+                continue;
+        }
+        else if (capabilities.features & FEATURE_QUIZ_RESULT)
+            send_msg(server_fd, MSG_QUIZ_SUBMIT, answer, strlen(answer));
+        else
+            send_msg(server_fd, MSG_QUIZ_ANSWER, answer, strlen(answer));
+        break;
+    }
+}
+
+/**
+ * @brief Asks the server to watch the rankings of some quizzes instead of playing
+ *
+ * It responds to the MSG_REQ_NICKNAME message with a MSG_SPECTATE message, whose payload contains
+ * the number of quizzes followed by their numbers; no quiz number means every quiz.
+ * If the server has not negotiated FEATURE_SPECTATE, the client disconnects instead.
+ *
+ * @param server_fd file descriptor of the server's socket
+ * @param total_quizzes number of quizzes to watch, 0 for all of them
+ * @param quiz_numbers numbers of the quizzes to watch, as strings
+ */
+void request_spectator_updates(int server_fd, int total_quizzes, const char **quiz_numbers)
+{
+    if (!(capabilities.features & FEATURE_SPECTATE))
+    {
+        printf("The server does not support spectators\n");
+        leave_server(server_fd);
+        return;
+    }
+    uint16_t payload[total_quizzes + 1];
+    payload[0] = htons(total_quizzes);
+    for (int i = 0; i < total_quizzes; i++)
+        payload[i + 1] = htons(atoi(quiz_numbers[i]));
+    send_msg(server_fd, MSG_SPECTATE, (char *)payload, sizeof(payload));
+    printf("Watching the rankings, press Ctrl+C to stop\n");
+}
+
+/**
+ * @brief Displays the ranking of a quiz pushed by the server to a spectator
+ *
+ * The payload of the MSG_RANKING_UPDATE message has this format:
+ * (quiz number) (number of users participating in the quiz) [(name length) (name) (score)]
+ *
+ * @param msg pointer to the message whose payload contains the serialized ranking
+ */
+void handle_ranking_update(Message *msg)
+{
+    char *pointer = msg->payload;
+    uint16_t quiz_number, clients_per_quiz, client_score, string_len;
+
+    memcpy(&quiz_number, pointer, sizeof(uint16_t));
+    pointer += sizeof(uint16_t);
+    memcpy(&clients_per_quiz, pointer, sizeof(uint16_t));
+    pointer += sizeof(uint16_t);
+    clients_per_quiz = ntohs(clients_per_quiz);
+
+    printf("\nTheme %d score (%d players)\n", ntohs(quiz_number), clients_per_quiz);
+    for (uint16_t j = 0; j < clients_per_quiz; j++)
+    {
+        memcpy(&string_len, pointer, sizeof(uint16_t));
+        string_len = ntohs(string_len);
+        pointer += sizeof(uint16_t);
+        memcpy(&client_score, pointer + string_len, sizeof(uint16_t));
+        client_score = ntohs(client_score);
+        printf("- %.*s %d\n", string_len, pointer, client_score);
+        pointer += string_len + sizeof(uint16_t);
+    }
+}
+
+/**
+ * @brief Receives the next message from the server, starting from the one set aside while looking for ranking changes
+ *
+ * @param server_fd file descriptor of the server socket
+ * @param msg pointer to the Message structure in which to store the received data
+ * @return the result of receive_msg
+ */
+int receive_server_msg(int server_fd, Message *msg)
+{
+    if (!has_stashed_msg)
+        return receive_msg(server_fd, msg);
+    *msg = stashed_msg;
+    has_stashed_msg = false;
+    return 1;
+}
+
+/**
+ * @brief Applies the ranking changes already received from the server, without waiting for more
+ *
+ * The first frame of another type is set aside for receive_server_msg, as well as a closed connection,
+ * which is reported again by the next receive.
+ *
+ * @param server_fd file descriptor of the server socket
+ */
+void apply_pending_ranking_changes(int server_fd)
+{
+    struct pollfd pollfd = {.fd = server_fd, .events = POLLIN};
+    Message msg;
+    while (!has_stashed_msg && poll(&pollfd, 1, 0) > 0 && receive_msg(server_fd, &msg) > 0)
+    {
+        if (msg.type == MSG_RANKING_RESYNC)
+            handle_ranking_resync(&msg);
+        else if (msg.type == MSG_RANKING_DELTA)
+            handle_ranking_delta(&msg);
+        else
+        {
+            stashed_msg = msg;
+            has_stashed_msg = true;
+            return;
+        }
+        free(msg.payload);
+    }
+}
+
+/**
+ * @brief Displays the local copies of the rankings of every quiz
+ */
+void print_ranking_replicas()
+{
+    for (uint16_t i = 0; i < total_replicas; i++)
+    {
+        printf("\nTheme %d score\n", i + 1);
+        for (uint16_t j = 0; j < replicas[i].total; j++)
+            printf("- %s %d\n", replicas[i].entries[j].nickname, replicas[i].entries[j].score);
+    }
+}
 
-    if (strcmp(answer, ENDQUIZ) == 0)
-        send_msg(server_fd, MSG_DISCONNECT, "", 0);
-    else if (strcmp(answer, SHOWSCORE) == 0)
+/**
+ * @brief Handles the request of the user to show the rankings
+ *
+ * The first time, the client subscribes to the changes of the rankings with a MSG_SUBSCRIBE_RANKING message:
+ * the server sends the whole rankings, then the prompt again, after which the rankings are displayed.
+ * Afterwards the rankings are displayed from the local copies, once the changes already received are applied,
+ * without any request to the server.
+ * If the server has not negotiated FEATURE_RANKING_DELTAS, the rankings are requested every time with MSG_REQ_RANKING.
+ *
+ * @param server_fd file descriptor of the server socket
+ * @return true if the rankings have been displayed and the user can be prompted again,
+ *         false if the server has been asked for them
+ */
+bool show_score(int server_fd)
+{
+    // Without ranking changes, the server sends the rankings and then the prompt again
+    if (!(capabilities.features & FEATURE_RANKING_DELTAS))
+    {
         send_msg(server_fd, MSG_REQ_RANKING, "", 0);
-    else
-        send_msg(server_fd, MSG_QUIZ_ANSWER, answer, strlen(answer));
+        return false;
+    }
+    if (!subscribed)
+    {
+        send_msg(server_fd, MSG_SUBSCRIBE_RANKING, "", 0);
+        subscribed = true;
+        score_pending = true;
+        return false;
+    }
+    apply_pending_ranking_changes(server_fd);
+    print_ranking_replicas();
+    printf("\n");
+    return true;
+}
+
+/**
+ * @brief Displays the rankings requested by the subscription, once the server has sent them
+ */
+void print_pending_score()
+{
+    if (!score_pending)
+        return;
+    score_pending = false;
+    print_ranking_replicas();
+}
+
+/**
+ * @brief Returns the local copy of the ranking of a quiz, allocating the copies up to it if needed
+ *
+ * @param quiz_number number of the quiz, starting from 1
+ * @return pointer to the copy, or NULL if the quiz number is not valid
+ */
+RankingReplica *find_ranking_replica(uint16_t quiz_number)
+{
+    if (quiz_number == 0)
+        return NULL;
+    if (quiz_number > total_replicas)
+    {
+        RankingReplica *new_replicas = realloc(replicas, quiz_number * sizeof(RankingReplica));
+        handle_malloc_error(new_replicas, "Memory allocation error for the rankings");
+        memset(new_replicas + total_replicas, 0, (quiz_number - total_replicas) * sizeof(RankingReplica));
+        replicas = new_replicas;
+        total_replicas = quiz_number;
+    }
+    return &replicas[quiz_number - 1];
+}
+
+/**
+ * @brief Removes a player from the local copy of a ranking, if present
+ */
+void remove_replica_entry(RankingReplica *replica, const char *nickname, uint16_t length)
+{
+    for (uint16_t i = 0; i < replica->total; i++)
+    {
+        if (strlen(replica->entries[i].nickname) != length || memcmp(replica->entries[i].nickname, nickname, length) != 0)
+            continue;
+        free(replica->entries[i].nickname);
+        memmove(&replica->entries[i], &replica->entries[i + 1], (replica->total - i - 1) * sizeof(ReplicaEntry));
+        replica->total--;
+        return;
+    }
+}
+
+/**
+ * @brief Inserts a player in the local copy of a ranking at a 1-based position
+ */
+void insert_replica_entry(RankingReplica *replica, const char *nickname, uint16_t length, uint16_t position,
+                          uint16_t score)
+{
+    if (replica->total == replica->capacity)
+    {
+        replica->capacity = replica->capacity ? replica->capacity * 2 : 16;
+        replica->entries = realloc(replica->entries, replica->capacity * sizeof(ReplicaEntry));
+        handle_malloc_error(replica->entries, "Memory allocation error for a ranking");
+    }
+    uint16_t index = position > 0 && position <= replica->total ? position - 1 : replica->total;
+    memmove(&replica->entries[index + 1], &replica->entries[index], (replica->total - index) * sizeof(ReplicaEntry));
+    replica->entries[index].nickname = strndup(nickname, length);
+    handle_malloc_error(replica->entries[index].nickname, "Memory allocation error for a ranking");
+    replica->entries[index].score = score;
+    replica->total++;
+}
+
+/**
+ * @brief Replaces the local copy of the ranking of a quiz with the whole ranking sent by the server
+ *
+ * The payload of the MSG_RANKING_RESYNC message has this format:
+ * (quiz number) (version) (number of users participating in the quiz) [(name length) (name) (score)]
+ * A ranking older than the copy, sent before the subscription has been registered, is ignored.
+ *
+ * @param msg pointer to the message whose payload contains the serialized ranking
+ */
+void handle_ranking_resync(Message *msg)
+{
+    char *pointer = msg->payload;
+    uint16_t quiz_number, total, string_len, score;
+    uint32_t version;
+
+    memcpy(&quiz_number, pointer, sizeof(uint16_t));
+    memcpy(&version, pointer + sizeof(uint16_t), sizeof(uint32_t));
+    memcpy(&total, pointer + sizeof(uint16_t) + sizeof(uint32_t), sizeof(uint16_t));
+    pointer += 2 * sizeof(uint16_t) + sizeof(uint32_t);
+    version = ntohl(version);
+
+    RankingReplica *replica = find_ranking_replica(ntohs(quiz_number));
+    if (!replica || (replica->synced && version < replica->version))
+        return;
+    for (uint16_t i = 0; i < replica->total; i++)
+        free(replica->entries[i].nickname);
+    replica->total = 0;
+    replica->synced = true;
+    replica->version = version;
+
+    for (uint16_t i = 0; i < ntohs(total); i++)
+    {
+        memcpy(&string_len, pointer, sizeof(uint16_t));
+        string_len = ntohs(string_len);
+        pointer += sizeof(uint16_t);
+        memcpy(&score, pointer + string_len, sizeof(uint16_t));
+        insert_replica_entry(replica, pointer, string_len, 0, ntohs(score));
+        pointer += string_len + sizeof(uint16_t);
+    }
+}
+
+/**
+ * @brief Applies to the local copy of the ranking of a quiz the changes pushed by the server
+ *
+ * The payload of the MSG_RANKING_DELTA message has this format:
+ * (quiz number) (version) (number of left users) [(name length) (name)]
+ * (number of moved users) [(name length) (name) (position) (score)]
+ * The left and moved users are removed, then the moved ones are inserted at their positions in the given order.
+ * The changes already included in the copy are ignored.
+ *
+ * @param msg pointer to the message whose payload contains the serialized changes
+ */
+void handle_ranking_delta(Message *msg)
+{
+    char *pointer = msg->payload;
+    uint16_t quiz_number, total, string_len, fields[2];
+    uint32_t version;
+
+    memcpy(&quiz_number, pointer, sizeof(uint16_t));
+    memcpy(&version, pointer + sizeof(uint16_t), sizeof(uint32_t));
+    pointer += sizeof(uint16_t) + sizeof(uint32_t);
+    version = ntohl(version);
+
+    RankingReplica *replica = find_ranking_replica(ntohs(quiz_number));
+    if (!replica || !replica->synced || version <= replica->version)
+        return;
+    replica->version = version;
+
+    // Remove the users who left
+    memcpy(&total, pointer, sizeof(uint16_t));
+    pointer += sizeof(uint16_t);
+    for (uint16_t i = 0; i < ntohs(total); i++)
+    {
+        memcpy(&string_len, pointer, sizeof(uint16_t));
+        string_len = ntohs(string_len);
+        remove_replica_entry(replica, pointer + sizeof(uint16_t), string_len);
+        pointer += sizeof(uint16_t) + string_len;
+    }
+
+    // Remove the users who moved, then insert them at their new positions
+    memcpy(&total, pointer, sizeof(uint16_t));
+    pointer += sizeof(uint16_t);
+    char *moved = pointer;
+    for (uint16_t i = 0; i < ntohs(total); i++)
+    {
+        memcpy(&string_len, pointer, sizeof(uint16_t));
+        string_len = ntohs(string_len);
+        remove_replica_entry(replica, pointer + sizeof(uint16_t), string_len);
+        pointer += sizeof(uint16_t) + string_len + sizeof(fields);
+    }
+    pointer = moved;
+    for (uint16_t i = 0; i < ntohs(total); i++)
+    {
+        memcpy(&string_len, pointer, sizeof(uint16_t));
+        string_len = ntohs(string_len);
+        memcpy(fields, pointer + sizeof(uint16_t) + string_len, sizeof(fields));
+        insert_replica_entry(replica, pointer + sizeof(uint16_t), string_len, ntohs(fields[0]), ntohs(fields[1]));
+        pointer += sizeof(uint16_t) + string_len + sizeof(fields);
+    }
+}
+
+/**
+ * @brief Discards the local copies of the rankings and the subscription, when the connection is closed
+ */
+void reset_ranking_replicas()
+{
+    for (uint16_t i = 0; i < total_replicas; i++)
+    {
+        for (uint16_t j = 0; j < replicas[i].total; j++)
+            free(replicas[i].entries[j].nickname);
+        free(replicas[i].entries);
+    }
+    free(replicas);
+    replicas = NULL;
+    total_replicas = 0;
+    subscribed = score_pending = false;
+    if (has_stashed_msg)
+        free(stashed_msg.payload);
+    has_stashed_msg = false;
+}
+
+/**
+ * @brief Establishes a connection to the server listening on a port of the local address
+ *
+ * @param port port of the server
+ * @return file descriptor of the connection, or -1 if it cannot be established
+ */
+int connect_to_server(int port)
+{
+    struct sockaddr_in server_address;
+    int server_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (server_fd < 0)
+        return -1;
+
+    memset(&server_address, 0, sizeof(server_address));
+    server_address.sin_family = AF_INET;
+    server_address.sin_port = htons(port);
+    // Convert the IP address to network format and establish the connection
+    if (inet_pton(AF_INET, SERVER_IP, &server_address.sin_addr) <= 0 ||
+        connect(server_fd, (struct sockaddr *)&server_address, sizeof(server_address)) < 0)
+    {
+        close(server_fd);
+        return -1;
+    }
+    return server_fd;
+}
+
+/**
+ * @brief Tells the server that the user is leaving, so that the session is not kept for a later resumption
+ *
+ * @param server_fd file descriptor of the server socket
+ */
+void leave_server(int server_fd)
+{
+    send_msg(server_fd, MSG_DISCONNECT, "", 0);
+    has_session_token = resume_pending = false;
+}
+
+/**
+ * @brief Stores the token sent by the server in a MSG_SESSION_TOKEN message after the nickname has been accepted
+ *
+ * @param msg pointer to the received message
+ */
+void handle_session_token(Message *msg)
+{
+    if (msg->payload_length != SESSION_TOKEN_SIZE)
+        return;
+    memcpy(session_token, msg->payload, SESSION_TOKEN_SIZE);
+    has_session_token = true;
+}
+
+/**
+ * @brief Connects again to the server after the connection dropped, to resume the session
+ *
+ * It retries up to RESUME_ATTEMPTS times, RESUME_DELAY_MS apart. The token is presented by resume_session
+ * when the server requests the nickname on the new connection.
+ *
+ * @param port port of the server
+ * @return file descriptor of the new connection, or -1 if there is no session to resume or the server is unreachable
+ */
+int reconnect_to_server(int port)
+{
+    if (!has_session_token)
+        return -1;
+    for (int attempt = 1; attempt <= RESUME_ATTEMPTS; attempt++)
+    {
+        printf("Reconnecting to resume the session (attempt %d of %d)\n", attempt, RESUME_ATTEMPTS);
+        usleep(RESUME_DELAY_MS * 1000);
+        int server_fd = connect_to_server(port);
+        if (server_fd == -1)
+            continue;
+        // The local rankings and the capabilities belong to the previous connection
+        reset_ranking_replicas();
+        exchange_hello(server_fd);
+        resume_pending = true;
+        return server_fd;
+    }
+    has_session_token = false;
+    return -1;
+}
+
+/**
+ * @brief Presents the token of the session to resume, instead of the nickname requested by the server
+ *
+ * @param server_fd file descriptor of the server socket
+ * @return true if the token has been sent, false if the nickname has to be chosen
+ */
+bool resume_session(int server_fd)
+{
+    if (!resume_pending || !(capabilities.features & FEATURE_SESSION_RESUME))
+        return false;
+    // If the session has expired, the server requests the nickname again
+    resume_pending = false;
+    send_msg(server_fd, MSG_RESUME_SESSION, (char *)session_token, SESSION_TOKEN_SIZE);
+    return true;
+}
+
+/**
+ * @brief Handles the MSG_SESSION_RESUMED message with which the server reattaches the client to its session
+ *
+ * The payload has this format:
+ * (quiz number, 0 if not playing) (score) (question to answer, or the quiz list if not playing)
+ * The question of a live quiz is empty, since it arrives with the next round.
+ *
+ * @param server_fd file descriptor of the server socket
+ * @param msg pointer to the received message
+ */
+void handle_session_resumed(int server_fd, Message *msg)
+{
+    uint16_t fields[2];
+    if (msg->payload_length < SESSION_RESUMED_HEADER_SIZE)
+        return;
+    memcpy(fields, msg->payload, sizeof(fields));
+    Message next = {.payload = msg->payload + SESSION_RESUMED_HEADER_SIZE,
+                    .payload_length = msg->payload_length - SESSION_RESUMED_HEADER_SIZE};
+
+    if (!fields[0])
+    {
+        printf("\nSession resumed\n");
+        next.type = MSG_RES_QUIZ_LIST;
+        handle_quiz_selection(server_fd, &next);
+        return;
+    }
+    printf("\nSession resumed in quiz %d with score %d\n", ntohs(fields[0]), ntohs(fields[1]));
+    if (!next.payload_length)
+        return;
+    next.type = MSG_QUIZ_QUESTION;
+    handle_quiz_question(server_fd, &next);
 }
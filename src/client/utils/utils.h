@@ -10,6 +10,27 @@
 #include <stdbool.h>
 #include "../../common/common.h"
 
+/**
+ * @brief Player in the local copy of the ranking of a quiz
+ */
+typedef struct ReplicaEntry
+{
+    char *nickname; /**< Nickname of the player. */
+    uint16_t score; /**< Score of the player. */
+} ReplicaEntry;
+
+/**
+ * @brief Local copy of the ranking of a quiz, kept up to date with the changes pushed by the server
+ */
+typedef struct RankingReplica
+{
+    bool synced;           /**< The whole ranking has been received at least once. */
+    uint32_t version;      /**< Version of the ranking on the server the copy corresponds to. */
+    ReplicaEntry *entries; /**< Players in ranking order. */
+    uint16_t total;        /**< Number of players. */
+    uint16_t capacity;     /**< Allocated size of the entries array. */
+} RankingReplica;
+
 // Dashboard
 
 void show_menu();
@@ -20,8 +41,26 @@ void handle_selected_quiz(Message *msg);
 void handle_nickname_selection(int server_fd, Message *msg);
 void handle_quiz_selection(int server_fd, Message *msg);
 void request_available_quizzes(int server_fd);
+void handle_hello(Message *msg);
+void exchange_hello(int server_fd);
+uint32_t server_payload_limit(MessageType type);
 void handle_rankings(Message *msg);
+void handle_compact_rankings(Message *msg);
 void handle_message(Message *msg);
 void handle_quiz_question(int server_fd, Message *msg);
+void request_spectator_updates(int server_fd, int total_quizzes, const char **quiz_numbers);
+void handle_ranking_update(Message *msg);
+int receive_server_msg(int server_fd, Message *msg);
+bool show_score(int server_fd);
+void print_pending_score();
+void handle_ranking_resync(Message *msg);
+void handle_ranking_delta(Message *msg);
+void reset_ranking_replicas();
+int connect_to_server(int port);
+void leave_server(int server_fd);
+void handle_session_token(Message *msg);
+int reconnect_to_server(int port);
+bool resume_session(int server_fd);
+void handle_session_resumed(int server_fd, Message *msg);
 
 #endif // CLIENT_UTILS_H
\ No newline at end of file
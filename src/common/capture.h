@@ -0,0 +1,48 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <stdint.h>
+
+/**
+ * @brief Binary format of the traffic capture files
+ *
+ * A capture file starts with a header made of the magic string CAPTURE_MAGIC followed by
+ * the format version on a uint16_t and two reserved bytes.
+ * The header is followed by a sequence of records, each one made of a fixed-size record header
+ * and of the payload of the frame, if any:
+ * (timestamp)(connection id)(kind)(message type)(payload length)(payload)
+ * where the timestamp is a uint64_t in nanoseconds since the start of the capture,
+ * the connection id and the payload length are uint32_t and kind and message type are uint8_t.
+ * As in the rest of the protocol, all numeric values are stored in network byte order.
+ */
+
+#define CAPTURE_MAGIC "TQCP"
+#define CAPTURE_MAGIC_SIZE 4
+#define CAPTURE_VERSION 1
+#define CAPTURE_FILE_HEADER_SIZE (CAPTURE_MAGIC_SIZE + 2 * sizeof(uint16_t))
+#define CAPTURE_RECORD_HEADER_SIZE (sizeof(uint64_t) + sizeof(uint32_t) + 2 * sizeof(uint8_t) + sizeof(uint32_t))
+
+/**
+ * @brief Kind of event stored in a capture record
+ */
+typedef enum CaptureKind
+{
+    CAPTURE_CONNECT,    /**< A new connection has been accepted by the server */
+    CAPTURE_INBOUND,    /**< Frame received by the server from the connection */
+    CAPTURE_OUTBOUND,   /**< Frame sent by the server to the connection */
+    CAPTURE_DISCONNECT  /**< The connection has been closed */
+} CaptureKind;
+
+/**
+ * @brief Decoded header of a capture record
+ */
+typedef struct CaptureRecord
+{
+    uint64_t timestamp_ns;   /**< Nanoseconds elapsed since the start of the capture */
+    uint32_t conn_id;        /**< Identifier of the connection the frame belongs to */
+    uint8_t kind;            /**< Kind of the record, see CaptureKind */
+    uint8_t type;            /**< MessageType of the frame */
+    uint32_t payload_length; /**< Size of the payload following the header in bytes */
+} CaptureRecord;
+
+#endif // CAPTURE_H
@@ -1,10 +1,127 @@
+#include <errno.h>
 #include <netinet/in.h>
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <unistd.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdbool.h>
+#include <time.h>
 #include "common.h"
+#include "params.h"
+#include "probes.h"
+
+#ifdef TRIVIA_PROBES
+// Semaphores of the static tracepoints, incremented by the tracers when they attach to a probe
+#define DEFINE_PROBE_SEMAPHORE(name) unsigned short PROBE_SEMAPHORE(name) __attribute__((section(".probes"))) = 0
+DEFINE_PROBE_SEMAPHORE(msg__receive);
+DEFINE_PROBE_SEMAPHORE(msg__dispatch__start);
+DEFINE_PROBE_SEMAPHORE(msg__dispatch__done);
+DEFINE_PROBE_SEMAPHORE(msg__send);
+DEFINE_PROBE_SEMAPHORE(client__connect);
+DEFINE_PROBE_SEMAPHORE(client__disconnect);
+DEFINE_PROBE_SEMAPHORE(quiz__select);
+DEFINE_PROBE_SEMAPHORE(quiz__complete);
+DEFINE_PROBE_SEMAPHORE(ranking__update);
+DEFINE_PROBE_SEMAPHORE(loop__start);
+DEFINE_PROBE_SEMAPHORE(loop__wake);
+DEFINE_PROBE_SEMAPHORE(loop__end);
+#endif
+
+/**
+ * @brief Sends data on a kernel socket
+ */
+ssize_t socket_send(int fd, const void *buffer, size_t length)
+{
+    return send(fd, buffer, length, 0);
+}
+
+/**
+ * @brief Receives data from a kernel socket
+ */
+ssize_t socket_recv(int fd, void *buffer, size_t length)
+{
+    return recv(fd, buffer, length, 0);
+}
+
+/**
+ * @brief Closes a kernel socket
+ */
+int socket_close(int fd)
+{
+    return close(fd);
+}
+
+// Default transport, which exchanges the messages through kernel sockets
+static const Transport socket_transport = {socket_send, socket_recv, socket_close};
+// Transport currently used by send_msg, receive_msg and close_connection
+static const Transport *transport = &socket_transport;
+// Optional observer notified of every frame sent with send_msg
+static FrameObserver send_observer = NULL;
+// Optional limit on the payloads accepted by receive_msg_into, checked before the payload is received
+static PayloadLimit payload_limit = NULL;
+// Clock returned by get_time_ns, NULL to use the monotonic clock of the system
+static uint64_t (*time_source)() = NULL;
+
+/**
+ * @brief Replaces the transport used to exchange the messages
+ *
+ * It allows running the protocol code on top of something other than kernel sockets,
+ * as done by the in-process simulation harness.
+ *
+ * @param new_transport transport to use, or NULL to restore the kernel sockets
+ */
+void set_transport(const Transport *new_transport)
+{
+    transport = new_transport ? new_transport : &socket_transport;
+}
+
+/**
+ * @brief Registers the function that bounds the payloads accepted by receive_msg and receive_msg_into
+ *
+ * A frame announcing a larger payload is rejected with EMSGSIZE as soon as its header is read, so a peer
+ * cannot make the receiver allocate an arbitrary amount of memory.
+ *
+ * @param limit function returning the largest payload accepted for each message type, or NULL for no limit
+ */
+void set_payload_limit(PayloadLimit limit)
+{
+    payload_limit = limit;
+}
+
+/**
+ * @brief Replaces the clock returned by get_time_ns
+ *
+ * @param clock function returning the current time in nanoseconds, or NULL to restore the monotonic clock
+ */
+void set_time_source(uint64_t (*clock)())
+{
+    time_source = clock;
+}
+
+/**
+ * @brief Closes a connection through the current transport
+ *
+ * @param fd file descriptor of the connection to close
+ * @return 0 on success, -1 in case of error
+ */
+int close_connection(int fd)
+{
+    return transport->close(fd);
+}
+
+/**
+ * @brief Registers a function that is notified of every frame sent with send_msg
+ *
+ * It is used by the server to record the outbound traffic without coupling the protocol code to the recorder.
+ *
+ * @param observer function to invoke after each successful send, or NULL to disable the notifications
+ */
+void set_send_observer(FrameObserver observer)
+{
+    send_observer = observer;
+}
 
 /**
  * @brief Handles memory allocation errors
@@ -24,6 +141,22 @@ void handle_malloc_error(void *ptr, const char *error_string)
     }
 }
 
+/**
+ * @brief Returns the current value of the monotonic clock
+ *
+ * The clock can be replaced with set_time_source, for example with a virtual clock during simulations.
+ *
+ * @return time in nanoseconds from an arbitrary starting point
+ */
+uint64_t get_time_ns()
+{
+    if (time_source)
+        return time_source();
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
 /**
  * @brief Sends all required bytes on the socket
  *
@@ -43,7 +176,7 @@ ssize_t send_all(int dest_fd, char *buffer, size_t length)
 
     while (total_sent < length)
     {
-        bytes_sent = send(dest_fd, buffer + total_sent, length - total_sent, 0);
+        bytes_sent = transport->send(dest_fd, buffer + total_sent, length - total_sent);
         if (bytes_sent <= 0)
             return bytes_sent;
         total_sent += bytes_sent;
@@ -70,7 +203,7 @@ ssize_t receive_all(int source_fd, char *buffer, size_t length)
 
     while (total_received < length)
     {
-        bytes_received = recv(source_fd, buffer + total_received, length - total_received, 0);
+        bytes_received = transport->recv(source_fd, buffer + total_received, length - total_received);
         if (bytes_received <= 0)
             return bytes_received;
         total_received += bytes_received;
@@ -95,46 +228,262 @@ int send_msg(int dest_fd, MessageType type, char *payload, size_t payload_length
 {
     uint8_t net_msg_type = type;
     uint32_t net_msg_payload_length = htonl(payload_length);
+    char frame[FRAME_HEADER_SIZE + DEFAULT_PAYLOAD_SIZE];
 
-    if (send(dest_fd, &net_msg_type, sizeof(net_msg_type), 0) == -1)
-        return -1;
+    memcpy(frame, &net_msg_type, sizeof(net_msg_type));
+    memcpy(frame + sizeof(net_msg_type), &net_msg_payload_length, sizeof(net_msg_payload_length));
 
-    if (send(dest_fd, &net_msg_payload_length, sizeof(net_msg_payload_length), 0) == -1)
+    // Small frames are sent with a single call, so that the header and the payload travel together
+    if (payload_length <= DEFAULT_PAYLOAD_SIZE)
+    {
+        if (payload_length > 0)
+            memcpy(frame + FRAME_HEADER_SIZE, payload, payload_length);
+        if (send_all(dest_fd, frame, FRAME_HEADER_SIZE + payload_length) == -1)
+            return -1;
+    }
+    else if (send_all(dest_fd, frame, FRAME_HEADER_SIZE) == -1 || send_all(dest_fd, payload, payload_length) == -1)
         return -1;
 
-    if (payload_length > 0)
-        if (send_all(dest_fd, payload, payload_length) == -1)
-            return -1;
+    PROBE3(msg__send, dest_fd, type, payload_length);
+    if (send_observer)
+        send_observer(dest_fd, type, payload, payload_length);
     return 1;
 }
 
 /**
- * @brief Receives a message from a specified source
+ * @brief Properties of each message type, shared by the encoders and decoders of both ends
+ */
+static const MessageDescriptor message_descriptors[MSG_TYPES_COUNT] = {
+    [MSG_REQ_NICKNAME] = {"MSG_REQ_NICKNAME", false, 0},
+    [MSG_SET_NICKNAME] = {"MSG_SET_NICKNAME", false, DEFAULT_PAYLOAD_SIZE},
+    [MSG_OK_NICKNAME] = {"MSG_OK_NICKNAME", false, 0},
+    [MSG_REQ_QUIZ_LIST] = {"MSG_REQ_QUIZ_LIST", false, 0},
+    [MSG_RES_QUIZ_LIST] = {"MSG_RES_QUIZ_LIST", true, 0},
+    [MSG_QUIZ_SELECT] = {"MSG_QUIZ_SELECT", true, sizeof(uint16_t)},
+    [MSG_QUIZ_SELECTED] = {"MSG_QUIZ_SELECTED", false, 0},
+    [MSG_QUIZ_QUESTION] = {"MSG_QUIZ_QUESTION", false, 0},
+    [MSG_QUIZ_ANSWER] = {"MSG_QUIZ_ANSWER", false, DEFAULT_PAYLOAD_SIZE},
+    [MSG_REQ_RANKING] = {"MSG_REQ_RANKING", false, 0},
+    [MSG_RES_RANKING] = {"MSG_RES_RANKING", true, 0},
+    [MSG_DISCONNECT] = {"MSG_DISCONNECT", false, 0},
+    [MSG_INFO] = {"MSG_INFO", false, 0},
+    [MSG_SPECTATE] = {"MSG_SPECTATE", true, (UINT16_MAX + 1) * sizeof(uint16_t)},
+    [MSG_RANKING_UPDATE] = {"MSG_RANKING_UPDATE", true, 0},
+    [MSG_SUBSCRIBE_RANKING] = {"MSG_SUBSCRIBE_RANKING", false, 0},
+    [MSG_RANKING_RESYNC] = {"MSG_RANKING_RESYNC", true, 0},
+    [MSG_RANKING_DELTA] = {"MSG_RANKING_DELTA", true, 0},
+    [MSG_QUIZ_SUBMIT] = {"MSG_QUIZ_SUBMIT", false, DEFAULT_PAYLOAD_SIZE},
+    [MSG_QUIZ_RESULT] = {"MSG_QUIZ_RESULT", true, 0},
+    [MSG_HELLO] = {"MSG_HELLO", true, HELLO_SIZE},
+    [MSG_SESSION_TOKEN] = {"MSG_SESSION_TOKEN", true, 0},
+    [MSG_RESUME_SESSION] = {"MSG_RESUME_SESSION", true, SESSION_TOKEN_SIZE},
+    [MSG_SESSION_RESUMED] = {"MSG_SESSION_RESUMED", true, 0},
+};
+
+/**
+ * @brief Tells if a message type uses the binary protocol
+ *
+ * Messages of the text protocol get a string terminator appended to their payload on reception.
+ *
+ * @param type type of the message
+ * @return true if the payload of the message is binary
+ */
+bool is_binary_message(MessageType type)
+{
+    return (unsigned)type < MSG_TYPES_COUNT && message_descriptors[type].binary;
+}
+
+/**
+ * @brief Returns the largest payload of a message type that the server accepts from a client
+ *
+ * The text messages are bounded by the input buffers of the clients, the binary ones by their encoding;
+ * the types only sent by the server carry no payload when they come from a client.
+ *
+ * @param type type of the message
+ * @return largest payload in bytes, 0 for the unknown types
+ */
+uint32_t max_request_payload(MessageType type)
+{
+    return (unsigned)type < MSG_TYPES_COUNT ? message_descriptors[type].max_request : 0;
+}
+
+/**
+ * @brief Initializes the capabilities of this end of a connection, with everything it supports
+ *
+ * @param capabilities pointer to the capabilities
+ * @param max_frame largest payload accepted by this end
+ */
+void init_capabilities(Capabilities *capabilities, uint32_t max_frame)
+{
+    capabilities->version = PROTOCOL_LATEST;
+    capabilities->compression = COMPRESSION_NONE;
+    capabilities->max_frame = max_frame;
+    capabilities->features = FEATURES_SUPPORTED;
+}
+
+/**
+ * @brief Initializes the capabilities assumed for a peer that has not sent a MSG_HELLO
+ *
+ * @param capabilities pointer to the capabilities
+ */
+void legacy_capabilities(Capabilities *capabilities)
+{
+    capabilities->version = PROTOCOL_V1;
+    capabilities->compression = COMPRESSION_NONE;
+    capabilities->max_frame = UINT32_MAX;
+    capabilities->features = 0;
+}
+
+/**
+ * @brief Computes the capabilities that both ends of a connection can use
+ *
+ * @param local pointer to the capabilities of this end
+ * @param peer pointer to the capabilities announced by the peer
+ * @param agreed pointer in which the negotiated capabilities are stored
+ */
+void negotiate_capabilities(const Capabilities *local, const Capabilities *peer, Capabilities *agreed)
+{
+    agreed->version = peer->version < local->version ? peer->version : local->version;
+    if (agreed->version < PROTOCOL_V1)
+        agreed->version = PROTOCOL_V1;
+    agreed->compression = peer->compression == local->compression ? local->compression : COMPRESSION_NONE;
+    agreed->max_frame = peer->max_frame;
+    agreed->features = peer->features & local->features;
+}
+
+/**
+ * @brief Serializes capabilities in the payload of a MSG_HELLO
+ *
+ * The payload has this format, with the 32-bit values in network byte order:
+ * (version) (compression) (max frame size) (features)
+ *
+ * @param buffer buffer of HELLO_SIZE bytes
+ * @param capabilities pointer to the capabilities
+ */
+void encode_hello(char *buffer, const Capabilities *capabilities)
+{
+    uint32_t net_values[2] = {htonl(capabilities->max_frame), htonl(capabilities->features)};
+    buffer[0] = (char)capabilities->version;
+    buffer[1] = (char)capabilities->compression;
+    memcpy(buffer + 2 * sizeof(uint8_t), net_values, sizeof(net_values));
+}
+
+/**
+ * @brief Deserializes the capabilities of a MSG_HELLO
+ *
+ * @param msg pointer to the received message
+ * @param capabilities pointer in which the capabilities are stored
+ * @return false if the payload is not a valid MSG_HELLO
+ */
+bool decode_hello(const Message *msg, Capabilities *capabilities)
+{
+    uint32_t net_values[2];
+    if (msg->type != MSG_HELLO || msg->payload_length != HELLO_SIZE)
+        return false;
+    capabilities->version = (uint8_t)msg->payload[0];
+    capabilities->compression = (uint8_t)msg->payload[1];
+    memcpy(net_values, msg->payload + 2 * sizeof(uint8_t), sizeof(net_values));
+    capabilities->max_frame = ntohl(net_values[0]);
+    capabilities->features = ntohl(net_values[1]);
+    return true;
+}
+
+/**
+ * @brief Computes the number of bytes of the varint encoding a value
+ *
+ * @param value value to encode
+ * @return number of bytes written by encode_varint
+ */
+size_t varint_size(uint64_t value)
+{
+    size_t length = 1;
+    while (value >= 0x80)
+    {
+        value >>= 7;
+        length++;
+    }
+    return length;
+}
+
+/**
+ * @brief Encodes an unsigned value as a varint of the version 2 protocol
+ *
+ * The value is written 7 bits at a time, starting from the least significant ones;
+ * the highest bit of each byte is set when other bytes follow, so values below 128 take a single byte.
+ *
+ * @param buffer buffer of at least VARINT_MAX_SIZE bytes in which to write the value
+ * @param value value to encode
+ * @return number of bytes written
+ */
+size_t encode_varint(char *buffer, uint64_t value)
+{
+    size_t length = 0;
+    while (value >= 0x80)
+    {
+        buffer[length++] = (char)(value | 0x80);
+        value >>= 7;
+    }
+    buffer[length++] = (char)value;
+    return length;
+}
+
+/**
+ * @brief Decodes a varint of the version 2 protocol
+ *
+ * @param buffer pointer to the first byte of the varint
+ * @param end pointer past the last byte that can be read
+ * @param value pointer in which the decoded value is stored
+ * @return number of bytes read, or 0 if the varint is truncated or too long
+ */
+size_t decode_varint(const char *buffer, const char *end, uint64_t *value)
+{
+    uint64_t result = 0;
+    for (size_t length = 0; length < VARINT_MAX_SIZE && buffer + length < end; length++)
+    {
+        uint8_t byte = (uint8_t)buffer[length];
+        result |= (uint64_t)(byte & 0x7F) << (7 * length);
+        if (!(byte & 0x80))
+        {
+            *value = result;
+            return length + 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Receives a message from a specified source into a reusable buffer
  *
  * This function receives a message from the client identified by the provided file descriptor.
  * Numeric values are converted from network byte order to host byte order after reception.
  *
+ * The payload is stored in *buffer, which is grown with realloc only when the message does not fit,
+ * so that a connection exchanging messages of similar sizes does not allocate memory after the first ones.
+ * The payload of the message points into the buffer, which remains owned by the caller.
+ *
  * In particular, it handles whether to add a string terminator in the case where the message payload
- * is of text protocol type or binary protocol as in the case of MSG_RES_QUIZ_LIST and MSG_RES_RANKING.
+ * is of text protocol type or binary protocol, as recorded in the descriptor of its type.
  *
  * @param source_fd file descriptor from which to receive the message
  * @param msg pointer to the Message structure in which to store the received data
+ * @param buffer pointer to the buffer in which to store the payload, possibly NULL
+ * @param buffer_size pointer to the current size of the buffer
  *
  * @return 1 if the message was received successfully, 0 if the client closed the connection,
  *         or a negative value in case of error.
  */
-int receive_msg(int source_fd, Message *msg)
+int receive_msg_into(int source_fd, Message *msg, char **buffer, size_t *buffer_size)
 {
     uint8_t net_msg_type;
     uint32_t net_msg_payload_length;
 
-    ssize_t bytes_received = recv(source_fd, &net_msg_type, sizeof(net_msg_type), 0);
+    ssize_t bytes_received = transport->recv(source_fd, &net_msg_type, sizeof(net_msg_type));
     if (bytes_received <= 0)
         return bytes_received;
 
     msg->type = net_msg_type;
 
-    bytes_received = recv(source_fd, &net_msg_payload_length, sizeof(net_msg_payload_length), 0);
+    bytes_received = transport->recv(source_fd, &net_msg_payload_length, sizeof(net_msg_payload_length));
 
     if (bytes_received <= 0)
         return bytes_received;
@@ -142,40 +491,85 @@ int receive_msg(int source_fd, Message *msg)
     msg->payload_length = ntohl(net_msg_payload_length);
     msg->payload = NULL;
 
-    // Add space for the string terminator only for messages that use the text protocol
-    if (msg->type == MSG_RES_QUIZ_LIST || msg->type == MSG_RES_RANKING || msg->type == MSG_QUIZ_SELECT)
+    // Reject the frame before allocating its payload, the connection cannot be used afterwards
+    if (payload_limit && msg->payload_length > payload_limit(msg->type))
     {
-        // If msg->payload_length is zero, a message with only the type has been sent, so no need to receive
-        if (msg->payload_length == 0)
-            return 1;
-        msg->payload = (char *)malloc(msg->payload_length);
-        handle_malloc_error(msg->payload, "Memory allocation error for the payload");
+        errno = EMSGSIZE;
+        return -1;
     }
-    else
+
+    // Add space for the string terminator only for messages that use the text protocol
+    bool binary = is_binary_message(msg->type);
+    // If msg->payload_length is zero, a binary message with only the type has been sent, so no need to receive
+    if (binary && msg->payload_length == 0)
+        return 1;
+
+    size_t required_size = (size_t)msg->payload_length + (binary ? 0 : 1);
+    if (required_size > *buffer_size)
     {
-        msg->payload = (char *)malloc(msg->payload_length + 1);
-        handle_malloc_error(msg->payload, "Memory allocation error for the payload");
-        // If msg->payload_length is zero, a message with only the type has been sent, so no need to receive
-        if (msg->payload_length == 0)
-        {
-            msg->payload[0] = '\0';
-            return 1;
-        }
+        // Grow geometrically, so that slightly longer messages do not cause a reallocation each time
+        size_t new_size = *buffer_size ? *buffer_size * 2 : DEFAULT_PAYLOAD_SIZE;
+        while (new_size < required_size)
+            new_size *= 2;
+        char *new_buffer = (char *)realloc(*buffer, new_size);
+        handle_malloc_error(new_buffer, "Memory allocation error for the payload");
+        *buffer = new_buffer;
+        *buffer_size = new_size;
     }
+    msg->payload = *buffer;
 
-    bytes_received = receive_all(source_fd, msg->payload, msg->payload_length);
-    if (bytes_received <= 0)
+    if (msg->payload_length > 0)
     {
-        free(msg->payload);
-        return bytes_received;
+        bytes_received = receive_all(source_fd, msg->payload, msg->payload_length);
+        if (bytes_received <= 0)
+            return bytes_received;
     }
     // If the message uses the text protocol, add the string terminator to the payload
-    if (!(msg->type == MSG_RES_QUIZ_LIST || msg->type == MSG_RES_RANKING || msg->type == MSG_QUIZ_SELECT))
+    if (!binary)
         msg->payload[msg->payload_length] = '\0';
 
     return 1;
 }
 
+/**
+ * @brief Receives a message from a specified source
+ *
+ * This function works as receive_msg_into, but the payload is allocated on the heap for each message
+ * and must be freed by the caller.
+ *
+ * @param source_fd file descriptor from which to receive the message
+ * @param msg pointer to the Message structure in which to store the received data
+ *
+ * @return 1 if the message was received successfully, 0 if the client closed the connection,
+ *         or a negative value in case of error.
+ */
+int receive_msg(int source_fd, Message *msg)
+{
+    char *buffer = NULL;
+    size_t buffer_size = 0;
+
+    int res = receive_msg_into(source_fd, msg, &buffer, &buffer_size);
+    if (res <= 0)
+    {
+        free(buffer);
+        msg->payload = NULL;
+    }
+    return res;
+}
+
+/**
+ * @brief Returns a printable name for a message type
+ *
+ * @param type type of the message
+ * @return constant string with the name of the type
+ */
+const char *message_type_name(MessageType type)
+{
+    if ((unsigned)type >= MSG_TYPES_COUNT)
+        return "MSG_UNKNOWN";
+    return message_descriptors[type].name;
+}
+
 /**
  * @brief Clears the standard input buffer.
  *
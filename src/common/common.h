@@ -3,6 +3,11 @@
 
 #include <stddef.h>
 #include <stdint.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+// Size of the header of a frame: the message type and the payload length
+#define FRAME_HEADER_SIZE (sizeof(uint8_t) + sizeof(uint32_t))
 
 /**
  * @brief Enumeration that defines the types of messages exchanged between client and server
@@ -24,13 +29,76 @@ typedef enum MessageType
     MSG_REQ_RANKING,   /**< Message sent by the client to the server to request the ranking */
     MSG_RES_RANKING,   /**< Message sent by the server to the client with the ranking [BINARY PROTOCOL] */
     MSG_DISCONNECT,    /**< Message sent by the client to the server to indicate disconnection */
-    MSG_INFO           /**< Message sent by the server with an informational message for the client */
+    MSG_INFO,          /**< Message sent by the server with an informational message for the client */
+    MSG_SPECTATE,      /**< Message sent by a spectator, instead of the nickname, to follow the rankings of quizzes [BINARY PROTOCOL] */
+    MSG_RANKING_UPDATE, /**< Message pushed by the server to the spectators with the ranking of a quiz [BINARY PROTOCOL] */
+    MSG_SUBSCRIBE_RANKING, /**< Message sent by the client to receive the changes of the rankings instead of requesting them */
+    MSG_RANKING_RESYNC, /**< Message pushed by the server to the subscribers with the whole ranking of a quiz [BINARY PROTOCOL] */
+    MSG_RANKING_DELTA, /**< Message pushed by the server to the subscribers with the changes of the ranking of a quiz [BINARY PROTOCOL] */
+    MSG_QUIZ_SUBMIT,   /**< Message sent by the client with the answer to the quiz question, answered by a MSG_QUIZ_RESULT */
+    MSG_QUIZ_RESULT,   /**< Message sent by the server with the verdict of an answer and the next question [BINARY PROTOCOL] */
+    MSG_HELLO,         /**< Message sent by the client before the nickname with its capabilities, and by the server with the ones negotiated [BINARY PROTOCOL] */
+    MSG_SESSION_TOKEN, /**< Message sent by the server after the nickname with the token that resumes the session on a new connection [BINARY PROTOCOL] */
+    MSG_RESUME_SESSION, /**< Message sent by the client, instead of the nickname, with the token of the session to resume [BINARY PROTOCOL] */
+    MSG_SESSION_RESUMED, /**< Message sent by the server with the state of the resumed session and the question to answer [BINARY PROTOCOL] */
+    MSG_TYPES_COUNT    /**< Number of message types, not a valid type */
 } MessageType;
 
+// Flags of a MSG_QUIZ_RESULT: the answer was correct
+#define QUIZ_RESULT_CORRECT 0x01
+// Flags of a MSG_QUIZ_RESULT: the quiz is completed and the quiz list follows instead of the next question
+#define QUIZ_RESULT_COMPLETED 0x02
+// Size of the fixed part of a MSG_QUIZ_RESULT: (flags) (score) (rank) (number of players)
+#define QUIZ_RESULT_HEADER_SIZE (sizeof(uint8_t) + 3 * sizeof(uint16_t))
+
+// Protocol version with fixed uint16_t counts, lengths and scores, used until another one is negotiated
+#define PROTOCOL_V1 1
+// Protocol version with varint counts, lengths and scores, and the nicknames of the rankings in a string table
+#define PROTOCOL_V2 2
+// Highest protocol version supported
+#define PROTOCOL_LATEST PROTOCOL_V2
+// Maximum size of a varint encoding a 64-bit value
+#define VARINT_MAX_SIZE 10
+
+// Size of the payload of a MSG_HELLO: (version) (compression) (max frame size) (features)
+#define HELLO_SIZE (2 * sizeof(uint8_t) + 2 * sizeof(uint32_t))
+// Compression of the payloads: none, the only one supported so far
+#define COMPRESSION_NONE 0
+// Optional message types: MSG_QUIZ_SUBMIT, answered by MSG_QUIZ_RESULT
+#define FEATURE_QUIZ_RESULT 0x01
+// Optional message types: MSG_SUBSCRIBE_RANKING, followed by MSG_RANKING_RESYNC and MSG_RANKING_DELTA
+#define FEATURE_RANKING_DELTAS 0x02
+// Optional message types: MSG_SPECTATE, followed by MSG_RANKING_UPDATE
+#define FEATURE_SPECTATE 0x04
+// Optional message types: MSG_SESSION_TOKEN, MSG_RESUME_SESSION and MSG_SESSION_RESUMED
+#define FEATURE_SESSION_RESUME 0x08
+// Optional message types supported
+#define FEATURES_SUPPORTED (FEATURE_QUIZ_RESULT | FEATURE_RANKING_DELTAS | FEATURE_SPECTATE | FEATURE_SESSION_RESUME)
+
+// Size of the random token identifying a session, the payload of MSG_SESSION_TOKEN and MSG_RESUME_SESSION
+#define SESSION_TOKEN_SIZE 16
+// Size of the fixed part of a MSG_SESSION_RESUMED: (quiz number) (score)
+#define SESSION_RESUMED_HEADER_SIZE (2 * sizeof(uint16_t))
+
+/**
+ * @brief Capabilities of one end of a connection, exchanged with MSG_HELLO
+ *
+ * Once negotiated, they describe what both ends can use: the protocol version, the compression and
+ * the optional message types are the ones supported by both, while the frame size is the one of the peer.
+ */
+typedef struct Capabilities
+{
+    uint8_t version;     /**< Version of the protocol, which decides the encoding of the binary payloads. */
+    uint8_t compression; /**< Compression of the payloads. */
+    uint32_t max_frame;  /**< Largest payload accepted. */
+    uint32_t features;   /**< Optional message types, FEATURE_* flags. */
+} Capabilities;
+
 /**
  * @brief Structure representing a message exchanged between client and server
  *
- * In particular, the payload is allocated on the heap based on payload_length.
+ * In particular, the payload is allocated on the heap based on payload_length by receive_msg,
+ * while with receive_msg_into it points into a buffer owned by the caller.
  */
 typedef struct Message
 {
@@ -39,8 +107,59 @@ typedef struct Message
     char *payload;           /**< Pointer to the message payload data */
 } Message;
 
+/**
+ * @brief Properties of a message type
+ */
+typedef struct MessageDescriptor
+{
+    const char *name;     /**< Printable name of the type. */
+    bool binary;          /**< The payload uses the binary protocol, so no string terminator is appended on reception. */
+    uint32_t max_request; /**< Largest payload the server accepts from a client, 0 for the types only sent by the server. */
+} MessageDescriptor;
+
+/**
+ * @brief Set of primitives used to exchange the messages on a connection
+ *
+ * The default transport uses kernel sockets; alternative transports, such as the in-memory one
+ * of the simulation harness, can be installed with set_transport.
+ */
+typedef struct Transport
+{
+    ssize_t (*send)(int fd, const void *buffer, size_t length); /**< Sends data, with the semantics of send */
+    ssize_t (*recv)(int fd, void *buffer, size_t length);       /**< Receives data, with the semantics of recv */
+    int (*close)(int fd);                                       /**< Closes the connection */
+} Transport;
+
+/**
+ * @brief Function notified of a frame exchanged on a file descriptor
+ */
+typedef void (*FrameObserver)(int fd, MessageType type, const char *payload, size_t payload_length);
+
+/**
+ * @brief Function returning the largest payload accepted for a message type
+ */
+typedef uint32_t (*PayloadLimit)(MessageType type);
+
+void set_send_observer(FrameObserver observer);
+void set_payload_limit(PayloadLimit limit);
+void set_transport(const Transport *new_transport);
+void set_time_source(uint64_t (*clock)());
+int close_connection(int fd);
+uint64_t get_time_ns();
 void handle_malloc_error(void *ptr, const char *error_string);
+bool is_binary_message(MessageType type);
+uint32_t max_request_payload(MessageType type);
+void init_capabilities(Capabilities *capabilities, uint32_t max_frame);
+void legacy_capabilities(Capabilities *capabilities);
+void negotiate_capabilities(const Capabilities *local, const Capabilities *peer, Capabilities *agreed);
+void encode_hello(char *buffer, const Capabilities *capabilities);
+bool decode_hello(const Message *msg, Capabilities *capabilities);
+size_t varint_size(uint64_t value);
+size_t encode_varint(char *buffer, uint64_t value);
+size_t decode_varint(const char *buffer, const char *end, uint64_t *value);
+const char *message_type_name(MessageType type);
 int receive_msg(int client_fd, Message *msg);
+int receive_msg_into(int source_fd, Message *msg, char **buffer, size_t *buffer_size);
 int send_msg(int client_fd, MessageType type, char *payload, size_t payload_len);
 int get_console_input(char *buffer, int buffer_size);
 void clear_input_buffer();
@@ -0,0 +1,101 @@
+#ifndef FLIGHT_H
+#define FLIGHT_H
+
+#include <stdint.h>
+
+/**
+ * @brief Format of the flight recorder dumps
+ *
+ * Every thread of the server records its events in its own ring buffer. A dump starts with a FlightDumpHeader,
+ * followed by each of the header.total_rings rings: a FlightRingHeader, then ring.dumped_events events
+ * (at most header.capacity) ordered from the oldest to the newest. The decoder merges the rings by timestamp.
+ * Since dumps are written from signal handlers, where no conversion
+ * can be afforded, all the values are stored in the byte order of the machine that produced them,
+ * which the decoder checks through the byte_order field.
+ *
+ * Timestamps are expressed in ticks of the recorder clock (the TSC on x86, nanoseconds elsewhere):
+ * the two reference points of the header allow converting them to nanoseconds.
+ */
+
+#define FLIGHT_MAGIC "TQFR"
+#define FLIGHT_MAGIC_SIZE 4
+#define FLIGHT_VERSION 2
+#define FLIGHT_BYTE_ORDER 0x01020304
+// Number of events kept by the ring of each thread, must be a power of two
+#define FLIGHT_CAPACITY 8192
+// Maximum number of rings, the threads started beyond the first FLIGHT_RINGS - 1 share the last one
+#define FLIGHT_RINGS 64
+
+/**
+ * @brief Kind of event kept by the flight recorder
+ */
+typedef enum FlightEventKind
+{
+    FLIGHT_FRAME_IN,   /**< Frame received: conn = client id, type = MessageType, a = fd, b = payload length */
+    FLIGHT_FRAME_OUT,  /**< Frame sent: conn = fd, type = MessageType, b = payload length */
+    FLIGHT_CONNECT,    /**< Connection registered: conn = client id, a = fd */
+    FLIGHT_DISCONNECT, /**< Connection closed: conn = client id, type = ClientState, a = fd */
+    FLIGHT_STATE,      /**< Client state transition: conn = client id, type = new ClientState, a = old ClientState */
+    FLIGHT_LOOP,       /**< Event-loop iteration: a = ready descriptors, b = busy ticks after the wakeup */
+    FLIGHT_ERROR,      /**< Error: type = FlightErrorCode, a = errno */
+    FLIGHT_EXIT,       /**< Process exit: a = exit status */
+    FLIGHT_SIGNAL,     /**< Signal received: a = signal number */
+    FLIGHT_TIMEOUT     /**< Client timeout expired: conn = client id, type = ClientState, a = fd, b = 1 for a question deadline */
+} FlightEventKind;
+
+/**
+ * @brief Errors recorded by the flight recorder
+ */
+typedef enum FlightErrorCode
+{
+    FLIGHT_ERROR_RECEIVE,     /**< Unexpected error while receiving from a client */
+    FLIGHT_ERROR_ACCEPT,      /**< Error accepting a new connection */
+    FLIGHT_ERROR_WAIT,        /**< Error while waiting for activity in the event loop */
+    FLIGHT_ERROR_QUIZ_FILE,   /**< Quiz file missing or malformed */
+    FLIGHT_ERROR_FRAME_SIZE,  /**< Client disconnected for announcing a frame larger than allowed for its type */
+    FLIGHT_ERROR_MEMORY       /**< Client disconnected for exceeding its memory budget */
+} FlightErrorCode;
+
+/**
+ * @brief Fixed-size event stored in the ring buffer
+ */
+typedef struct FlightEvent
+{
+    uint64_t timestamp; /**< Ticks of the recorder clock. */
+    uint32_t sequence;  /**< Sequence number of the event in its ring, used to detect slots overwritten during a dump. */
+    uint16_t kind;      /**< Kind of the event, see FlightEventKind. */
+    uint16_t type;      /**< Message type, client state or error code, depending on the kind. */
+    uint32_t conn;      /**< Client id or file descriptor, depending on the kind. */
+    uint32_t a;         /**< First argument, depending on the kind. */
+    uint64_t b;         /**< Second argument, depending on the kind. */
+} FlightEvent;
+
+/**
+ * @brief Header of a flight recorder dump
+ */
+typedef struct FlightDumpHeader
+{
+    char magic[FLIGHT_MAGIC_SIZE]; /**< FLIGHT_MAGIC. */
+    uint16_t version;              /**< FLIGHT_VERSION. */
+    uint16_t event_size;           /**< sizeof(FlightEvent). */
+    uint32_t byte_order;           /**< FLIGHT_BYTE_ORDER in the byte order of the producer. */
+    uint32_t capacity;             /**< Number of slots of each ring buffer. */
+    uint32_t total_rings;          /**< Number of rings following the header. */
+    uint64_t total_events;         /**< Number of events recorded since the start, in all the rings. */
+    uint64_t dumped_events;        /**< Number of events in the dump, in all the rings. */
+    uint64_t start_ticks;          /**< Recorder clock when the recorder was started. */
+    uint64_t start_ns;             /**< Monotonic time in nanoseconds when the recorder was started. */
+    uint64_t dump_ticks;           /**< Recorder clock when the dump was written. */
+    uint64_t dump_ns;              /**< Monotonic time in nanoseconds when the dump was written. */
+} FlightDumpHeader;
+
+/**
+ * @brief Header of the events of a ring in a flight recorder dump
+ */
+typedef struct FlightRingHeader
+{
+    uint64_t total_events;  /**< Number of events recorded in the ring since the start. */
+    uint64_t dumped_events; /**< Number of events of the ring following this header. */
+} FlightRingHeader;
+
+#endif // FLIGHT_H
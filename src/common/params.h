@@ -2,4 +2,55 @@
 #define SERVER_PORT 8080
 #define SERVER_IP "127.0.0.1"
 #define ENDQUIZ "endquiz"
-#define SHOWSCORE "show score"
\ No newline at end of file
+#define SHOWSCORE "show score"
+#define FLIGHT_DUMP_PATH "trivia-flight.bin"
+#define DASHBOARD_REFRESH_MS 500
+#define LISTEN_BACKLOG 4096
+#define LOGIN_TIMEOUT_MS 30000
+#define IDLE_TIMEOUT_MS 1800000
+#define QUESTION_TIMEOUT_MS 0
+#define SESSION_GRACE_MS 60000
+#define KEEPALIVE_IDLE_S 60
+#define KEEPALIVE_INTERVAL_S 10
+#define KEEPALIVE_PROBES 3
+#define LIVE_ROUND_MS 15000
+#define LIVE_PAUSE_MS 3000
+#define LIVE_RESULTS_TOP 10
+#define SPECTATOR_UPDATES_PER_S 4
+#define RANKING_RESYNC_BATCHES 64
+#define SERVER_MAX_FRAME (1 << 20)
+#define CLIENT_MAX_FRAME (64 << 20)
+#define HELLO_TIMEOUT_MS 2000
+#define RESUME_ATTEMPTS 5
+#define RESUME_DELAY_MS 1000
+#define WAL_COMMIT_MS 10
+#define WAL_BUFFER_SIZE (64 << 10)
+#define WAL_SNAPSHOT_BYTES (8 << 20)
+#define UPGRADE_FD_ENV "TRIVIA_UPGRADE_FD"
+#define UPGRADE_READY_TIMEOUT_MS 10000
+#define HANDOFF_FDS_PER_MESSAGE 250
+#define SHM_NAME "/trivia"
+#define SHM_BUFFER_SIZE (1 << 20)
+#define SHM_LEADERBOARD_TOP 100
+#define SHM_PUBLISH_MS 100
+#define CONNECTION_MEMORY_BUDGET (4 << 20)
+#define MEMORY_SWEEP_MS 1000
+#define RATE_ANSWERS_PER_S 10
+#define RATE_ANSWERS_BURST 20
+#define RATE_RANKINGS_PER_S 2
+#define RATE_RANKINGS_BURST 5
+#define RATE_QUIZ_LISTS_PER_S 5
+#define RATE_QUIZ_LISTS_BURST 10
+#define RATE_NICKNAMES_PER_S 2
+#define RATE_NICKNAMES_BURST 5
+#define RANKING_CACHE_MS 500
+#define OVERLOAD_CACHE_LAG_US 10000
+#define OVERLOAD_CACHE_QUEUE 1024
+#define OVERLOAD_WAITING_LAG_US 25000
+#define OVERLOAD_WAITING_QUEUE 2048
+#define OVERLOAD_PAUSE_LAG_US 50000
+#define OVERLOAD_PAUSE_QUEUE 3072
+#define OVERLOAD_LAG_WINDOW_MS 100
+#define OVERLOAD_COOLDOWN_MS 1000
+#define WAITING_UPDATE_MS 1000
+#define DASHBOARD_OVERLOAD_REFRESH_MS 2000
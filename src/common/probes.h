@@ -0,0 +1,75 @@
+#ifndef PROBES_H
+#define PROBES_H
+
+/**
+ * Static tracepoints (USDT) of the "trivia" provider
+ *
+ * When <sys/sdt.h> is available the probes are compiled in as nop instructions that perf and bpftrace
+ * can attach to, for example with usdt:./server:trivia:msg__receive. Otherwise, or when building with
+ * -DTRIVIA_NO_PROBES, they are compiled out.
+ *
+ * Each probe has a semaphore, so that arguments that are expensive to compute can be skipped with
+ * PROBE_ENABLED when nobody is tracing.
+ *
+ * Probes and their arguments:
+ *  - msg__receive(conn_id, type, payload_length)   frame received by the server
+ *  - msg__dispatch__start(conn_id, type)            handler of a frame started
+ *  - msg__dispatch__done(conn_id, type)             handler of a frame completed
+ *  - msg__send(fd, type, payload_length)            frame sent with send_msg
+ *  - client__connect(conn_id, fd)                   connection registered
+ *  - client__disconnect(conn_id, fd, state)         connection closed
+ *  - quiz__select(conn_id, quiz_id)                 quiz session started
+ *  - quiz__complete(conn_id, quiz_id, score)        quiz session completed
+ *  - ranking__update(quiz_id, score, old_pos, new_pos) node moved in a quiz ranking (1-based positions)
+ *  - loop__start()                                  beginning of an event-loop iteration
+ *  - loop__wake(ready)                              the event loop has been woken up with ready descriptors
+ *  - loop__end()                                    end of an event-loop iteration
+ */
+
+#if !defined(TRIVIA_NO_PROBES) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#define TRIVIA_PROBES 1
+#endif
+#endif
+
+#ifdef TRIVIA_PROBES
+
+#define _SDT_HAS_SEMAPHORES 1
+#include <sys/sdt.h>
+
+#define PROBE_SEMAPHORE(name) trivia_##name##_semaphore
+#define PROBE_ENABLED(name) __builtin_expect(PROBE_SEMAPHORE(name) != 0, 0)
+#define PROBE0(name) DTRACE_PROBE(trivia, name)
+#define PROBE1(name, a1) DTRACE_PROBE1(trivia, name, a1)
+#define PROBE2(name, a1, a2) DTRACE_PROBE2(trivia, name, a1, a2)
+#define PROBE3(name, a1, a2, a3) DTRACE_PROBE3(trivia, name, a1, a2, a3)
+#define PROBE4(name, a1, a2, a3, a4) DTRACE_PROBE4(trivia, name, a1, a2, a3, a4)
+
+// Semaphores incremented by the tracers attached to the probes, defined in common.c
+#define DECLARE_PROBE_SEMAPHORE(name) extern unsigned short PROBE_SEMAPHORE(name)
+DECLARE_PROBE_SEMAPHORE(msg__receive);
+DECLARE_PROBE_SEMAPHORE(msg__dispatch__start);
+DECLARE_PROBE_SEMAPHORE(msg__dispatch__done);
+DECLARE_PROBE_SEMAPHORE(msg__send);
+DECLARE_PROBE_SEMAPHORE(client__connect);
+DECLARE_PROBE_SEMAPHORE(client__disconnect);
+DECLARE_PROBE_SEMAPHORE(quiz__select);
+DECLARE_PROBE_SEMAPHORE(quiz__complete);
+DECLARE_PROBE_SEMAPHORE(ranking__update);
+DECLARE_PROBE_SEMAPHORE(loop__start);
+DECLARE_PROBE_SEMAPHORE(loop__wake);
+DECLARE_PROBE_SEMAPHORE(loop__end);
+
+#else
+
+// The arguments are referenced in dead code, so that they are never evaluated but do not trigger unused warnings
+#define PROBE_ENABLED(name) 0
+#define PROBE0(name) do { } while (0)
+#define PROBE1(name, a1) do { if (0) { (void)(a1); } } while (0)
+#define PROBE2(name, a1, a2) do { if (0) { (void)(a1); (void)(a2); } } while (0)
+#define PROBE3(name, a1, a2, a3) do { if (0) { (void)(a1); (void)(a2); (void)(a3); } } while (0)
+#define PROBE4(name, a1, a2, a3, a4) do { if (0) { (void)(a1); (void)(a2); (void)(a3); (void)(a4); } } while (0)
+
+#endif
+
+#endif // PROBES_H
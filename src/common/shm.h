@@ -0,0 +1,115 @@
+#ifndef SHM_H
+#define SHM_H
+
+#include <stdint.h>
+
+/**
+ * @brief Layout of the POSIX shared-memory region in which the server publishes its statistics and leaderboards
+ *
+ * The region starts with a ShmHeader followed by two buffers of header.buffer_size bytes. The server writes
+ * each publication in the buffer not holding the last one, then increments header.sequence, so that publication
+ * number s is always in buffer s % 2. Before writing publication s it stores s in header.started: a reader
+ * copies buffer s % 2 after reading sequence s, then checks that started is still below s + 2, which means
+ * the writer has not come back to the same buffer in the meantime, and retries otherwise. Readers therefore
+ * never block the server, which never waits for them.
+ *
+ * Since the region is only shared between processes of the same machine, the values are stored in the byte
+ * order of the machine. A publication is made of a ShmStats, followed by total_workers ShmWorker and by
+ * the leaderboard of each quiz: a ShmQuiz, the name of the quiz, then the first ShmQuiz.shown players
+ * in ranking order, each one encoded as (nickname length)(nickname)(score)(completed) where the numbers are
+ * varints. The fixed-size structures are not aligned in the buffer and must be copied out with memcpy.
+ */
+
+#define SHM_MAGIC "TQSM"
+#define SHM_MAGIC_SIZE 4
+#define SHM_VERSION 5
+// Client states of the server, in the order of its ClientState enumeration
+#define SHM_CLIENT_STATES 5
+// Classes of requests limited by the server, in the order of its RateClass enumeration
+#define SHM_RATE_CLASSES 4
+// Stages of overload of the server, in the order of its OverloadStage enumeration
+#define SHM_OVERLOAD_STAGES 4
+
+/**
+ * @brief Header of the shared-memory region
+ */
+typedef struct ShmHeader
+{
+    char magic[SHM_MAGIC_SIZE]; /**< SHM_MAGIC, written last when the region is created. */
+    uint16_t version;           /**< SHM_VERSION. */
+    uint16_t header_size;       /**< sizeof(ShmHeader), offset of the first buffer. */
+    uint32_t buffer_size;       /**< Size of each of the two buffers. */
+    uint32_t pid;               /**< Process id of the server publishing in the region. */
+    uint64_t started;           /**< Number of the publication being written, or of the last one written. */
+    uint64_t sequence;          /**< Number of the last complete publication, 0 if none yet. */
+    uint64_t lengths[2];        /**< Length of the publication in each buffer. */
+} ShmHeader;
+
+/**
+ * @brief Statistics of the whole server, opening each publication
+ */
+typedef struct ShmStats
+{
+    uint64_t published_ns;     /**< Monotonic time of the publication. */
+    uint64_t handled_events;   /**< Connections and messages handled by all the workers. */
+    uint64_t accepted;         /**< Connections accepted since the start. */
+    uint64_t deferred;         /**< Iterations in which the accept budget left connections in the listen queue. */
+    uint64_t rejected;         /**< Connections closed at once, since their descriptor could not be monitored by select. */
+    uint64_t timers_pending;   /**< Timers currently scheduled. */
+    uint64_t timers_expired;   /**< Timers expired since the start. */
+    uint64_t sessions_resumed; /**< Sessions resumed since the start. */
+    uint64_t sessions_expired; /**< Sessions expired since the start. */
+    uint64_t wal_bytes;        /**< Bytes appended to the write-ahead log. */
+    uint64_t wal_commits;      /**< Commits of the write-ahead log. */
+    uint64_t wal_snapshots;    /**< Snapshots of the rankings taken. */
+    uint64_t wal_fork_ns;      /**< Duration of the fork of the last snapshot. */
+    uint64_t snapshot_bytes;   /**< Size of the last snapshot. */
+    uint64_t snapshot_ns;      /**< Time taken to write the last snapshot. */
+    uint64_t memory_bytes[SHM_CLIENT_STATES]; /**< Memory used by the clients in each state. */
+    uint64_t frames_oversized; /**< Clients disconnected for announcing a frame larger than allowed. */
+    uint64_t memory_exceeded;  /**< Clients disconnected for exceeding their memory budget. */
+    uint64_t throttled[SHM_RATE_CLASSES]; /**< Requests of each class over the rate limit of their client. */
+    uint64_t loop_lag_ns;      /**< Smoothed duration of the iterations of the most loaded worker. */
+    uint64_t queue_depth;      /**< Largest queue depth of the workers. */
+    uint64_t cached_rankings;  /**< Rankings sent from the cache because of the overload. */
+    uint64_t admitted;         /**< Clients admitted from the waiting rooms. */
+    uint64_t overload_entered[SHM_OVERLOAD_STAGES]; /**< Times each stage of overload has been entered by a worker. */
+    uint32_t participants;     /**< Nicknames in use. */
+    uint32_t sessions_parked;  /**< Sessions waiting to be resumed. */
+    uint32_t total_workers;    /**< Number of ShmWorker following the statistics. */
+    uint32_t memory_clients[SHM_CLIENT_STATES]; /**< Clients in each state. */
+    uint32_t waiting;          /**< Clients in the waiting rooms. */
+    uint32_t overload_lag_us[SHM_OVERLOAD_STAGES]; /**< Lag above which each stage of overload is entered, 0 if not used. */
+    uint32_t overload_queue[SHM_OVERLOAD_STAGES];  /**< Queue depth above which each stage is entered, 0 if not used. */
+    uint16_t total_quizzes;    /**< Number of leaderboards following the workers. */
+    uint8_t wal_enabled;       /**< The rankings are logged, so the wal_* fields are meaningful. */
+    uint8_t resumption;        /**< The sessions of the dropped players are kept, so the session fields are meaningful. */
+    uint8_t overload_stage;    /**< Stage of overload of the most overloaded worker. */
+    char backend[16];          /**< Name of the I/O backend of the workers. */
+} ShmStats;
+
+/**
+ * @brief Statistics of a worker
+ */
+typedef struct ShmWorker
+{
+    uint32_t clients;    /**< Clients connected to the worker. */
+    uint32_t reserved;   /**< Padding, always 0. */
+    uint64_t syscalls;   /**< System calls issued to wait, accept, receive and send. */
+    uint64_t frames_in;  /**< Frames received from the clients. */
+    uint64_t frames_out; /**< Frames sent to the clients. */
+} ShmWorker;
+
+/**
+ * @brief Fixed part of the leaderboard of a quiz
+ */
+typedef struct ShmQuiz
+{
+    uint32_t version;       /**< Version of the ranking, see Quiz. */
+    uint32_t total_players; /**< Players in the ranking. */
+    uint32_t completed;     /**< Players in the ranking who have completed the quiz. */
+    uint32_t shown;         /**< Players following the name, the first of the ranking. */
+    uint16_t name_length;   /**< Length of the name of the quiz following this structure. */
+} ShmQuiz;
+
+#endif // SHM_H
@@ -0,0 +1,50 @@
+#ifndef WAL_H
+#define WAL_H
+
+#include <stdint.h>
+
+/**
+ * @brief Binary format of the write-ahead log of the rankings
+ *
+ * A log file starts with a header made of the magic string WAL_MAGIC followed by
+ * the format version and the generation of the log on uint16_t, the generation being incremented
+ * modulo 2^16 each time the records covered by a snapshot are dropped.
+ * The header is followed by a sequence of records, one for each change applied to a ranking:
+ * (kind)(quiz number)(score)(nickname length)(nickname)(checksum)
+ * where kind is a uint8_t, the quiz number, the score and the nickname length are uint16_t and the checksum
+ * is the 32-bit FNV-1a hash of the preceding bytes of the record, so that a record torn by a crash is detected.
+ * As in the rest of the protocol, all numeric values are stored in network byte order.
+ *
+ * A snapshot file starts with a header made of the magic string SNAPSHOT_MAGIC followed by the format version
+ * and the generation of the log on uint16_t, the offset of the log covered by the snapshot on a uint64_t
+ * and the number of quizzes on a uint16_t. For each quiz follow the number of players in its ranking and,
+ * in order of ranking, the entry of each of them:
+ * (nickname length)(nickname)(score)(current question << 1 | completed)
+ * where the numbers are varints. The snapshot ends with the 32-bit FNV-1a hash of all the preceding bytes.
+ */
+
+#define WAL_MAGIC "TQWL"
+#define WAL_MAGIC_SIZE 4
+#define WAL_VERSION 1
+#define WAL_FILE_HEADER_SIZE (WAL_MAGIC_SIZE + 2 * sizeof(uint16_t))
+#define WAL_RECORD_HEADER_SIZE (sizeof(uint8_t) + 3 * sizeof(uint16_t))
+#define WAL_CHECKSUM_SIZE sizeof(uint32_t)
+#define WAL_CHECKSUM_SEED 2166136261u
+
+#define SNAPSHOT_MAGIC "TQSN"
+#define SNAPSHOT_MAGIC_SIZE 4
+#define SNAPSHOT_VERSION 1
+#define SNAPSHOT_HEADER_SIZE (SNAPSHOT_MAGIC_SIZE + 3 * sizeof(uint16_t) + sizeof(uint64_t))
+
+/**
+ * @brief Kind of change stored in a log record
+ */
+typedef enum WalRecordKind
+{
+    WAL_JOIN,     /**< The player has started the quiz, with a score of zero. */
+    WAL_SCORE,    /**< The score of the player has changed to the one of the record. */
+    WAL_COMPLETE, /**< The player has completed the quiz. */
+    WAL_LEAVE     /**< The player has left the ranking of the quiz. */
+} WalRecordKind;
+
+#endif // WAL_H
@@ -0,0 +1,227 @@
+#include <getopt.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../common/common.h"
+#include "../common/flight.h"
+#include "../common/params.h"
+#include "../server/utils/utils.h"
+
+// Names of the client states, as recorded in the STATE and DISCONNECT events
+static const char *state_names[] = {
+    [LOGIN] = "LOGIN",
+    [LOGGED_IN] = "LOGGED_IN",
+    [SELECTING_QUIZ] = "SELECTING_QUIZ",
+    [PLAYING] = "PLAYING",
+    [SPECTATING] = "SPECTATING"};
+
+// Names of the error codes, as recorded in the ERROR events
+static const char *error_names[] = {
+    [FLIGHT_ERROR_RECEIVE] = "receive",
+    [FLIGHT_ERROR_ACCEPT] = "accept",
+    [FLIGHT_ERROR_WAIT] = "wait",
+    [FLIGHT_ERROR_QUIZ_FILE] = "quiz-file",
+    [FLIGHT_ERROR_FRAME_SIZE] = "frame-size",
+    [FLIGHT_ERROR_MEMORY] = "memory-budget"};
+
+/**
+ * @brief Prints the command line options accepted by the decoder
+ *
+ * @param program_name name of the executable
+ */
+void print_usage(const char *program_name)
+{
+    printf("Usage: %s [-n last_events] [dump_file]\n", program_name);
+    printf("  -n last_events  print only the most recent events\n");
+    printf("  dump_file       flight recorder dump to decode (default %s)\n", FLIGHT_DUMP_PATH);
+}
+
+/**
+ * @brief Returns the name of a client state recorded in an event
+ */
+const char *state_name(unsigned int state)
+{
+    if (state < sizeof(state_names) / sizeof(state_names[0]) && state_names[state])
+        return state_names[state];
+    return "UNKNOWN";
+}
+
+/**
+ * @brief Returns the name of an error code recorded in an event
+ */
+const char *error_name(unsigned int code)
+{
+    if (code < sizeof(error_names) / sizeof(error_names[0]) && error_names[code])
+        return error_names[code];
+    return "unknown";
+}
+
+/**
+ * @brief Prints the description of an event
+ *
+ * @param event pointer to the event to print
+ * @param ns_per_tick conversion factor from recorder ticks to nanoseconds
+ */
+void print_event(const FlightEvent *event, double ns_per_tick)
+{
+    switch (event->kind)
+    {
+    case FLIGHT_FRAME_IN:
+        printf("frame-in    conn %-6u %-18s %llu bytes (fd %u)\n", event->conn, message_type_name(event->type),
+               (unsigned long long)event->b, event->a);
+        break;
+    case FLIGHT_FRAME_OUT:
+        printf("frame-out   fd %-8u %-18s %llu bytes\n", event->conn, message_type_name(event->type),
+               (unsigned long long)event->b);
+        break;
+    case FLIGHT_CONNECT:
+        printf("connect     conn %-6u fd %u\n", event->conn, event->a);
+        break;
+    case FLIGHT_DISCONNECT:
+        printf("disconnect  conn %-6u fd %u in state %s\n", event->conn, event->a, state_name(event->type));
+        break;
+    case FLIGHT_STATE:
+        printf("state       conn %-6u %s -> %s\n", event->conn, state_name(event->a), state_name(event->type));
+        break;
+    case FLIGHT_LOOP:
+        printf("loop        %u ready, busy %.1f us\n", event->a, event->b * ns_per_tick / 1000.0);
+        break;
+    case FLIGHT_ERROR:
+        printf("error       %s (errno %u: %s)\n", error_name(event->type), event->a, event->a ? strerror(event->a) : "none");
+        break;
+    case FLIGHT_EXIT:
+        printf("exit        status %u\n", event->a);
+        break;
+    case FLIGHT_SIGNAL:
+        printf("signal      %u (%s)\n", event->a, strsignal(event->a));
+        break;
+    case FLIGHT_TIMEOUT:
+        printf("timeout     conn %-6u fd %u %s in state %s\n", event->conn, event->a,
+               event->b ? "question deadline" : "inactivity", state_name(event->type));
+        break;
+    default:
+        printf("unknown     kind %u\n", event->kind);
+        break;
+    }
+}
+
+/**
+ * @brief Event read from a dump, together with the ring of the thread that recorded it
+ */
+typedef struct DumpedEvent
+{
+    FlightEvent event; /**< Recorded event. */
+    uint32_t ring;     /**< Index of the ring of the event in the dump. */
+} DumpedEvent;
+
+/**
+ * @brief Orders the events of all the rings by timestamp, keeping the order of each ring for equal timestamps
+ */
+int compare_events(const void *first, const void *second)
+{
+    const DumpedEvent *a = first, *b = second;
+    if (a->event.timestamp != b->event.timestamp)
+        return a->event.timestamp < b->event.timestamp ? -1 : 1;
+    if (a->ring != b->ring)
+        return a->ring < b->ring ? -1 : 1;
+    return a->event.sequence < b->event.sequence ? -1 : a->event.sequence > b->event.sequence;
+}
+
+int main(int argc, char **argv)
+{
+    FlightDumpHeader header;
+    const char *path = FLIGHT_DUMP_PATH;
+    unsigned long long last_events = 0;
+    int option;
+
+    while ((option = getopt(argc, argv, "n:h")) != -1)
+    {
+        switch (option)
+        {
+        case 'n':
+            last_events = strtoull(optarg, NULL, 10);
+            break;
+        default:
+            print_usage(argv[0]);
+            exit(option == 'h' ? EXIT_SUCCESS : EXIT_FAILURE);
+        }
+    }
+    if (optind < argc)
+        path = argv[optind];
+
+    FILE *file = fopen(path, "rb");
+    if (!file)
+    {
+        perror("Error opening the dump file");
+        exit(EXIT_FAILURE);
+    }
+    if (fread(&header, sizeof(header), 1, file) != 1 || memcmp(header.magic, FLIGHT_MAGIC, FLIGHT_MAGIC_SIZE) != 0)
+    {
+        printf("%s is not a flight recorder dump\n", path);
+        exit(EXIT_FAILURE);
+    }
+    // Dumps are written in the byte order of the producer, so they can only be decoded on a compatible machine
+    if (header.byte_order != FLIGHT_BYTE_ORDER || header.version != FLIGHT_VERSION ||
+        header.event_size != sizeof(FlightEvent))
+    {
+        printf("Unsupported dump: version %u, event size %u, produced on a machine with a different byte order: %s\n",
+               header.version, header.event_size, header.byte_order != FLIGHT_BYTE_ORDER ? "yes" : "no");
+        exit(EXIT_FAILURE);
+    }
+
+    // Load the rings one after the other, remembering the ring of each event and dropping the overwritten ones
+    DumpedEvent *events = malloc((header.dumped_events ? header.dumped_events : 1) * sizeof(DumpedEvent));
+    handle_malloc_error(events, "Memory allocation error for the events");
+    size_t loaded = 0, overwritten = 0;
+    for (uint32_t ring = 0; ring < header.total_rings; ring++)
+    {
+        FlightRingHeader ring_header;
+        if (fread(&ring_header, sizeof(ring_header), 1, file) != 1)
+            break;
+        uint32_t expected_sequence = (uint32_t)(ring_header.total_events - ring_header.dumped_events);
+        for (uint64_t i = 0; i < ring_header.dumped_events && loaded < header.dumped_events; i++, expected_sequence++)
+        {
+            if (fread(&events[loaded].event, sizeof(FlightEvent), 1, file) != 1)
+                break;
+            // A slot whose sequence does not match has been overwritten while the dump was being written
+            if (events[loaded].event.sequence != expected_sequence)
+            {
+                overwritten++;
+                continue;
+            }
+            events[loaded++].ring = ring;
+        }
+    }
+    fclose(file);
+    if (loaded + overwritten < header.dumped_events)
+        printf("Warning: the dump is truncated, %zu of %llu events available\n", loaded + overwritten,
+               (unsigned long long)header.dumped_events);
+    qsort(events, loaded, sizeof(DumpedEvent), compare_events);
+
+    // The two reference points of the header give the rate of the recorder clock
+    double ns_per_tick = 1.0;
+    if (header.dump_ticks > header.start_ticks)
+        ns_per_tick = (double)(header.dump_ns - header.start_ns) / (header.dump_ticks - header.start_ticks);
+
+    printf("Flight recorder dump %s\n", path);
+    printf("- %llu events recorded by %u threads, %zu in the dump (capacity %u per thread)\n",
+           (unsigned long long)header.total_events, header.total_rings, loaded, header.capacity);
+    if (overwritten)
+        printf("- %zu events overwritten during the dump\n", overwritten);
+    printf("- dumped %.6f s after the start, clock %.3f ns/tick\n\n",
+           (header.dump_ns - header.start_ns) / 1e9, ns_per_tick);
+
+    size_t first = last_events && last_events < loaded ? loaded - last_events : 0;
+    for (size_t i = first; i < loaded; i++)
+    {
+        const FlightEvent *event = &events[i].event;
+        // Times are shown relative to the dump, so the last events are the ones closest to 0
+        double offset_ms = ((double)event->timestamp - (double)header.dump_ticks) * ns_per_tick / 1e6;
+        printf("%12.3f ms  t%-3u #%-8u ", offset_ms, events[i].ring, event->sequence);
+        print_event(event, ns_per_tick);
+    }
+
+    free(events);
+    return 0;
+}
@@ -0,0 +1,495 @@
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "../common/common.h"
+#include "../common/params.h"
+
+// Maximum time without any frame from the server before giving up
+#define LOAD_TIMEOUT_MS 5000
+// Default maximum number of connections waiting for the first frame of the server
+#define LOAD_CONNECT_WINDOW 8
+// Text of the MSG_INFO sent by the server when a quiz has been completed
+#define LOAD_COMPLETED_INFO "You completed the quiz"
+
+/**
+ * @brief State of a virtual player driven by the load generator
+ */
+typedef struct LoadConnection
+{
+    int fd;                /**< Socket connected to the server, -1 between two sessions */
+    unsigned int id;       /**< Index of the player */
+    unsigned int session;  /**< Number of the current session, each one plays a single quiz */
+    bool connecting;       /**< The first frame of the server has not been received yet */
+    bool completed;        /**< The quiz of the current session has been completed */
+    bool spectator;        /**< The connection watches the rankings of all the quizzes instead of playing */
+    uint64_t request_ns;   /**< Time at which the last request has been sent, 0 once answered */
+    char *input;           /**< Data received and not yet parsed */
+    size_t input_length;   /**< Number of bytes in the input buffer */
+    size_t input_capacity; /**< Allocated size of the input buffer */
+} LoadConnection;
+
+/**
+ * @brief State of the whole run: the players, the connections to open and the statistics
+ */
+typedef struct LoadRun
+{
+    LoadConnection *connections;    /**< Array of the players followed by the spectators */
+    unsigned int total_players;     /**< Number of players */
+    unsigned int total_spectators;  /**< Number of spectators, connected for the whole run */
+    unsigned int total_connections; /**< Number of players and spectators */
+    unsigned int total_sessions;    /**< Sessions played by each player */
+    uint8_t protocol;               /**< Version of the protocol requested by the players */
+    int port;                       /**< Port of the server */
+    unsigned int connect_window;    /**< Maximum number of connections waiting for the first frame of the server */
+    unsigned int *waiting;          /**< Circular queue of the players waiting to open their next connection */
+    unsigned int waiting_head;      /**< Position of the next player to connect */
+    unsigned int waiting_count;     /**< Number of players in the queue */
+    unsigned int connecting;        /**< Connections waiting for the first frame of the server */
+    unsigned int finished;          /**< Players that have played all their sessions */
+    uint64_t requests;              /**< Frames sent to the server */
+    uint64_t responses;             /**< Frames received from the server */
+    uint64_t sessions;              /**< Sessions completed, from the connection to the disconnection */
+    uint64_t updates;               /**< Rankings pushed to the spectators */
+    uint64_t rankings;              /**< Rankings received by the players at the end of their sessions */
+    uint64_t ranking_bytes;         /**< Total size of the payloads of the rankings received */
+    uint64_t *latencies;            /**< Time between each request and the first frame of its response */
+    size_t latency_count;           /**< Number of measured latencies */
+    size_t latency_capacity;        /**< Allocated size of the latencies array */
+} LoadRun;
+
+/**
+ * @brief Prints the command line options accepted by the load generator
+ *
+ * @param program_name name of the executable
+ */
+void print_usage(const char *program_name)
+{
+    printf("Usage: %s [-c connections] [-s sessions] [-S spectators] [-w window] [-P protocol] [-p port]\n",
+           program_name);
+    printf("  -c connections  number of concurrent players (default 64)\n");
+    printf("  -s sessions     sessions played by each player, each on a new connection (default 4)\n");
+    printf("  -S spectators   connections watching the rankings of all the quizzes during the run (default 0)\n");
+    printf("  -w window       connections opened at the same time, as many as the players for a burst (default %d)\n",
+           LOAD_CONNECT_WINDOW);
+    printf("  -P protocol     version of the protocol requested by the players (default %d, latest %d)\n", PROTOCOL_V1,
+           PROTOCOL_LATEST);
+    printf("  -p port         port of the server (default %d)\n", SERVER_PORT);
+}
+
+/**
+ * @brief Starts a connection to the server, with Nagle's algorithm disabled like an interactive client
+ *
+ * The handshake completes in the background, so that the other players are not stalled:
+ * the connection is established when the server sends its first frame.
+ *
+ * @param port port on which the server is listening
+ * @return file descriptor of the socket, or -1 in case of error
+ */
+int connect_to_server(int port)
+{
+    struct sockaddr_in server_address;
+    int opt = 1;
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (fd < 0)
+        return -1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
+    server_address.sin_family = AF_INET;
+    server_address.sin_port = htons(port);
+    inet_pton(AF_INET, SERVER_IP, &server_address.sin_addr);
+    if (connect(fd, (struct sockaddr *)&server_address, sizeof(server_address)) < 0 && errno != EINPROGRESS)
+    {
+        close(fd);
+        return -1;
+    }
+    // The requests are sent with blocking calls once the connection is established
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+    return fd;
+}
+
+/**
+ * @brief Opens the connections of the waiting players, without exceeding the connection window
+ */
+void open_connections(LoadRun *run)
+{
+    while (run->waiting_count > 0 && run->connecting < run->connect_window)
+    {
+        LoadConnection *connection = &run->connections[run->waiting[run->waiting_head]];
+        run->waiting_head = (run->waiting_head + 1) % run->total_connections;
+        run->waiting_count--;
+        if ((connection->fd = connect_to_server(run->port)) == -1)
+        {
+            perror("Error connecting to the server");
+            exit(EXIT_FAILURE);
+        }
+        connection->connecting = true;
+        run->connecting++;
+    }
+}
+
+/**
+ * @brief Queues a player for the opening of its next connection
+ */
+void queue_connection(LoadRun *run, LoadConnection *connection)
+{
+    run->waiting[(run->waiting_head + run->waiting_count) % run->total_connections] = connection->id;
+    run->waiting_count++;
+}
+
+/**
+ * @brief Sends a request of a player and starts measuring its latency
+ */
+void send_request(LoadRun *run, LoadConnection *connection, MessageType type, char *payload, size_t payload_length)
+{
+    if (send_msg(connection->fd, type, payload, payload_length) == -1)
+    {
+        perror("Error sending a request");
+        exit(EXIT_FAILURE);
+    }
+    connection->request_ns = get_time_ns();
+    run->requests++;
+}
+
+/**
+ * @brief Records the latency of the request answered by a frame, if it is the first frame of the response
+ */
+void record_response(LoadRun *run, LoadConnection *connection)
+{
+    run->responses++;
+    if (connection->connecting)
+    {
+        connection->connecting = false;
+        run->connecting--;
+    }
+    if (!connection->request_ns)
+        return;
+    if (run->latency_count == run->latency_capacity)
+    {
+        run->latency_capacity = run->latency_capacity ? run->latency_capacity * 2 : 4096;
+        uint64_t *new_latencies = realloc(run->latencies, run->latency_capacity * sizeof(uint64_t));
+        handle_malloc_error(new_latencies, "Memory allocation error for the latencies");
+        run->latencies = new_latencies;
+    }
+    run->latencies[run->latency_count++] = get_time_ns() - connection->request_ns;
+    connection->request_ns = 0;
+}
+
+/**
+ * @brief Closes the connection of a finished session, and queues the next session of the player if any
+ */
+void end_session(LoadRun *run, LoadConnection *connection)
+{
+    close(connection->fd);
+    connection->fd = -1;
+    connection->input_length = 0;
+    connection->completed = false;
+    connection->request_ns = 0;
+    run->sessions++;
+    if (++connection->session == run->total_sessions)
+        run->finished++;
+    else
+        queue_connection(run, connection);
+}
+
+/**
+ * @brief Reacts to a frame received by a spectator, which negotiates FEATURE_SPECTATE, subscribes to every quiz
+ * and counts the rankings pushed
+ */
+void handle_spectator_frame(LoadRun *run, LoadConnection *connection, MessageType type)
+{
+    uint16_t all_quizzes = 0;
+    Capabilities capabilities;
+    char hello[HELLO_SIZE];
+    int res = 0;
+
+    if (connection->connecting)
+    {
+        connection->connecting = false;
+        run->connecting--;
+    }
+    if (type == MSG_REQ_NICKNAME)
+    {
+        init_capabilities(&capabilities, UINT32_MAX);
+        capabilities.version = PROTOCOL_V1;
+        capabilities.features = FEATURE_SPECTATE;
+        encode_hello(hello, &capabilities);
+        res = send_msg(connection->fd, MSG_HELLO, hello, sizeof(hello));
+    }
+    else if (type == MSG_HELLO)
+        res = send_msg(connection->fd, MSG_SPECTATE, (char *)&all_quizzes, sizeof(all_quizzes));
+    else if (type == MSG_RANKING_UPDATE)
+        run->updates++;
+    if (res == -1)
+    {
+        perror("Error sending a request");
+        exit(EXIT_FAILURE);
+    }
+}
+
+/**
+ * @brief Reacts to a frame received by a player, as a player answering immediately would do
+ *
+ * Each session sets a nickname, plays one quiz answering every question, requests the ranking and disconnects.
+ */
+void handle_frame(LoadRun *run, LoadConnection *connection, MessageType type, char *payload, uint32_t payload_length)
+{
+    char nickname[DEFAULT_PAYLOAD_SIZE];
+    uint16_t net_total_quizzes, net_selected_quiz;
+    uint64_t total_quizzes;
+
+    if (connection->spectator)
+    {
+        handle_spectator_frame(run, connection, type);
+        return;
+    }
+    record_response(run, connection);
+    switch (type)
+    {
+    case MSG_REQ_NICKNAME:
+        if (run->protocol > PROTOCOL_V1)
+        {
+            // Announce the capabilities of the player with the version requested, then log in once negotiated
+            Capabilities capabilities;
+            char hello[HELLO_SIZE];
+            init_capabilities(&capabilities, UINT32_MAX);
+            capabilities.version = run->protocol;
+            encode_hello(hello, &capabilities);
+            send_request(run, connection, MSG_HELLO, hello, sizeof(hello));
+            break;
+        }
+        // fall through
+    case MSG_HELLO:
+        snprintf(nickname, sizeof(nickname), "load%us%u", connection->id, connection->session);
+        send_request(run, connection, MSG_SET_NICKNAME, nickname, strlen(nickname));
+        break;
+    case MSG_OK_NICKNAME:
+        send_request(run, connection, MSG_REQ_QUIZ_LIST, "", 0);
+        break;
+    case MSG_RES_QUIZ_LIST:
+        if (connection->completed)
+        {
+            send_request(run, connection, MSG_REQ_RANKING, "", 0);
+            break;
+        }
+        if (run->protocol > PROTOCOL_V1)
+        {
+            if (!decode_varint(payload, payload + payload_length, &total_quizzes))
+                break;
+        }
+        else
+        {
+            if (payload_length < sizeof(net_total_quizzes))
+                break;
+            memcpy(&net_total_quizzes, payload, sizeof(net_total_quizzes));
+            total_quizzes = ntohs(net_total_quizzes);
+        }
+        if (!total_quizzes)
+            break;
+        // Spread the players among the quizzes
+        net_selected_quiz = htons((connection->id + connection->session) % total_quizzes + 1);
+        send_request(run, connection, MSG_QUIZ_SELECT, (char *)&net_selected_quiz, sizeof(net_selected_quiz));
+        break;
+    case MSG_QUIZ_QUESTION:
+        send_request(run, connection, MSG_QUIZ_ANSWER, "load", strlen("load"));
+        break;
+    case MSG_INFO:
+        if (payload_length == strlen(LOAD_COMPLETED_INFO) && memcmp(payload, LOAD_COMPLETED_INFO, payload_length) == 0)
+            connection->completed = true;
+        break;
+    case MSG_RES_RANKING:
+        run->rankings++;
+        run->ranking_bytes += payload_length;
+        // The disconnection has no response
+        send_request(run, connection, MSG_DISCONNECT, "", 0);
+        end_session(run, connection);
+        break;
+    default:
+        break;
+    }
+}
+
+/**
+ * @brief Receives the data available on the connection of a player and handles every complete frame
+ */
+void receive_frames(LoadRun *run, LoadConnection *connection)
+{
+    if (connection->input_capacity - connection->input_length < DEFAULT_PAYLOAD_SIZE)
+    {
+        connection->input_capacity = connection->input_capacity ? connection->input_capacity * 2 : 4096;
+        char *new_input = realloc(connection->input, connection->input_capacity);
+        handle_malloc_error(new_input, "Memory allocation error for the input of a player");
+        connection->input = new_input;
+    }
+    ssize_t received = recv(connection->fd, connection->input + connection->input_length,
+                            connection->input_capacity - connection->input_length, 0);
+    if (received <= 0)
+    {
+        printf("The server closed the connection of player %u\n", connection->id);
+        exit(EXIT_FAILURE);
+    }
+    connection->input_length += received;
+
+    size_t offset = 0;
+    unsigned int session = connection->session;
+    while (connection->session == session && connection->input_length - offset >= FRAME_HEADER_SIZE)
+    {
+        uint32_t net_payload_length;
+        memcpy(&net_payload_length, connection->input + offset + sizeof(uint8_t), sizeof(net_payload_length));
+        uint32_t payload_length = ntohl(net_payload_length);
+        if (connection->input_length - offset - FRAME_HEADER_SIZE < payload_length)
+            break;
+        MessageType type = (uint8_t)connection->input[offset];
+        char *payload = connection->input + offset + FRAME_HEADER_SIZE;
+        offset += FRAME_HEADER_SIZE + payload_length;
+        handle_frame(run, connection, type, payload, payload_length);
+    }
+    // The input of a finished session has already been discarded
+    if (connection->session != session)
+        return;
+    connection->input_length -= offset;
+    memmove(connection->input, connection->input + offset, connection->input_length);
+}
+
+/**
+ * @brief Compares two latencies, used to sort them
+ */
+int compare_latencies(const void *a, const void *b)
+{
+    uint64_t first = *(const uint64_t *)a, second = *(const uint64_t *)b;
+    return first < second ? -1 : first > second;
+}
+
+/**
+ * @brief Returns a percentile of the sorted latencies in microseconds
+ */
+double latency_percentile(LoadRun *run, double percentile)
+{
+    if (run->latency_count == 0)
+        return 0;
+    size_t index = (size_t)(percentile * (run->latency_count - 1));
+    return run->latencies[index] / 1000.0;
+}
+
+int main(int argc, char **argv)
+{
+    int option;
+    LoadRun run;
+
+    memset(&run, 0, sizeof(run));
+    run.total_players = 64;
+    run.total_sessions = 4;
+    run.port = SERVER_PORT;
+    run.connect_window = LOAD_CONNECT_WINDOW;
+    run.protocol = PROTOCOL_V1;
+    while ((option = getopt(argc, argv, "c:s:S:w:P:p:h")) != -1)
+    {
+        switch (option)
+        {
+        case 'c':
+            run.total_players = strtoul(optarg, NULL, 10);
+            break;
+        case 's':
+            run.total_sessions = strtoul(optarg, NULL, 10);
+            break;
+        case 'S':
+            run.total_spectators = strtoul(optarg, NULL, 10);
+            break;
+        case 'w':
+            run.connect_window = strtoul(optarg, NULL, 10);
+            break;
+        case 'P':
+            run.protocol = strtoul(optarg, NULL, 10);
+            break;
+        case 'p':
+            run.port = atoi(optarg);
+            break;
+        default:
+            print_usage(argv[0]);
+            exit(option == 'h' ? EXIT_SUCCESS : EXIT_FAILURE);
+        }
+    }
+    if (optind != argc || run.total_players == 0 || run.total_sessions == 0 || run.connect_window == 0 ||
+        run.protocol < PROTOCOL_V1 || run.protocol > PROTOCOL_LATEST)
+    {
+        print_usage(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+    run.total_connections = run.total_players + run.total_spectators;
+    run.connections = calloc(run.total_connections, sizeof(LoadConnection));
+    run.waiting = malloc(run.total_connections * sizeof(unsigned int));
+    struct pollfd *pollfds = malloc(run.total_connections * sizeof(struct pollfd));
+    handle_malloc_error(run.connections, "Memory allocation error for the players");
+    handle_malloc_error(run.waiting, "Memory allocation error for the players");
+    handle_malloc_error(pollfds, "Memory allocation error for the players");
+    // The spectators connect first, so that they watch the whole run
+    for (unsigned int i = run.total_connections; i-- > 0;)
+    {
+        run.connections[i].id = i;
+        run.connections[i].fd = -1;
+        run.connections[i].spectator = i >= run.total_players;
+        queue_connection(&run, &run.connections[i]);
+    }
+
+    uint64_t start_ns = get_time_ns();
+    while (run.finished < run.total_players)
+    {
+        open_connections(&run);
+        for (unsigned int i = 0; i < run.total_connections; i++)
+        {
+            pollfds[i].fd = run.connections[i].fd;
+            pollfds[i].events = POLLIN;
+            pollfds[i].revents = 0;
+        }
+        int ready = poll(pollfds, run.total_connections, LOAD_TIMEOUT_MS);
+        if (ready < 0 && errno == EINTR)
+            continue;
+        if (ready <= 0)
+        {
+            printf("The server did not respond within %d ms\n", LOAD_TIMEOUT_MS);
+            exit(EXIT_FAILURE);
+        }
+
+        for (unsigned int i = 0; i < run.total_connections; i++)
+        {
+            if (pollfds[i].revents & (POLLIN | POLLHUP | POLLERR))
+                receive_frames(&run, &run.connections[i]);
+        }
+    }
+    double elapsed_s = (get_time_ns() - start_ns) / 1e9;
+
+    qsort(run.latencies, run.latency_count, sizeof(uint64_t), compare_latencies);
+    printf("%u players, %lu sessions in %.3f s\n", run.total_players, (unsigned long)run.sessions, elapsed_s);
+    printf("%lu requests, %lu responses, %.0f requests/s\n", (unsigned long)run.requests,
+           (unsigned long)run.responses, run.requests / elapsed_s);
+    printf("latency p50 %.1f us, p99 %.1f us, max %.1f us\n", latency_percentile(&run, 0.5),
+           latency_percentile(&run, 0.99), latency_percentile(&run, 1.0));
+    if (run.rankings)
+        printf("%lu rankings received, %.1f bytes each\n", (unsigned long)run.rankings,
+               (double)run.ranking_bytes / run.rankings);
+    if (run.total_spectators)
+        printf("%lu rankings pushed to %u spectators\n", (unsigned long)run.updates, run.total_spectators);
+
+    for (unsigned int i = 0; i < run.total_connections; i++)
+    {
+        if (run.connections[i].spectator && run.connections[i].fd != -1)
+            close(run.connections[i].fd);
+        free(run.connections[i].input);
+    }
+    free(run.connections);
+    free(run.waiting);
+    free(pollfds);
+    free(run.latencies);
+    return 0;
+}
@@ -0,0 +1,434 @@
+#include <arpa/inet.h>
+#include <errno.h>
+#include <getopt.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+#include "../common/capture.h"
+#include "../common/common.h"
+#include "../common/params.h"
+
+// Time to wait for the outstanding frames once the whole capture has been replayed
+#define DRAIN_TIMEOUT_MS 2000
+
+/**
+ * @brief Record loaded from the capture file together with its payload
+ */
+typedef struct ReplayRecord
+{
+    CaptureRecord header; /**< Decoded header of the record */
+    char *payload;        /**< Payload of the frame, NULL if empty */
+} ReplayRecord;
+
+/**
+ * @brief State of a connection opened towards the server under test
+ */
+typedef struct ReplayConnection
+{
+    int fd;                          /**< Socket connected to the server, -1 if not connected */
+    size_t *expected;                /**< Indexes of the outbound records still to be received */
+    size_t expected_head;            /**< Position of the next outbound record to be matched */
+    size_t expected_count;           /**< Number of outbound records queued */
+    size_t expected_capacity;        /**< Capacity of the expected array */
+    uint64_t last_inbound_original;  /**< Capture timestamp of the last frame sent by the client */
+    uint64_t last_inbound_replay;    /**< Replay time at which the last frame has been sent */
+    bool closing;                    /**< The connection must be closed once all the expected frames arrive */
+} ReplayConnection;
+
+/**
+ * @brief Statistics collected during the replay
+ */
+typedef struct ReplayStats
+{
+    size_t sent_frames;            /**< Frames sent to the server */
+    size_t matched_frames;         /**< Outbound frames identical to the recorded ones */
+    size_t mismatched_frames;      /**< Outbound frames that differ from the recorded ones */
+    size_t unexpected_frames;      /**< Outbound frames that were not present in the capture */
+    size_t missing_frames;         /**< Recorded outbound frames that have never been received */
+    size_t pending_frames;         /**< Recorded outbound frames still awaited on open connections */
+    uint64_t original_latency_ns;  /**< Sum of the recorded response times */
+    uint64_t replay_latency_ns;    /**< Sum of the response times measured during the replay */
+    size_t latency_samples;        /**< Number of responses whose latency has been measured */
+} ReplayStats;
+
+/**
+ * @brief Reads exactly length bytes from the capture file
+ *
+ * @return 1 on success, 0 on end of file
+ */
+int read_exact(FILE *file, void *buffer, size_t length)
+{
+    return fread(buffer, 1, length, file) == length;
+}
+
+/**
+ * @brief Loads all the records of a capture file in memory
+ *
+ * @param path path of the capture file
+ * @param records pointer in which to store the array of loaded records
+ * @param max_conn_id pointer in which to store the highest connection id found
+ * @return number of records loaded
+ */
+size_t load_capture(const char *path, ReplayRecord **records, uint32_t *max_conn_id)
+{
+    char file_header[CAPTURE_FILE_HEADER_SIZE];
+    char header[CAPTURE_RECORD_HEADER_SIZE];
+    uint16_t net_version;
+    uint32_t net_high, net_low, net_conn_id, net_payload_length;
+    size_t count = 0, capacity = 1024;
+
+    FILE *file = fopen(path, "rb");
+    if (!file)
+    {
+        perror("Error opening the capture file");
+        exit(EXIT_FAILURE);
+    }
+    if (!read_exact(file, file_header, sizeof(file_header)) || memcmp(file_header, CAPTURE_MAGIC, CAPTURE_MAGIC_SIZE) != 0)
+    {
+        printf("The file %s is not a valid capture\n", path);
+        exit(EXIT_FAILURE);
+    }
+    memcpy(&net_version, file_header + CAPTURE_MAGIC_SIZE, sizeof(uint16_t));
+    if (ntohs(net_version) != CAPTURE_VERSION)
+    {
+        printf("Unsupported capture version %u\n", ntohs(net_version));
+        exit(EXIT_FAILURE);
+    }
+
+    *max_conn_id = 0;
+    *records = malloc(capacity * sizeof(ReplayRecord));
+    handle_malloc_error(*records, "Memory allocation error for the capture records");
+
+    while (read_exact(file, header, sizeof(header)))
+    {
+        if (count == capacity)
+        {
+            capacity *= 2;
+            ReplayRecord *new_records = realloc(*records, capacity * sizeof(ReplayRecord));
+            handle_malloc_error(new_records, "Memory allocation error for the capture records");
+            *records = new_records;
+        }
+        ReplayRecord *record = &(*records)[count];
+        char *pointer = header;
+
+        memcpy(&net_high, pointer, sizeof(uint32_t));
+        pointer += sizeof(uint32_t);
+        memcpy(&net_low, pointer, sizeof(uint32_t));
+        pointer += sizeof(uint32_t);
+        memcpy(&net_conn_id, pointer, sizeof(uint32_t));
+        pointer += sizeof(uint32_t);
+        record->header.kind = *pointer++;
+        record->header.type = *pointer++;
+        memcpy(&net_payload_length, pointer, sizeof(uint32_t));
+
+        record->header.timestamp_ns = ((uint64_t)ntohl(net_high) << 32) | ntohl(net_low);
+        record->header.conn_id = ntohl(net_conn_id);
+        record->header.payload_length = ntohl(net_payload_length);
+        record->payload = NULL;
+
+        if (record->header.payload_length > 0)
+        {
+            record->payload = malloc(record->header.payload_length);
+            handle_malloc_error(record->payload, "Memory allocation error for a capture payload");
+            if (!read_exact(file, record->payload, record->header.payload_length))
+            {
+                // The capture has been truncated while writing the last record
+                free(record->payload);
+                break;
+            }
+        }
+        if (record->header.conn_id > *max_conn_id)
+            *max_conn_id = record->header.conn_id;
+        count++;
+    }
+    fclose(file);
+    return count;
+}
+
+/**
+ * @brief Opens a connection to the server under test
+ *
+ * @param port port on which the server is listening
+ * @return file descriptor of the connected socket, or -1 in case of error
+ */
+int connect_to_server(int port)
+{
+    struct sockaddr_in server_address;
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0)
+        return -1;
+    server_address.sin_family = AF_INET;
+    server_address.sin_port = htons(port);
+    inet_pton(AF_INET, SERVER_IP, &server_address.sin_addr);
+    if (connect(fd, (struct sockaddr *)&server_address, sizeof(server_address)) < 0)
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/**
+ * @brief Queues a recorded outbound frame as expected on its connection
+ */
+void expect_frame(ReplayConnection *connection, size_t record_idx, ReplayStats *stats)
+{
+    if (connection->expected_count == connection->expected_capacity)
+    {
+        connection->expected_capacity = connection->expected_capacity ? connection->expected_capacity * 2 : 16;
+        size_t *new_expected = realloc(connection->expected, connection->expected_capacity * sizeof(size_t));
+        handle_malloc_error(new_expected, "Memory allocation error for the expected frames");
+        connection->expected = new_expected;
+    }
+    connection->expected[connection->expected_count++] = record_idx;
+    if (connection->fd != -1)
+        stats->pending_frames++;
+}
+
+/**
+ * @brief Compares a frame received from the server with the next recorded outbound frame of the connection
+ *
+ * Text messages are compared without the string terminator added by receive_msg.
+ */
+void match_frame(ReplayConnection *connection, Message *msg, ReplayRecord *records, uint64_t replay_now, ReplayStats *stats)
+{
+    if (connection->expected_head == connection->expected_count)
+    {
+        stats->unexpected_frames++;
+        return;
+    }
+    ReplayRecord *expected = &records[connection->expected[connection->expected_head++]];
+    stats->pending_frames--;
+
+    if (expected->header.type == msg->type && expected->header.payload_length == msg->payload_length &&
+        (msg->payload_length == 0 || memcmp(expected->payload, msg->payload, msg->payload_length) == 0))
+        stats->matched_frames++;
+    else
+    {
+        stats->mismatched_frames++;
+        printf("Mismatch on connection at capture time %.3f ms: expected type %u (%u bytes), received type %u (%u bytes)\n",
+               expected->header.timestamp_ns / 1e6, expected->header.type, expected->header.payload_length,
+               msg->type, msg->payload_length);
+    }
+
+    // Compare the time elapsed since the last request of the client in the capture and in the replay
+    if (expected->header.timestamp_ns >= connection->last_inbound_original && connection->last_inbound_replay)
+    {
+        stats->original_latency_ns += expected->header.timestamp_ns - connection->last_inbound_original;
+        stats->replay_latency_ns += replay_now - connection->last_inbound_replay;
+        stats->latency_samples++;
+    }
+}
+
+/**
+ * @brief Closes the connection if it has been closed in the capture and all of its frames have arrived
+ */
+void close_if_done(ReplayConnection *connection)
+{
+    if (connection->fd != -1 && connection->closing && connection->expected_head == connection->expected_count)
+    {
+        close(connection->fd);
+        connection->fd = -1;
+    }
+}
+
+/**
+ * @brief Closes a connection that has been dropped by the server, giving up on the frames still expected on it
+ */
+void drop_connection(ReplayConnection *connection, ReplayStats *stats)
+{
+    close(connection->fd);
+    connection->fd = -1;
+    stats->pending_frames -= connection->expected_count - connection->expected_head;
+}
+
+/**
+ * @brief Waits for frames from the server until the deadline, matching them against the capture
+ *
+ * @param deadline_ns monotonic time until which to wait, 0 to only consume the frames already available
+ * @param until_idle if true, returns as soon as no recorded outbound frame is awaited anymore
+ */
+void pump_connections(ReplayConnection *connections, uint32_t total_connections, ReplayRecord *records,
+                      uint64_t start_ns, uint64_t deadline_ns, bool until_idle, ReplayStats *stats)
+{
+    struct pollfd *pollfds = malloc(total_connections * sizeof(struct pollfd));
+    uint32_t *owners = malloc(total_connections * sizeof(uint32_t));
+    handle_malloc_error(pollfds, "Memory allocation error for the poll set");
+    handle_malloc_error(owners, "Memory allocation error for the poll set");
+
+    while (!until_idle || stats->pending_frames > 0)
+    {
+        nfds_t nfds = 0;
+        for (uint32_t i = 0; i < total_connections; i++)
+            if (connections[i].fd != -1)
+            {
+                pollfds[nfds].fd = connections[i].fd;
+                pollfds[nfds].events = POLLIN;
+                owners[nfds++] = i;
+            }
+
+        uint64_t now = get_time_ns();
+        int timeout = deadline_ns > now ? (int)((deadline_ns - now + 999999) / 1000000) : 0;
+        int ready = poll(pollfds, nfds, timeout);
+        if (ready < 0 && errno != EINTR)
+        {
+            perror("Poll failed");
+            exit(EXIT_FAILURE);
+        }
+        if (ready <= 0)
+            break;
+
+        for (nfds_t i = 0; i < nfds; i++)
+        {
+            if (!(pollfds[i].revents & (POLLIN | POLLHUP | POLLERR)))
+                continue;
+            ReplayConnection *connection = &connections[owners[i]];
+            Message msg;
+            if (receive_msg(connection->fd, &msg) <= 0)
+            {
+                drop_connection(connection, stats);
+                continue;
+            }
+            match_frame(connection, &msg, records, get_time_ns() - start_ns, stats);
+            free(msg.payload);
+            close_if_done(connection);
+        }
+    }
+    free(pollfds);
+    free(owners);
+}
+
+/**
+ * @brief Prints the command line options accepted by the replay tool
+ */
+void print_usage(const char *program_name)
+{
+    printf("Usage: %s [-p port] [-s speed] capture_file\n", program_name);
+    printf("  -p port   port of the server under test (default %d)\n", SERVER_PORT);
+    printf("  -s speed  replay speed factor, 1 for the original timing, 0 to replay as fast as possible\n");
+}
+
+int main(int argc, char **argv)
+{
+    int option, port = SERVER_PORT;
+    double speed = 1.0;
+    ReplayRecord *records;
+    uint32_t max_conn_id;
+    ReplayStats stats = {0};
+
+    while ((option = getopt(argc, argv, "p:s:h")) != -1)
+    {
+        switch (option)
+        {
+        case 'p':
+            port = atoi(optarg);
+            break;
+        case 's':
+            speed = atof(optarg);
+            break;
+        default:
+            print_usage(argv[0]);
+            exit(option == 'h' ? EXIT_SUCCESS : EXIT_FAILURE);
+        }
+    }
+    if (optind != argc - 1 || speed < 0)
+    {
+        print_usage(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+
+    size_t total_records = load_capture(argv[optind], &records, &max_conn_id);
+    uint32_t total_connections = total_records ? max_conn_id + 1 : 0;
+    ReplayConnection *connections = calloc(total_connections ? total_connections : 1, sizeof(ReplayConnection));
+    handle_malloc_error(connections, "Memory allocation error for the connections");
+    for (uint32_t i = 0; i < total_connections; i++)
+        connections[i].fd = -1;
+
+    printf("Replaying %zu records on %u connections\n", total_records, total_connections);
+
+    uint64_t start_ns = get_time_ns();
+    for (size_t r = 0; r < total_records; r++)
+    {
+        ReplayRecord *record = &records[r];
+        ReplayConnection *connection = &connections[record->header.conn_id];
+
+        // Outbound frames are only queued: they are matched when the server sends them
+        if (record->header.kind == CAPTURE_OUTBOUND)
+        {
+            expect_frame(connection, r, &stats);
+            continue;
+        }
+
+        // Respect the original timing of the client actions, scaled by the speed factor
+        uint64_t due_ns = start_ns + (speed > 0 ? (uint64_t)(record->header.timestamp_ns / speed) : 0);
+        pump_connections(connections, total_connections, records, start_ns, due_ns, false, &stats);
+
+        // Wait for the responses recorded before this action, so that the server observes the actions
+        // of the different connections in the same order as in the capture
+        pump_connections(connections, total_connections, records, start_ns, get_time_ns() + DRAIN_TIMEOUT_MS * 1000000ULL, true, &stats);
+
+        switch (record->header.kind)
+        {
+        case CAPTURE_CONNECT:
+            connection->fd = connect_to_server(port);
+            if (connection->fd == -1)
+            {
+                perror("Connection to the server failed");
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case CAPTURE_INBOUND:
+            if (connection->fd == -1)
+                break;
+            send_msg(connection->fd, record->header.type, record->payload, record->header.payload_length);
+            connection->last_inbound_original = record->header.timestamp_ns;
+            connection->last_inbound_replay = get_time_ns() - start_ns;
+            stats.sent_frames++;
+            break;
+        case CAPTURE_DISCONNECT:
+            connection->closing = true;
+            close_if_done(connection);
+            break;
+        default:
+            break;
+        }
+    }
+
+    // Wait for the frames still in flight
+    pump_connections(connections, total_connections, records, start_ns, get_time_ns() + DRAIN_TIMEOUT_MS * 1000000ULL, true, &stats);
+    uint64_t elapsed_ns = get_time_ns() - start_ns;
+
+    for (uint32_t i = 0; i < total_connections; i++)
+    {
+        stats.missing_frames += connections[i].expected_count - connections[i].expected_head;
+        if (connections[i].fd != -1)
+            close(connections[i].fd);
+        free(connections[i].expected);
+    }
+
+    printf("\nReplay completed in %.3f s\n", elapsed_ns / 1e9);
+    printf("Frames sent:        %zu\n", stats.sent_frames);
+    printf("Frames matched:     %zu\n", stats.matched_frames);
+    printf("Frames mismatched:  %zu\n", stats.mismatched_frames);
+    printf("Frames unexpected:  %zu\n", stats.unexpected_frames);
+    printf("Frames missing:     %zu\n", stats.missing_frames);
+    if (stats.latency_samples)
+        printf("Mean response time: %.3f ms recorded by the server, %.3f ms observed by the replay\n",
+               stats.original_latency_ns / 1e6 / stats.latency_samples,
+               stats.replay_latency_ns / 1e6 / stats.latency_samples);
+
+    for (size_t r = 0; r < total_records; r++)
+        free(records[r].payload);
+    free(records);
+    free(connections);
+
+    return stats.mismatched_frames || stats.unexpected_frames || stats.missing_frames ? EXIT_FAILURE : EXIT_SUCCESS;
+}
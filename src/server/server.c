@@ -3,117 +3,519 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/resource.h>
 #include <sys/select.h>
 #include <sys/socket.h>
 #include <unistd.h>
 #include <signal.h>
+#include <getopt.h>
+#include <poll.h>
+#include <pthread.h>
 #include "utils/utils.h"
 #include "../common/params.h"
 
-int main()
+// Set by the termination signals to stop the main loop and shut down the server cleanly
+static volatile sig_atomic_t terminate_requested = 0;
+
+/**
+ * @brief Handles SIGINT and SIGTERM by requesting the termination of the main loop
+ *
+ * @param signum number of the received signal
+ */
+void handle_termination_signal(int signum)
 {
-    int activity;
-    Context context;
-    struct sockaddr_in server_address;
-    int opt = 1;
+    terminate_requested = 1;
+}
 
-    load_quizzes_from_directory("./quizzes", &context.quizzesInfo);
-    init_clients_info(&context.clientsInfo);
-    signal(SIGPIPE, SIG_IGN);
+// Set by SIGUSR2 to hand the connections over to a new instance of the server binary
+static volatile sig_atomic_t upgrade_requested = 0;
 
-    FD_ZERO(&context.masterfds);
-    FD_ZERO(&context.readfds);
+/**
+ * @brief Handles SIGUSR2 by requesting an upgrade from the main loop
+ *
+ * @param signum number of the received signal
+ */
+void handle_upgrade_signal(int signum)
+{
+    upgrade_requested = 1;
+}
+
+/**
+ * @brief Prints the command line options accepted by the server
+ *
+ * @param program_name name of the executable
+ */
+void print_usage(const char *program_name)
+{
+    printf("Usage: %s [-r capture_file] [-f flight_dump_file] [-W wal_file] [-m shm_name] [-w workers] [-b backend] [-l backlog] [-L seconds]"
+           " [-i seconds] [-q seconds] [-R seconds] [-g quiz_number] [-T seconds] [-u updates]"
+           " [-M kilobytes] [-t class=rate[/burst]] [-O stage=lag_us[/queue_depth]]\n", program_name);
+    printf("  -r capture_file      record every inbound and outbound frame in capture_file\n");
+    printf("  -f flight_dump_file  file in which the flight recorder is dumped (default %s)\n", FLIGHT_DUMP_PATH);
+    printf("  -W wal_file          log the changes to the rankings in wal_file and rebuild them from it on startup\n");
+    printf("  -m shm_name          publish the statistics and the leaderboards in a shared-memory region read by trivia-top\n");
+    printf("  -w workers           number of worker threads (default: number of online CPUs)\n");
+    printf("  -b backend           I/O backend of the workers: io_uring (default if supported), epoll or select\n");
+    printf("  -l backlog           length of the listen queue of each worker (default %d)\n", LISTEN_BACKLOG);
+    printf("  -L seconds           time allowed to log in, 0 for no limit (default %d)\n", LOGIN_TIMEOUT_MS / 1000);
+    printf("  -i seconds           inactivity after which a client is disconnected, 0 for no limit (default %d)\n",
+           IDLE_TIMEOUT_MS / 1000);
+    printf("  -q seconds           time allowed to answer each question, 0 for no limit (default %d)\n",
+           QUESTION_TIMEOUT_MS / 1000);
+    printf("  -R seconds           time for which a dropped player can resume its session, 0 to disable (default %d)\n",
+           SESSION_GRACE_MS / 1000);
+    printf("  -g quiz_number       play the quiz in live rounds broadcast to all its players (repeatable)\n");
+    printf("  -T seconds           duration of the live rounds (default %d)\n", LIVE_ROUND_MS / 1000);
+    printf("  -u updates           rankings of each quiz pushed to the spectators per second, 1 to 1000 (default %d)\n",
+           SPECTATOR_UPDATES_PER_S);
+    printf("  -M kilobytes         memory each client can use before being disconnected, 0 for no limit (default %d)\n",
+           CONNECTION_MEMORY_BUDGET / 1024);
+    printf("  -t class=rate[/burst] requests of a class each client can send per second, 0 for no limit (repeatable);\n"
+           "                       the classes are answers (default %d/%d), rankings (%d/%d), quiz-lists (%d/%d)\n"
+           "                       and nicknames (%d/%d)\n", RATE_ANSWERS_PER_S, RATE_ANSWERS_BURST, RATE_RANKINGS_PER_S,
+           RATE_RANKINGS_BURST, RATE_QUIZ_LISTS_PER_S, RATE_QUIZ_LISTS_BURST, RATE_NICKNAMES_PER_S, RATE_NICKNAMES_BURST);
+    printf("  -O stage=lag_us[/queue_depth] loop lag and queue depth above which a worker sheds load, 0 if not used\n"
+           "                       (repeatable); the stages are cache (default %d/%d), waiting (%d/%d) and pause (%d/%d)\n",
+           OVERLOAD_CACHE_LAG_US, OVERLOAD_CACHE_QUEUE, OVERLOAD_WAITING_LAG_US, OVERLOAD_WAITING_QUEUE,
+           OVERLOAD_PAUSE_LAG_US, OVERLOAD_PAUSE_QUEUE);
+    printf("Send SIGUSR2 to execute the binary again and hand it the connections without closing them\n");
+}
+
+/**
+ * @brief Raises the limit on the open file descriptors to the maximum allowed, so that bursts of players can connect
+ *
+ * @return limit on the open file descriptors, 0 if it cannot be read
+ */
+rlim_t raise_descriptor_limit()
+{
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) != 0)
+        return 0;
+    if (limit.rlim_cur < limit.rlim_max)
+    {
+        limit.rlim_cur = limit.rlim_max;
+        if (setrlimit(RLIMIT_NOFILE, &limit) != 0)
+            getrlimit(RLIMIT_NOFILE, &limit);
+    }
+    return limit.rlim_cur;
+}
+
+/**
+ * @brief Prints the system calls issued by the workers for each frame exchanged with the clients
+ *
+ * @param workers array of the workers
+ * @param total_workers number of workers
+ */
+void print_io_summary(Context *workers, unsigned int total_workers)
+{
+    IoStats total = {0, 0, 0};
+    for (unsigned int i = 0; i < total_workers; i++)
+    {
+        total.syscalls += workers[i].io_stats.syscalls;
+        total.frames_in += workers[i].io_stats.frames_in;
+        total.frames_out += workers[i].io_stats.frames_out;
+        total.accepted += workers[i].io_stats.accepted;
+        total.deferred += workers[i].io_stats.deferred;
+    }
+    uint64_t frames = total.frames_in + total.frames_out;
+    printf("I/O backend %s: %lu system calls, %lu frames received, %lu frames sent, %.3f system calls per frame\n",
+           workers[0].io->name, (unsigned long)total.syscalls, (unsigned long)total.frames_in,
+           (unsigned long)total.frames_out, frames ? (double)total.syscalls / frames : 0.0);
+    printf("Accepted %lu connections, the accept budget was exhausted %lu times\n", (unsigned long)total.accepted,
+           (unsigned long)total.deferred);
+}
+
+/**
+ * @brief Creates a listener socket bound to the server address
+ *
+ * SO_REUSEPORT allows every worker to bind its own listener to the same address:
+ * the kernel then spreads the incoming connections among them.
+ * The listener is non-blocking, so that a worker never waits on a connection accepted by the kernel elsewhere.
+ *
+ * @param backlog length of the queue of the connections waiting to be accepted, capped by the kernel to somaxconn
+ * @return file descriptor of the listener socket
+ */
+int open_listener(int backlog)
+{
+    struct sockaddr_in server_address;
+    int opt = 1;
+    int server_fd;
 
     // Create the server socket
-    if ((context.server_fd = socket(AF_INET, SOCK_STREAM, 0)) == 0)
+    if ((server_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) == -1)
     {
         perror("Socket failed");
         exit(EXIT_FAILURE);
     }
 
-    if (setsockopt(context.server_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0)
+    if (setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0)
     {
         perror("Error setting SO_REUSEADDR");
         exit(EXIT_FAILURE);
     }
 
+    if (setsockopt(server_fd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) < 0)
+    {
+        perror("Error setting SO_REUSEPORT");
+        exit(EXIT_FAILURE);
+    }
+
     // Configure the socket
     server_address.sin_family = AF_INET;
     inet_pton(AF_INET, SERVER_IP, &server_address.sin_addr);
     server_address.sin_port = htons(SERVER_PORT);
 
     // Bind the socket
-    if (bind(context.server_fd, (struct sockaddr *)&server_address, sizeof(server_address)) < 0)
+    if (bind(server_fd, (struct sockaddr *)&server_address, sizeof(server_address)) < 0)
     {
         perror("Bind failed");
         exit(EXIT_FAILURE);
     }
 
     // Listen for connections
-    if (listen(context.server_fd, 10) < 0)
+    if (listen(server_fd, backlog) < 0)
     {
         perror("Listen failed");
         exit(EXIT_FAILURE);
     }
+    return server_fd;
+}
+
+/**
+ * @brief Returns the total number of events handled by the workers, used to refresh the dashboard only on changes
+ */
+uint64_t total_handled_events(Context *workers, unsigned int total_workers)
+{
+    uint64_t total = 0;
+    for (unsigned int i = 0; i < total_workers; i++)
+        total += __atomic_load_n(&workers[i].handled_events, __ATOMIC_RELAXED);
+    return total;
+}
+
+int main(int argc, char **argv)
+{
+    QuizzesInfo quizzesInfo;
+    NicknameRegistry nicknames;
+    SessionRegistry *sessions;
+    Context *workers;
+    long online_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    unsigned int total_workers = online_cpus > 0 ? online_cpus : 1;
+    int option;
+    const char *capture_path = NULL;
+    const char *flight_dump_path = FLIGHT_DUMP_PATH;
+    const char *wal_path = NULL;
+    const char *shm_name = NULL;
+    const IoBackend *backend = NULL;
+    int backlog = LISTEN_BACKLOG;
+    Timeouts timeouts = {LOGIN_TIMEOUT_MS, IDLE_TIMEOUT_MS, QUESTION_TIMEOUT_MS, LIVE_ROUND_MS,
+                         1000 / SPECTATOR_UPDATES_PER_S, SESSION_GRACE_MS};
+    ClientLimits limits;
+    OverloadThreshold thresholds[OVERLOAD_STAGES_COUNT];
+    unsigned long live_quizzes[argc];
+    int total_live_quizzes = 0;
+    // Set when the server is started by an upgrade, see upgrade.c
+    const char *upgrade_fd = getenv(UPGRADE_FD_ENV);
+    init_client_limits(&limits);
+    init_overload_thresholds(thresholds);
+
+    while ((option = getopt(argc, argv, "r:f:W:m:w:b:l:L:i:q:R:g:T:u:M:t:O:h")) != -1)
+    {
+        switch (option)
+        {
+        case 'r':
+            capture_path = optarg;
+            break;
+        case 'f':
+            flight_dump_path = optarg;
+            break;
+        case 'W':
+            wal_path = optarg;
+            break;
+        case 'm':
+            shm_name = optarg;
+            break;
+        case 'w':
+            total_workers = strtoul(optarg, NULL, 10);
+            if (total_workers == 0)
+            {
+                print_usage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'b':
+            if (strcmp(optarg, "io_uring") == 0)
+                backend = &uring_backend;
+            else if (strcmp(optarg, "epoll") == 0)
+                backend = &epoll_backend;
+            else if (strcmp(optarg, "select") == 0)
+                backend = &select_backend;
+            else
+            {
+                print_usage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'l':
+            backlog = atoi(optarg);
+            if (backlog <= 0)
+            {
+                print_usage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'L':
+            timeouts.login_ms = strtoul(optarg, NULL, 10) * 1000;
+            break;
+        case 'i':
+            timeouts.idle_ms = strtoul(optarg, NULL, 10) * 1000;
+            break;
+        case 'q':
+            timeouts.question_ms = strtoul(optarg, NULL, 10) * 1000;
+            break;
+        case 'R':
+            timeouts.resume_ms = strtoul(optarg, NULL, 10) * 1000;
+            break;
+        case 'g':
+            live_quizzes[total_live_quizzes++] = strtoul(optarg, NULL, 10);
+            break;
+        case 'T':
+            timeouts.round_ms = strtoul(optarg, NULL, 10) * 1000;
+            if (timeouts.round_ms == 0)
+            {
+                print_usage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'M':
+            limits.memory_budget = strtoul(optarg, NULL, 10) * 1024;
+            break;
+        case 't':
+            if (!parse_rate_limit(optarg, &limits))
+            {
+                print_usage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'O':
+            if (!parse_overload_threshold(optarg, thresholds))
+            {
+                print_usage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'u':
+        {
+            // More than one update per millisecond would make the interval between the updates zero
+            char *end;
+            unsigned long updates = strtoul(optarg, &end, 10);
+            if (end == optarg || *end != '\0' || updates == 0 || updates > 1000)
+            {
+                print_usage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+            timeouts.update_ms = 1000 / updates;
+            break;
+        }
+        default:
+            print_usage(argv[0]);
+            exit(option == 'h' ? EXIT_SUCCESS : EXIT_FAILURE);
+        }
+    }
 
-    printf("DEBUG: Server listening on port %d...\n", SERVER_PORT);
+    // Use io_uring by default, and epoll where the kernel does not support it
+    if (!backend)
+        backend = uring_supported() ? &uring_backend : &epoll_backend;
+    else if (backend == &uring_backend && !uring_supported())
+    {
+        printf("io_uring is not available, falling back to epoll\n");
+        backend = &epoll_backend;
+    }
 
-    FD_SET(context.server_fd, &context.masterfds);
-    FD_SET(STDIN_FILENO, &context.masterfds); // Add stdin to monitor input
-    context.clientsInfo.max_fd = (context.server_fd > STDIN_FILENO) ? context.server_fd : STDIN_FILENO;
-    Client *client, *next;
+    // Keep the recent history of the server, dumped on crashes, failures and SIGUSR1
+    flight_init(flight_dump_path);
+    set_send_observer(handle_sent_frame);
+    // select cannot monitor the descriptors from FD_SETSIZE on, so its connections beyond them are closed at once
+    if (raise_descriptor_limit() > FD_SETSIZE && backend == &select_backend)
+        printf("select can only monitor %d descriptors, the players beyond are rejected: use -b epoll to serve them\n",
+               FD_SETSIZE);
+    // The handlers write the frames to the buffers of the connections, sent by the backend once per iteration
+    init_connection_table();
+    set_transport(&connection_transport);
+    // Frames larger than allowed for their type are refused as soon as their header is received
+    set_payload_limit(request_payload_limit);
 
-    // Main server loop
-    while (1)
+    if (capture_path && capture_open(capture_path) == -1)
     {
-        context.readfds = context.masterfds;
+        perror("Error opening the capture file");
+        exit(EXIT_FAILURE);
+    }
 
-        show_dashboard(&context);
+    load_quizzes_from_directory("./quizzes", &quizzesInfo);
+    for (int i = 0; i < total_live_quizzes; i++)
+    {
+        if (live_quizzes[i] == 0 || live_quizzes[i] > quizzesInfo.total_quizzes)
+        {
+            printf("Quiz %lu does not exist\n", live_quizzes[i]);
+            exit(EXIT_FAILURE);
+        }
+        enable_live_quiz(quizzesInfo.quizzes[live_quizzes[i] - 1]);
+    }
+    // When started by an upgrade, take over the workers of the previous server, whose rankings are received
+    // with its connections instead of being replayed from the write-ahead log
+    if (upgrade_fd)
+    {
+        int upgrade_socket = atoi(upgrade_fd);
+        unsetenv(UPGRADE_FD_ENV);
+        total_workers = receive_handoff(upgrade_socket);
+        if (total_workers == 0)
+        {
+            perror("Error receiving the connections of the upgraded server");
+            exit(EXIT_FAILURE);
+        }
+    }
+    // Rebuild the rankings from the changes logged before the last termination
+    if (wal_path && (upgrade_fd ? wal_adopt(wal_path, &quizzesInfo) : wal_open(wal_path, &quizzesInfo)) == -1)
+    {
+        perror("Error opening the write-ahead log");
+        exit(EXIT_FAILURE);
+    }
+    init_nickname_registry(&nicknames);
+    // The registry of the sessions is large, so it is not kept on the stack
+    sessions = malloc(sizeof(SessionRegistry));
+    handle_malloc_error(sessions, "Memory allocation error for the session registry");
+    init_session_registry(sessions);
+    signal(SIGPIPE, SIG_IGN);
+
+    // Terminate through the normal shutdown path, so that buffered data such as the capture is flushed
+    struct sigaction termination_action;
+    memset(&termination_action, 0, sizeof(termination_action));
+    termination_action.sa_handler = handle_termination_signal;
+    sigaction(SIGINT, &termination_action, NULL);
+    sigaction(SIGTERM, &termination_action, NULL);
+    struct sigaction upgrade_action;
+    memset(&upgrade_action, 0, sizeof(upgrade_action));
+    upgrade_action.sa_handler = handle_upgrade_signal;
+    sigaction(SIGUSR2, &upgrade_action, NULL);
 
-        activity = select(context.clientsInfo.max_fd + 1, &context.readfds, NULL, NULL, NULL);
+    // Create a worker for each thread, with its own listener socket
+    workers = malloc(total_workers * sizeof(Context));
+    handle_malloc_error(workers, "Memory allocation error for the workers");
+    for (unsigned int i = 0; i < total_workers; i++)
+    {
+        init_worker(&workers[i], i, total_workers, &quizzesInfo, &nicknames, sessions, backend);
+        workers[i].timeouts = timeouts;
+        workers[i].limits = limits;
+        memcpy(workers[i].overload.thresholds, thresholds, sizeof(thresholds));
+        workers[i].workers = workers;
+        workers[i].server_fd = upgrade_fd ? handoff_listener(i) : open_listener(backlog);
+    }
+    if (upgrade_fd && !restore_handoff(workers, total_workers))
+    {
+        printf("The state handed over by the upgraded server does not match the quizzes\n");
+        exit(EXIT_FAILURE);
+    }
+    if (shm_name && shm_open_region(shm_name) == -1)
+    {
+        perror("Error creating the shared-memory region");
+        exit(EXIT_FAILURE);
+    }
 
-        // Check for errors in select
-        if ((activity < 0) && (errno != EINTR))
+    // The asynchronous signals are handled by the main thread, so the workers are started with them blocked
+    sigset_t blocked_signals, previous_signals;
+    sigemptyset(&blocked_signals);
+    sigaddset(&blocked_signals, SIGINT);
+    sigaddset(&blocked_signals, SIGTERM);
+    sigaddset(&blocked_signals, SIGUSR1);
+    sigaddset(&blocked_signals, SIGUSR2);
+    pthread_sigmask(SIG_BLOCK, &blocked_signals, &previous_signals);
+    wal_start(workers, total_workers);
+    for (unsigned int i = 0; i < total_workers; i++)
+    {
+        if (pthread_create(&workers[i].thread, NULL, run_worker, &workers[i]) != 0)
         {
-            perror("Select failed");
+            printf("Error creating the thread of a worker\n");
             exit(EXIT_FAILURE);
         }
-        // Check if the user typed the character "q" to terminate the server
-        if (FD_ISSET(STDIN_FILENO, &context.readfds))
+    }
+    pthread_sigmask(SIG_SETMASK, &previous_signals, NULL);
+
+    printf("DEBUG: Server listening on port %d with %u workers on %s...\n", SERVER_PORT, total_workers, backend->name);
+
+    // The main thread refreshes the dashboard, publishes the statistics and waits for the termination command
+    struct pollfd console = {STDIN_FILENO, POLLIN, 0};
+    uint64_t shown_events = UINT64_MAX, shown_ns = 0;
+    int upgraded = 0;
+    while (!terminate_requested)
+    {
+        // The server terminates once its connections are handed over, or if the handover failed midway
+        if (upgrade_requested)
         {
-            char buffer[DEFAULT_PAYLOAD_SIZE];
-            if (get_console_input(buffer, sizeof(buffer)) == -1)
-            {
-                // If there is an error or EOF, remove STDIN from the master set
-                FD_CLR(STDIN_FILENO, &context.masterfds);
-            }
-            else if (buffer[0] == 'q' && buffer[1] == '\0')
-            {
+            upgrade_requested = 0;
+            upgraded = upgrade_server(argv, workers, total_workers);
+            if (upgraded != 0)
                 break;
-            }
         }
 
-        // Handle a new connection from a user on the server
-        if (FD_ISSET(context.server_fd, &context.readfds))
-            handle_new_client_connection(&context);
+        shm_publish(workers, total_workers);
+        uint64_t handled_events = total_handled_events(workers, total_workers);
+        uint64_t now_ns = get_time_ns();
+        // The dashboard is refreshed less often while a worker is overloaded, leaving the CPU to the workers
+        uint64_t refresh_ms = worst_overload_stage(workers, total_workers) >= OVERLOAD_CACHED_RANKINGS
+                                  ? DASHBOARD_OVERLOAD_REFRESH_MS
+                                  : DASHBOARD_REFRESH_MS;
+        if (handled_events != shown_events && now_ns - shown_ns >= refresh_ms * 1000000ULL)
+        {
+            show_dashboard(workers, total_workers);
+            shown_events = handled_events;
+            shown_ns = now_ns;
+        }
 
-        // Loop through the client list to handle requests on their respective sockets
-        client = context.clientsInfo.clients_head;
-        while (client)
+        if (poll(&console, 1, shm_name ? SHM_PUBLISH_MS : DASHBOARD_REFRESH_MS) <= 0)
+            continue;
+        // Check if the user typed the character "q" to terminate the server
+        char buffer[DEFAULT_PAYLOAD_SIZE];
+        if (get_console_input(buffer, sizeof(buffer)) == -1)
+        {
+            // If there is an error or EOF, stop monitoring STDIN
+            console.fd = -1;
+        }
+        else if (buffer[0] == 'q' && buffer[1] == '\0')
         {
-            next = client->next_node;
-            if (FD_ISSET(client->socket_fd, &context.readfds))
-                handle_client(client, &context);
-            client = next;
+            break;
         }
     }
 
     printf("\nTerminating server\n");
-    close(context.server_fd);
+    // Stop the writer of the write-ahead log first, since a checkpoint waits for all the workers
+    if (upgraded == 0)
+    {
+        wal_stop();
+        for (unsigned int i = 0; i < total_workers; i++)
+            stop_worker(&workers[i]);
+        for (unsigned int i = 0; i < total_workers; i++)
+            pthread_join(workers[i].thread, NULL);
+    }
+
+    // Apply the changes left in the ranking queues, then commit the last changes to the rankings and save
+    // a snapshot of them, if logged
+    for (unsigned int i = 0; i < total_workers; i++)
+        drain_ranking_events(&workers[i]);
+    wal_close();
+    // Flush the traffic capture, if enabled
+    capture_close();
+    // Leave the shared-memory region to the upgraded server, which has taken it over
+    shm_close(upgraded != 1);
+    print_io_summary(workers, total_workers);
 
-    // Deallocate the quizzes
-    deallocate_quizzes(&context.quizzesInfo);
-    // Deallocate the clients
-    deallocate_clients(&context.clientsInfo);
+    // Deallocate the clients of each worker
+    for (unsigned int i = 0; i < total_workers; i++)
+        deallocate_worker(&workers[i]);
+    free(workers);
+    deallocate_connection_table();
+    // Deallocate the quizzes, the nicknames and the sessions
+    deallocate_quizzes(&quizzesInfo);
+    deallocate_nickname_registry(&nicknames);
+    deallocate_session_registry(sessions);
+    free(sessions);
     return 0;
 }
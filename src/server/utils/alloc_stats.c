@@ -0,0 +1,135 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "utils.h"
+
+/**
+ * Allocation counting is only active in the instrumentation build, compiled with -DALLOC_STATS and linked with
+ * -Wl,--wrap=malloc,--wrap=calloc,--wrap=realloc,--wrap=free so that the calls made by the server code
+ * are routed through the wrappers below. In the regular build the functions of this file only return empty statistics.
+ */
+
+// Counters of each scope: one per MessageType handler, plus ALLOC_SCOPE_OTHER for everything else.
+// They are shared by the workers and updated atomically
+static AllocStats scope_stats[ALLOC_SCOPES_COUNT];
+// Scope to which the allocations of the calling thread are currently attributed
+static __thread int current_scope = ALLOC_SCOPE_OTHER;
+
+/**
+ * @brief Accounts an allocation to the current scope of the calling thread
+ */
+void alloc_stats_count(size_t size)
+{
+    __atomic_add_fetch(&scope_stats[current_scope].allocations, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&scope_stats[current_scope].bytes, size, __ATOMIC_RELAXED);
+}
+
+#ifdef ALLOC_STATS
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+void __real_free(void *ptr);
+
+void *__wrap_malloc(size_t size)
+{
+    alloc_stats_count(size);
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t count, size_t size)
+{
+    alloc_stats_count(count * size);
+    return __real_calloc(count, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size)
+{
+    alloc_stats_count(size);
+    return __real_realloc(ptr, size);
+}
+
+void __wrap_free(void *ptr)
+{
+    if (ptr)
+        __atomic_add_fetch(&scope_stats[current_scope].frees, 1, __ATOMIC_RELAXED);
+    __real_free(ptr);
+}
+
+#endif
+
+/**
+ * @brief Tells if the server has been built with allocation counting
+ */
+bool alloc_stats_enabled()
+{
+#ifdef ALLOC_STATS
+    return true;
+#else
+    return false;
+#endif
+}
+
+/**
+ * @brief Attributes the following allocations of the calling thread to a scope
+ *
+ * @param scope MessageType of the handler being executed, or ALLOC_SCOPE_OTHER
+ * @return scope that was active before the call, to be restored at the end of the handler
+ */
+int alloc_stats_enter(int scope)
+{
+    int previous_scope = current_scope;
+    if (scope < 0 || scope >= ALLOC_SCOPES_COUNT)
+        scope = ALLOC_SCOPE_OTHER;
+    current_scope = scope;
+    return previous_scope;
+}
+
+/**
+ * @brief Returns the counters of a scope
+ *
+ * @param scope MessageType of the handler, or ALLOC_SCOPE_OTHER
+ */
+AllocStats alloc_stats_get(int scope)
+{
+    AllocStats stats;
+    stats.allocations = __atomic_load_n(&scope_stats[scope].allocations, __ATOMIC_RELAXED);
+    stats.frees = __atomic_load_n(&scope_stats[scope].frees, __ATOMIC_RELAXED);
+    stats.bytes = __atomic_load_n(&scope_stats[scope].bytes, __ATOMIC_RELAXED);
+    return stats;
+}
+
+/**
+ * @brief Returns the sum of the counters of all the scopes
+ */
+AllocStats alloc_stats_total()
+{
+    AllocStats total = {0, 0, 0};
+    for (int i = 0; i < ALLOC_SCOPES_COUNT; i++)
+    {
+        AllocStats stats = alloc_stats_get(i);
+        total.allocations += stats.allocations;
+        total.frees += stats.frees;
+        total.bytes += stats.bytes;
+    }
+    return total;
+}
+
+/**
+ * @brief Displays the allocations performed by each message handler
+ */
+void show_alloc_stats()
+{
+    if (!alloc_stats_enabled())
+        return;
+    printf("\nAllocations per handler\n");
+    for (int i = 0; i < ALLOC_SCOPES_COUNT; i++)
+    {
+        AllocStats stats = alloc_stats_get(i);
+        if (!stats.allocations && !stats.frees)
+            continue;
+        printf("- %-18s %llu allocations, %llu frees, %llu bytes\n",
+               i == ALLOC_SCOPE_OTHER ? "other" : message_type_name(i),
+               (unsigned long long)stats.allocations, (unsigned long long)stats.frees,
+               (unsigned long long)stats.bytes);
+    }
+}
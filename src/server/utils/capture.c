@@ -0,0 +1,170 @@
+#include <arpa/inet.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "../../common/capture.h"
+#include "utils.h"
+
+// Size of the stdio buffer used for the capture file, so that records are written in large blocks
+#define CAPTURE_BUFFER_SIZE (1 << 20)
+
+// File in which the records are written, NULL when the recorder is disabled
+static FILE *capture_file = NULL;
+// Monotonic time at which the capture was started
+static uint64_t capture_start_ns;
+// Table that maps each socket file descriptor to the id of the connection currently using it
+static uint32_t *fd_conn_ids = NULL;
+static size_t fd_conn_ids_size = 0;
+// Serializes the records written by the workers and protects the connection table
+static pthread_mutex_t capture_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * @brief Writes a record to the capture file
+ *
+ * The record header is serialized in network byte order as described in capture.h
+ * and is followed by the payload of the frame.
+ *
+ * @param conn_id identifier of the connection the record refers to
+ * @param kind kind of the record
+ * @param type type of the message exchanged
+ * @param payload pointer to the payload of the frame
+ * @param payload_length length of the payload in bytes
+ */
+void capture_write_record(uint32_t conn_id, CaptureKind kind, MessageType type, const char *payload, size_t payload_length)
+{
+    char header[CAPTURE_RECORD_HEADER_SIZE];
+    char *pointer = header;
+    uint64_t timestamp = get_time_ns() - capture_start_ns;
+    uint32_t net_high = htonl(timestamp >> 32), net_low = htonl(timestamp & 0xFFFFFFFF);
+    uint32_t net_conn_id = htonl(conn_id), net_payload_length = htonl(payload_length);
+
+    memcpy(pointer, &net_high, sizeof(uint32_t));
+    pointer += sizeof(uint32_t);
+    memcpy(pointer, &net_low, sizeof(uint32_t));
+    pointer += sizeof(uint32_t);
+    memcpy(pointer, &net_conn_id, sizeof(uint32_t));
+    pointer += sizeof(uint32_t);
+    *pointer++ = kind;
+    *pointer++ = type;
+    memcpy(pointer, &net_payload_length, sizeof(uint32_t));
+
+    fwrite(header, 1, sizeof(header), capture_file);
+    if (payload_length > 0)
+        fwrite(payload, 1, payload_length, capture_file);
+}
+
+/**
+ * @brief Records a frame sent by the server
+ *
+ * It is called by the send observer of the server for every frame sent with send_msg.
+ *
+ * @param fd file descriptor to which the frame has been sent
+ * @param type type of the message sent
+ * @param payload pointer to the payload of the frame
+ * @param payload_length length of the payload in bytes
+ */
+void capture_outbound(int fd, MessageType type, const char *payload, size_t payload_length)
+{
+    if (!capture_file || fd < 0)
+        return;
+    pthread_mutex_lock(&capture_lock);
+    if ((size_t)fd < fd_conn_ids_size)
+        capture_write_record(fd_conn_ids[fd], CAPTURE_OUTBOUND, type, payload, payload_length);
+    pthread_mutex_unlock(&capture_lock);
+}
+
+/**
+ * @brief Starts recording the traffic of the server in a capture file
+ *
+ * @param path path of the capture file to create
+ * @return 1 if the recorder has been started, -1 in case of error
+ */
+int capture_open(const char *path)
+{
+    char header[CAPTURE_FILE_HEADER_SIZE] = CAPTURE_MAGIC;
+    uint16_t net_version = htons(CAPTURE_VERSION);
+
+    capture_file = fopen(path, "wb");
+    if (!capture_file)
+        return -1;
+    setvbuf(capture_file, NULL, _IOFBF, CAPTURE_BUFFER_SIZE);
+
+    memcpy(header + CAPTURE_MAGIC_SIZE, &net_version, sizeof(uint16_t));
+    fwrite(header, 1, sizeof(header), capture_file);
+
+    capture_start_ns = get_time_ns();
+    // Make sure the buffered records reach the disk also when the server terminates through exit()
+    atexit(capture_close);
+    return 1;
+}
+
+/**
+ * @brief Stops the recorder, flushing and closing the capture file
+ */
+void capture_close()
+{
+    if (!capture_file)
+        return;
+    fclose(capture_file);
+    capture_file = NULL;
+    free(fd_conn_ids);
+    fd_conn_ids = NULL;
+    fd_conn_ids_size = 0;
+}
+
+/**
+ * @brief Records the connection of a new client
+ *
+ * It also binds the socket of the client to its connection id, so that the frames sent with send_msg
+ * can be attributed to the right connection.
+ *
+ * @param client pointer to the client that has connected
+ */
+void capture_connect(Client *client)
+{
+    if (!capture_file)
+        return;
+    pthread_mutex_lock(&capture_lock);
+    if ((size_t)client->socket_fd >= fd_conn_ids_size)
+    {
+        size_t new_size = fd_conn_ids_size ? fd_conn_ids_size : 64;
+        while (new_size <= (size_t)client->socket_fd)
+            new_size *= 2;
+        uint32_t *new_ids = realloc(fd_conn_ids, new_size * sizeof(uint32_t));
+        handle_malloc_error(new_ids, "Memory allocation error for the capture connection table");
+        fd_conn_ids = new_ids;
+        fd_conn_ids_size = new_size;
+    }
+    fd_conn_ids[client->socket_fd] = client->id;
+    capture_write_record(client->id, CAPTURE_CONNECT, 0, NULL, 0);
+    pthread_mutex_unlock(&capture_lock);
+}
+
+/**
+ * @brief Records a frame received from a client
+ *
+ * @param client pointer to the client that sent the frame
+ * @param msg pointer to the received message
+ */
+void capture_inbound(Client *client, Message *msg)
+{
+    if (!capture_file)
+        return;
+    pthread_mutex_lock(&capture_lock);
+    capture_write_record(client->id, CAPTURE_INBOUND, msg->type, msg->payload, msg->payload_length);
+    pthread_mutex_unlock(&capture_lock);
+}
+
+/**
+ * @brief Records the disconnection of a client
+ *
+ * @param client pointer to the client that is disconnecting
+ */
+void capture_disconnect(Client *client)
+{
+    if (!capture_file)
+        return;
+    pthread_mutex_lock(&capture_lock);
+    capture_write_record(client->id, CAPTURE_DISCONNECT, 0, NULL, 0);
+    pthread_mutex_unlock(&capture_lock);
+}
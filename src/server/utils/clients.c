@@ -17,6 +17,9 @@ void init_clients_info(ClientsInfo *clientsInfo)
     clientsInfo->connected_clients = 0;
     clientsInfo->clients_head = clientsInfo->clients_tail = NULL;
     clientsInfo->max_fd = 0;
+    clientsInfo->max_fd_stale = false;
+    clientsInfo->closing_head = NULL;
+    clientsInfo->next_client_id = 0;
 }
 
 /**
@@ -35,10 +38,25 @@ Client *create_client_node(int client_fd, QuizzesInfo *quizzesInfo)
     handle_malloc_error(new_client, "Memory allocation error for the new client");
     new_client->client_rankings = NULL;
     new_client->nickname = NULL;
+    new_client->input_buffer = NULL;
+    new_client->input_buffer_size = 0;
     new_client->next_node = new_client->prev_node = NULL;
     new_client->current_quiz_id = -1;
     new_client->socket_fd = client_fd;
     new_client->state = LOGIN;
+    new_client->live = false;
+    new_client->live_prev = new_client->live_next = NULL;
+    new_client->spectator_slots = NULL;
+    new_client->subscriber_slot = -1;
+    new_client->resumable = false;
+    init_client_protocol(new_client);
+    init_timer(&new_client->idle_timer, handle_idle_timeout, new_client);
+    init_timer(&new_client->question_timer, handle_question_timeout, new_client);
+    init_timer(&new_client->throttle_timer, resume_throttled_client, new_client);
+    memset(new_client->rate_full_ns, 0, sizeof(new_client->rate_full_ns));
+    new_client->throttled = false;
+    new_client->waiting = false;
+    new_client->waiting_prev = new_client->waiting_next = NULL;
     new_client->client_rankings = malloc(quizzesInfo->total_quizzes * sizeof(RankingNode *));
     handle_malloc_error(new_client->client_rankings, "Memory allocation error for the new client's rankings");
     memset(new_client->client_rankings, 0, quizzesInfo->total_quizzes * sizeof(RankingNode *));
@@ -70,9 +88,9 @@ void add_client(Client *node, ClientsInfo *clientsInfo)
 }
 
 /**
- * @brief Removes and deallocates a Client structure from the list of connected clients
+ * @brief Removes a Client structure from the list of connected clients
  *
- * @param node pointer to the Client structure to remove and deallocate
+ * @param node pointer to the Client structure to remove
  * @param clientsInfo pointer to the structure containing the clients' information
  */
 void remove_client(Client *node, ClientsInfo *clientsInfo)
@@ -94,8 +112,19 @@ void remove_client(Client *node, ClientsInfo *clientsInfo)
     if (node->next_node != NULL)
         node->next_node->prev_node = node->prev_node;
 
+    node->prev_node = node->next_node = NULL;
+}
+
+/**
+ * @brief Deallocates a Client structure, already removed from the list of connected clients
+ *
+ * @param node pointer to the Client structure to deallocate
+ */
+void free_client(Client *node)
+{
     free(node->nickname);
     free(node->client_rankings);
+    free(node->input_buffer);
     free(node);
 }
 
@@ -112,9 +141,7 @@ void deallocate_clients(ClientsInfo *clientsInfo)
     while (current != NULL)
     {
         next = current->next_node;
-        free(current->client_rankings);
-        free(current->nickname);
-        free(current);
+        free_client(current);
         current = next;
     }
 }
@@ -174,46 +201,87 @@ void request_client_nickname(int client_fd)
 }
 
 /**
- * @brief Handles the connection of a new client to the system
+ * @brief Registers a new connection in the system
  *
- * This function is invoked when a new connection is detected on the server socket.
- * It accepts the connection and creates all the necessary data structures to manage the new client.
+ * This function creates all the necessary data structures to manage the new client,
+ * starts monitoring its socket and asks for its nickname.
  *
+ * @param client_fd file descriptor of the new connection
  * @param context pointer to the structure that contains the service context information
+ * @return pointer to the Client structure created for the connection
  */
-void handle_new_client_connection(Context *context)
+Client *register_client(int client_fd, Context *context)
 {
-    struct sockaddr_in client_address;
-    int client_fd;
-    socklen_t address_size = sizeof(client_address);
-    // Accept the connection
-    client_fd = accept(context->server_fd, (struct sockaddr *)&client_address, &address_size);
-    if (client_fd == -1)
-    {
-        if (errno == EINTR)
-            return;
-        else
-            exit(EXIT_FAILURE);
-    }
-    // Add the file descriptor to the master set
-    FD_SET(client_fd, &context->masterfds);
-    // Update max_fd
-    if (client_fd > context->clientsInfo.max_fd)
-        context->clientsInfo.max_fd = client_fd;
+    // Add the file descriptor to the ones monitored by the event loop
+    context->io->watch(context, client_fd);
 
     // Create the client node and add it to the list
-    Client *client = create_client_node(client_fd, &context->quizzesInfo);
+    Client *client = create_client_node(client_fd, context->quizzesInfo);
+    // Interleave the identifiers of the workers, so that they are unique in the whole server
+    client->id = context->clientsInfo.next_client_id++ * context->total_workers + context->worker_id;
     add_client(client, &context->clientsInfo);
+    capture_connect(client);
+    flight_record(FLIGHT_CONNECT, 0, client->id, client_fd, 0);
+    PROBE2(client__connect, client->id, client_fd);
+
+    // An overloaded worker makes the new clients wait before they can log in
+    if (context->overload.stage >= OVERLOAD_WAITING_ROOM)
+    {
+        enter_waiting_room(client, context);
+        return client;
+    }
+
+    // Give the client a limited time to log in
+    if (context->timeouts.login_ms)
+        schedule_timer(&context->timers, &client->idle_timer, context->timeouts.login_ms);
 
     // Send the username request message to the client
     request_client_nickname(client_fd);
+    return client;
 }
 
 /**
- * @brief Sends the list of available quizzes to the client
+ * @brief Handles the connection of a new client to the system
+ *
+ * This function is invoked when the backend reports activity on the server socket.
+ * It drains the listen queue, registering the new clients, up to ACCEPT_BUDGET connections per iteration:
+ * the connections beyond the budget stay queued in the kernel and are accepted in the next iteration,
+ * after the requests of the clients already connected have been handled.
  *
- * This function responds to a MSG_REQ_QUIZ_LIST message by serializing the list of available quizzes using the binary protocol
- * and sending them to the client.
+ * @param context pointer to the structure that contains the service context information
+ */
+void handle_new_client_connection(Context *context)
+{
+    int client_fd = -1;
+    unsigned int accepted = 0;
+    while (accepted < ACCEPT_BUDGET && (client_fd = context->io->accept(context)) != -1)
+    {
+        register_client(client_fd, context);
+        accepted++;
+    }
+    count_io(&context->io_stats.accepted, accepted);
+
+    if (client_fd != -1)
+    {
+        count_io(&context->io_stats.deferred, 1);
+        return;
+    }
+    // The queue has been drained, the others are retried at the next wake-up
+    if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR || errno == ECONNABORTED)
+        return;
+    flight_record(FLIGHT_ERROR, FLIGHT_ERROR_ACCEPT, 0, errno, 0);
+    // Running out of descriptors or memory is transient: the connections wait in the listen queue
+    if (errno == EMFILE || errno == ENFILE || errno == ENOBUFS || errno == ENOMEM)
+        return;
+    exit(EXIT_FAILURE);
+}
+
+/**
+ * @brief Serializes the list of available quizzes
+ *
+ * This function serializes the list of available quizzes using the binary protocol.
+ * Since the quizzes do not change while the server is running, the list is serialized once when the quizzes
+ * are loaded, and the result stored in quizzesInfo is shared by the workers for every MSG_REQ_QUIZ_LIST request.
  *
  * In particular, it uses the htons function to convert data from host byte order to network byte order,
  * and uses standardized uint16_t types to ensure portability.
@@ -222,16 +290,14 @@ void handle_new_client_connection(Context *context)
  * (number of quizzes) [(name length)(name)] [(name length)(name)] [...]
  * where the parentheses indicate the level of nesting and are not actually part of the transmitted data.
  *
- * @param client pointer to the client to which the list is sent
  * @param quizzesInfo pointer to the structure containing the quiz information
  */
-void send_quiz_list(Client *client, QuizzesInfo *quizzesInfo)
+void serialize_quiz_list(QuizzesInfo *quizzesInfo)
 {
     // Create a payload for our packet with a standard size
     size_t buffer_size = DEFAULT_PAYLOAD_SIZE;
     char *payload = (char *)malloc(buffer_size);
     handle_malloc_error(payload, "Error allocating payload");
-    int payload_size;
 
     char *pointer = payload;
     size_t string_len;
@@ -262,42 +328,51 @@ void send_quiz_list(Client *client, QuizzesInfo *quizzesInfo)
         pointer += string_len;
     }
 
-    payload_size = pointer - payload;
+    quizzesInfo->quiz_list_payload = payload;
+    quizzesInfo->quiz_list_length = pointer - payload;
+}
 
-    client->state = SELECTING_QUIZ;
+/**
+ * @brief Sends the list of available quizzes to the client
+ *
+ * This function responds to a MSG_REQ_QUIZ_LIST message by sending the serialized list of available quizzes to the client.
+ *
+ * @param client pointer to the client to which the list is sent
+ * @param quizzesInfo pointer to the structure containing the quiz information
+ */
+void send_quiz_list(Client *client, QuizzesInfo *quizzesInfo)
+{
+    size_t length;
+    const char *payload = client_quiz_list(client, quizzesInfo, &length);
+    set_client_state(client, SELECTING_QUIZ);
 
-    // Send the serialized message
-    send_msg(client->socket_fd, MSG_RES_QUIZ_LIST, payload, payload_size);
-    free(payload);
+    // Send the list serialized for the protocol of the client
+    send_msg(client->socket_fd, MSG_RES_QUIZ_LIST, (char *)payload, length);
 }
 
 /**
  * @brief Checks the validity of the nickname provided by the client
  *
  * This function is invoked after receiving a MSG_SET_NICKNAME message from the client
- * and checks whether the nickname is valid by verifying its uniqueness.
+ * and checks whether the nickname is valid by reserving it in the registry shared by all the workers.
  *
  * @param client pointer to the client that sent the nickname
  * @param received_msg pointer to the received message
- * @param clientsInfo pointer to the structure containing the clients' information
+ * @param context pointer to the structure containing the service context information
  */
-void handle_client_nickname(Client *client, Message *received_msg, ClientsInfo *clientsInfo)
+void handle_client_nickname(Client *client, Message *received_msg, Context *context)
 {
     char *selected_nickname = received_msg->payload;
-    bool found = 0;
 
-    // Perform a linear search among clients that already have an associated nickname
-    Client *current_client = clientsInfo->clients_head;
-    while (current_client != NULL)
+    // The nickname of a client that has logged in stays claimed until it disconnects
+    if (client->state != LOGIN)
     {
-        if (current_client->nickname && strcmp(selected_nickname, current_client->nickname) == 0)
-        {
-            found = true;
-            break;
-        }
-        current_client = current_client->next_node;
+        char *message = "The nickname has already been chosen";
+        send_msg(client->socket_fd, MSG_INFO, message, strlen(message));
+        return;
     }
-    if (found)
+
+    if (!claim_nickname(context->nicknames, selected_nickname))
     {
         // If the nickname is already in use, send a message indicating the situation
         char *message = "Nickname already in use";
@@ -307,14 +382,15 @@ void handle_client_nickname(Client *client, Message *received_msg, ClientsInfo *
         return;
     }
 
-    client->state = LOGGED_IN;
-    clientsInfo->connected_clients += 1;
+    set_client_state(client, LOGGED_IN);
+    context->clientsInfo.connected_clients += 1;
     client->nickname = malloc(strlen(selected_nickname) + 1);
     handle_malloc_error(client->nickname, "Error allocating memory for the client's nickname");
     strcpy(client->nickname, selected_nickname);
 
-    // Send the correct nickname confirmation message to the client
+    // Send the correct nickname confirmation message to the client, followed by the token to resume the session
     send_msg(client->socket_fd, MSG_OK_NICKNAME, "", 0);
+    issue_session_token(client, context);
 }
 
 /**
@@ -322,37 +398,68 @@ void handle_client_nickname(Client *client, Message *received_msg, ClientsInfo *
  *
  * This function manages the disconnection of a client, which can occur either explicitly through a MSG_DISCONNECT message
  * or implicitly through direct socket closure.
+ * The client is detached at once from everything that could reach it, while its socket is closed and its nodes are
+ * removed from the rankings in a batch at the end of the iteration, so that a mass disconnection costs the worker
+ * and the owners of the quizzes only the work for the clients that left.
  *
  * @param client pointer to the client to disconnect
  * @param context pointer to the structure containing the service context information
  */
 void handle_client_disconnection(Client *client, Context *context)
 {
-    // Remove the client from the active file descriptor set and close the socket
-    FD_CLR(client->socket_fd, &context->masterfds);
-    close(client->socket_fd);
-
-    // Remove all of the client's ranking entries
-    for (uint16_t i = 0; i < context->quizzesInfo.total_quizzes; i++)
-        remove_ranking(client->client_rankings[i], context->quizzesInfo.quizzes[i]);
-
-    // Update max_fd
-    if (client->socket_fd == context->clientsInfo.max_fd)
+    capture_disconnect(client);
+    flight_record(FLIGHT_DISCONNECT, client->state, client->id, client->socket_fd, 0);
+    PROBE3(client__disconnect, client->id, client->socket_fd, client->state);
+
+    cancel_timer(&context->timers, &client->idle_timer);
+    cancel_timer(&context->timers, &client->question_timer);
+    cancel_timer(&context->timers, &client->throttle_timer);
+    leave_waiting_room(client, context);
+    leave_live_round(client, context);
+    remove_spectator(client, context);
+    unsubscribe_rankings(client, context);
+
+    // Keep the nickname and the ranking entries of a player whose connection dropped, until it resumes its session
+    if (!park_client_session(client, context))
     {
-        Client *current_client = context->clientsInfo.clients_head;
-        context->clientsInfo.max_fd = context->server_fd > STDIN_FILENO ? context->server_fd : STDIN_FILENO;
-        while (current_client)
+        // Remove all of the client's ranking entries, which are deallocated by the owners of the quizzes
+        for (uint16_t i = 0; i < context->quizzesInfo->total_quizzes; i++)
         {
-            if (current_client != client && current_client->socket_fd > context->clientsInfo.max_fd)
-                context->clientsInfo.max_fd = current_client->socket_fd;
-
-            current_client = current_client->next_node;
+            if (!client->client_rankings[i])
+                continue;
+            queue_ranking_removal(context, context->quizzesInfo->quizzes[i], client->client_rankings[i]);
         }
-    }
 
+        if (client->nickname)
+            release_nickname(context->nicknames, client->nickname);
+    }
     if (client->state != LOGIN)
         context->clientsInfo.connected_clients--;
     remove_client(client, &context->clientsInfo);
+    client->next_node = context->clientsInfo.closing_head;
+    context->clientsInfo.closing_head = client;
+}
+
+/**
+ * @brief Closes the sockets of the clients disconnected during the iteration and deallocates them
+ *
+ * The output still buffered is sent if the kernel accepts it without blocking, as the sockets are unwatched.
+ *
+ * @param context pointer to the structure containing the service context information
+ */
+void release_disconnected_clients(Context *context)
+{
+    Client *client = context->clientsInfo.closing_head;
+    context->clientsInfo.closing_head = NULL;
+    while (client)
+    {
+        Client *next = client->next_node;
+        // Stop monitoring the socket of the client and close it
+        context->io->unwatch(context, client->socket_fd);
+        close_connection(client->socket_fd);
+        free_client(client);
+        client = next;
+    }
 }
 
 /**
@@ -391,20 +498,95 @@ bool verify_quiz_answer(char *answer, QuizQuestion *question)
     return false;
 }
 
+/**
+ * @brief Moves the client to the next question of the quiz they are playing
+ *
+ * It sends the next question and arms its deadline, if the quiz is not finished;
+ * otherwise, it records the completion and sends the quiz list again.
+ *
+ * @param client pointer to the client playing the quiz
+ * @param context pointer to the structure containing the service context information
+ */
+void advance_quiz(Client *client, Context *context)
+{
+    QuizzesInfo *quizzesInfo = context->quizzesInfo;
+    RankingNode *current_ranking = client->client_rankings[client->current_quiz_id];
+    Quiz *playing_quiz = quizzesInfo->quizzes[client->current_quiz_id];
+
+    current_ranking->current_question += 1;
+    // If the client has finished the quiz, send the list of available quizzes; otherwise, send the next question
+    if (current_ranking->current_question == playing_quiz->total_questions)
+    {
+        submit_ranking_event(context, playing_quiz, RANKING_COMPLETE, current_ranking, 0);
+        PROBE3(quiz__complete, client->id, playing_quiz->id, current_ranking->correct_answers);
+        char *payload = "You completed the quiz";
+        send_msg(client->socket_fd, MSG_INFO, payload, strlen(payload));
+        set_client_state(client, SELECTING_QUIZ);
+        send_quiz_list(client, quizzesInfo);
+    }
+    else
+    {
+        send_quiz_question(client, playing_quiz);
+        arm_question_deadline(client, context);
+    }
+}
+
+/**
+ * @brief Takes a client out of the quiz it is playing, before it goes back to the quiz selection
+ *
+ * The quiz is left unfinished: the client stays in its ranking, but is no longer sent its live rounds,
+ * nor moved on by the deadline of its current question.
+ *
+ * @param client pointer to the client
+ * @param context pointer to the structure containing the service context information
+ */
+void leave_quiz(Client *client, Context *context)
+{
+    if (client->state != PLAYING)
+        return;
+    cancel_timer(&context->timers, &client->question_timer);
+    leave_live_round(client, context);
+}
+
+/**
+ * @brief Starts the time limit for answering the question just sent to the client, if one is configured
+ *
+ * @param client pointer to the client playing the quiz
+ * @param context pointer to the structure containing the service context information
+ */
+void arm_question_deadline(Client *client, Context *context)
+{
+    if (context->timeouts.question_ms)
+        schedule_timer(&context->timers, &client->question_timer, context->timeouts.question_ms);
+}
+
 /**
  * @brief Handles the client's answer message for a quiz question
  *
  * This function is invoked after receiving a MSG_QUIZ_ANSWER message from the client.
  * It checks the correctness of the answer, notifies the client of the result via a MSG_INFO message,
- * and updates the quiz ranking if the answer is correct.
+ * and submits the new score to the owner of the quiz ranking if the answer is correct.
  * Additionally, it sends the next question if the quiz is not finished; otherwise, it sends the quiz list again.
+ * The answers sent with a MSG_QUIZ_SUBMIT message receive all of this in a single MSG_QUIZ_RESULT message instead.
+ * The answers arriving after the deadline of the question has moved the client on are ignored.
  *
  * @param client pointer to the client that sent the answer
  * @param msg pointer to the message containing the answer
- * @param quizzesInfo pointer to the structure containing the quiz information
+ * @param context pointer to the structure containing the service context information
  */
-void handle_quiz_answer(Client *client, Message *msg, QuizzesInfo *quizzesInfo)
+void handle_quiz_answer(Client *client, Message *msg, Context *context)
 {
+    bool compact = msg->type == MSG_QUIZ_SUBMIT;
+    if (client->state != PLAYING)
+        return;
+    cancel_timer(&context->timers, &client->question_timer);
+    if (client->live)
+    {
+        handle_live_answer(client, msg->payload, context);
+        return;
+    }
+
+    QuizzesInfo *quizzesInfo = context->quizzesInfo;
     char *user_answer = msg->payload;
     // Retrieve the RankingNode related to the quiz for which the client provided an answer
     RankingNode *current_ranking = client->client_rankings[client->current_quiz_id];
@@ -415,30 +597,84 @@ void handle_quiz_answer(Client *client, Message *msg, QuizzesInfo *quizzesInfo)
     char *payload;
 
     bool correct_answer = verify_quiz_answer(user_answer, current_question);
-    // If the answer is correct, update the client's score and the ranking
+    // If the answer is correct, update the client's score and submit it to the owner of the ranking
     if (correct_answer)
     {
         payload = "Correct answer";
-        current_ranking->score += 1;
-        update_ranking(current_ranking, playing_quiz);
+        current_ranking->correct_answers += 1;
+        submit_ranking_event(context, playing_quiz, RANKING_SCORE, current_ranking, current_ranking->correct_answers);
     }
     else
         payload = "Wrong answer";
 
+    if (compact)
+    {
+        send_quiz_result(client, correct_answer, context);
+        return;
+    }
     send_msg(client->socket_fd, MSG_INFO, payload, strlen(payload));
+    advance_quiz(client, context);
+}
+
+/**
+ * @brief Moves the client to the next question, sending the verdict of its answer together with it
+ *
+ * It works as advance_quiz, but everything the client needs after an answer is sent in a single MSG_QUIZ_RESULT
+ * message, whose payload has this format:
+ * (flags) (score) (rank) (number of players) (next question, or the quiz list if the quiz is completed)
+ * The rank is computed from the last ranking published by the owner of the quiz, which might not include the
+ * last answers yet.
+ *
+ * @param client pointer to the client playing the quiz
+ * @param correct whether the answer was correct
+ * @param context pointer to the structure containing the service context information
+ */
+void send_quiz_result(Client *client, bool correct, Context *context)
+{
+    QuizzesInfo *quizzesInfo = context->quizzesInfo;
+    RankingNode *current_ranking = client->client_rankings[client->current_quiz_id];
+    Quiz *playing_quiz = quizzesInfo->quizzes[client->current_quiz_id];
+    uint8_t flags = correct ? QUIZ_RESULT_CORRECT : 0;
+    const char *next;
+    size_t next_length;
 
     current_ranking->current_question += 1;
-    // If the client has finished the quiz, send the list of available quizzes; otherwise, send the next question
     if (current_ranking->current_question == playing_quiz->total_questions)
     {
-        current_ranking->is_quiz_completed = true;
-        payload = "You completed the quiz";
-        send_msg(client->socket_fd, MSG_INFO, payload, strlen(payload));
-        client->state = SELECTING_QUIZ;
-        send_quiz_list(client, quizzesInfo);
+        submit_ranking_event(context, playing_quiz, RANKING_COMPLETE, current_ranking, 0);
+        PROBE3(quiz__complete, client->id, playing_quiz->id, current_ranking->correct_answers);
+        set_client_state(client, SELECTING_QUIZ);
+        flags |= QUIZ_RESULT_COMPLETED;
+        next = client_quiz_list(client, quizzesInfo, &next_length);
     }
     else
-        send_quiz_question(client, playing_quiz);
+    {
+        next = playing_quiz->questions[current_ranking->current_question]->question;
+        next_length = strlen(next);
+        arm_question_deadline(client, context);
+    }
+
+    // Reuse the ranking buffer of the worker, so that answering does not allocate memory
+    if (!context->ranking_buffer)
+    {
+        context->ranking_buffer_size = DEFAULT_PAYLOAD_SIZE;
+        context->ranking_buffer = (char *)malloc(context->ranking_buffer_size);
+        handle_malloc_error(context->ranking_buffer, "Error allocating payload");
+    }
+    char *pointer = context->ranking_buffer;
+    ensure_capacity(&context->ranking_buffer, &pointer, &context->ranking_buffer_size,
+                    QUIZ_RESULT_HEADER_SIZE + next_length);
+
+    RankingSnapshot *snapshot = acquire_ranking_snapshot(playing_quiz);
+    uint32_t rank = snapshot_rank(snapshot, current_ranking->correct_answers);
+    uint16_t fields[3] = {htons(current_ranking->correct_answers), htons(rank < UINT16_MAX ? rank : UINT16_MAX),
+                          htons(snapshot->total_clients < UINT16_MAX ? snapshot->total_clients : UINT16_MAX)};
+    release_ranking_snapshot(playing_quiz, snapshot);
+
+    *pointer = flags;
+    memcpy(pointer + sizeof(uint8_t), fields, sizeof(fields));
+    memcpy(pointer + QUIZ_RESULT_HEADER_SIZE, next, next_length);
+    send_msg(client->socket_fd, MSG_QUIZ_RESULT, context->ranking_buffer, QUIZ_RESULT_HEADER_SIZE + next_length);
 }
 
 /**
@@ -449,13 +685,17 @@ void handle_quiz_answer(Client *client, Message *msg, QuizzesInfo *quizzesInfo)
  *
  * @param client pointer to the client who selected the quiz
  * @param msg pointer to the message containing the selected quiz
- * @param quizzesInfo pointer to the structure containing the quiz information
+ * @param context pointer to the structure containing the service context information
  */
-void handle_quiz_selection(Client *client, Message *msg, QuizzesInfo *quizzesInfo)
+void handle_quiz_selection(Client *client, Message *msg, Context *context)
 {
-    uint16_t net_selected_quiz_number, selected_quiz_number;
-    memcpy(&net_selected_quiz_number, msg->payload, sizeof(net_selected_quiz_number));
-    selected_quiz_number = ntohs(net_selected_quiz_number);
+    QuizzesInfo *quizzesInfo = context->quizzesInfo;
+    uint16_t net_selected_quiz_number, selected_quiz_number = 0;
+    if (msg->payload_length == sizeof(net_selected_quiz_number))
+    {
+        memcpy(&net_selected_quiz_number, msg->payload, sizeof(net_selected_quiz_number));
+        selected_quiz_number = ntohs(net_selected_quiz_number);
+    }
 
     // Handle possible error situations
 
@@ -481,27 +721,92 @@ void handle_quiz_selection(Client *client, Message *msg, QuizzesInfo *quizzesInf
 
     // Initialize the ranking information
     Quiz *selected_quiz = quizzesInfo->quizzes[selected_quiz_number - 1];
-    selected_quiz->total_clients += 1;
     RankingNode *new_node = create_ranking_node(client);
     client->client_rankings[client->current_quiz_id] = new_node;
 
-    // Insert the node into the doubly linked ranking list for the quiz
-    insert_ranking_node(selected_quiz, new_node);
+    // Ask the owner of the quiz to insert the node into the doubly linked ranking list
+    submit_ranking_event(context, selected_quiz, RANKING_INSERT, new_node, 0);
 
-    client->state = PLAYING;
+    set_client_state(client, PLAYING);
+    PROBE2(quiz__select, client->id, selected_quiz->id);
 
     // Send the client a message confirming that a valid quiz has been selected
     send_msg(client->socket_fd, MSG_QUIZ_SELECTED, selected_quiz->name, strlen(selected_quiz->name));
 
+    // The questions of a live quiz are broadcast by its owner, the others are sent at the client's pace
+    if (selected_quiz->live)
+    {
+        join_live_round(client, context);
+        return;
+    }
+
     // Send the first question to the client
     send_quiz_question(client, selected_quiz);
+    arm_question_deadline(client, context);
+}
+
+/**
+ * @brief Disconnects a client that did not log in in time or has been inactive for too long
+ *
+ * It is the callback of the idle timer of the client, which holds the login deadline until the client logs in
+ * and is then rescheduled by every message received.
+ *
+ * @param timer pointer to the expired timer
+ * @param context pointer to the structure containing the service context information
+ */
+void handle_idle_timeout(Timer *timer, Context *context)
+{
+    Client *client = timer->data;
+    flight_record(FLIGHT_TIMEOUT, client->state, client->id, client->socket_fd, 0);
+    printf("The client %s timed out\n", client->state == LOGIN ? "did not log in and" : "was inactive and");
+    handle_client_disconnection(client, context);
+}
+
+/**
+ * @brief Moves on a client that did not answer the current question in time
+ *
+ * The question is counted as unanswered and the next one is sent, or the quiz completed if it was the last.
+ * The deadline is cancelled whenever the client stops playing the quiz, and it never applies to the live
+ * quizzes, whose rounds are closed by their owner: an expiration in any other situation is ignored.
+ *
+ * @param timer pointer to the expired timer
+ * @param context pointer to the structure containing the service context information
+ */
+void handle_question_timeout(Timer *timer, Context *context)
+{
+    Client *client = timer->data;
+    if (client->state != PLAYING || client->live)
+        return;
+    flight_record(FLIGHT_TIMEOUT, client->state, client->id, client->socket_fd, 1);
+    char *message = "Time is up";
+    send_msg(client->socket_fd, MSG_INFO, message, strlen(message));
+    advance_quiz(client, context);
 }
 
 /**
  * @brief Sends the ranking for each quiz to the client
  *
- * This function is invoked after receiving a MSG_REQ_RANKING message from the client,
- * and it serializes the clients' ranking for each quiz using the binary protocol and sends it to the client.
+ * This function is invoked after receiving a MSG_REQ_RANKING message from the client, and it
+ * serializes the rankings with the encoder of the protocol version negotiated with the client.
+ *
+ * @param client pointer to the client to which the ranking is sent
+ * @param context pointer to the structure containing the service context information
+ */
+void send_ranking(Client *client, Context *context)
+{
+    size_t payload_size = client->codec->encode_ranking(context);
+    // Send the payload to the client in a MSG_RES_RANKING message, if it is not too large for the client
+    send_bounded_msg(client, MSG_RES_RANKING, context->ranking_buffer, payload_size);
+    send_client_prompt(client, context);
+}
+
+/**
+ * @brief Serializes the ranking for each quiz using the version 1 protocol
+ *
+ * It serializes the clients' ranking for each quiz using the binary protocol in the ranking buffer of the worker,
+ * which is kept in the context and reused by the following requests.
+ * Each ranking is copied from the snapshot published by the owner of its quiz, which is already serialized,
+ * so no lock is taken; the rankings owned by the current worker are brought up to date first.
  *
  * In particular, it uses the htons function to convert data from host byte order to network byte order,
  * and uses standardized uint16_t types to ensure portability.
@@ -509,22 +814,29 @@ void handle_quiz_selection(Client *client, Message *msg, QuizzesInfo *quizzesInf
  * The quiz ranking data will be serialized in the following binary protocol format:
  * (number of quizzes)  {(number of users participating in the quiz) [(name length) (name) (score)]} {...}
  * where the parentheses indicate the level of nesting and are not actually part of the transmitted data.
+ * Only the first UINT16_MAX users of each ranking fit in this format; the clients that negotiated the
+ * version 2 protocol receive the whole rankings from encode_ranking_v2.
  *
- * @param client pointer to the client to which the ranking is sent
- * @param quizzesInfo pointer to the structure containing the quiz information
+ * @param context pointer to the structure containing the service context information
+ * @return length of the payload in the ranking buffer
  */
-void send_ranking(Client *client, QuizzesInfo *quizzesInfo)
+size_t encode_ranking_v1(Context *context)
 {
-    // Allocate a standard-sized buffer that can be expanded if needed
-    size_t buffer_size = DEFAULT_PAYLOAD_SIZE;
-    char *payload = (char *)malloc(buffer_size);
-    handle_malloc_error(payload, "Error allocating payload");
+    QuizzesInfo *quizzesInfo = context->quizzesInfo;
+    // Reuse the buffer of the previous requests, allocating a standard-sized one that can be expanded if needed
+    if (!context->ranking_buffer)
+    {
+        context->ranking_buffer_size = DEFAULT_PAYLOAD_SIZE;
+        context->ranking_buffer = (char *)malloc(context->ranking_buffer_size);
+        handle_malloc_error(context->ranking_buffer, "Error allocating payload");
+    }
+    size_t buffer_size = context->ranking_buffer_size;
+    char *payload = context->ranking_buffer;
 
     // Allocate the necessary data structures
     char *pointer = payload;
-    size_t string_len;
-    uint16_t net_string_len, net_client_score, net_clients_per_quiz;
-    int payload_size;
+
+    process_ranking_events(context);
 
     // Insert the total number of quizzes for which the ranking will be printed
     uint16_t net_quizzes_num = htons(quizzesInfo->total_quizzes);
@@ -537,49 +849,40 @@ void send_ranking(Client *client, QuizzesInfo *quizzesInfo)
     for (uint16_t i = 0; i < quizzesInfo->total_quizzes; i++)
     {
         Quiz *quiz = quizzesInfo->quizzes[i];
-        // Insert the number of clients in the ranking for the quiz
-        net_clients_per_quiz = htons(quiz->total_clients);
-        ensure_capacity(&payload, &pointer, &buffer_size, sizeof(uint16_t));
-        memcpy(pointer, &net_clients_per_quiz, sizeof(uint16_t));
-        pointer += sizeof(uint16_t);
-
-        RankingNode *current = quiz->ranking_head;
-        // Traverse the ranking list for the quiz
-        while (current)
-        {
-            string_len = strlen(current->client->nickname);
-            net_string_len = htons(string_len);
-
-            // Handle the situation where the allocated buffer is not large enough
-            ensure_capacity(&payload, &pointer, &buffer_size, sizeof(uint16_t) + string_len + sizeof(uint16_t));
-
-            // Insert the length of the current client's nickname
-            memcpy(pointer, &net_string_len, sizeof(uint16_t));
-            pointer += sizeof(uint16_t);
-
-            // Insert the current client's nickname
-            memcpy(pointer, current->client->nickname, string_len);
-            pointer += string_len;
-
-            // Insert the current client's score
-            net_client_score = htons(current->score);
-            memcpy(pointer, &net_client_score, sizeof(uint16_t));
-            pointer += sizeof(uint16_t);
-            current = current->next_node;
-        }
+        RankingSnapshot *snapshot = acquire_ranking_snapshot(quiz);
+        // Handle the situation where the allocated buffer is not large enough
+        ensure_capacity(&payload, &pointer, &buffer_size, snapshot->length);
+        memcpy(pointer, snapshot->data, snapshot->length);
+        pointer += snapshot->length;
+        release_ranking_snapshot(quiz, snapshot);
     }
-    payload_size = pointer - payload;
-    // Send the payload to the client in a MSG_RES_RANKING message
-    send_msg(client->socket_fd, MSG_RES_RANKING, payload, payload_size);
 
-    free(payload);
+    // Keep the buffer, which might have been reallocated, for the next requests
+    context->ranking_buffer = payload;
+    context->ranking_buffer_size = buffer_size;
+    return pointer - payload;
+}
+
+/**
+ * @brief Sends again to a client what it was responding to before requesting the ranking
+ *
+ * @param client pointer to the client
+ * @param context pointer to the structure containing the service context information
+ */
+void send_client_prompt(Client *client, Context *context)
+{
+    QuizzesInfo *quizzesInfo = context->quizzesInfo;
 
     // Based on the client's current state, send a different message
     switch (client->state)
     {
     case PLAYING:
-        // If the client is in a quiz session, send the question to answer
-        send_quiz_question(client, quizzesInfo->quizzes[client->current_quiz_id]);
+        // If the client is in a quiz session, send the question to answer; the live participants instead
+        // give up the question they were sent, and receive the next one with the other players
+        if (!client->live)
+            send_quiz_question(client, quizzesInfo->quizzes[client->current_quiz_id]);
+        else if (client->live_backlog > 0)
+            client->live_backlog--;
         break;
     case SELECTING_QUIZ:
         // If the client is selecting a quiz, send the list of quizzes
@@ -591,64 +894,245 @@ void send_ranking(Client *client, QuizzesInfo *quizzesInfo)
 }
 
 /**
- * @brief Handles the reception of a message from a client
+ * @brief Changes the state of a client
+ *
+ * Every transition goes through this function, so that it is recorded by the flight recorder.
+ *
+ * @param client pointer to the client
+ * @param state new state of the client
+ */
+void set_client_state(Client *client, ClientState state)
+{
+    flight_record(FLIGHT_STATE, state, client->id, client->state, 0);
+    client->state = state;
+}
+
+/**
+ * @brief Observes the frames sent by the server with send_msg
+ *
+ * It is registered as the send observer at startup and forwards each frame to the flight recorder
+ * and to the traffic recorder.
+ *
+ * @param fd file descriptor to which the frame has been sent
+ * @param type type of the message sent
+ * @param payload pointer to the payload of the frame
+ * @param payload_length length of the payload in bytes
+ */
+void handle_sent_frame(int fd, MessageType type, const char *payload, size_t payload_length)
+{
+    flight_record(FLIGHT_FRAME_OUT, type, fd, 0, payload_length);
+    capture_outbound(fd, type, payload, payload_length);
+    count_sent_frame(fd);
+}
+
+/**
+ * @brief Handles the reception of messages from a client
  *
- * This function is invoked each time a socket is added to the readfds set, and it handles the client's request
- * based on the type of the received message.
+ * This function is invoked each time the backend reports activity on the socket of the client, and it handles
+ * the client's requests based on the type of the received messages.
  *
- * Using the receive_msg function, it obtains the message sent by the client and handles any disconnections or errors
- * that may occur during transmission.
+ * The backend first moves the received data to the input buffer of the connection, then the buffered requests
+ * are handled by handle_client_requests.
  *
- * @param client pointer to the client that has been added to readfds
+ * @param client pointer to the client reported as ready by the backend
  * @param context pointer to the structure containing the service context information
  */
 void handle_client(Client *client, Context *context)
+{
+    context->io->receive(context, client->socket_fd);
+    handle_client_requests(client, context);
+}
+
+/**
+ * @brief Handles the requests buffered in the connection of a client
+ *
+ * Every complete frame is obtained with the receive_msg function and handled, so that the requests sent together
+ * cost a single wake-up. A request over the rate limit of its class stops the loop, which is resumed by the
+ * throttle timer of the client. Disconnections and errors that may occur during transmission are reported once
+ * no complete frame is left.
+ *
+ * @param client pointer to the client
+ * @param context pointer to the structure containing the service context information
+ */
+void handle_client_requests(Client *client, Context *context)
 {
     Message received_msg;
-    int res = receive_msg(client->socket_fd, &received_msg);
+    for (;;)
+    {
+        if (throttle_next_request(client, context))
+            return;
+        int res = receive_msg_into(client->socket_fd, &received_msg, &client->input_buffer, &client->input_buffer_size);
+        // Wait for the rest of the next frame
+        if (res == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return;
+        if (handle_client_message(client, &received_msg, res, context) == -1)
+            return;
+    }
+}
+
+/**
+ * @brief Tells why a request cannot be handled in the current state of the client
+ *
+ * Playing and receiving the rankings require a nickname, since they create nodes in the rankings
+ * or refer to the ones of the client. The optional message types are only handled if the client
+ * has negotiated their feature in its MSG_HELLO.
+ *
+ * @param client pointer to the client that sent the request
+ * @param type type of the request
+ * @return message explaining the rejection to the client, or NULL if the request can be handled
+ */
+char *reject_client_request(Client *client, MessageType type)
+{
+    switch (type)
+    {
+    case MSG_QUIZ_SELECT:
+    case MSG_QUIZ_ANSWER:
+    case MSG_QUIZ_SUBMIT:
+    case MSG_REQ_RANKING:
+    case MSG_SUBSCRIBE_RANKING:
+        if (client->state == LOGIN)
+            return "Choose a nickname first";
+        break;
+    default:
+        break;
+    }
+
+    uint32_t required;
+    switch (type)
+    {
+    case MSG_QUIZ_SUBMIT:
+        required = FEATURE_QUIZ_RESULT;
+        break;
+    case MSG_SUBSCRIBE_RANKING:
+        required = FEATURE_RANKING_DELTAS;
+        break;
+    case MSG_SPECTATE:
+        required = FEATURE_SPECTATE;
+        break;
+    default:
+        return NULL;
+    }
+    return client->capabilities.features & required ? NULL : "The feature has not been negotiated";
+}
+
+/**
+ * @brief Handles a message received from a client, or the error that occurred while receiving it
+ *
+ * @param client pointer to the client that sent the message
+ * @param message pointer to the received message
+ * @param res result of receive_msg_into
+ * @param context pointer to the structure containing the service context information
+ * @return 0 if the client is still connected, -1 if it has been disconnected and deallocated
+ */
+int handle_client_message(Client *client, Message *message, int res, Context *context)
+{
+    Message received_msg = *message;
     if (res == 0)
     {
         printf("The client closed the connection gracefully\n");
         handle_client_disconnection(client, context);
-        return;
+        return -1;
     }
     else if (res == -1)
     {
-        if (errno == ECONNRESET || errno == ETIMEDOUT || errno == EPIPE)
+        if (errno == EMSGSIZE || errno == ENOBUFS)
+        {
+            disconnect_abusive_client(client, errno, context);
+            return -1;
+        }
+        else if (errno == ECONNRESET || errno == ETIMEDOUT || errno == EPIPE)
         {
             printf("The client closed the connection abnormally\n");
             handle_client_disconnection(client, context);
-            return;
+            return -1;
         }
         else
         {
             printf("Critical error on the server\n");
+            flight_record(FLIGHT_ERROR, FLIGHT_ERROR_RECEIVE, client->id, errno, 0);
             exit(EXIT_FAILURE);
         }
     }
 
-    switch (received_msg.type)
+    capture_inbound(client, &received_msg);
+    count_io(&context->io_stats.frames_in, 1);
+    flight_record(FLIGHT_FRAME_IN, received_msg.type, client->id, client->socket_fd, received_msg.payload_length);
+    PROBE3(msg__receive, client->id, received_msg.type, received_msg.payload_length);
+
+    // The client might be deallocated by the handler, so keep its id for the probes
+    uint32_t conn_id = client->id;
+    PROBE2(msg__dispatch__start, conn_id, received_msg.type);
+
+    // Attribute the allocations performed while handling the message to its type
+    int previous_scope = alloc_stats_enter(received_msg.type);
+
+    // Spectators only receive the rankings of the quizzes they watch
+    MessageType type = received_msg.type;
+    if (client->state == SPECTATING && type != MSG_DISCONNECT)
+        type = MSG_TYPES_COUNT;
+
+    // The requests the client is not allowed to make yet are answered with the reason and otherwise ignored
+    char *rejection = type == MSG_TYPES_COUNT ? NULL : reject_client_request(client, type);
+    if (rejection)
     {
+        send_msg(client->socket_fd, MSG_INFO, rejection, strlen(rejection));
+        type = MSG_TYPES_COUNT;
+    }
+
+    switch (type)
+    {
+    case MSG_HELLO:
+        handle_hello(client, &received_msg);
+        break;
+    case MSG_SPECTATE:
+        handle_spectate(client, &received_msg, context);
+        break;
     case MSG_SET_NICKNAME:
-        handle_client_nickname(client, &received_msg, &context->clientsInfo);
+        handle_client_nickname(client, &received_msg, context);
+        break;
+    case MSG_RESUME_SESSION:
+        handle_resume_session(client, &received_msg, context);
         break;
     case MSG_REQ_QUIZ_LIST:
-        send_quiz_list(client, &context->quizzesInfo);
+        leave_quiz(client, context);
+        send_quiz_list(client, context->quizzesInfo);
         break;
     case MSG_QUIZ_SELECT:
-        handle_quiz_selection(client, &received_msg, &context->quizzesInfo);
+        leave_quiz(client, context);
+        handle_quiz_selection(client, &received_msg, context);
         break;
     case MSG_QUIZ_ANSWER:
-        handle_quiz_answer(client, &received_msg, &context->quizzesInfo);
+    case MSG_QUIZ_SUBMIT:
+        handle_quiz_answer(client, &received_msg, context);
         break;
     case MSG_REQ_RANKING:
-        send_ranking(client, &context->quizzesInfo);
+        handle_ranking_request(client, context);
+        break;
+    case MSG_SUBSCRIBE_RANKING:
+        subscribe_rankings(client, context);
         break;
     case MSG_DISCONNECT:
+        // The player is leaving, so its session is not kept
+        client->resumable = false;
         handle_client_disconnection(client, context);
         break;
     default:
         break;
     }
-    free(received_msg.payload);
+    alloc_stats_enter(previous_scope);
+    PROBE2(msg__dispatch__done, conn_id, received_msg.type);
+
+    // The client has been deallocated by the disconnection
+    if (received_msg.type == MSG_DISCONNECT)
+        return -1;
+
+    // Any message postpones the inactivity timeout, while the login deadline is kept until the client logs in
+    if (client->state != LOGIN && client->state != SPECTATING)
+    {
+        if (context->timeouts.idle_ms)
+            schedule_timer(&context->timers, &client->idle_timer, context->timeouts.idle_ms);
+        else
+            cancel_timer(&context->timers, &client->idle_timer);
+    }
+    return 0;
 }
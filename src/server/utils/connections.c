@@ -0,0 +1,582 @@
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include "utils.h"
+#include "../../common/params.h"
+
+// Connections indexed by the file descriptor of their socket
+static Connection **connection_table = NULL;
+// Number of entries of the table, equal to the limit on the open file descriptors
+static size_t connection_table_size = 0;
+
+/**
+ * @brief Allocates the table of the connections, large enough for every file descriptor the process can open
+ *
+ * Each entry is only accessed by the worker handling the connection, so the table needs no lock.
+ */
+void init_connection_table()
+{
+    struct rlimit limit;
+    connection_table_size = 1024;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur != RLIM_INFINITY)
+        connection_table_size = limit.rlim_cur;
+    connection_table = calloc(connection_table_size, sizeof(Connection *));
+    handle_malloc_error(connection_table, "Memory allocation error for the connection table");
+}
+
+/**
+ * @brief Deallocates the table of the connections
+ */
+void deallocate_connection_table()
+{
+    free(connection_table);
+    connection_table = NULL;
+    connection_table_size = 0;
+}
+
+/**
+ * @brief Creates the buffers of a new client connection
+ *
+ * @param context pointer to the context of the worker handling the connection
+ * @param fd file descriptor of the socket
+ * @return pointer to the new connection
+ */
+Connection *open_connection(Context *context, int fd)
+{
+    if (fd < 0 || (size_t)fd >= connection_table_size)
+    {
+        printf("File descriptor %d exceeds the connection table\n", fd);
+        exit(EXIT_FAILURE);
+    }
+    Connection *connection = calloc(1, sizeof(Connection));
+    handle_malloc_error(connection, "Memory allocation error for a connection");
+    connection->fd = fd;
+    connection->worker = context;
+    connection_table[fd] = connection;
+    return connection;
+}
+
+/**
+ * @brief Returns the connection of a socket, NULL if the socket is not a client connection
+ */
+Connection *find_connection(int fd)
+{
+    if (fd < 0 || (size_t)fd >= connection_table_size)
+        return NULL;
+    return connection_table[fd];
+}
+
+/**
+ * @brief Detaches a connection from its socket and from the flush list of its worker
+ *
+ * The connection is not deallocated, since the kernel might still reference its buffers.
+ *
+ * @param connection pointer to the connection
+ */
+void release_connection(Connection *connection)
+{
+    if (connection_table[connection->fd] == connection)
+        connection_table[connection->fd] = NULL;
+
+    if (connection->flush_queued)
+    {
+        for (Connection **link = &connection->worker->flush_head; *link; link = &(*link)->next_flush)
+        {
+            if (*link == connection)
+            {
+                *link = connection->next_flush;
+                break;
+            }
+        }
+        connection->flush_queued = false;
+    }
+    connection->next_flush = NULL;
+    connection->released = true;
+}
+
+/**
+ * @brief Deallocates a connection and its buffers
+ *
+ * @param connection pointer to the connection
+ */
+void free_connection(Connection *connection)
+{
+    discard_output(connection);
+    free(connection->shared);
+    free(connection->sending_shared);
+    free(connection->input);
+    free(connection->output);
+    free(connection->sending);
+    free(connection);
+}
+
+/**
+ * @brief Makes room at the end of the input buffer of a connection
+ *
+ * The data not yet consumed is moved to the beginning of the buffer, which is enlarged only if it is still too small.
+ *
+ * @param connection pointer to the connection
+ * @param length number of bytes to make room for
+ * @return pointer to the free space, at least length bytes long
+ */
+char *reserve_input(Connection *connection, size_t length)
+{
+    if (connection->input_capacity - connection->input_length >= length)
+        return connection->input + connection->input_length;
+
+    if (connection->input_offset > 0)
+    {
+        connection->input_length -= connection->input_offset;
+        memmove(connection->input, connection->input + connection->input_offset, connection->input_length);
+        connection->input_offset = 0;
+    }
+    if (connection->input_capacity - connection->input_length < length)
+    {
+        size_t new_capacity = connection->input_capacity ? connection->input_capacity : RECEIVE_CHUNK_SIZE;
+        while (new_capacity - connection->input_length < length)
+            new_capacity *= 2;
+        char *new_input = realloc(connection->input, new_capacity);
+        handle_malloc_error(new_input, "Memory allocation error for the input of a connection");
+        connection->input = new_input;
+        connection->input_capacity = new_capacity;
+    }
+    return connection->input + connection->input_length;
+}
+
+/**
+ * @brief Adds a connection to the list of the connections whose output is sent at the end of the iteration
+ *
+ * @param connection pointer to the connection
+ */
+void queue_flush(Connection *connection)
+{
+    if (connection->flush_queued || connection->released)
+        return;
+    connection->next_flush = connection->worker->flush_head;
+    connection->worker->flush_head = connection;
+    connection->flush_queued = true;
+}
+
+/**
+ * @brief Moves the buffered output of a connection to its sending buffer, if the previous one has been sent
+ *
+ * @param connection pointer to the connection
+ * @return true if the sending buffer contains data to send
+ */
+bool take_output(Connection *connection)
+{
+    if (connection->sending_offset < connection->sending_total)
+        return true;
+    release_shared_segments(connection->sending_shared, &connection->sending_shared_count);
+    if (connection->output_length == 0 && connection->shared_count == 0)
+        return false;
+
+    // Swap the buffers, so that both keep their allocation
+    char *buffer = connection->sending;
+    size_t capacity = connection->sending_capacity;
+    connection->sending = connection->output;
+    connection->sending_capacity = connection->output_capacity;
+    connection->sending_length = connection->output_length;
+    connection->sending_offset = 0;
+    connection->output = buffer;
+    connection->output_capacity = capacity;
+    connection->output_length = 0;
+
+    SharedSegment *segments = connection->sending_shared;
+    capacity = connection->sending_shared_capacity;
+    connection->sending_shared = connection->shared;
+    connection->sending_shared_capacity = connection->shared_capacity;
+    connection->sending_shared_count = connection->shared_count;
+    connection->shared = segments;
+    connection->shared_capacity = capacity;
+    connection->shared_count = 0;
+
+    connection->sending_total = connection->sending_length;
+    for (size_t i = 0; i < connection->sending_shared_count; i++)
+        connection->sending_total += connection->sending_shared[i].frame->length;
+    return true;
+}
+
+/**
+ * @brief Releases the shared frames referenced by an array of segments and empties it
+ *
+ * @param segments array of the segments
+ * @param count pointer to the number of segments, set to 0
+ */
+void release_shared_segments(SharedSegment *segments, size_t *count)
+{
+    for (size_t i = 0; i < *count; i++)
+        release_shared_frame(segments[i].frame);
+    *count = 0;
+}
+
+/**
+ * @brief Discards the output of a connection that can no longer be sent, releasing its shared frames
+ *
+ * @param connection pointer to the connection
+ */
+void discard_output(Connection *connection)
+{
+    release_shared_segments(connection->shared, &connection->shared_count);
+    release_shared_segments(connection->sending_shared, &connection->sending_shared_count);
+    connection->output_length = 0;
+    connection->sending_length = connection->sending_offset = connection->sending_total = 0;
+}
+
+/**
+ * @brief Describes the part of the sending buffer not yet accepted by the kernel as an array of pieces
+ *
+ * The private frames are interleaved with the shared ones in the order they were sent by the handlers.
+ * When the pieces exceed the array, the rest is described once the first ones have been sent.
+ *
+ * @param connection pointer to the connection
+ * @param iov array filled with the pieces
+ * @param max_pieces size of the array
+ * @return number of pieces
+ */
+int fill_send_iov(Connection *connection, struct iovec *iov, int max_pieces)
+{
+    size_t skip = connection->sending_offset, private_start = 0;
+    int pieces = 0;
+
+    for (size_t i = 0; i <= connection->sending_shared_count && pieces < max_pieces; i++)
+    {
+        bool last = i == connection->sending_shared_count;
+        size_t private_end = last ? connection->sending_length : connection->sending_shared[i].position;
+        char *chunks[2] = {connection->sending + private_start, last ? NULL : connection->sending_shared[i].frame->data};
+        size_t lengths[2] = {private_end - private_start, last ? 0 : connection->sending_shared[i].frame->length};
+
+        for (int c = 0; c < 2 && pieces < max_pieces; c++)
+        {
+            if (lengths[c] <= skip)
+            {
+                skip -= lengths[c];
+                continue;
+            }
+            iov[pieces].iov_base = chunks[c] + skip;
+            iov[pieces].iov_len = lengths[c] - skip;
+            pieces++;
+            skip = 0;
+        }
+        private_start = private_end;
+    }
+    return pieces;
+}
+
+/**
+ * @brief Sends the pending part of the sending buffer of a connection without blocking
+ *
+ * @param connection pointer to the connection
+ * @return number of bytes accepted by the kernel, or -1 in case of error
+ */
+ssize_t send_pending_output(Connection *connection)
+{
+    struct iovec iov[SEND_IOV_MAX];
+    struct msghdr message = {.msg_iov = iov, .msg_iovlen = fill_send_iov(connection, iov, SEND_IOV_MAX)};
+    if (message.msg_iovlen == 1)
+        return send(connection->fd, iov[0].iov_base, iov[0].iov_len, MSG_DONTWAIT | MSG_NOSIGNAL);
+    return sendmsg(connection->fd, &message, MSG_DONTWAIT | MSG_NOSIGNAL);
+}
+
+/**
+ * @brief Allocates a frame that is sent to many connections without being copied, writing its header
+ *
+ * The payload, which follows the header, is filled in by the caller.
+ *
+ * @param type type of the message
+ * @param payload_length length of the payload in bytes
+ * @param references initial number of references, released by their holders with release_shared_frame
+ * @return pointer to the new frame
+ */
+SharedFrame *allocate_shared_frame(MessageType type, size_t payload_length, unsigned int references)
+{
+    SharedFrame *frame = malloc(sizeof(SharedFrame) + FRAME_HEADER_SIZE + payload_length);
+    handle_malloc_error(frame, "Memory allocation error for a shared frame");
+    uint32_t net_payload_length = htonl(payload_length);
+    frame->references = references;
+    frame->key = 0;
+    frame->length = FRAME_HEADER_SIZE + payload_length;
+    frame->data[0] = type;
+    memcpy(frame->data + sizeof(uint8_t), &net_payload_length, sizeof(uint32_t));
+    return frame;
+}
+
+/**
+ * @brief Serializes a frame that is sent to many connections without being copied
+ *
+ * @param type type of the message
+ * @param payload pointer to the payload
+ * @param payload_length length of the payload in bytes
+ * @param references initial number of references, released by their holders with release_shared_frame
+ * @return pointer to the new frame
+ */
+SharedFrame *create_shared_frame(MessageType type, const char *payload, size_t payload_length, unsigned int references)
+{
+    SharedFrame *frame = allocate_shared_frame(type, payload_length, references);
+    memcpy(frame->data + FRAME_HEADER_SIZE, payload, payload_length);
+    return frame;
+}
+
+/**
+ * @brief Releases a reference to a shared frame, deallocating it with the last one
+ *
+ * @param frame pointer to the frame
+ */
+void release_shared_frame(SharedFrame *frame)
+{
+    if (__atomic_sub_fetch(&frame->references, 1, __ATOMIC_ACQ_REL) == 0)
+        free(frame);
+}
+
+/**
+ * @brief Sends a shared frame to a client, after the frames already sent to it
+ *
+ * The output of the connection references the frame, which is not copied; the sockets that are not
+ * client connections of the server receive a copy through the transport.
+ * A frame with a key replaces the frame with the same key still waiting in the output, so a connection
+ * that cannot keep up only receives the latest state instead of accumulating the intermediate ones.
+ *
+ * @param fd file descriptor of the socket of the client
+ * @param frame pointer to the frame
+ */
+void send_shared_frame(int fd, SharedFrame *frame)
+{
+    MessageType type = (uint8_t)frame->data[0];
+    Connection *connection = find_connection(fd);
+    if (!connection)
+    {
+        send_msg(fd, type, frame->data + FRAME_HEADER_SIZE, frame->length - FRAME_HEADER_SIZE);
+        return;
+    }
+    if (connection->error)
+        return;
+
+    __atomic_add_fetch(&frame->references, 1, __ATOMIC_RELAXED);
+    for (size_t i = 0; frame->key && i < connection->shared_count; i++)
+    {
+        if (connection->shared[i].frame->key != frame->key)
+            continue;
+        release_shared_frame(connection->shared[i].frame);
+        connection->shared[i].frame = frame;
+        return;
+    }
+
+    if (connection->shared_count == connection->shared_capacity)
+    {
+        connection->shared_capacity = connection->shared_capacity ? connection->shared_capacity * 2 : 4;
+        connection->shared = realloc(connection->shared, connection->shared_capacity * sizeof(SharedSegment));
+        handle_malloc_error(connection->shared, "Memory allocation error for the shared output of a connection");
+    }
+    connection->shared[connection->shared_count].frame = frame;
+    connection->shared[connection->shared_count].position = connection->output_length;
+    connection->shared_count++;
+    queue_flush(connection);
+    handle_sent_frame(fd, type, frame->data + FRAME_HEADER_SIZE, frame->length - FRAME_HEADER_SIZE);
+    check_memory_budget(connection);
+}
+
+/**
+ * @brief Computes the memory used by a connection: its buffers and the shared frames it keeps alive
+ *
+ * The shared frames are counted in full, since the connection prevents them from being deallocated.
+ *
+ * @param connection pointer to the connection
+ * @return memory used in bytes
+ */
+size_t connection_memory(Connection *connection)
+{
+    size_t memory = sizeof(Connection) + connection->input_capacity + connection->output_capacity +
+                    connection->sending_capacity +
+                    (connection->shared_capacity + connection->sending_shared_capacity) * sizeof(SharedSegment);
+    for (size_t i = 0; i < connection->shared_count; i++)
+        memory += connection->shared[i].frame->length;
+    for (size_t i = 0; i < connection->sending_shared_count; i++)
+        memory += connection->sending_shared[i].frame->length;
+    return memory;
+}
+
+/**
+ * @brief Adds an amount to a counter of a worker, which is read by the dashboard from another thread
+ *
+ * @param counter pointer to the counter, only written by the worker
+ * @param amount amount to add
+ */
+void count_io(uint64_t *counter, uint64_t amount)
+{
+    __atomic_store_n(counter, *counter + amount, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Counts a frame sent on a client connection in the statistics of its worker
+ *
+ * @param fd file descriptor of the socket
+ */
+void count_sent_frame(int fd)
+{
+    Connection *connection = find_connection(fd);
+    if (connection)
+        count_io(&connection->worker->io_stats.frames_out, 1);
+}
+
+/**
+ * @brief Configures the socket of a new client
+ *
+ * The frames of an iteration are already coalesced by the server, so Nagle's algorithm would only delay them.
+ * The keepalive probes sent by the kernel detect the peers that vanished without closing the connection,
+ * which is then reported as ETIMEDOUT, without requiring the clients to answer application-level pings.
+ *
+ * @param fd file descriptor of the socket
+ */
+void configure_client_socket(int fd)
+{
+    int opt = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
+    setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, &opt, sizeof(opt));
+    opt = KEEPALIVE_IDLE_S;
+    setsockopt(fd, IPPROTO_TCP, TCP_KEEPIDLE, &opt, sizeof(opt));
+    opt = KEEPALIVE_INTERVAL_S;
+    setsockopt(fd, IPPROTO_TCP, TCP_KEEPINTVL, &opt, sizeof(opt));
+    opt = KEEPALIVE_PROBES;
+    setsockopt(fd, IPPROTO_TCP, TCP_KEEPCNT, &opt, sizeof(opt));
+}
+
+/**
+ * @brief Tells if the input buffer of a connection contains a complete frame
+ */
+bool frame_available(Connection *connection)
+{
+    size_t available = connection->input_length - connection->input_offset;
+    uint32_t net_payload_length;
+
+    if (available < FRAME_HEADER_SIZE)
+        return false;
+    memcpy(&net_payload_length, connection->input + connection->input_offset + sizeof(uint8_t), sizeof(uint32_t));
+    return available - FRAME_HEADER_SIZE >= ntohl(net_payload_length);
+}
+
+/**
+ * @brief Tells if the next frame of the input buffer of a connection announces a payload larger than allowed for its type
+ *
+ * It only needs the header, so the frame is refused before the rest of it is buffered.
+ */
+bool frame_oversized(Connection *connection)
+{
+    uint32_t net_payload_length;
+    if (connection->input_length - connection->input_offset < FRAME_HEADER_SIZE)
+        return false;
+    memcpy(&net_payload_length, connection->input + connection->input_offset + sizeof(uint8_t), sizeof(uint32_t));
+    return ntohl(net_payload_length) > request_payload_limit((uint8_t)connection->input[connection->input_offset]);
+}
+
+/**
+ * @brief Returns the type of the next frame of the input buffer of a connection, without consuming it
+ *
+ * @param connection pointer to the connection
+ * @return type of the frame, -1 if no complete frame is buffered
+ */
+int next_frame_type(Connection *connection)
+{
+    if (!frame_available(connection))
+        return -1;
+    return (uint8_t)connection->input[connection->input_offset];
+}
+
+/**
+ * @brief Transport primitive that appends the data sent by the handlers to the output buffer of the connection
+ */
+ssize_t connection_send(int fd, const void *buffer, size_t length)
+{
+    Connection *connection = find_connection(fd);
+    if (!connection)
+    {
+        errno = EBADF;
+        return -1;
+    }
+    // The output of a connection that failed is never sent
+    if (connection->error)
+        return length;
+
+    if (connection->output_capacity - connection->output_length < length)
+    {
+        size_t new_capacity = connection->output_capacity ? connection->output_capacity : DEFAULT_PAYLOAD_SIZE;
+        while (new_capacity - connection->output_length < length)
+            new_capacity *= 2;
+        char *new_output = realloc(connection->output, new_capacity);
+        handle_malloc_error(new_output, "Memory allocation error for the output of a connection");
+        connection->output = new_output;
+        connection->output_capacity = new_capacity;
+    }
+    memcpy(connection->output + connection->output_length, buffer, length);
+    connection->output_length += length;
+    queue_flush(connection);
+    check_memory_budget(connection);
+    return length;
+}
+
+/**
+ * @brief Transport primitive that reads the data of a frame from the input buffer of the connection
+ *
+ * A frame is handed out only once it has been completely received, so a message is never parsed from
+ * partial data: when the next frame is incomplete, the call fails with EAGAIN, unless the peer has closed
+ * the connection or an error has occurred, which are reported with the semantics of recv. A frame announcing
+ * a payload larger than allowed for its type fails with EMSGSIZE as soon as its header is received.
+ */
+ssize_t connection_recv(int fd, void *buffer, size_t length)
+{
+    Connection *connection = find_connection(fd);
+    if (!connection)
+    {
+        errno = EBADF;
+        return -1;
+    }
+
+    if (connection->frame_remaining == 0)
+    {
+        // The data following an oversized frame cannot be parsed, so the connection is dropped
+        if (frame_oversized(connection))
+        {
+            connection->error = EMSGSIZE;
+            connection->input_offset = connection->input_length = 0;
+        }
+        if (!frame_available(connection))
+        {
+            if (connection->error)
+            {
+                errno = connection->error;
+                return -1;
+            }
+            if (connection->closed)
+                return 0;
+            errno = EAGAIN;
+            return -1;
+        }
+        uint32_t net_payload_length;
+        memcpy(&net_payload_length, connection->input + connection->input_offset + sizeof(uint8_t), sizeof(uint32_t));
+        connection->frame_remaining = FRAME_HEADER_SIZE + ntohl(net_payload_length);
+    }
+
+    if (length > connection->frame_remaining)
+        length = connection->frame_remaining;
+    memcpy(buffer, connection->input + connection->input_offset, length);
+    connection->input_offset += length;
+    connection->frame_remaining -= length;
+    if (connection->input_offset == connection->input_length)
+        connection->input_offset = connection->input_length = 0;
+    return length;
+}
+
+/**
+ * @brief Transport primitive that closes the socket of a connection, already released by the backend
+ */
+int connection_close(int fd)
+{
+    return close(fd);
+}
+
+// Transport of the server, which exchanges the frames through the buffers of the connections
+const Transport connection_transport = {connection_send, connection_recv, connection_close};
@@ -15,20 +15,81 @@ void show_quiz_names(QuizzesInfo *quizzesInfo)
 }
 
 /**
- * @brief Displays the number of connected clients and their nicknames
+ * @brief Displays the number of clients handled by each worker, the system calls it issues for each frame,
+ * the rate at which the connections are accepted and the timers of the workers
  *
- * @param clientsInfo pointer to the structure containing client information
+ * @param workers array of the contexts of the workers
+ * @param total_workers number of workers
  */
-void show_clients(ClientsInfo *clientsInfo)
+void show_workers(Context *workers, unsigned int total_workers)
 {
-  printf("\nParticipants (%d)\n", clientsInfo->connected_clients);
-  Client *current_client = clientsInfo->clients_head;
-  while (current_client)
+  printf("Workers (%u):", total_workers);
+  for (unsigned int i = 0; i < total_workers; i++)
+    printf(" %u", __atomic_load_n(&workers[i].clientsInfo.connected_clients, __ATOMIC_RELAXED));
+  printf("\n");
+
+  // System calls issued for each frame received or sent by the worker
+  printf("Syscalls/frame (%s):", workers[0].io->name);
+  for (unsigned int i = 0; i < total_workers; i++)
+  {
+    uint64_t syscalls = __atomic_load_n(&workers[i].io_stats.syscalls, __ATOMIC_RELAXED);
+    uint64_t frames = __atomic_load_n(&workers[i].io_stats.frames_in, __ATOMIC_RELAXED) +
+                      __atomic_load_n(&workers[i].io_stats.frames_out, __ATOMIC_RELAXED);
+    printf(" %.2f", frames ? (double)syscalls / frames : 0.0);
+  }
+  printf("\n");
+
+  // Rate of the connections accepted since the previous refresh of the dashboard
+  static uint64_t previous_accepted = 0, previous_ns = 0;
+  uint64_t accepted = 0, deferred = 0, rejected = 0, now_ns = get_time_ns();
+  for (unsigned int i = 0; i < total_workers; i++)
+  {
+    accepted += __atomic_load_n(&workers[i].io_stats.accepted, __ATOMIC_RELAXED);
+    deferred += __atomic_load_n(&workers[i].io_stats.deferred, __ATOMIC_RELAXED);
+    rejected += __atomic_load_n(&workers[i].io_stats.rejected, __ATOMIC_RELAXED);
+  }
+  double rate = previous_ns && now_ns > previous_ns ? (accepted - previous_accepted) * 1e9 / (now_ns - previous_ns) : 0.0;
+  printf("Accepted: %lu (%.0f/s), budget exhausted %lu times, %lu rejected over the select limit\n", (unsigned long)accepted,
+         rate, (unsigned long)deferred, (unsigned long)rejected);
+  previous_accepted = accepted;
+  previous_ns = now_ns;
+
+  // Timeouts currently armed and expired since the start
+  uint64_t pending = 0, expired = 0;
+  for (unsigned int i = 0; i < total_workers; i++)
   {
-    if (current_client->nickname)
-      printf("- %s\n", current_client->nickname);
-    current_client = current_client->next_node;
+    pending += __atomic_load_n(&workers[i].timers.pending, __ATOMIC_RELAXED);
+    expired += __atomic_load_n(&workers[i].timers.expired, __ATOMIC_RELAXED);
   }
+  printf("Timers: %lu pending, %lu expired\n", (unsigned long)pending, (unsigned long)expired);
+}
+
+/**
+ * @brief Displays the number of connected clients and their nicknames
+ *
+ * @param nicknames pointer to the registry of the nicknames in use
+ */
+void show_clients(NicknameRegistry *nicknames)
+{
+  printf("\nParticipants (%u)\n", __atomic_load_n(&nicknames->total_nicknames, __ATOMIC_RELAXED));
+  list_nicknames(nicknames);
+}
+
+/**
+ * @brief Displays the sessions of the dropped players waiting to be resumed, once some have been kept
+ *
+ * @param sessions pointer to the registry of the sessions, NULL if the resumption is disabled
+ */
+void show_sessions(SessionRegistry *sessions)
+{
+  if (!sessions)
+    return;
+  uint64_t resumed = __atomic_load_n(&sessions->resumed, __ATOMIC_RELAXED);
+  uint64_t expired = __atomic_load_n(&sessions->expired, __ATOMIC_RELAXED);
+  unsigned int parked = __atomic_load_n(&sessions->parked, __ATOMIC_RELAXED);
+  if (parked || resumed || expired)
+    printf("Sessions waiting to be resumed: %u (%llu resumed, %llu expired)\n", parked, (unsigned long long)resumed,
+           (unsigned long long)expired);
 }
 
 /**
@@ -62,21 +123,34 @@ void show_completed_quizes(QuizzesInfo *quizzesInfo)
 /**
  * @brief Prints the server dashboard on screen
  *
- * @param context pointer to the structure containing the service context information
+ * It is called by the main thread while the workers are running, so the shared structures
+ * are read under their locks.
+ *
+ * @param workers array of the contexts of the workers
+ * @param total_workers number of workers
  */
-void show_dashboard(Context *context)
+void show_dashboard(Context *workers, unsigned int total_workers)
 {
+  QuizzesInfo *quizzesInfo = workers[0].quizzesInfo;
+
   // Clear the screen and flush the output buffer
   system("clear");
   fflush(stdout);
 
   printf("Trivia Quiz\n");
   printf("+++++++++++++++++++++++++++\n");
-  show_quiz_names(&context->quizzesInfo);
+  show_quiz_names(quizzesInfo);
+  show_workers(workers, total_workers);
+  show_memory_stats(workers, total_workers);
+  show_rate_stats(workers, total_workers);
+  show_overload_stats(workers, total_workers);
+  show_wal_stats();
   printf("+++++++++++++++++++++++++++\n");
-  show_clients(&context->clientsInfo);
-  show_scores(&context->quizzesInfo);
-  show_completed_quizes(&context->quizzesInfo);
+  show_clients(workers[0].nicknames);
+  show_sessions(workers[0].sessions);
+  show_scores(quizzesInfo);
+  show_completed_quizes(quizzesInfo);
+  show_alloc_stats();
 
   printf("\nType 'q' to terminate the server: \n");
 }
@@ -0,0 +1,268 @@
+#include <arpa/inet.h>
+#include "utils.h"
+#include "../../common/params.h"
+
+/**
+ * @brief Records the nickname of a node leaving the ranking, to be pushed with the next changes of the quiz
+ *
+ * It is called by the owner before the node is removed and deallocated.
+ *
+ * @param quiz pointer to the quiz
+ * @param node pointer to the node being removed
+ */
+void record_left_player(Quiz *quiz, RankingNode *node)
+{
+    size_t string_len = strlen(node->nickname);
+    if (!quiz->delta_left)
+    {
+        quiz->delta_left_capacity = DEFAULT_PAYLOAD_SIZE;
+        quiz->delta_left = malloc(quiz->delta_left_capacity);
+        handle_malloc_error(quiz->delta_left, "Memory allocation error for the left players");
+    }
+    char *pointer = quiz->delta_left + quiz->delta_left_length;
+    ensure_capacity(&quiz->delta_left, &pointer, &quiz->delta_left_capacity, sizeof(uint16_t) + string_len);
+
+    uint16_t net_string_len = htons(string_len);
+    memcpy(pointer, &net_string_len, sizeof(uint16_t));
+    memcpy(pointer + sizeof(uint16_t), node->nickname, string_len);
+    quiz->delta_left_length += sizeof(uint16_t) + string_len;
+    quiz->delta_left_count++;
+}
+
+/**
+ * @brief Subscribes a client to the changes of the rankings of every quiz
+ *
+ * The client receives the current ranking of each quiz in a MSG_RANKING_RESYNC frame, then the changes
+ * in MSG_RANKING_DELTA frames as they are published; afterwards it is sent the question or the quiz list
+ * it was answering, as for a MSG_REQ_RANKING request. Subscribing again only sends the rankings.
+ *
+ * @param client pointer to the client
+ * @param context pointer to the context of the worker of the client
+ */
+void subscribe_rankings(Client *client, Context *context)
+{
+    QuizzesInfo *quizzesInfo = context->quizzesInfo;
+    if (client->state == LOGIN)
+        return;
+
+    add_ranking_subscriber(client, context);
+    process_ranking_events(context);
+    for (uint16_t i = 0; i < quizzesInfo->total_quizzes; i++)
+    {
+        Quiz *quiz = quizzesInfo->quizzes[i];
+        RankingSnapshot *snapshot = acquire_ranking_snapshot(quiz);
+        SharedFrame *frame = create_ranking_resync(quiz, snapshot, 1);
+        release_ranking_snapshot(quiz, snapshot);
+        send_shared_frame(client->socket_fd, frame);
+        release_shared_frame(frame);
+    }
+    send_client_prompt(client, context);
+}
+
+/**
+ * @brief Adds a client to the ranking subscribers of its worker, if it is not subscribed yet
+ *
+ * @param client pointer to the client
+ * @param context pointer to the context of the worker of the client
+ */
+void add_ranking_subscriber(Client *client, Context *context)
+{
+    if (client->subscriber_slot != -1)
+        return;
+    if (context->total_subscribers == context->subscribers_capacity)
+    {
+        context->subscribers_capacity = context->subscribers_capacity ? context->subscribers_capacity * 2 : 16;
+        context->subscribers = realloc(context->subscribers, context->subscribers_capacity * sizeof(Client *));
+        handle_malloc_error(context->subscribers, "Memory allocation error for the ranking subscribers");
+    }
+    client->subscriber_slot = context->total_subscribers;
+    context->subscribers[context->total_subscribers++] = client;
+    // The owners read the counter after publishing, so the rankings read afterwards include any change not pushed
+    __atomic_add_fetch(&context->quizzesInfo->subscribers, 1, __ATOMIC_SEQ_CST);
+}
+
+/**
+ * @brief Removes a client from the ranking subscribers of its worker, if it is subscribed
+ *
+ * The last subscriber takes the place of the removed one.
+ *
+ * @param client pointer to the client
+ * @param context pointer to the context of the worker of the client
+ */
+void unsubscribe_rankings(Client *client, Context *context)
+{
+    if (client->subscriber_slot == -1)
+        return;
+    Client *last = context->subscribers[--context->total_subscribers];
+    context->subscribers[client->subscriber_slot] = last;
+    last->subscriber_slot = client->subscriber_slot;
+    client->subscriber_slot = -1;
+    __atomic_sub_fetch(&context->quizzesInfo->subscribers, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Serializes a snapshot of the ranking of a quiz in a MSG_RANKING_RESYNC frame
+ *
+ * The payload contains the quiz number and the version of the ranking followed by the ranking
+ * as in the MSG_RES_RANKING payload:
+ * (quiz number) (version) (number of users) [(name length) (name) (score)]
+ *
+ * @param quiz pointer to the quiz
+ * @param snapshot pointer to a snapshot of the ranking of the quiz
+ * @param references initial number of references of the frame
+ * @return pointer to the new frame
+ */
+SharedFrame *create_ranking_resync(Quiz *quiz, RankingSnapshot *snapshot, unsigned int references)
+{
+    size_t header_length = sizeof(uint16_t) + sizeof(uint32_t);
+    SharedFrame *frame = allocate_shared_frame(MSG_RANKING_RESYNC, header_length + snapshot->length, references);
+    char *pointer = frame->data + FRAME_HEADER_SIZE;
+    uint16_t quiz_number = htons(quiz->id + 1);
+    uint32_t version = htonl(snapshot->version);
+
+    memcpy(pointer, &quiz_number, sizeof(uint16_t));
+    memcpy(pointer + sizeof(uint16_t), &version, sizeof(uint32_t));
+    memcpy(pointer + header_length, snapshot->data, snapshot->length);
+    return frame;
+}
+
+/**
+ * @brief Computes the length of the payload of the changes of the ranking of a quiz since the previous snapshot
+ *
+ * @param quiz pointer to the quiz
+ * @param moved pointer in which the number of users inserted or moved is stored
+ * @return length of the payload
+ */
+size_t ranking_delta_length(Quiz *quiz, uint16_t *moved)
+{
+    size_t length = sizeof(uint16_t) + sizeof(uint32_t) + sizeof(uint16_t) + quiz->delta_left_length + sizeof(uint16_t);
+    *moved = 0;
+    for (RankingNode *current = quiz->ranking_head; current; current = current->next_node)
+    {
+        if (current->changed_version != quiz->ranking_version)
+            continue;
+        (*moved)++;
+        length += sizeof(uint16_t) + strlen(current->nickname) + 2 * sizeof(uint16_t);
+    }
+    return length;
+}
+
+/**
+ * @brief Serializes the changes of the ranking of a quiz since the previous snapshot in a MSG_RANKING_DELTA frame
+ *
+ * The payload has this format:
+ * (quiz number) (version) (number of left users) [(name length) (name)]
+ * (number of moved users) [(name length) (name) (position) (score)]
+ * The moved users are the ones inserted or whose score changed, in ranking order with their 1-based positions:
+ * the receiver removes the left and moved users from its copy of the previous version, then inserts each moved
+ * user at its position, which gives the new version since the others keep their relative order.
+ *
+ * @param quiz pointer to the quiz
+ * @param moved number of users inserted or moved, as computed by ranking_delta_length
+ * @param length length of the payload, as computed by ranking_delta_length
+ * @param references initial number of references of the frame
+ * @return pointer to the new frame
+ */
+SharedFrame *create_ranking_delta(Quiz *quiz, uint16_t moved, size_t length, unsigned int references)
+{
+    uint32_t version = quiz->ranking_version;
+    SharedFrame *frame = allocate_shared_frame(MSG_RANKING_DELTA, length, references);
+    char *pointer = frame->data + FRAME_HEADER_SIZE;
+    uint16_t net_value = htons(quiz->id + 1);
+    uint32_t net_version = htonl(version);
+    memcpy(pointer, &net_value, sizeof(uint16_t));
+    pointer += sizeof(uint16_t);
+    memcpy(pointer, &net_version, sizeof(uint32_t));
+    pointer += sizeof(uint32_t);
+    net_value = htons(quiz->delta_left_count);
+    memcpy(pointer, &net_value, sizeof(uint16_t));
+    pointer += sizeof(uint16_t);
+    if (quiz->delta_left_count)
+        memcpy(pointer, quiz->delta_left, quiz->delta_left_length);
+    pointer += quiz->delta_left_length;
+    net_value = htons(moved);
+    memcpy(pointer, &net_value, sizeof(uint16_t));
+    pointer += sizeof(uint16_t);
+
+    uint16_t position = 0;
+    for (RankingNode *current = quiz->ranking_head; current; current = current->next_node)
+    {
+        position++;
+        if (current->changed_version != version)
+            continue;
+        size_t string_len = strlen(current->nickname);
+        uint16_t fields[2] = {htons(position), htons(current->score)};
+        net_value = htons(string_len);
+        memcpy(pointer, &net_value, sizeof(uint16_t));
+        pointer += sizeof(uint16_t);
+        memcpy(pointer, current->nickname, string_len);
+        pointer += string_len;
+        memcpy(pointer, fields, sizeof(fields));
+        pointer += sizeof(fields);
+    }
+    return frame;
+}
+
+/**
+ * @brief Pushes the changes of the ranking of a quiz to the subscribers of every worker, called by the owner after
+ * publishing a snapshot
+ *
+ * All the changes applied since the previous snapshot are pushed together in a single frame, serialized once and
+ * shared by the workers. Every RANKING_RESYNC_BATCHES pushes, or when the changes would be larger than the ranking
+ * itself, the whole ranking is pushed instead.
+ *
+ * @param context pointer to the context of the owner of the quiz
+ * @param quiz pointer to the quiz
+ * @param snapshot pointer to the snapshot just published
+ */
+void push_ranking_delta(Context *context, Quiz *quiz, RankingSnapshot *snapshot)
+{
+    SharedFrame *frame = NULL;
+    uint16_t moved;
+    // Pairs with the subscription, so that a client subscribing now either is counted or reads the new snapshot
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&context->quizzesInfo->subscribers, __ATOMIC_RELAXED))
+    {
+        size_t length = ranking_delta_length(quiz, &moved);
+        if (++quiz->delta_batches % RANKING_RESYNC_BATCHES == 0 || length >= snapshot->length)
+            frame = create_ranking_resync(quiz, snapshot, context->total_workers);
+        // The completion of a quiz changes the snapshot without changing the ranking
+        else if (moved || quiz->delta_left_count)
+            frame = create_ranking_delta(quiz, moved, length, context->total_workers);
+    }
+    quiz->delta_left_length = 0;
+    quiz->delta_left_count = 0;
+    if (!frame)
+        return;
+
+    RankingEvent event = {.frame = frame, .quiz_id = quiz->id, .kind = RANKING_DELTA_OUT};
+    for (unsigned int i = 0; i < context->total_workers; i++)
+        if (&context->workers[i] != context)
+            post_ranking_event(context, &context->workers[i], &event);
+    deliver_ranking_delta(context, frame);
+}
+
+/**
+ * @brief Delivers the changes of a ranking pushed by the owner of the quiz to the subscribers connected to the worker
+ *
+ * @param context pointer to the context of the worker
+ * @param frame pointer to the frame, of which the worker holds a reference released here
+ */
+void deliver_ranking_delta(Context *context, SharedFrame *frame)
+{
+    for (size_t i = 0; i < context->total_subscribers; i++)
+        send_shared_frame(context->subscribers[i]->socket_fd, frame);
+    release_shared_frame(frame);
+}
+
+/**
+ * @brief Deallocates the removed nicknames recorded for the changes of a quiz
+ *
+ * @param quiz pointer to the quiz
+ */
+void deallocate_ranking_deltas(Quiz *quiz)
+{
+    free(quiz->delta_left);
+    quiz->delta_left = NULL;
+    quiz->delta_left_length = quiz->delta_left_capacity = 0;
+}
@@ -0,0 +1,282 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include "utils.h"
+
+// Maximum number of events collected by a single epoll_wait, the others are reported by the next one
+#define EPOLL_EVENTS 1024
+
+/**
+ * @brief State of the epoll backend of a worker
+ */
+typedef struct EpollState
+{
+    int epoll_fd;                            /**< File descriptor of the epoll instance. */
+    struct epoll_event events[EPOLL_EVENTS]; /**< Events reported by the last wait. */
+    bool listener_ready;                     /**< The listener has been reported readable and not yet drained. */
+    bool wake_ready;                         /**< The wake-up descriptor has been reported readable. */
+} EpollState;
+
+/**
+ * @brief Changes the events monitored on a descriptor, exiting if the kernel refuses
+ *
+ * @param state pointer to the state of the backend
+ * @param operation EPOLL_CTL_ADD, EPOLL_CTL_MOD or EPOLL_CTL_DEL
+ * @param fd file descriptor to monitor
+ * @param events events to monitor
+ */
+void epoll_control(EpollState *state, int operation, int fd, uint32_t events)
+{
+    struct epoll_event event = {.events = events, .data.fd = fd};
+    if (epoll_ctl(state->epoll_fd, operation, fd, &event) == -1 && operation != EPOLL_CTL_DEL)
+    {
+        perror("Error monitoring a descriptor with epoll");
+        exit(EXIT_FAILURE);
+    }
+}
+
+/**
+ * @brief Creates the epoll instance of the worker and monitors the listener and the wake-up descriptor
+ *
+ * The descriptors are level-triggered, as with select, so that a listener left with connections by the accept
+ * budget, or a socket whose data exceeds a single receive, is reported again by the next wait.
+ *
+ * @param context pointer to the context of the worker
+ */
+void epoll_init(Context *context)
+{
+    EpollState *state = calloc(1, sizeof(EpollState));
+    handle_malloc_error(state, "Memory allocation error for the epoll backend");
+    state->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (state->epoll_fd == -1)
+    {
+        perror("Error creating the epoll instance");
+        exit(EXIT_FAILURE);
+    }
+    context->io_state = state;
+    context->blocked_writes = 0;
+    epoll_control(state, EPOLL_CTL_ADD, context->server_fd, EPOLLIN);
+    epoll_control(state, EPOLL_CTL_ADD, context->wake_fd, EPOLLIN);
+}
+
+/**
+ * @brief Starts monitoring the socket of a client
+ *
+ * @param context pointer to the context of the worker
+ * @param fd file descriptor of the socket
+ */
+void epoll_watch(Context *context, int fd)
+{
+    open_connection(context, fd);
+    configure_client_socket(fd);
+    epoll_control(context->io_state, EPOLL_CTL_ADD, fd, EPOLLIN);
+}
+
+/**
+ * @brief Stops monitoring the socket of a client, before it is closed
+ *
+ * The output still buffered is sent if the kernel accepts it without blocking, then the connection is deallocated.
+ * The socket is removed from the interest list explicitly, since closing it does not remove it while a process
+ * forked by the write-ahead log still shares it.
+ *
+ * @param context pointer to the context of the worker
+ * @param fd file descriptor of the socket
+ */
+void epoll_unwatch(Context *context, int fd)
+{
+    Connection *connection = find_connection(fd);
+    if (connection)
+    {
+        if (!connection->error)
+            select_send(context, connection);
+        if (connection->write_blocked)
+            context->blocked_writes--;
+        release_connection(connection);
+        free_connection(connection);
+    }
+    epoll_control(context->io_state, EPOLL_CTL_DEL, fd, 0);
+}
+
+/**
+ * @brief Waits with epoll until at least one of the monitored descriptors is ready
+ *
+ * The readable sockets are marked as ready until their data is received, as the io_uring backend does with the
+ * completed receives. The sockets that have become writable are monitored for reading only again, and flushed.
+ *
+ * @param context pointer to the context of the worker
+ * @param timeout_ms maximum time to wait in milliseconds, -1 to wait without limit
+ * @return number of ready descriptors, 0 if interrupted by a signal or timed out, -1 in case of error
+ */
+int epoll_wait_events(Context *context, int timeout_ms)
+{
+    EpollState *state = context->io_state;
+    state->listener_ready = state->wake_ready = false;
+
+    int total_events = epoll_wait(state->epoll_fd, state->events, EPOLL_EVENTS, timeout_ms);
+    count_io(&context->io_stats.syscalls, 1);
+    if (total_events < 0)
+        return errno == EINTR ? 0 : -1;
+
+    for (int i = 0; i < total_events; i++)
+    {
+        int fd = state->events[i].data.fd;
+        uint32_t events = state->events[i].events;
+        if (fd == context->server_fd)
+        {
+            state->listener_ready = true;
+            continue;
+        }
+        if (fd == context->wake_fd)
+        {
+            state->wake_ready = true;
+            continue;
+        }
+        Connection *connection = find_connection(fd);
+        if (!connection)
+            continue;
+        if (events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+            connection->ready = true;
+        if (events & (EPOLLOUT | EPOLLHUP | EPOLLERR) && connection->write_blocked)
+        {
+            epoll_control(state, EPOLL_CTL_MOD, fd, EPOLLIN);
+            connection->write_blocked = false;
+            context->blocked_writes--;
+            queue_flush(connection);
+        }
+    }
+    return total_events;
+}
+
+/**
+ * @brief Tells if a descriptor has been reported as readable by the last wait
+ *
+ * @param context pointer to the context of the worker
+ * @param fd file descriptor to check
+ */
+bool epoll_is_ready(Context *context, int fd)
+{
+    EpollState *state = context->io_state;
+    if (fd == context->server_fd)
+        return state->listener_ready;
+    if (fd == context->wake_fd)
+        return state->wake_ready;
+    Connection *connection = find_connection(fd);
+    return connection && connection->ready;
+}
+
+/**
+ * @brief Accepts the next connection queued on the listener, if it has been reported as readable
+ *
+ * The queue is drained until accept4 fails with EAGAIN, skipping the connections aborted by the peer while queued.
+ * Unlike select, epoll has no limit on the value of the descriptors it monitors.
+ *
+ * @param context pointer to the context of the worker
+ * @return file descriptor of the new connection, or -1 with errno set
+ */
+int epoll_accept(Context *context)
+{
+    EpollState *state = context->io_state;
+    int client_fd;
+    if (!state->listener_ready)
+    {
+        errno = EAGAIN;
+        return -1;
+    }
+    do
+    {
+        client_fd = accept4(context->server_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        count_io(&context->io_stats.syscalls, 1);
+    } while (client_fd == -1 && (errno == ECONNABORTED || errno == EINTR));
+
+    if (client_fd == -1)
+        state->listener_ready = false;
+    return client_fd;
+}
+
+/**
+ * @brief Receives the data available on the socket of a client with a single recv
+ *
+ * @param context pointer to the context of the worker
+ * @param fd file descriptor of the socket, reported as readable by the last wait
+ */
+void epoll_receive(Context *context, int fd)
+{
+    select_receive(context, fd);
+    find_connection(fd)->ready = false;
+}
+
+/**
+ * @brief Sends the output coalesced during the iteration, with one send for each connection
+ *
+ * The sockets whose output did not fit in the kernel buffers are monitored for writing until they have room.
+ *
+ * @param context pointer to the context of the worker
+ */
+void epoll_flush(Context *context)
+{
+    Connection *connection = context->flush_head;
+    context->flush_head = NULL;
+    while (connection)
+    {
+        Connection *next = connection->next_flush;
+        connection->flush_queued = false;
+        connection->next_flush = NULL;
+        if (!select_send(context, connection) && !connection->write_blocked)
+        {
+            epoll_control(context->io_state, EPOLL_CTL_MOD, connection->fd, EPOLLIN | EPOLLOUT);
+            connection->write_blocked = true;
+            context->blocked_writes++;
+        }
+        connection = next;
+    }
+}
+
+/**
+ * @brief Closes the epoll instance of the worker
+ *
+ * @param context pointer to the context of the worker
+ */
+void epoll_destroy(Context *context)
+{
+    EpollState *state = context->io_state;
+    if (!state)
+        return;
+    close(state->epoll_fd);
+    free(state);
+    context->io_state = NULL;
+}
+
+/**
+ * @brief Prepares the connections to be handed over, which needs nothing with epoll
+ *
+ * As with select, no operation is in flight, and the connections not yet accepted stay in the listen queue.
+ *
+ * @return false, since no accepted connection is left to register
+ */
+bool epoll_quiesce(Context *context)
+{
+    return false;
+}
+
+/**
+ * @brief Stops or resumes monitoring the listener, so that the new connections wait in the listen queue
+ *
+ * @param context pointer to the context of the worker
+ * @param paused true to stop accepting, false to resume
+ */
+void epoll_pause_accepts(Context *context, bool paused)
+{
+    EpollState *state = context->io_state;
+    epoll_control(state, EPOLL_CTL_MOD, context->server_fd, paused ? 0 : EPOLLIN);
+    if (paused)
+        state->listener_ready = false;
+}
+
+// I/O backend based on epoll: the cost of a wait depends on the ready descriptors rather than on the monitored ones,
+// and the descriptors are not limited to FD_SETSIZE
+const IoBackend epoll_backend = {"epoll", epoll_init, epoll_watch, epoll_unwatch, epoll_wait_events, epoll_is_ready,
+                                 epoll_accept, epoll_receive, epoll_flush, epoll_destroy, epoll_quiesce,
+                                 epoll_pause_accepts};
@@ -0,0 +1,256 @@
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+#include "utils.h"
+
+/**
+ * The flight recorder keeps the last FLIGHT_CAPACITY events of each thread in a static ring buffer owned by it.
+ * Recording an event only advances the position of the ring of the thread and fills in a slot, without locks,
+ * atomic read-modify-write operations or allocations, so the workers never contend for a cache line and the recorder
+ * is cheap enough to stay always on. The threads started once the rings are exhausted share the last one, reserving
+ * its slots with an atomic increment. The rings are written to disk when the process exits with a failure,
+ * on fatal signals and on SIGUSR1; since the dump can happen in a signal handler, it only uses
+ * async-signal-safe functions.
+ */
+
+/**
+ * @brief Ring buffer of the events recorded by a thread
+ */
+typedef struct FlightRing
+{
+    FlightEvent events[FLIGHT_CAPACITY]; /**< Recorded events, the slot of each event is its index modulo FLIGHT_CAPACITY. */
+    uint64_t head;                       /**< Number of events recorded in the ring since the start. */
+    bool shared;                         /**< The ring is shared by several threads, which reserve its slots atomically. */
+} __attribute__((aligned(64))) FlightRing;
+
+// Ring buffers of the threads, assigned in the order in which the threads record their first event
+static FlightRing flight_rings[FLIGHT_RINGS];
+// Number of threads that have been assigned a ring, the ones beyond FLIGHT_RINGS - 1 sharing the last ring
+static unsigned int flight_total_rings = 0;
+// Ring of the calling thread, NULL until it records its first event
+static __thread FlightRing *flight_ring = NULL;
+// Reference points used by the decoder to convert the recorder clock to nanoseconds
+static uint64_t flight_start_ticks, flight_start_ns;
+// Path of the dump file, prepared in advance since it cannot be built in a signal handler
+static char flight_dump_path[PATH_MAX];
+
+/**
+ * @brief Reads the clock of the flight recorder
+ *
+ * On x86 the timestamp counter is used, which is much cheaper than clock_gettime.
+ *
+ * @return current value of the clock in ticks
+ */
+uint64_t flight_clock()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return get_time_ns();
+#endif
+}
+
+/**
+ * @brief Returns the monotonic time in nanoseconds, with an async-signal-safe call
+ */
+uint64_t flight_monotonic_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ * @brief Assigns a ring to the calling thread, when it records its first event
+ *
+ * @return ring of the thread
+ */
+FlightRing *flight_claim_ring()
+{
+    unsigned int index = __atomic_fetch_add(&flight_total_rings, 1, __ATOMIC_RELAXED);
+    // The count keeps growing past the rings, the dump only reads the first FLIGHT_RINGS
+    if (index >= FLIGHT_RINGS - 1)
+    {
+        index = FLIGHT_RINGS - 1;
+        __atomic_store_n(&flight_rings[index].shared, true, __ATOMIC_RELAXED);
+    }
+    flight_ring = &flight_rings[index];
+    return flight_ring;
+}
+
+/**
+ * @brief Records an event in the ring buffer of the calling thread
+ *
+ * The meaning of the fields depends on the kind of the event, as described in flight.h.
+ * An event recorded by a signal handler that interrupted the same thread in this function may take the slot
+ * of the interrupted event, which is then lost.
+ *
+ * @param kind kind of the event
+ * @param type message type, client state or error code
+ * @param conn client id or file descriptor
+ * @param a first argument
+ * @param b second argument
+ */
+void flight_record(FlightEventKind kind, uint16_t type, uint32_t conn, uint32_t a, uint64_t b)
+{
+    FlightRing *ring = flight_ring ? flight_ring : flight_claim_ring();
+    uint64_t index;
+    if (__builtin_expect(ring->shared, 0))
+        index = __atomic_fetch_add(&ring->head, 1, __ATOMIC_RELAXED);
+    else
+    {
+        // Only this thread writes the position, which the dump reads
+        index = ring->head;
+        __atomic_store_n(&ring->head, index + 1, __ATOMIC_RELAXED);
+    }
+    FlightEvent *event = &ring->events[index & (FLIGHT_CAPACITY - 1)];
+
+    event->timestamp = flight_clock();
+    event->kind = kind;
+    event->type = type;
+    event->conn = conn;
+    event->a = a;
+    event->b = b;
+    __atomic_store_n(&event->sequence, (uint32_t)index, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Writes a whole buffer to a file descriptor, with async-signal-safe calls only
+ */
+void flight_write_all(int fd, const void *buffer, size_t length)
+{
+    const char *pointer = buffer;
+    while (length > 0)
+    {
+        ssize_t written = write(fd, pointer, length);
+        if (written <= 0)
+            return;
+        pointer += written;
+        length -= written;
+    }
+}
+
+/**
+ * @brief Writes the content of the ring buffers to the dump file
+ *
+ * The events of each ring are written from the oldest to the newest. This function is async-signal-safe.
+ */
+void flight_dump()
+{
+    FlightDumpHeader header;
+    FlightRingHeader ring_headers[FLIGHT_RINGS];
+    unsigned int total_rings = __atomic_load_n(&flight_total_rings, __ATOMIC_ACQUIRE);
+    if (total_rings > FLIGHT_RINGS)
+        total_rings = FLIGHT_RINGS;
+
+    int fd = open(flight_dump_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1)
+        return;
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, FLIGHT_MAGIC, FLIGHT_MAGIC_SIZE);
+    header.version = FLIGHT_VERSION;
+    header.event_size = sizeof(FlightEvent);
+    header.byte_order = FLIGHT_BYTE_ORDER;
+    header.capacity = FLIGHT_CAPACITY;
+    header.total_rings = total_rings;
+    for (unsigned int i = 0; i < total_rings; i++)
+    {
+        uint64_t total = __atomic_load_n(&flight_rings[i].head, __ATOMIC_ACQUIRE);
+        ring_headers[i].total_events = total;
+        ring_headers[i].dumped_events = total < FLIGHT_CAPACITY ? total : FLIGHT_CAPACITY;
+        header.total_events += total;
+        header.dumped_events += ring_headers[i].dumped_events;
+    }
+    header.start_ticks = flight_start_ticks;
+    header.start_ns = flight_start_ns;
+    header.dump_ticks = flight_clock();
+    header.dump_ns = flight_monotonic_ns();
+    flight_write_all(fd, &header, sizeof(header));
+
+    for (unsigned int i = 0; i < total_rings; i++)
+    {
+        FlightEvent *events = flight_rings[i].events;
+        uint64_t dumped = ring_headers[i].dumped_events;
+        size_t first_slot = (ring_headers[i].total_events - dumped) & (FLIGHT_CAPACITY - 1);
+        flight_write_all(fd, &ring_headers[i], sizeof(FlightRingHeader));
+        // The oldest events go from first_slot to the end of the buffer, the newest ones from its start
+        size_t tail_events = FLIGHT_CAPACITY - first_slot < dumped ? FLIGHT_CAPACITY - first_slot : dumped;
+        flight_write_all(fd, &events[first_slot], tail_events * sizeof(FlightEvent));
+        flight_write_all(fd, events, (dumped - tail_events) * sizeof(FlightEvent));
+    }
+    close(fd);
+}
+
+/**
+ * @brief Dumps the buffers when the process exits with a failure status
+ *
+ * This covers all the exit(EXIT_FAILURE) paths of the server, such as allocation failures.
+ *
+ * @param status exit status of the process
+ * @param arg unused
+ */
+void flight_on_exit(int status, void *arg)
+{
+    if (status == EXIT_SUCCESS)
+        return;
+    flight_record(FLIGHT_EXIT, 0, 0, status, 0);
+    flight_dump();
+}
+
+/**
+ * @brief Handles SIGUSR1 by dumping the buffers, without stopping the server
+ */
+void flight_on_dump_signal(int signum)
+{
+    flight_record(FLIGHT_SIGNAL, 0, 0, signum, 0);
+    flight_dump();
+}
+
+/**
+ * @brief Handles the fatal signals by dumping the buffers and then letting the default action terminate the process
+ */
+void flight_on_fatal_signal(int signum)
+{
+    flight_record(FLIGHT_SIGNAL, 0, 0, signum, 0);
+    flight_dump();
+    // The handler has been reset by SA_RESETHAND, so raising the signal again applies the default action
+    raise(signum);
+}
+
+/**
+ * @brief Starts the flight recorder
+ *
+ * It sets the dump file and installs the handlers that dump the buffers on failures and on SIGUSR1.
+ *
+ * @param dump_path path of the file in which the buffers are dumped
+ */
+void flight_init(const char *dump_path)
+{
+    struct sigaction action;
+    int fatal_signals[] = {SIGSEGV, SIGBUS, SIGABRT, SIGFPE, SIGILL};
+
+    snprintf(flight_dump_path, sizeof(flight_dump_path), "%s", dump_path);
+    flight_start_ticks = flight_clock();
+    flight_start_ns = flight_monotonic_ns();
+
+    on_exit(flight_on_exit, NULL);
+
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = flight_on_dump_signal;
+    action.sa_flags = SA_RESTART;
+    sigaction(SIGUSR1, &action, NULL);
+
+    action.sa_handler = flight_on_fatal_signal;
+    action.sa_flags = SA_RESETHAND;
+    for (size_t i = 0; i < sizeof(fatal_signals) / sizeof(fatal_signals[0]); i++)
+        sigaction(fatal_signals[i], &action, NULL);
+}
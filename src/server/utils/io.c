@@ -0,0 +1,297 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include "utils.h"
+
+/**
+ * @brief Adds a file descriptor to a set monitored by select, updating max_fd
+ */
+void select_add(Context *context, fd_set *set, int fd)
+{
+    FD_SET(fd, set);
+    if (fd > context->clientsInfo.max_fd)
+        context->clientsInfo.max_fd = fd;
+}
+
+/**
+ * @brief Initializes the file descriptor sets used by select and monitors the listener and the wake-up descriptor
+ *
+ * @param context pointer to the structure containing the service context information
+ */
+void select_init(Context *context)
+{
+    FD_ZERO(&context->masterfds);
+    FD_ZERO(&context->readfds);
+    FD_ZERO(&context->master_writefds);
+    FD_ZERO(&context->writefds);
+    context->blocked_writes = 0;
+    context->clientsInfo.max_fd = 0;
+    select_add(context, &context->masterfds, context->server_fd);
+    select_add(context, &context->masterfds, context->wake_fd);
+}
+
+/**
+ * @brief Adds the socket of a client to the master set monitored by select
+ *
+ * @param context pointer to the structure containing the service context information
+ * @param fd file descriptor to monitor
+ */
+void select_watch(Context *context, int fd)
+{
+    open_connection(context, fd);
+    configure_client_socket(fd);
+    select_add(context, &context->masterfds, fd);
+}
+
+/**
+ * @brief Sends as much as possible of the pending output of a connection without blocking
+ *
+ * @param context pointer to the structure containing the service context information
+ * @param connection pointer to the connection
+ * @return true if the output has been completely sent, false if the kernel buffer is full
+ */
+bool select_send(Context *context, Connection *connection)
+{
+    while (take_output(connection))
+    {
+        ssize_t sent = send_pending_output(connection);
+        count_io(&context->io_stats.syscalls, 1);
+        if (sent < 0)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return false;
+            if (errno == EINTR)
+                continue;
+            // The error is reported by the next receive, the output is discarded
+            connection->error = errno;
+            discard_output(connection);
+            return true;
+        }
+        connection->sending_offset += sent;
+    }
+    return true;
+}
+
+/**
+ * @brief Removes the socket of a client from the master sets monitored by select
+ *
+ * The output still buffered is sent if the kernel accepts it without blocking, then the connection is deallocated.
+ * If the descriptor was the highest one, max_fd is recomputed before the next select, once for all the clients
+ * released in the iteration.
+ *
+ * @param context pointer to the structure containing the service context information
+ * @param fd file descriptor to stop monitoring
+ */
+void select_unwatch(Context *context, int fd)
+{
+    Connection *connection = find_connection(fd);
+    if (connection)
+    {
+        if (!connection->error)
+            select_send(context, connection);
+        release_connection(connection);
+        free_connection(connection);
+    }
+
+    FD_CLR(fd, &context->masterfds);
+    if (FD_ISSET(fd, &context->master_writefds))
+    {
+        FD_CLR(fd, &context->master_writefds);
+        context->blocked_writes--;
+    }
+
+    if (fd == context->clientsInfo.max_fd)
+        context->clientsInfo.max_fd_stale = true;
+}
+
+/**
+ * @brief Recomputes max_fd among the listener, the wake-up descriptor and the clients still connected
+ *
+ * @param context pointer to the structure containing the service context information
+ */
+void select_update_max_fd(Context *context)
+{
+    Client *current_client = context->clientsInfo.clients_head;
+    context->clientsInfo.max_fd = context->server_fd > context->wake_fd ? context->server_fd : context->wake_fd;
+    while (current_client)
+    {
+        if (current_client->socket_fd > context->clientsInfo.max_fd)
+            context->clientsInfo.max_fd = current_client->socket_fd;
+
+        current_client = current_client->next_node;
+    }
+    context->clientsInfo.max_fd_stale = false;
+}
+
+/**
+ * @brief Waits with select until at least one of the monitored file descriptors is ready
+ *
+ * The sockets whose output did not fit in the kernel buffers are also monitored for writing,
+ * and are flushed again as soon as they become writable.
+ *
+ * @param context pointer to the structure containing the service context information
+ * @param timeout_ms maximum time to wait in milliseconds, -1 to wait without limit
+ * @return number of ready file descriptors, 0 if interrupted by a signal or timed out, -1 in case of error
+ */
+int select_wait(Context *context, int timeout_ms)
+{
+    struct timeval timeout = {.tv_sec = timeout_ms / 1000, .tv_usec = (timeout_ms % 1000) * 1000};
+    if (context->clientsInfo.max_fd_stale)
+        select_update_max_fd(context);
+    context->readfds = context->masterfds;
+    context->writefds = context->master_writefds;
+    int activity = select(context->clientsInfo.max_fd + 1, &context->readfds,
+                          context->blocked_writes ? &context->writefds : NULL, NULL, timeout_ms < 0 ? NULL : &timeout);
+    count_io(&context->io_stats.syscalls, 1);
+    if (activity < 0 && errno == EINTR)
+    {
+        // The content of the sets is undefined after an interrupted select
+        FD_ZERO(&context->readfds);
+        return 0;
+    }
+
+    if (activity > 0 && context->blocked_writes)
+    {
+        for (Client *client = context->clientsInfo.clients_head; client; client = client->next_node)
+        {
+            if (!FD_ISSET(client->socket_fd, &context->writefds))
+                continue;
+            FD_CLR(client->socket_fd, &context->master_writefds);
+            context->blocked_writes--;
+            queue_flush(find_connection(client->socket_fd));
+        }
+    }
+    return activity;
+}
+
+/**
+ * @brief Tells if a file descriptor has been reported as readable by the last select
+ *
+ * @param context pointer to the structure containing the service context information
+ * @param fd file descriptor to check
+ */
+bool select_is_ready(Context *context, int fd)
+{
+    return FD_ISSET(fd, &context->readfds);
+}
+
+/**
+ * @brief Accepts the next connection queued on the listener, if it has been reported as readable
+ *
+ * The listener is non-blocking, so the queue can be drained until accept4 fails with EAGAIN;
+ * the connections aborted by the peer while queued are skipped. Since select cannot monitor the descriptors
+ * from FD_SETSIZE on, the connections receiving one are closed at once and counted as rejected: the server
+ * warns about it at startup, and the other backends, one of which is used by default, have no such limit.
+ *
+ * @param context pointer to the structure containing the service context information
+ * @return file descriptor of the new connection, or -1 with errno set
+ */
+int select_accept(Context *context)
+{
+    int client_fd;
+    if (!FD_ISSET(context->server_fd, &context->readfds))
+    {
+        errno = EAGAIN;
+        return -1;
+    }
+    while (true)
+    {
+        client_fd = accept4(context->server_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        count_io(&context->io_stats.syscalls, 1);
+        if (client_fd == -1 && (errno == ECONNABORTED || errno == EINTR))
+            continue;
+        if (client_fd >= FD_SETSIZE)
+        {
+            close(client_fd);
+            count_io(&context->io_stats.rejected, 1);
+            continue;
+        }
+        break;
+    }
+
+    if (client_fd == -1)
+        FD_CLR(context->server_fd, &context->readfds);
+    return client_fd;
+}
+
+/**
+ * @brief Receives the data available on the socket of a client with a single recv
+ *
+ * @param context pointer to the structure containing the service context information
+ * @param fd file descriptor of the socket, reported as readable by the last select
+ */
+void select_receive(Context *context, int fd)
+{
+    Connection *connection = find_connection(fd);
+    char *space = reserve_input(connection, RECEIVE_CHUNK_SIZE);
+
+    ssize_t received = recv(fd, space, connection->input_capacity - connection->input_length, 0);
+    count_io(&context->io_stats.syscalls, 1);
+    if (received > 0)
+        connection->input_length += received;
+    else if (received == 0)
+        connection->closed = true;
+    else if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+        connection->error = errno;
+}
+
+/**
+ * @brief Sends the output coalesced during the iteration, with one send for each connection
+ *
+ * @param context pointer to the structure containing the service context information
+ */
+void select_flush(Context *context)
+{
+    Connection *connection = context->flush_head;
+    context->flush_head = NULL;
+    while (connection)
+    {
+        Connection *next = connection->next_flush;
+        connection->flush_queued = false;
+        connection->next_flush = NULL;
+        if (!select_send(context, connection) && !FD_ISSET(connection->fd, &context->master_writefds))
+        {
+            // Wait until the kernel has room for the rest of the output
+            FD_SET(connection->fd, &context->master_writefds);
+            context->blocked_writes++;
+        }
+        connection = next;
+    }
+}
+
+/**
+ * @brief Deallocates the state of the select backend, which has none
+ */
+void select_destroy(Context *context) {}
+
+/**
+ * @brief Prepares the connections to be handed over, which needs nothing with select
+ *
+ * The select backend has no operation in flight, and the connections not yet accepted stay in the listen queue.
+ *
+ * @return false, since no accepted connection is left to register
+ */
+bool select_quiesce(Context *context)
+{
+    return false;
+}
+
+/**
+ * @brief Stops or resumes monitoring the listener, so that the new connections wait in the listen queue
+ *
+ * @param context pointer to the structure containing the service context information
+ * @param paused true to stop accepting, false to resume
+ */
+void select_pause_accepts(Context *context, bool paused)
+{
+    if (paused)
+        FD_CLR(context->server_fd, &context->masterfds);
+    else
+        select_add(context, &context->masterfds, context->server_fd);
+}
+
+// I/O backend based on the select primitive
+const IoBackend select_backend = {"select", select_init, select_watch, select_unwatch, select_wait, select_is_ready,
+                                  select_accept, select_receive, select_flush, select_destroy, select_quiesce,
+                                  select_pause_accepts};
@@ -0,0 +1,467 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "utils.h"
+#include "../../common/params.h"
+
+// Names of the client states in the memory statistics, indexed by ClientState
+static const char *state_names[CLIENT_STATES_COUNT] = {"login", "logged in", "selecting", "playing", "spectating"};
+// Names of the classes of requests in the options and the statistics, indexed by RateClass
+static const char *rate_names[RATE_CLASSES_COUNT] = {"answers", "rankings", "quiz-lists", "nicknames"};
+
+/**
+ * @brief Initializes the limits of the clients with their default values
+ *
+ * @param limits pointer to the limits
+ */
+void init_client_limits(ClientLimits *limits)
+{
+    limits->memory_budget = CONNECTION_MEMORY_BUDGET;
+    limits->rates[RATE_ANSWERS] = (RateLimit){RATE_ANSWERS_PER_S, RATE_ANSWERS_BURST};
+    limits->rates[RATE_RANKINGS] = (RateLimit){RATE_RANKINGS_PER_S, RATE_RANKINGS_BURST};
+    limits->rates[RATE_QUIZ_LISTS] = (RateLimit){RATE_QUIZ_LISTS_PER_S, RATE_QUIZ_LISTS_BURST};
+    limits->rates[RATE_NICKNAMES] = (RateLimit){RATE_NICKNAMES_PER_S, RATE_NICKNAMES_BURST};
+}
+
+/**
+ * @brief Returns the largest payload the server accepts for a message type
+ *
+ * It is the limit of the type, never above the frame size announced to the clients in the MSG_HELLO.
+ *
+ * @param type type of the message
+ * @return largest payload in bytes
+ */
+uint32_t request_payload_limit(MessageType type)
+{
+    uint32_t limit = max_request_payload(type);
+    return limit < SERVER_MAX_FRAME ? limit : SERVER_MAX_FRAME;
+}
+
+/**
+ * @brief Computes the memory used by a client: its structures, its nickname and the buffers of its connection
+ *
+ * @param client pointer to the client
+ * @param context pointer to the structure containing the service context information
+ * @return memory used in bytes
+ */
+size_t client_memory(Client *client, Context *context)
+{
+    uint16_t total_quizzes = context->quizzesInfo->total_quizzes;
+    size_t memory = sizeof(Client) + total_quizzes * sizeof(RankingNode *) + client->input_buffer_size;
+    if (client->nickname)
+        memory += strlen(client->nickname) + 1;
+    if (client->spectator_slots)
+        memory += total_quizzes * sizeof(int);
+    Connection *connection = find_connection(client->socket_fd);
+    if (connection)
+        memory += connection_memory(connection);
+    return memory;
+}
+
+/**
+ * @brief Fails a connection whose buffers exceed the memory budget of the clients
+ *
+ * It is checked whenever output is added to the connection, which is how a client that does not read
+ * what it requests makes the server accumulate memory. The output not yet passed to the kernel is dropped
+ * and the client is disconnected as soon as its worker handles it, or at the next measurement.
+ *
+ * @param connection pointer to the connection
+ */
+void check_memory_budget(Connection *connection)
+{
+    size_t budget = connection->worker->limits.memory_budget;
+    if (budget == 0 || connection->error || connection_memory(connection) <= budget)
+        return;
+    connection->error = ENOBUFS;
+    release_shared_segments(connection->shared, &connection->shared_count);
+    connection->output_length = 0;
+    connection->ready = true;
+}
+
+/**
+ * @brief Schedules the first measurement of the memory used by the clients of a worker
+ *
+ * @param context pointer to the structure containing the service context information
+ */
+void start_memory_sweep(Context *context)
+{
+    schedule_timer(&context->timers, &context->memory_timer, MEMORY_SWEEP_MS);
+}
+
+/**
+ * @brief Measures the memory used by the clients of a worker, grouped by state, and enforces their budget
+ *
+ * It is the callback of the memory timer of the worker, rescheduled every MEMORY_SWEEP_MS. The clients over
+ * the budget, including the ones whose connection failed on it while they were not being handled, are disconnected.
+ *
+ * @param timer pointer to the expired timer
+ * @param context pointer to the structure containing the service context information
+ */
+void sweep_client_memory(Timer *timer, Context *context)
+{
+    uint64_t bytes[CLIENT_STATES_COUNT] = {0};
+    uint32_t clients[CLIENT_STATES_COUNT] = {0};
+    size_t budget = context->limits.memory_budget;
+    Client *client = context->clientsInfo.clients_head, *next;
+
+    while (client)
+    {
+        next = client->next_node;
+        size_t memory = client_memory(client, context);
+        Connection *connection = find_connection(client->socket_fd);
+        if ((budget && memory > budget) || (connection && connection->error == ENOBUFS))
+            disconnect_abusive_client(client, ENOBUFS, context);
+        else
+        {
+            bytes[client->state] += memory;
+            clients[client->state]++;
+        }
+        client = next;
+    }
+
+    for (int i = 0; i < CLIENT_STATES_COUNT; i++)
+    {
+        __atomic_store_n(&context->memory_stats.bytes[i], bytes[i], __ATOMIC_RELAXED);
+        __atomic_store_n(&context->memory_stats.clients[i], clients[i], __ATOMIC_RELAXED);
+    }
+    schedule_timer(&context->timers, timer, MEMORY_SWEEP_MS);
+}
+
+/**
+ * @brief Disconnects a client that announced an oversized frame or exceeded its memory budget
+ *
+ * A client that broke the protocol cannot resume its session, while the session of a client that was too slow
+ * to read its output is kept as for any dropped connection.
+ *
+ * @param client pointer to the client
+ * @param error EMSGSIZE for an oversized frame, ENOBUFS for the memory budget
+ * @param context pointer to the structure containing the service context information
+ */
+void disconnect_abusive_client(Client *client, int error, Context *context)
+{
+    if (error == EMSGSIZE)
+    {
+        printf("The client sent a frame larger than allowed\n");
+        flight_record(FLIGHT_ERROR, FLIGHT_ERROR_FRAME_SIZE, client->id, error, 0);
+        count_io(&context->memory_stats.oversized, 1);
+        client->resumable = false;
+    }
+    else
+    {
+        printf("The client exceeded its memory budget\n");
+        flight_record(FLIGHT_ERROR, FLIGHT_ERROR_MEMORY, client->id, error, 0);
+        count_io(&context->memory_stats.over_budget, 1);
+    }
+    handle_client_disconnection(client, context);
+}
+
+/**
+ * @brief Displays the memory used by the clients of all the workers in each state, and the clients disconnected
+ * for abusing it
+ *
+ * @param workers array of the contexts of the workers
+ * @param total_workers number of workers
+ */
+void show_memory_stats(Context *workers, unsigned int total_workers)
+{
+    uint64_t bytes[CLIENT_STATES_COUNT] = {0}, total_bytes = 0, oversized = 0, over_budget = 0;
+    uint32_t total_clients = 0;
+    for (unsigned int i = 0; i < total_workers; i++)
+    {
+        for (int s = 0; s < CLIENT_STATES_COUNT; s++)
+        {
+            bytes[s] += __atomic_load_n(&workers[i].memory_stats.bytes[s], __ATOMIC_RELAXED);
+            total_clients += __atomic_load_n(&workers[i].memory_stats.clients[s], __ATOMIC_RELAXED);
+        }
+        oversized += __atomic_load_n(&workers[i].memory_stats.oversized, __ATOMIC_RELAXED);
+        over_budget += __atomic_load_n(&workers[i].memory_stats.over_budget, __ATOMIC_RELAXED);
+    }
+    for (int s = 0; s < CLIENT_STATES_COUNT; s++)
+        total_bytes += bytes[s];
+
+    printf("Memory: %llu KB for %u clients (", (unsigned long long)total_bytes / 1024, total_clients);
+    for (int s = 0; s < CLIENT_STATES_COUNT; s++)
+        printf("%s%s %llu", s ? ", " : "", state_names[s], (unsigned long long)bytes[s] / 1024);
+    printf(" KB), dropped %llu oversized frames, %llu over budget\n", (unsigned long long)oversized,
+           (unsigned long long)over_budget);
+}
+
+/**
+ * @brief Copies the memory statistics of the clients of all the workers in a publication of the shared-memory region
+ *
+ * @param stats pointer to the statistics of the publication
+ * @param workers array of the contexts of the workers
+ * @param total_workers number of workers
+ */
+void fill_memory_stats(ShmStats *stats, Context *workers, unsigned int total_workers)
+{
+    for (unsigned int i = 0; i < total_workers; i++)
+    {
+        for (int s = 0; s < CLIENT_STATES_COUNT && s < SHM_CLIENT_STATES; s++)
+        {
+            stats->memory_bytes[s] += __atomic_load_n(&workers[i].memory_stats.bytes[s], __ATOMIC_RELAXED);
+            stats->memory_clients[s] += __atomic_load_n(&workers[i].memory_stats.clients[s], __ATOMIC_RELAXED);
+        }
+        stats->frames_oversized += __atomic_load_n(&workers[i].memory_stats.oversized, __ATOMIC_RELAXED);
+        stats->memory_exceeded += __atomic_load_n(&workers[i].memory_stats.over_budget, __ATOMIC_RELAXED);
+    }
+}
+
+/**
+ * @brief Returns the class of a request whose rate is limited
+ *
+ * @param type type of the request
+ * @return class of the request, RATE_CLASSES_COUNT if its rate is not limited
+ */
+RateClass request_rate_class(MessageType type)
+{
+    switch (type)
+    {
+    case MSG_QUIZ_ANSWER:
+    case MSG_QUIZ_SUBMIT:
+        return RATE_ANSWERS;
+    case MSG_REQ_RANKING:
+        return RATE_RANKINGS;
+    case MSG_REQ_QUIZ_LIST:
+        return RATE_QUIZ_LISTS;
+    case MSG_SET_NICKNAME:
+    case MSG_RESUME_SESSION:
+        return RATE_NICKNAMES;
+    default:
+        return RATE_CLASSES_COUNT;
+    }
+}
+
+/**
+ * @brief Returns the time a client has to wait before sending a request of a class
+ *
+ * Each class has a token bucket, kept as the time at which it is full again: every request moves it forward by
+ * the interval between two requests at the limited rate, and is allowed while it stays within burst intervals.
+ *
+ * @param client pointer to the client
+ * @param rate_class class of the request
+ * @param context pointer to the structure containing the service context information
+ * @return time to wait in nanoseconds, 0 if the request can be handled now
+ */
+uint64_t rate_token_delay(Client *client, RateClass rate_class, Context *context)
+{
+    RateLimit *limit = &context->limits.rates[rate_class];
+    if (limit->rate == 0)
+        return 0;
+    uint64_t now_ns = get_time_ns(), interval_ns = 1000000000ULL / limit->rate;
+    uint64_t full_ns = client->rate_full_ns[rate_class] > now_ns ? client->rate_full_ns[rate_class] : now_ns;
+    uint64_t level_ns = full_ns + interval_ns - now_ns, capacity_ns = limit->burst * interval_ns;
+    return level_ns > capacity_ns ? level_ns - capacity_ns : 0;
+}
+
+/**
+ * @brief Takes a token from the bucket of a class of requests of a client, if it has one
+ *
+ * @param client pointer to the client
+ * @param rate_class class of the request
+ * @param context pointer to the structure containing the service context information
+ * @return true if the request can be handled, false if it is over the limit
+ */
+bool take_rate_token(Client *client, RateClass rate_class, Context *context)
+{
+    RateLimit *limit = &context->limits.rates[rate_class];
+    if (limit->rate == 0)
+        return true;
+    if (rate_token_delay(client, rate_class, context))
+        return false;
+    uint64_t now_ns = get_time_ns();
+    if (client->rate_full_ns[rate_class] < now_ns)
+        client->rate_full_ns[rate_class] = now_ns;
+    client->rate_full_ns[rate_class] += 1000000000ULL / limit->rate;
+    return true;
+}
+
+/**
+ * @brief Delays the next request of a client if it is over the rate limit of its class, or if the client is in
+ * the waiting room
+ *
+ * The request is left in the input buffer of the connection, before the following ones, until the bucket of its
+ * class has a token again, when the throttle timer of the client resumes the handling of its requests. The requests
+ * for the rankings are never delayed, they are answered from a cache by handle_ranking_request. The clients of the
+ * waiting room can only negotiate the protocol, their other requests are handled when they are admitted.
+ *
+ * @param client pointer to the client
+ * @param context pointer to the structure containing the service context information
+ * @return true if the requests of the client must wait, false if the next one can be received
+ */
+bool throttle_next_request(Client *client, Context *context)
+{
+    Connection *connection = find_connection(client->socket_fd);
+    // The requests left by a client that is gone are handled at once, before its disconnection is reported
+    if (!connection || connection->closed || connection->error)
+    {
+        cancel_timer(&context->timers, &client->throttle_timer);
+        return false;
+    }
+    if (timer_pending(&client->throttle_timer))
+        return true;
+
+    int type = next_frame_type(connection);
+    if (type < 0)
+        return false;
+    if (client->waiting && type != MSG_HELLO)
+        return true;
+    RateClass rate_class = request_rate_class(type);
+    if (rate_class == RATE_CLASSES_COUNT || rate_class == RATE_RANKINGS)
+        return false;
+    uint64_t delay_ns = rate_token_delay(client, rate_class, context);
+    if (delay_ns == 0)
+    {
+        take_rate_token(client, rate_class, context);
+        client->throttled = false;
+        return false;
+    }
+    // The timer might expire a tick early, the request is only counted the first time it is delayed
+    if (!client->throttled)
+        count_io(&context->throttled[rate_class], 1);
+    client->throttled = true;
+    schedule_timer(&context->timers, &client->throttle_timer, delay_ns / 1000000 + 1);
+    return true;
+}
+
+/**
+ * @brief Resumes the handling of the requests of a client once the one delayed by its rate limit can be handled
+ *
+ * It is the callback of the throttle timer of the client.
+ *
+ * @param timer pointer to the expired timer
+ * @param context pointer to the structure containing the service context information
+ */
+void resume_throttled_client(Timer *timer, Context *context)
+{
+    handle_client_requests(timer->data, context);
+}
+
+/**
+ * @brief Answers a request for the rankings of a client, from the cache of the worker if it is over its rate limit
+ * or if the worker is overloaded
+ *
+ * @param client pointer to the client
+ * @param context pointer to the structure containing the service context information
+ */
+void handle_ranking_request(Client *client, Context *context)
+{
+    if (context->overload.stage >= OVERLOAD_CACHED_RANKINGS)
+        count_io(&context->overload.cached_rankings, 1);
+    else if (take_rate_token(client, RATE_RANKINGS, context))
+    {
+        send_ranking(client, context);
+        return;
+    }
+    else
+        count_io(&context->throttled[RATE_RANKINGS], 1);
+    send_cached_ranking(client, context);
+}
+
+/**
+ * @brief Sends to a client the rankings cached by its worker
+ *
+ * The cache keeps the rankings serialized for each version of the protocol as a shared frame, serialized again
+ * at most every RANKING_CACHE_MS, so the clients get slightly older rankings without a copy.
+ *
+ * @param client pointer to the client
+ * @param context pointer to the structure containing the service context information
+ */
+void send_cached_ranking(Client *client, Context *context)
+{
+    RankingCache *cache = &context->ranking_cache[client->codec->version - 1];
+    uint64_t now_ns = get_time_ns();
+    if (!cache->frame || now_ns - cache->built_ns >= RANKING_CACHE_MS * 1000000ULL)
+    {
+        size_t payload_length = client->codec->encode_ranking(context);
+        if (cache->frame)
+            release_shared_frame(cache->frame);
+        cache->frame = create_shared_frame(MSG_RES_RANKING, context->ranking_buffer, payload_length, 1);
+        cache->built_ns = now_ns;
+    }
+
+    size_t payload_length = cache->frame->length - FRAME_HEADER_SIZE;
+    if (payload_length > client->capabilities.max_frame)
+        send_bounded_msg(client, MSG_RES_RANKING, cache->frame->data + FRAME_HEADER_SIZE, payload_length);
+    else
+        send_shared_frame(client->socket_fd, cache->frame);
+    send_client_prompt(client, context);
+}
+
+/**
+ * @brief Releases the rankings cached by a worker
+ *
+ * @param context pointer to the structure containing the service context information
+ */
+void deallocate_ranking_cache(Context *context)
+{
+    for (int i = 0; i < PROTOCOL_LATEST; i++)
+    {
+        if (context->ranking_cache[i].frame)
+            release_shared_frame(context->ranking_cache[i].frame);
+        context->ranking_cache[i].frame = NULL;
+    }
+}
+
+/**
+ * @brief Parses the rate limit of a class of requests given on the command line
+ *
+ * The limit has the form class=rate[/burst], with the rate in requests per second and a burst equal to the rate
+ * if omitted; a rate of 0 removes the limit.
+ *
+ * @param arg argument of the option
+ * @param limits pointer to the limits in which the rate is set
+ * @return true if the argument is valid
+ */
+bool parse_rate_limit(const char *arg, ClientLimits *limits)
+{
+    for (int c = 0; c < RATE_CLASSES_COUNT; c++)
+    {
+        size_t name_length = strlen(rate_names[c]);
+        if (strncmp(arg, rate_names[c], name_length) != 0 || arg[name_length] != '=')
+            continue;
+        char *end;
+        unsigned long rate = strtoul(arg + name_length + 1, &end, 10), burst = rate;
+        if (*end == '/')
+            burst = strtoul(end + 1, &end, 10);
+        if (*end != '\0' || rate > UINT32_MAX || burst > UINT32_MAX || (rate && burst == 0))
+            return false;
+        limits->rates[c] = (RateLimit){rate, burst};
+        return true;
+    }
+    return false;
+}
+
+/**
+ * @brief Displays the requests of each class over the rate limit of their client, for all the workers
+ *
+ * @param workers array of the contexts of the workers
+ * @param total_workers number of workers
+ */
+void show_rate_stats(Context *workers, unsigned int total_workers)
+{
+    printf("Throttled:");
+    for (int c = 0; c < RATE_CLASSES_COUNT; c++)
+    {
+        uint64_t throttled = 0;
+        for (unsigned int i = 0; i < total_workers; i++)
+            throttled += __atomic_load_n(&workers[i].throttled[c], __ATOMIC_RELAXED);
+        printf("%s %s %llu", c ? "," : "", rate_names[c], (unsigned long long)throttled);
+    }
+    printf(" (rankings answered from cache, others delayed)\n");
+}
+
+/**
+ * @brief Copies the requests over the rate limit of their client in a publication of the shared-memory region
+ *
+ * @param stats pointer to the statistics of the publication
+ * @param workers array of the contexts of the workers
+ * @param total_workers number of workers
+ */
+void fill_rate_stats(ShmStats *stats, Context *workers, unsigned int total_workers)
+{
+    for (unsigned int i = 0; i < total_workers; i++)
+        for (int c = 0; c < RATE_CLASSES_COUNT && c < SHM_RATE_CLASSES; c++)
+            stats->throttled[c] += __atomic_load_n(&workers[i].throttled[c], __ATOMIC_RELAXED);
+}
@@ -0,0 +1,333 @@
+#include "utils.h"
+#include "../../common/params.h"
+
+/**
+ * @brief Makes a quiz be played in synchronized live rounds
+ *
+ * It must be called before the workers are started.
+ *
+ * @param quiz pointer to the quiz
+ */
+void enable_live_quiz(Quiz *quiz)
+{
+    if (quiz->live)
+        return;
+    quiz->live = calloc(1, sizeof(LiveRound));
+    handle_malloc_error(quiz->live, "Memory allocation error for a live quiz");
+    quiz->live->phase = LIVE_IDLE;
+    init_timer(&quiz->live->timer, handle_live_timer, quiz);
+}
+
+/**
+ * @brief Allocates the rosters of the live participants of a worker, one for each quiz
+ *
+ * @param context pointer to the context of the worker
+ */
+void init_live_rosters(Context *context)
+{
+    context->live_rosters = calloc(context->quizzesInfo->total_quizzes, sizeof(Client *));
+    handle_malloc_error(context->live_rosters, "Memory allocation error for the live rosters");
+}
+
+/**
+ * @brief Adds a client that has selected a live quiz to the roster of its worker
+ *
+ * The client receives the questions broadcast from the next round on.
+ *
+ * @param client pointer to the client
+ * @param context pointer to the context of the worker of the client
+ */
+void join_live_round(Client *client, Context *context)
+{
+    add_live_participant(client, context);
+
+    char *message = "You joined the live quiz, the questions are sent to all the players at the same time";
+    send_msg(client->socket_fd, MSG_INFO, message, strlen(message));
+}
+
+/**
+ * @brief Links a client in the roster of the live quiz it is playing, without notifying it
+ *
+ * @param client pointer to the client
+ * @param context pointer to the context of the worker of the client
+ */
+void add_live_participant(Client *client, Context *context)
+{
+    Client **roster = &context->live_rosters[client->current_quiz_id];
+    client->live = true;
+    client->live_backlog = 0;
+    client->live_round = client->live_answered = 0;
+    client->live_prev = NULL;
+    client->live_next = *roster;
+    if (*roster)
+        (*roster)->live_prev = client;
+    *roster = client;
+}
+
+/**
+ * @brief Removes a client from the roster of the live quiz it is playing
+ *
+ * @param client pointer to the client
+ * @param context pointer to the context of the worker of the client
+ */
+void leave_live_round(Client *client, Context *context)
+{
+    if (!client->live)
+        return;
+    if (client->live_prev)
+        client->live_prev->live_next = client->live_next;
+    else
+        context->live_rosters[client->current_quiz_id] = client->live_next;
+    if (client->live_next)
+        client->live_next->live_prev = client->live_prev;
+    client->live_prev = client->live_next = NULL;
+    client->live = false;
+}
+
+/**
+ * @brief Handles the answer of a live participant
+ *
+ * The answer is accepted only if it responds to the question of the round still open: since the client responds
+ * to the questions in the order it receives them, an answer sent while other questions were already waiting
+ * for the client belongs to a round that has been closed in the meantime.
+ *
+ * @param client pointer to the client that sent the answer
+ * @param answer pointer to the answer
+ * @param context pointer to the context of the worker of the client
+ */
+void handle_live_answer(Client *client, char *answer, Context *context)
+{
+    Quiz *quiz = context->quizzesInfo->quizzes[client->current_quiz_id];
+    RankingNode *ranking = client->client_rankings[client->current_quiz_id];
+    bool latest = client->live_backlog == 1;
+    if (client->live_backlog > 0)
+        client->live_backlog--;
+
+    uint64_t round_word = __atomic_load_n(&quiz->live->round_word, __ATOMIC_ACQUIRE);
+    uint32_t sequence = round_word >> 32, question = (uint32_t)round_word;
+    char *payload;
+    if (!latest || question == 0 || sequence != client->live_round || client->live_answered == sequence)
+    {
+        payload = "Time is up, the answer was not counted";
+        send_msg(client->socket_fd, MSG_INFO, payload, strlen(payload));
+        return;
+    }
+    client->live_answered = sequence;
+
+    if (verify_quiz_answer(answer, quiz->questions[question - 1]))
+    {
+        payload = "Correct answer";
+        ranking->correct_answers += 1;
+        submit_ranking_event(context, quiz, RANKING_SCORE, ranking, ranking->correct_answers);
+    }
+    else
+        payload = "Wrong answer";
+    send_msg(client->socket_fd, MSG_INFO, payload, strlen(payload));
+}
+
+/**
+ * @brief Delivers a frame broadcast by the owner of a live quiz to the participants connected to the worker
+ *
+ * The frame is referenced by the output of every participant without being copied.
+ * At the end of the game the participants complete the quiz and go back to the quiz selection.
+ *
+ * @param context pointer to the context of the worker
+ * @param quiz pointer to the live quiz
+ * @param kind kind of the broadcast
+ * @param frame pointer to the frame, of which the worker holds a reference released here
+ */
+void deliver_live_frame(Context *context, Quiz *quiz, RankingEventKind kind, SharedFrame *frame)
+{
+    uint32_t sequence = __atomic_load_n(&quiz->live->round_word, __ATOMIC_ACQUIRE) >> 32;
+    Client *client = context->live_rosters[quiz->id];
+    while (client)
+    {
+        Client *next = client->live_next;
+        send_shared_frame(client->socket_fd, frame);
+        if (kind == LIVE_QUESTION)
+        {
+            client->live_backlog++;
+            client->live_round = sequence;
+        }
+        else if (kind == LIVE_END)
+        {
+            RankingNode *ranking = client->client_rankings[quiz->id];
+            leave_live_round(client, context);
+            submit_ranking_event(context, quiz, RANKING_COMPLETE, ranking, 0);
+            PROBE3(quiz__complete, client->id, quiz->id, ranking->correct_answers);
+            send_quiz_list(client, context->quizzesInfo);
+        }
+        client = next;
+    }
+    release_shared_frame(frame);
+}
+
+/**
+ * @brief Broadcasts a frame of a live quiz to the participants connected to every worker
+ *
+ * The frame is serialized once: each worker receives a reference through its ranking queue and
+ * delivers it to its own participants, while the participants of the owner are served immediately.
+ *
+ * @param context pointer to the context of the owner of the quiz
+ * @param quiz pointer to the live quiz
+ * @param kind kind of the broadcast
+ * @param type type of the message
+ * @param payload pointer to the payload
+ * @param payload_length length of the payload in bytes
+ */
+void broadcast_live_frame(Context *context, Quiz *quiz, RankingEventKind kind, MessageType type, char *payload,
+                          size_t payload_length)
+{
+    SharedFrame *frame = create_shared_frame(type, payload, payload_length, context->total_workers);
+    RankingEvent event = {.frame = frame, .quiz_id = quiz->id, .kind = kind};
+    for (unsigned int i = 0; i < context->total_workers; i++)
+        if (&context->workers[i] != context)
+            post_ranking_event(context, &context->workers[i], &event);
+    deliver_live_frame(context, quiz, kind, frame);
+}
+
+/**
+ * @brief Starts the lobby of a live game when the first participant joins, called by the owner of the quiz
+ *
+ * The lobby lasts as long as a round, then the first question is broadcast.
+ *
+ * @param quiz pointer to the live quiz
+ */
+void start_live_game(Quiz *quiz)
+{
+    if (quiz->live->phase != LIVE_IDLE)
+        return;
+    quiz->live->phase = LIVE_LOBBY;
+    quiz->live->question = 0;
+    schedule_timer(&quiz->owner->timers, &quiz->live->timer, quiz->owner->timeouts.round_ms);
+}
+
+/**
+ * @brief Opens the next round of a live game, broadcasting its question
+ *
+ * @param context pointer to the context of the owner of the quiz
+ * @param quiz pointer to the live quiz
+ */
+void open_live_round(Context *context, Quiz *quiz)
+{
+    LiveRound *live = quiz->live;
+    char payload[DEFAULT_PAYLOAD_SIZE * 4];
+    uint16_t question = live->question++;
+
+    live->sequence++;
+    __atomic_store_n(&live->round_word, (uint64_t)live->sequence << 32 | (question + 1), __ATOMIC_RELEASE);
+    int length = snprintf(payload, sizeof(payload), "Round %u of %u (%u seconds): %s", question + 1,
+                          quiz->total_questions, context->timeouts.round_ms / 1000, quiz->questions[question]->question);
+    if (length >= (int)sizeof(payload))
+        length = sizeof(payload) - 1;
+    broadcast_live_frame(context, quiz, LIVE_QUESTION, MSG_QUIZ_QUESTION, payload, length);
+
+    live->phase = LIVE_OPEN;
+    schedule_timer(&context->timers, &live->timer, context->timeouts.round_ms);
+}
+
+/**
+ * @brief Closes the open round of a live game and broadcasts its results
+ *
+ * The results contain the expected answer, the number of participants who answered correctly and the
+ * leading participants with the points gained in the round. The scores submitted by the other workers
+ * before the deadline are applied first.
+ *
+ * @param context pointer to the context of the owner of the quiz
+ * @param quiz pointer to the live quiz
+ */
+void close_live_round(Context *context, Quiz *quiz)
+{
+    LiveRound *live = quiz->live;
+    QuizQuestion *question = quiz->questions[live->question - 1];
+    __atomic_store_n(&live->round_word, (uint64_t)live->sequence << 32, __ATOMIC_RELEASE);
+    drain_ranking_events(context);
+
+    size_t buffer_size = DEFAULT_PAYLOAD_SIZE;
+    char *payload = malloc(buffer_size);
+    handle_malloc_error(payload, "Error allocating payload");
+    char *pointer = payload;
+    unsigned int players = 0, correct = 0, shown = 0;
+    char line[DEFAULT_PAYLOAD_SIZE * 2];
+
+    int length = snprintf(line, sizeof(line), "Round %u of %u is over, the answer was: %s\n", live->question,
+                          quiz->total_questions, question->answers[0]);
+    ensure_capacity(&payload, &pointer, &buffer_size, length);
+    memcpy(pointer, line, length);
+    pointer += length;
+
+    for (RankingNode *node = quiz->ranking_head; node; node = node->next_node)
+    {
+        if (node->is_quiz_completed)
+            continue;
+        players++;
+        unsigned int gained = node->score - node->round_score;
+        if (gained)
+            correct++;
+        node->round_score = node->score;
+        if (shown == LIVE_RESULTS_TOP)
+            continue;
+        shown++;
+        length = snprintf(line, sizeof(line), "%u. %s %u (+%u)\n", shown, node->nickname, node->score, gained);
+        if (length >= (int)sizeof(line))
+            length = sizeof(line) - 1;
+        ensure_capacity(&payload, &pointer, &buffer_size, length);
+        memcpy(pointer, line, length);
+        pointer += length;
+    }
+    length = snprintf(line, sizeof(line), "%u of %u players answered correctly", correct, players);
+    ensure_capacity(&payload, &pointer, &buffer_size, length);
+    memcpy(pointer, line, length);
+    pointer += length;
+
+    broadcast_live_frame(context, quiz, LIVE_RESULTS_OUT, MSG_INFO, payload, pointer - payload);
+    free(payload);
+}
+
+/**
+ * @brief Advances the live game of a quiz at the end of each phase
+ *
+ * It is the callback of the timer of the live quiz, scheduled on the wheel of the owner.
+ *
+ * @param timer pointer to the expired timer
+ * @param context pointer to the context of the owner of the quiz
+ */
+void handle_live_timer(Timer *timer, Context *context)
+{
+    Quiz *quiz = timer->data;
+    LiveRound *live = quiz->live;
+
+    switch (live->phase)
+    {
+    case LIVE_LOBBY:
+    case LIVE_RESULTS:
+        open_live_round(context, quiz);
+        break;
+    case LIVE_OPEN:
+        close_live_round(context, quiz);
+        if (live->question < quiz->total_questions)
+        {
+            live->phase = LIVE_RESULTS;
+            schedule_timer(&context->timers, &live->timer, LIVE_PAUSE_MS);
+            break;
+        }
+        char *message = "The live quiz is over";
+        live->phase = LIVE_IDLE;
+        __atomic_store_n(&live->round_word, 0, __ATOMIC_RELEASE);
+        broadcast_live_frame(context, quiz, LIVE_END, MSG_INFO, message, strlen(message));
+        break;
+    case LIVE_IDLE:
+        break;
+    }
+}
+
+/**
+ * @brief Deallocates the live game of a quiz
+ *
+ * @param quiz pointer to the quiz
+ */
+void deallocate_live_quiz(Quiz *quiz)
+{
+    free(quiz->live);
+    quiz->live = NULL;
+}
@@ -0,0 +1,147 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "utils.h"
+
+/**
+ * @brief Computes the bucket of a nickname with the FNV-1a hash
+ *
+ * @param nickname nickname to hash
+ * @return index of the bucket of the nickname
+ */
+size_t nickname_bucket(const char *nickname)
+{
+    uint32_t hash = 2166136261u;
+    for (const unsigned char *c = (const unsigned char *)nickname; *c; c++)
+        hash = (hash ^ *c) * 16777619u;
+    return hash % NICKNAME_BUCKETS;
+}
+
+/**
+ * @brief Returns the lock protecting a bucket of the registry
+ */
+pthread_mutex_t *nickname_lock(NicknameRegistry *registry, size_t bucket)
+{
+    return &registry->locks[bucket % NICKNAME_LOCK_STRIPES];
+}
+
+/**
+ * @brief Initializes an empty nickname registry
+ *
+ * @param registry pointer to the registry to initialize
+ */
+void init_nickname_registry(NicknameRegistry *registry)
+{
+    memset(registry->buckets, 0, sizeof(registry->buckets));
+    for (int i = 0; i < NICKNAME_LOCK_STRIPES; i++)
+        pthread_mutex_init(&registry->locks[i], NULL);
+    registry->total_nicknames = 0;
+}
+
+/**
+ * @brief Reserves a nickname, if it is not already in use
+ *
+ * The check and the insertion happen under the lock of the bucket, so two clients connected
+ * to different workers can never obtain the same nickname.
+ *
+ * @param registry pointer to the registry of the nicknames
+ * @param nickname nickname to reserve
+ * @return true if the nickname has been reserved, false if it is already in use
+ */
+bool claim_nickname(NicknameRegistry *registry, const char *nickname)
+{
+    size_t bucket = nickname_bucket(nickname);
+    pthread_mutex_t *lock = nickname_lock(registry, bucket);
+
+    pthread_mutex_lock(lock);
+    for (NicknameEntry *entry = registry->buckets[bucket]; entry; entry = entry->next)
+    {
+        if (strcmp(entry->nickname, nickname) == 0)
+        {
+            pthread_mutex_unlock(lock);
+            return false;
+        }
+    }
+
+    NicknameEntry *entry = malloc(sizeof(NicknameEntry));
+    handle_malloc_error(entry, "Memory allocation error for the nickname registry");
+    entry->nickname = strdup(nickname);
+    handle_malloc_error(entry->nickname, "Memory allocation error for the nickname registry");
+    entry->next = registry->buckets[bucket];
+    registry->buckets[bucket] = entry;
+    pthread_mutex_unlock(lock);
+
+    __atomic_add_fetch(&registry->total_nicknames, 1, __ATOMIC_RELAXED);
+    return true;
+}
+
+/**
+ * @brief Releases a nickname, so that it can be chosen by other clients
+ *
+ * @param registry pointer to the registry of the nicknames
+ * @param nickname nickname to release
+ */
+void release_nickname(NicknameRegistry *registry, const char *nickname)
+{
+    size_t bucket = nickname_bucket(nickname);
+    pthread_mutex_t *lock = nickname_lock(registry, bucket);
+
+    pthread_mutex_lock(lock);
+    for (NicknameEntry **link = &registry->buckets[bucket]; *link; link = &(*link)->next)
+    {
+        NicknameEntry *entry = *link;
+        if (strcmp(entry->nickname, nickname) == 0)
+        {
+            *link = entry->next;
+            free(entry->nickname);
+            free(entry);
+            __atomic_sub_fetch(&registry->total_nicknames, 1, __ATOMIC_RELAXED);
+            break;
+        }
+    }
+    pthread_mutex_unlock(lock);
+}
+
+/**
+ * @brief Displays the nicknames in use
+ *
+ * @param registry pointer to the registry of the nicknames
+ */
+void list_nicknames(NicknameRegistry *registry)
+{
+    for (size_t bucket = 0; bucket < NICKNAME_BUCKETS; bucket++)
+    {
+        // Skip the empty buckets without taking their lock
+        if (!__atomic_load_n(&registry->buckets[bucket], __ATOMIC_RELAXED))
+            continue;
+        pthread_mutex_t *lock = nickname_lock(registry, bucket);
+        pthread_mutex_lock(lock);
+        for (NicknameEntry *entry = registry->buckets[bucket]; entry; entry = entry->next)
+            printf("- %s\n", entry->nickname);
+        pthread_mutex_unlock(lock);
+    }
+}
+
+/**
+ * @brief Deallocates all the entries of the registry
+ *
+ * @param registry pointer to the registry of the nicknames
+ */
+void deallocate_nickname_registry(NicknameRegistry *registry)
+{
+    for (size_t bucket = 0; bucket < NICKNAME_BUCKETS; bucket++)
+    {
+        NicknameEntry *entry = registry->buckets[bucket];
+        while (entry)
+        {
+            NicknameEntry *next = entry->next;
+            free(entry->nickname);
+            free(entry);
+            entry = next;
+        }
+        registry->buckets[bucket] = NULL;
+    }
+    for (int i = 0; i < NICKNAME_LOCK_STRIPES; i++)
+        pthread_mutex_destroy(&registry->locks[i]);
+    registry->total_nicknames = 0;
+}
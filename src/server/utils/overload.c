@@ -0,0 +1,342 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "utils.h"
+#include "../../common/params.h"
+
+// Names of the stages in the statistics, indexed by OverloadStage
+static const char *stage_names[OVERLOAD_STAGES_COUNT] = {"none", "cached rankings", "waiting room", "accepts paused"};
+// Names of the stages in the options, indexed by OverloadStage
+static const char *stage_options[OVERLOAD_STAGES_COUNT] = {NULL, "cache", "waiting", "pause"};
+
+/**
+ * @brief Initializes the thresholds of the stages of overload with their default values
+ *
+ * @param thresholds array of the thresholds of each stage
+ */
+void init_overload_thresholds(OverloadThreshold *thresholds)
+{
+    thresholds[OVERLOAD_NONE] = (OverloadThreshold){0, 0};
+    thresholds[OVERLOAD_CACHED_RANKINGS] = (OverloadThreshold){OVERLOAD_CACHE_LAG_US, OVERLOAD_CACHE_QUEUE};
+    thresholds[OVERLOAD_WAITING_ROOM] = (OverloadThreshold){OVERLOAD_WAITING_LAG_US, OVERLOAD_WAITING_QUEUE};
+    thresholds[OVERLOAD_ACCEPTS_PAUSED] = (OverloadThreshold){OVERLOAD_PAUSE_LAG_US, OVERLOAD_PAUSE_QUEUE};
+}
+
+/**
+ * @brief Initializes the overload controller of a worker, with the default thresholds and an empty waiting room
+ *
+ * @param context pointer to the structure containing the service context information
+ */
+void init_overload(Context *context)
+{
+    OverloadState *overload = &context->overload;
+    memset(overload, 0, sizeof(OverloadState));
+    init_overload_thresholds(overload->thresholds);
+    overload->stage = OVERLOAD_NONE;
+    overload->changed_ns = overload->updated_ns = get_time_ns();
+    init_timer(&overload->waiting_timer, send_waiting_positions, NULL);
+}
+
+/**
+ * @brief Parses the thresholds of a stage of overload given on the command line
+ *
+ * The thresholds have the form stage=lag_us[/queue_depth], where the stage is cache, waiting or pause;
+ * a threshold of 0, or a queue depth omitted, is not used.
+ *
+ * @param arg argument of the option
+ * @param thresholds array of the thresholds of each stage
+ * @return true if the argument is valid
+ */
+bool parse_overload_threshold(const char *arg, OverloadThreshold *thresholds)
+{
+    for (int s = OVERLOAD_CACHED_RANKINGS; s < OVERLOAD_STAGES_COUNT; s++)
+    {
+        size_t name_length = strlen(stage_options[s]);
+        if (strncmp(arg, stage_options[s], name_length) != 0 || arg[name_length] != '=')
+            continue;
+        char *end;
+        unsigned long lag_us = strtoul(arg + name_length + 1, &end, 10), queue_depth = 0;
+        if (*end == '/')
+            queue_depth = strtoul(end + 1, &end, 10);
+        if (*end != '\0' || lag_us > UINT32_MAX || queue_depth > UINT32_MAX)
+            return false;
+        thresholds[s] = (OverloadThreshold){lag_us, queue_depth};
+        return true;
+    }
+    return false;
+}
+
+/**
+ * @brief Tells if the signals of a worker exceed the thresholds of a stage
+ *
+ * @param threshold pointer to the thresholds of the stage
+ * @param lag_ns smoothed duration of the iterations
+ * @param queue_depth queue depth
+ * @param divisor divisor applied to the thresholds, 2 to check that the worker has recovered from the stage
+ * @return true if a signal used by the stage exceeds its threshold
+ */
+bool overload_signals_above(OverloadThreshold *threshold, uint64_t lag_ns, uint64_t queue_depth, unsigned int divisor)
+{
+    if (threshold->lag_us && lag_ns >= threshold->lag_us * 1000ULL / divisor)
+        return true;
+    return threshold->queue_depth && queue_depth >= threshold->queue_depth / divisor;
+}
+
+/**
+ * @brief Updates the signals of the overload controller of a worker at the end of an iteration, and its stage
+ *
+ * The lag is the duration of the iterations, which is how long a request arriving during one waits at most,
+ * averaged over the last OVERLOAD_LAG_WINDOW_MS: each iteration weighs as much as the time it covers, waiting
+ * included, so the lag of an idle worker vanishes at its next wake-up. The queue depth counts the ranking events
+ * waiting for the worker and the connections whose output is waiting for space in the kernel buffers.
+ *
+ * A stage is entered as soon as one of its signals exceeds its threshold, and left one at a time, once the signals
+ * are below half of its thresholds and OVERLOAD_COOLDOWN_MS have passed since the last change, so that the
+ * worker does not oscillate. Once the waiting room is closed, its clients are admitted ADMISSION_BUDGET at a time.
+ *
+ * @param context pointer to the structure containing the service context information
+ * @param busy_ns time spent handling the events of the iteration
+ */
+void update_overload(Context *context, uint64_t busy_ns)
+{
+    OverloadState *overload = &context->overload;
+    uint64_t now_ns = get_time_ns(), window_ns = OVERLOAD_LAG_WINDOW_MS * 1000000ULL;
+    uint64_t covered_ns = now_ns - overload->updated_ns;
+    if (covered_ns > 10 * window_ns)
+        covered_ns = 10 * window_ns;
+    uint64_t lag_ns = (overload->lag_ns * window_ns + busy_ns * covered_ns) / (window_ns + covered_ns);
+    uint64_t queue_depth = ranking_queue_depth(&context->ranking_queue) + context->blocked_writes;
+    overload->updated_ns = now_ns;
+    __atomic_store_n(&overload->lag_ns, lag_ns, __ATOMIC_RELAXED);
+    __atomic_store_n(&overload->queue_depth, queue_depth, __ATOMIC_RELAXED);
+
+    OverloadStage stage = overload->stage;
+    for (int s = OVERLOAD_STAGES_COUNT - 1; s > (int)stage; s--)
+    {
+        if (!overload_signals_above(&overload->thresholds[s], lag_ns, queue_depth, 1))
+            continue;
+        set_overload_stage(context, s);
+        break;
+    }
+    if (overload->stage == stage && stage > OVERLOAD_NONE &&
+        now_ns - overload->changed_ns >= OVERLOAD_COOLDOWN_MS * 1000000ULL &&
+        !overload_signals_above(&overload->thresholds[stage], lag_ns, queue_depth, 2))
+        set_overload_stage(context, stage - 1);
+
+    if (overload->stage < OVERLOAD_WAITING_ROOM && overload->total_waiting)
+        admit_waiting_clients(context, ADMISSION_BUDGET);
+}
+
+/**
+ * @brief Moves a worker to a stage of overload, pausing or resuming its accepts if needed
+ *
+ * @param context pointer to the structure containing the service context information
+ * @param stage new stage
+ */
+void set_overload_stage(Context *context, OverloadStage stage)
+{
+    OverloadState *overload = &context->overload;
+    bool was_paused = overload->stage >= OVERLOAD_ACCEPTS_PAUSED, paused = stage >= OVERLOAD_ACCEPTS_PAUSED;
+    if (was_paused != paused)
+        context->io->pause_accepts(context, paused);
+    // A worker jumping to a stage also enters the ones before it
+    for (int s = overload->stage + 1; s <= (int)stage; s++)
+        count_io(&overload->entered[s], 1);
+    printf("Worker %u: overload stage %s, loop lag %.1f ms, queue depth %llu\n", context->worker_id,
+           stage_names[stage], overload->lag_ns / 1e6, (unsigned long long)overload->queue_depth);
+    __atomic_store_n(&overload->stage, stage, __ATOMIC_RELAXED);
+    overload->changed_ns = get_time_ns();
+}
+
+/**
+ * @brief Puts a new client in the waiting room of its overloaded worker, instead of asking for its nickname
+ *
+ * The client is told its position, updated every WAITING_UPDATE_MS, and its requests other than the
+ * negotiation of the protocol wait in the input of its connection until it is admitted.
+ *
+ * @param client pointer to the client
+ * @param context pointer to the structure containing the service context information
+ */
+void enter_waiting_room(Client *client, Context *context)
+{
+    OverloadState *overload = &context->overload;
+    client->waiting = true;
+    client->waiting_next = NULL;
+    client->waiting_prev = overload->waiting_tail;
+    if (overload->waiting_tail)
+        overload->waiting_tail->waiting_next = client;
+    else
+        overload->waiting_head = client;
+    overload->waiting_tail = client;
+    __atomic_store_n(&overload->total_waiting, overload->total_waiting + 1, __ATOMIC_RELAXED);
+
+    send_waiting_position(client, overload->total_waiting);
+    if (!timer_pending(&overload->waiting_timer))
+        schedule_timer(&context->timers, &overload->waiting_timer, WAITING_UPDATE_MS);
+}
+
+/**
+ * @brief Removes a client from the waiting room, if it is in it
+ *
+ * @param client pointer to the client
+ * @param context pointer to the structure containing the service context information
+ */
+void leave_waiting_room(Client *client, Context *context)
+{
+    OverloadState *overload = &context->overload;
+    if (!client->waiting)
+        return;
+    if (client->waiting_prev)
+        client->waiting_prev->waiting_next = client->waiting_next;
+    else
+        overload->waiting_head = client->waiting_next;
+    if (client->waiting_next)
+        client->waiting_next->waiting_prev = client->waiting_prev;
+    else
+        overload->waiting_tail = client->waiting_prev;
+    client->waiting = false;
+    client->waiting_prev = client->waiting_next = NULL;
+    __atomic_store_n(&overload->total_waiting, overload->total_waiting - 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Admits the first clients of the waiting room, asking for their nickname as to any new client
+ *
+ * The requests they sent meanwhile are handled right away.
+ *
+ * @param context pointer to the structure containing the service context information
+ * @param count maximum number of clients to admit
+ */
+void admit_waiting_clients(Context *context, unsigned int count)
+{
+    OverloadState *overload = &context->overload;
+    for (unsigned int i = 0; i < count && overload->waiting_head; i++)
+    {
+        Client *client = overload->waiting_head;
+        leave_waiting_room(client, context);
+        count_io(&overload->admitted, 1);
+        if (context->timeouts.login_ms)
+            schedule_timer(&context->timers, &client->idle_timer, context->timeouts.login_ms);
+        request_client_nickname(client->socket_fd);
+        handle_client_requests(client, context);
+    }
+    if (!overload->waiting_head)
+        cancel_timer(&context->timers, &overload->waiting_timer);
+}
+
+/**
+ * @brief Tells a client of the waiting room its position
+ *
+ * @param client pointer to the client
+ * @param position position of the client, 1 for the next one admitted
+ */
+void send_waiting_position(Client *client, uint32_t position)
+{
+    char message[DEFAULT_PAYLOAD_SIZE];
+    int length = snprintf(message, sizeof(message), "The server is busy: you are number %u in the waiting room",
+                          position);
+    send_msg(client->socket_fd, MSG_INFO, message, length);
+}
+
+/**
+ * @brief Sends their position to the clients of the waiting room
+ *
+ * It is the callback of the waiting timer of the worker, rescheduled every WAITING_UPDATE_MS while the waiting
+ * room is not empty.
+ *
+ * @param timer pointer to the expired timer
+ * @param context pointer to the structure containing the service context information
+ */
+void send_waiting_positions(Timer *timer, Context *context)
+{
+    uint32_t position = 0;
+    for (Client *client = context->overload.waiting_head; client; client = client->waiting_next)
+        send_waiting_position(client, ++position);
+    if (position)
+        schedule_timer(&context->timers, timer, WAITING_UPDATE_MS);
+}
+
+/**
+ * @brief Returns the highest stage of overload among the workers
+ *
+ * @param workers array of the contexts of the workers
+ * @param total_workers number of workers
+ * @return stage of the most overloaded worker
+ */
+OverloadStage worst_overload_stage(Context *workers, unsigned int total_workers)
+{
+    OverloadStage worst = OVERLOAD_NONE;
+    for (unsigned int i = 0; i < total_workers; i++)
+    {
+        OverloadStage stage = __atomic_load_n(&workers[i].overload.stage, __ATOMIC_RELAXED);
+        if (stage > worst)
+            worst = stage;
+    }
+    return worst;
+}
+
+/**
+ * @brief Displays the signals and the stage of the most overloaded worker, the waiting rooms and the thresholds
+ *
+ * @param workers array of the contexts of the workers
+ * @param total_workers number of workers
+ */
+void show_overload_stats(Context *workers, unsigned int total_workers)
+{
+    uint64_t lag_ns = 0, queue_depth = 0, cached = 0, admitted = 0, entered[OVERLOAD_STAGES_COUNT] = {0};
+    uint32_t waiting = 0;
+    for (unsigned int i = 0; i < total_workers; i++)
+    {
+        OverloadState *overload = &workers[i].overload;
+        uint64_t worker_lag = __atomic_load_n(&overload->lag_ns, __ATOMIC_RELAXED);
+        uint64_t worker_queue = __atomic_load_n(&overload->queue_depth, __ATOMIC_RELAXED);
+        lag_ns = worker_lag > lag_ns ? worker_lag : lag_ns;
+        queue_depth = worker_queue > queue_depth ? worker_queue : queue_depth;
+        cached += __atomic_load_n(&overload->cached_rankings, __ATOMIC_RELAXED);
+        admitted += __atomic_load_n(&overload->admitted, __ATOMIC_RELAXED);
+        waiting += __atomic_load_n(&overload->total_waiting, __ATOMIC_RELAXED);
+        for (int s = 0; s < OVERLOAD_STAGES_COUNT; s++)
+            entered[s] += __atomic_load_n(&overload->entered[s], __ATOMIC_RELAXED);
+    }
+
+    printf("Overload: stage %s, loop lag %.2f ms, queue depth %llu, %u waiting, %llu admitted, %llu cached rankings\n",
+           stage_names[worst_overload_stage(workers, total_workers)], lag_ns / 1e6, (unsigned long long)queue_depth,
+           waiting, (unsigned long long)admitted, (unsigned long long)cached);
+    printf("Overload stages:");
+    for (int s = OVERLOAD_CACHED_RANKINGS; s < OVERLOAD_STAGES_COUNT; s++)
+    {
+        OverloadThreshold *threshold = &workers[0].overload.thresholds[s];
+        printf("%s %s at %.1f ms/%u queued, entered %llu times", s > OVERLOAD_CACHED_RANKINGS ? "," : "",
+               stage_names[s], threshold->lag_us / 1e3, threshold->queue_depth, (unsigned long long)entered[s]);
+    }
+    printf("\n");
+}
+
+/**
+ * @brief Copies the state of the overload controllers of all the workers in a publication of the shared-memory region
+ *
+ * @param stats pointer to the statistics of the publication
+ * @param workers array of the contexts of the workers
+ * @param total_workers number of workers
+ */
+void fill_overload_stats(ShmStats *stats, Context *workers, unsigned int total_workers)
+{
+    stats->overload_stage = worst_overload_stage(workers, total_workers);
+    for (unsigned int i = 0; i < total_workers; i++)
+    {
+        OverloadState *overload = &workers[i].overload;
+        uint64_t lag_ns = __atomic_load_n(&overload->lag_ns, __ATOMIC_RELAXED);
+        uint64_t queue_depth = __atomic_load_n(&overload->queue_depth, __ATOMIC_RELAXED);
+        stats->loop_lag_ns = lag_ns > stats->loop_lag_ns ? lag_ns : stats->loop_lag_ns;
+        stats->queue_depth = queue_depth > stats->queue_depth ? queue_depth : stats->queue_depth;
+        stats->cached_rankings += __atomic_load_n(&overload->cached_rankings, __ATOMIC_RELAXED);
+        stats->admitted += __atomic_load_n(&overload->admitted, __ATOMIC_RELAXED);
+        stats->waiting += __atomic_load_n(&overload->total_waiting, __ATOMIC_RELAXED);
+        for (int s = 0; s < OVERLOAD_STAGES_COUNT && s < SHM_OVERLOAD_STAGES; s++)
+        {
+            stats->overload_entered[s] += __atomic_load_n(&overload->entered[s], __ATOMIC_RELAXED);
+            stats->overload_lag_us[s] = overload->thresholds[s].lag_us;
+            stats->overload_queue[s] = overload->thresholds[s].queue_depth;
+        }
+    }
+}
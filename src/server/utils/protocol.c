@@ -0,0 +1,337 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "utils.h"
+#include "../../common/params.h"
+
+// Encoders of each version of the protocol, indexed by version - 1
+static const ProtocolCodec codecs[] = {
+    {PROTOCOL_V1, encode_ranking_v1, quiz_list_v1},
+    {PROTOCOL_V2, encode_ranking_v2, quiz_list_v2},
+};
+
+/**
+ * @brief Returns the encoders of a version of the protocol
+ *
+ * @param version version of the protocol, between PROTOCOL_V1 and PROTOCOL_LATEST
+ * @return pointer to the encoders
+ */
+const ProtocolCodec *select_codec(uint8_t version)
+{
+    if (version < PROTOCOL_V1 || version > PROTOCOL_LATEST)
+        version = PROTOCOL_V1;
+    return &codecs[version - 1];
+}
+
+/**
+ * @brief Initializes the protocol of a new client, as for a client that never sends a MSG_HELLO
+ *
+ * @param client pointer to the client
+ */
+void init_client_protocol(Client *client)
+{
+    legacy_capabilities(&client->capabilities);
+    client->codec = select_codec(client->capabilities.version);
+}
+
+/**
+ * @brief Handles the capabilities announced by a client, negotiating the ones used by the connection
+ *
+ * The client sends its capabilities before the nickname, and the server responds with a MSG_HELLO containing
+ * the ones supported by both together with the largest payload accepted by the server. The encoders of the
+ * binary payloads sent afterwards are selected from the protocol version negotiated.
+ * It can only be done before logging in; until then the version 1 protocol is used.
+ *
+ * @param client pointer to the client that sent the capabilities
+ * @param msg pointer to the received message
+ */
+void handle_hello(Client *client, Message *msg)
+{
+    Capabilities local, peer;
+    if (client->state != LOGIN || !decode_hello(msg, &peer))
+    {
+        char *message = "The capabilities can only be negotiated before logging in";
+        send_msg(client->socket_fd, MSG_INFO, message, strlen(message));
+        return;
+    }
+
+    init_capabilities(&local, SERVER_MAX_FRAME);
+    negotiate_capabilities(&local, &peer, &client->capabilities);
+    client->codec = select_codec(client->capabilities.version);
+
+    char payload[HELLO_SIZE];
+    Capabilities response = client->capabilities;
+    response.max_frame = local.max_frame;
+    encode_hello(payload, &response);
+    send_msg(client->socket_fd, MSG_HELLO, payload, sizeof(payload));
+}
+
+/**
+ * @brief Sends a message to a client only if its payload fits in the frames accepted by the client
+ *
+ * Otherwise the client is informed with a MSG_INFO message instead.
+ *
+ * @param client pointer to the client
+ * @param type type of the message
+ * @param payload pointer to the payload
+ * @param payload_length length of the payload
+ * @return true if the message has been sent
+ */
+bool send_bounded_msg(Client *client, MessageType type, char *payload, size_t payload_length)
+{
+    if (payload_length > client->capabilities.max_frame)
+    {
+        char *message = "The response is larger than the frames accepted by the client";
+        send_msg(client->socket_fd, MSG_INFO, message, strlen(message));
+        return false;
+    }
+    send_msg(client->socket_fd, type, payload, payload_length);
+    return true;
+}
+
+/**
+ * @brief Serializes the list of available quizzes for the version 2 protocol
+ *
+ * The list has the same layout as in the version 1 protocol, with varints instead of uint16_t values:
+ * (number of quizzes) [(name length) (name)]
+ *
+ * @param quizzesInfo pointer to the structure containing the quiz information
+ */
+void serialize_compact_quiz_list(QuizzesInfo *quizzesInfo)
+{
+    size_t length = varint_size(quizzesInfo->total_quizzes);
+    for (uint16_t i = 0; i < quizzesInfo->total_quizzes; i++)
+    {
+        size_t string_len = strlen(quizzesInfo->quizzes[i]->name);
+        length += varint_size(string_len) + string_len;
+    }
+
+    char *payload = malloc(length);
+    handle_malloc_error(payload, "Error allocating payload");
+    char *pointer = payload + encode_varint(payload, quizzesInfo->total_quizzes);
+    for (uint16_t i = 0; i < quizzesInfo->total_quizzes; i++)
+    {
+        size_t string_len = strlen(quizzesInfo->quizzes[i]->name);
+        pointer += encode_varint(pointer, string_len);
+        memcpy(pointer, quizzesInfo->quizzes[i]->name, string_len);
+        pointer += string_len;
+    }
+
+    quizzesInfo->quiz_list_compact = payload;
+    quizzesInfo->quiz_list_compact_length = length;
+}
+
+/**
+ * @brief Returns the list of available quizzes serialized for the version 1 protocol
+ *
+ * @param quizzesInfo pointer to the structure containing the quiz information
+ * @param length pointer in which the length of the list is stored
+ * @return pointer to the serialized list
+ */
+const char *quiz_list_v1(QuizzesInfo *quizzesInfo, size_t *length)
+{
+    *length = quizzesInfo->quiz_list_length;
+    return quizzesInfo->quiz_list_payload;
+}
+
+/**
+ * @brief Returns the list of available quizzes serialized for the version 2 protocol
+ *
+ * @param quizzesInfo pointer to the structure containing the quiz information
+ * @param length pointer in which the length of the list is stored
+ * @return pointer to the serialized list
+ */
+const char *quiz_list_v2(QuizzesInfo *quizzesInfo, size_t *length)
+{
+    *length = quizzesInfo->quiz_list_compact_length;
+    return quizzesInfo->quiz_list_compact;
+}
+
+/**
+ * @brief Returns the list of available quizzes serialized for the protocol negotiated with a client
+ *
+ * @param client pointer to the client
+ * @param quizzesInfo pointer to the structure containing the quiz information
+ * @param length pointer in which the length of the list is stored
+ * @return pointer to the serialized list
+ */
+const char *client_quiz_list(Client *client, QuizzesInfo *quizzesInfo, size_t *length)
+{
+    return client->codec->quiz_list(quizzesInfo, length);
+}
+
+/**
+ * @brief Empties a string table, keeping its memory for the next frame
+ *
+ * @param table pointer to the string table
+ */
+void reset_string_table(StringTable *table)
+{
+    table->length = 0;
+    table->count = 0;
+    if (table->slots)
+        memset(table->slots, 0, table->slot_count * sizeof(uint32_t));
+}
+
+/**
+ * @brief Doubles the slots of a string table and hashes its strings again
+ *
+ * @param table pointer to the string table
+ */
+void grow_string_slots(StringTable *table)
+{
+    table->slot_count = table->slot_count ? table->slot_count * 2 : 64;
+    free(table->slots);
+    table->slots = calloc(table->slot_count, sizeof(uint32_t));
+    handle_malloc_error(table->slots, "Memory allocation error for a string table");
+
+    for (uint32_t index = 0; index < table->count; index++)
+    {
+        const char *string = table->data + table->offsets[index];
+        uint32_t hash = 2166136261u;
+        for (uint32_t i = 0; i < table->lengths[index]; i++)
+            hash = (hash ^ (uint8_t)string[i]) * 16777619u;
+        uint32_t slot = hash & (table->slot_count - 1);
+        while (table->slots[slot])
+            slot = (slot + 1) & (table->slot_count - 1);
+        table->slots[slot] = index + 1;
+    }
+}
+
+/**
+ * @brief Returns the index of a string in a string table, adding it the first time it is seen
+ *
+ * @param table pointer to the string table
+ * @param string pointer to the characters of the string, not necessarily terminated
+ * @param length length of the string
+ * @return index of the string in the table
+ */
+uint32_t intern_string(StringTable *table, const char *string, uint32_t length)
+{
+    if (2 * (table->count + 1) > table->slot_count)
+        grow_string_slots(table);
+
+    uint32_t hash = 2166136261u;
+    for (uint32_t i = 0; i < length; i++)
+        hash = (hash ^ (uint8_t)string[i]) * 16777619u;
+    uint32_t slot = hash & (table->slot_count - 1);
+    while (table->slots[slot])
+    {
+        uint32_t index = table->slots[slot] - 1;
+        if (table->lengths[index] == length && memcmp(table->data + table->offsets[index], string, length) == 0)
+            return index;
+        slot = (slot + 1) & (table->slot_count - 1);
+    }
+
+    if (table->count == table->capacity)
+    {
+        table->capacity = table->capacity ? table->capacity * 2 : 64;
+        table->offsets = realloc(table->offsets, table->capacity * sizeof(uint32_t));
+        table->lengths = realloc(table->lengths, table->capacity * sizeof(uint32_t));
+        handle_malloc_error(table->offsets, "Memory allocation error for a string table");
+        handle_malloc_error(table->lengths, "Memory allocation error for a string table");
+    }
+    if (!table->data)
+    {
+        table->size = DEFAULT_PAYLOAD_SIZE;
+        table->data = malloc(table->size);
+        handle_malloc_error(table->data, "Memory allocation error for a string table");
+    }
+    char *pointer = table->data + table->length;
+    ensure_capacity(&table->data, &pointer, &table->size, VARINT_MAX_SIZE + length);
+    pointer += encode_varint(pointer, length);
+    memcpy(pointer, string, length);
+
+    uint32_t index = table->count++;
+    table->offsets[index] = pointer - table->data;
+    table->lengths[index] = length;
+    table->length = pointer + length - table->data;
+    table->slots[slot] = index + 1;
+    return index;
+}
+
+/**
+ * @brief Serializes the ranking for each quiz using the version 2 protocol
+ *
+ * It works as encode_ranking_v1, but counts, lengths and scores are varints and each nickname is sent only once
+ * in a string table, however many quizzes the user is playing; the users of each ranking refer to it by index:
+ * (number of strings) [(name length) (name)] (number of quizzes) {(number of users) [(name index) (score)]} {...}
+ * The rankings are read from the encoding of the snapshots for the version 2 protocol, which has no size limit.
+ *
+ * @param context pointer to the structure containing the service context information
+ * @return length of the payload in the ranking buffer
+ */
+size_t encode_ranking_v2(Context *context)
+{
+    QuizzesInfo *quizzesInfo = context->quizzesInfo;
+    StringTable *table = &context->strings;
+    if (!context->entries_buffer)
+    {
+        context->entries_buffer_size = DEFAULT_PAYLOAD_SIZE;
+        context->entries_buffer = malloc(context->entries_buffer_size);
+        handle_malloc_error(context->entries_buffer, "Error allocating payload");
+    }
+    if (!context->ranking_buffer)
+    {
+        context->ranking_buffer_size = DEFAULT_PAYLOAD_SIZE;
+        context->ranking_buffer = malloc(context->ranking_buffer_size);
+        handle_malloc_error(context->ranking_buffer, "Error allocating payload");
+    }
+
+    process_ranking_events(context);
+    reset_string_table(table);
+
+    // Encode the users of every ranking first, collecting their nicknames in the string table
+    char *pointer = context->entries_buffer;
+    ensure_capacity(&context->entries_buffer, &pointer, &context->entries_buffer_size, VARINT_MAX_SIZE);
+    pointer += encode_varint(pointer, quizzesInfo->total_quizzes);
+    for (uint16_t i = 0; i < quizzesInfo->total_quizzes; i++)
+    {
+        Quiz *quiz = quizzesInfo->quizzes[i];
+        RankingSnapshot *snapshot = acquire_ranking_snapshot(quiz);
+        const char *source = snapshot->compact, *end = snapshot->compact + snapshot->compact_length;
+        uint64_t total_clients, string_len, score;
+        source += decode_varint(source, end, &total_clients);
+
+        ensure_capacity(&context->entries_buffer, &pointer, &context->entries_buffer_size, VARINT_MAX_SIZE);
+        pointer += encode_varint(pointer, total_clients);
+        for (uint64_t j = 0; j < total_clients; j++)
+        {
+            source += decode_varint(source, end, &string_len);
+            uint32_t index = intern_string(table, source, string_len);
+            source += string_len;
+            source += decode_varint(source, end, &score);
+
+            ensure_capacity(&context->entries_buffer, &pointer, &context->entries_buffer_size, 2 * VARINT_MAX_SIZE);
+            pointer += encode_varint(pointer, index);
+            pointer += encode_varint(pointer, score);
+        }
+        release_ranking_snapshot(quiz, snapshot);
+    }
+    size_t entries_length = pointer - context->entries_buffer;
+
+    // Then put the string table in front of them
+    pointer = context->ranking_buffer;
+    ensure_capacity(&context->ranking_buffer, &pointer, &context->ranking_buffer_size,
+                    VARINT_MAX_SIZE + table->length + entries_length);
+    pointer += encode_varint(pointer, table->count);
+    if (table->length)
+        memcpy(pointer, table->data, table->length);
+    pointer += table->length;
+    memcpy(pointer, context->entries_buffer, entries_length);
+    pointer += entries_length;
+    return pointer - context->ranking_buffer;
+}
+
+/**
+ * @brief Deallocates the memory of a string table
+ *
+ * @param table pointer to the string table
+ */
+void deallocate_string_table(StringTable *table)
+{
+    free(table->data);
+    free(table->offsets);
+    free(table->lengths);
+    free(table->slots);
+    memset(table, 0, sizeof(StringTable));
+}
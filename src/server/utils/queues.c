@@ -0,0 +1,108 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "utils.h"
+
+/**
+ * @brief Initializes an empty ranking queue
+ *
+ * The queue is a ring of slots, each tagged with the position it is ready for: a slot whose sequence
+ * equals the position of the tail can be filled, and a slot whose sequence is one past the position
+ * of the head holds an event ready to be consumed.
+ *
+ * @param queue pointer to the queue to initialize
+ * @param capacity number of slots, must be a power of two
+ */
+void init_ranking_queue(RankingQueue *queue, size_t capacity)
+{
+    queue->slots = malloc(capacity * sizeof(RankingQueueSlot));
+    handle_malloc_error(queue->slots, "Memory allocation error for a ranking queue");
+    for (size_t i = 0; i < capacity; i++)
+        queue->slots[i].sequence = i;
+    queue->mask = capacity - 1;
+    queue->head = 0;
+    queue->tail = 0;
+}
+
+/**
+ * @brief Appends an event to a ranking queue, from any thread
+ *
+ * @param queue pointer to the queue
+ * @param event pointer to the event to append
+ * @return true if the event has been appended, false if the queue is full
+ */
+bool push_ranking_event(RankingQueue *queue, const RankingEvent *event)
+{
+    RankingQueueSlot *slot;
+    size_t position = __atomic_load_n(&queue->tail, __ATOMIC_RELAXED);
+
+    for (;;)
+    {
+        slot = &queue->slots[position & queue->mask];
+        size_t sequence = __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE);
+        intptr_t difference = (intptr_t)sequence - (intptr_t)position;
+
+        // The slot is free: reserve it by moving the tail forward
+        if (difference == 0)
+        {
+            if (__atomic_compare_exchange_n(&queue->tail, &position, position + 1, true, __ATOMIC_RELAXED,
+                                            __ATOMIC_RELAXED))
+                break;
+        }
+        // The slot still holds the event of the previous lap, which has not been consumed
+        else if (difference < 0)
+            return false;
+        // Another producer has reserved the slot in the meantime
+        else
+            position = __atomic_load_n(&queue->tail, __ATOMIC_RELAXED);
+    }
+
+    slot->event = *event;
+    __atomic_store_n(&slot->sequence, position + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+/**
+ * @brief Removes the oldest event from a ranking queue, only from the thread that owns the queue
+ *
+ * @param queue pointer to the queue
+ * @param event pointer to the structure where the event is copied
+ * @return true if an event has been removed, false if the queue is empty
+ */
+bool pop_ranking_event(RankingQueue *queue, RankingEvent *event)
+{
+    RankingQueueSlot *slot = &queue->slots[queue->head & queue->mask];
+    size_t sequence = __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE);
+
+    if ((intptr_t)sequence - (intptr_t)(queue->head + 1) < 0)
+        return false;
+
+    *event = slot->event;
+    // Make the slot available to the producers of the next lap
+    __atomic_store_n(&slot->sequence, queue->head + queue->mask + 1, __ATOMIC_RELEASE);
+    queue->head++;
+    return true;
+}
+
+/**
+ * @brief Deallocates the slots of a ranking queue
+ *
+ * @param queue pointer to the queue
+ */
+void deallocate_ranking_queue(RankingQueue *queue)
+{
+    free(queue->slots);
+    queue->slots = NULL;
+}
+
+/**
+ * @brief Returns the number of events waiting in a ranking queue, read by its consumer
+ *
+ * The events being appended by the producers are counted too, so the result is only an estimate.
+ *
+ * @param queue pointer to the queue
+ * @return number of events
+ */
+size_t ranking_queue_depth(RankingQueue *queue)
+{
+    return __atomic_load_n(&queue->tail, __ATOMIC_RELAXED) - queue->head;
+}
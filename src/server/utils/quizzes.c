@@ -1,4 +1,5 @@
 #include <dirent.h>
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/stat.h>
@@ -51,6 +52,7 @@ Quiz *load_quiz_from_file(const char *file_path)
     if (!file)
     {
         printf("Error opening the file\n");
+        flight_record(FLIGHT_ERROR, FLIGHT_ERROR_QUIZ_FILE, 0, errno, 0);
         exit(EXIT_FAILURE);
     }
     // Allocate the quiz
@@ -75,6 +77,17 @@ Quiz *load_quiz_from_file(const char *file_path)
     quiz->ranking_head = NULL;
     quiz->ranking_tail = NULL;
     quiz->total_clients = 0;
+    quiz->owner = NULL;
+    quiz->snapshot_stale = false;
+    quiz->live = NULL;
+    init_spectator_timer(quiz);
+    quiz->ranking_version = 0;
+    quiz->delta_left = NULL;
+    quiz->delta_left_length = quiz->delta_left_capacity = 0;
+    quiz->delta_left_count = 0;
+    quiz->delta_batches = 0;
+    quiz->recovered_players = 0;
+    quiz->snapshot_word = 0;
 
     // Read the first line, which contains the name of the quiz
     if ((read = getline(&lineptr, &len, file)) != -1)
@@ -94,6 +107,8 @@ Quiz *load_quiz_from_file(const char *file_path)
     }
 
     quiz->total_questions = question_count;
+    // Readers always find a snapshot, even before the first change to the ranking
+    publish_ranking_snapshot(quiz, build_ranking_snapshot(quiz));
 
     // Allocate arrays for questions and answers
     quiz->questions = (QuizQuestion **)malloc(question_count * sizeof(QuizQuestion *));
@@ -124,6 +139,7 @@ Quiz *load_quiz_from_file(const char *file_path)
         if (strncmp(lineptr, "Question: ", 10) != 0)
         {
             printf("The quiz file %s is not formatted correctly, please refer to the documentation\n", quiz->name);
+            flight_record(FLIGHT_ERROR, FLIGHT_ERROR_QUIZ_FILE, 0, 0, 0);
             exit(EXIT_FAILURE);
         }
         // Allocate the object for the current question
@@ -141,6 +157,7 @@ Quiz *load_quiz_from_file(const char *file_path)
         {
             // In this case, there is a question without answers
             printf("The quiz file %s is not formatted correctly, please refer to the documentation\n", quiz->name);
+            flight_record(FLIGHT_ERROR, FLIGHT_ERROR_QUIZ_FILE, 0, 0, 0);
             exit(EXIT_FAILURE);
         }
         // Skip the string "Answers: "
@@ -209,9 +226,16 @@ int load_quizzes_from_directory(const char *directory_path, QuizzesInfo *quizzes
     if (directory == NULL)
     {
         printf("Error opening the specified directory\n");
+        flight_record(FLIGHT_ERROR, FLIGHT_ERROR_QUIZ_FILE, 0, errno, 0);
         exit(EXIT_FAILURE);
     }
 
+    quizzesInfo->quiz_list_payload = NULL;
+    quizzesInfo->subscribers = 0;
+    quizzesInfo->quiz_list_length = 0;
+    quizzesInfo->quiz_list_compact = NULL;
+    quizzesInfo->quiz_list_compact_length = 0;
+
     // Count the total number of quizzes present in the directory
     quizzesInfo->total_quizzes = get_directory_total_files(directory);
 
@@ -235,11 +259,16 @@ int load_quizzes_from_directory(const char *directory_path, QuizzesInfo *quizzes
 
         // Load the quiz from the file and insert it into the array
         quizzesInfo->quizzes[current_quiz] = load_quiz_from_file(file_path);
+        quizzesInfo->quizzes[current_quiz]->id = current_quiz;
         current_quiz++;
     }
 
     // Close the directory
     closedir(directory);
+
+    // The list never changes, so it is serialized once for all the workers
+    serialize_quiz_list(quizzesInfo);
+    serialize_compact_quiz_list(quizzesInfo);
     return quizzesInfo->total_quizzes;
 }
 
@@ -259,6 +288,9 @@ void deallocate_quizzes(QuizzesInfo *quizzesInfo)
 
         // Deallocate the doubly linked list associated with the quiz ranking
         deallocate_rankings(quiz);
+        discard_ranking_snapshot(quiz);
+        deallocate_live_quiz(quiz);
+        deallocate_ranking_deltas(quiz);
 
         for (uint16_t j = 0; j < quiz->total_questions; j++)
         {
@@ -278,4 +310,6 @@ void deallocate_quizzes(QuizzesInfo *quizzesInfo)
         free(quiz);
     }
     free(quizzesInfo->quizzes);
+    free(quizzesInfo->quiz_list_payload);
+    free(quizzesInfo->quiz_list_compact);
 }
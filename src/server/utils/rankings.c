@@ -1,9 +1,15 @@
+#include <arpa/inet.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include "utils.h"
 
 /**
  * @brief Creates a new RankingNode for a client
  *
  * This function initializes a RankingNode for a client passed as a parameter.
+ * The nickname of the client is copied, since the node is deallocated by the owner of the quiz.
  *
  * @param client pointer to the client associated with the RankingNode
  * @return initialized RankingNode
@@ -12,10 +18,15 @@ RankingNode *create_ranking_node(Client *client)
 {
     RankingNode *new_node = malloc(sizeof(RankingNode));
     handle_malloc_error(new_node, "Error allocating RankingNode");
-    new_node->client = client;
+    new_node->nickname = strdup(client->nickname);
+    handle_malloc_error(new_node->nickname, "Error allocating RankingNode");
     new_node->is_quiz_completed = false;
     new_node->score = 0;
     new_node->current_question = 0;
+    new_node->correct_answers = 0;
+    new_node->round_score = 0;
+    new_node->changed_version = 0;
+    new_node->recovered = false;
     new_node->next_node = NULL;
     new_node->prev_node = NULL;
 
@@ -48,52 +59,86 @@ void insert_ranking_node(Quiz *quiz, RankingNode *node)
 /**
  * @brief Displays the ranking list for a quiz on screen
  *
+ * The ranking is read from the last snapshot published by the owner of the quiz, in its complete encoding
+ * for the version 2 protocol.
+ *
  * @param quiz pointer to the quiz for which to display the ranking list
  */
 void list_rankings(Quiz *quiz)
 {
-    RankingNode *current = quiz->ranking_head;
-    if (!current)
+    RankingSnapshot *snapshot = acquire_ranking_snapshot(quiz);
+    const char *pointer = snapshot->compact, *end = snapshot->compact + snapshot->compact_length;
+    uint64_t total_clients, string_len, score;
+    pointer += decode_varint(pointer, end, &total_clients);
+
+    if (!total_clients)
         printf("------\n");
-    while (current)
+    for (uint32_t i = 0; i < total_clients; i++)
     {
-        printf("- %s %d\n", current->client->nickname, current->score);
-        current = current->next_node;
+        pointer += decode_varint(pointer, end, &string_len);
+        printf("- %.*s", (int)string_len, pointer);
+        pointer += string_len;
+        pointer += decode_varint(pointer, end, &score);
+        printf(" %d\n", (int)score);
     }
+    release_ranking_snapshot(quiz, snapshot);
 }
 
 /**
  * @brief Displays the nicknames of users who have completed the quiz on screen
  *
+ * The ranking is read from the last snapshot published by the owner of the quiz, in its complete encoding
+ * for the version 2 protocol.
+ *
  * @param quiz pointer to the quiz for which to display the users that have completed it
  */
 void list_completed_rankings(Quiz *quiz)
 {
-    RankingNode *current = quiz->ranking_head;
+    RankingSnapshot *snapshot = acquire_ranking_snapshot(quiz);
+    const char *pointer = snapshot->compact, *end = snapshot->compact + snapshot->compact_length;
+    uint64_t total_clients, string_len, score;
     int counter = 0;
-    while (current)
+    pointer += decode_varint(pointer, end, &total_clients);
+
+    for (uint32_t i = 0; i < total_clients; i++)
     {
-        if (current->is_quiz_completed)
+        pointer += decode_varint(pointer, end, &string_len);
+        if (snapshot->completed[i])
         {
-            printf("- %s\n", current->client->nickname);
+            printf("- %.*s\n", (int)string_len, pointer);
             counter += 1;
         }
-        current = current->next_node;
+        pointer += string_len;
+        pointer += decode_varint(pointer, end, &score);
     }
     if (!counter)
         printf("------\n");
+    release_ranking_snapshot(quiz, snapshot);
 }
 
 /**
- * @brief Updates the ranking for a quiz
+ * @brief Computes the position of a node in the ranking of its quiz
  *
- * This function moves a node towards the head of the doubly linked ranking list for a quiz until it is placed
- * in the correct position based on its score.
+ * This function walks the list towards the head, so it is linear in the position of the node.
+ *
+ * @param node pointer to the node whose position is computed
+ * @return 1-based position of the node in the ranking
+ */
+unsigned int ranking_position(RankingNode *node)
+{
+    unsigned int position = 1;
+    for (RankingNode *current = node->prev_node; current; current = current->prev_node)
+        position++;
+    return position;
+}
+
+/**
+ * @brief Moves a node towards the head of the ranking until it is placed in the correct position
  *
  * @param node pointer to the node to reposition within the ranking based on its score
  * @param quiz pointer to the quiz whose ranking is to be updated
  */
-void update_ranking(RankingNode *node, Quiz *quiz)
+void reposition_ranking_node(RankingNode *node, Quiz *quiz)
 {
     if (node == NULL || quiz->ranking_head == NULL)
         return;
@@ -103,6 +148,8 @@ void update_ranking(RankingNode *node, Quiz *quiz)
         return;
 
     // Remove the node from its current position
+    if (quiz->ranking_tail == node)
+        quiz->ranking_tail = node->prev_node;
     if (node->next_node != NULL)
         node->next_node->prev_node = node->prev_node;
     if (node->prev_node != NULL)
@@ -135,6 +182,29 @@ void update_ranking(RankingNode *node, Quiz *quiz)
     }
 }
 
+/**
+ * @brief Updates the ranking for a quiz
+ *
+ * This function moves a node towards the head of the doubly linked ranking list for a quiz until it is placed
+ * in the correct position based on its score.
+ *
+ * @param node pointer to the node to reposition within the ranking based on its score
+ * @param quiz pointer to the quiz whose ranking is to be updated
+ */
+void update_ranking(RankingNode *node, Quiz *quiz)
+{
+    if (node == NULL)
+        return;
+
+    // The positions are only computed when a tracer is attached to the probe
+    unsigned int old_position = PROBE_ENABLED(ranking__update) ? ranking_position(node) : 0;
+
+    reposition_ranking_node(node, quiz);
+
+    if (PROBE_ENABLED(ranking__update))
+        PROBE4(ranking__update, quiz->id, node->score, old_position, ranking_position(node));
+}
+
 /**
  * @brief Removes and deallocates an element from a quiz ranking
  *
@@ -164,6 +234,7 @@ void remove_ranking(RankingNode *node, Quiz *quiz)
     if (node->next_node != NULL)
         node->next_node->prev_node = node->prev_node;
 
+    free(node->nickname);
     free(node);
 }
 
@@ -179,8 +250,219 @@ void deallocate_rankings(Quiz *quiz)
     while (current)
     {
         next = current->next_node;
+        free(current->nickname);
         free(current);
         current = next;
     }
     quiz->ranking_head = quiz->ranking_tail = NULL;
 }
+
+/**
+ * @brief Applies a change to a ranking owned by the current worker
+ *
+ * The change is appended to the write-ahead log first, if enabled.
+ *
+ * @param quiz pointer to the quiz whose ranking is changed
+ * @param event pointer to the change to apply
+ */
+void apply_ranking_event(Quiz *quiz, const RankingEvent *event)
+{
+    log_ranking_event(quiz, event);
+    switch (event->kind)
+    {
+    case RANKING_INSERT:
+        if (quiz->recovered_players)
+            discard_recovered_player(quiz, event->node);
+        quiz->total_clients += 1;
+        insert_ranking_node(quiz, event->node);
+        event->node->changed_version = quiz->ranking_version + 1;
+        if (quiz->live)
+            start_live_game(quiz);
+        break;
+    case RANKING_SCORE:
+        event->node->score = event->score;
+        update_ranking(event->node, quiz);
+        event->node->changed_version = quiz->ranking_version + 1;
+        break;
+    case RANKING_COMPLETE:
+        event->node->is_quiz_completed = true;
+        break;
+    case RANKING_REMOVE:
+        record_left_player(quiz, event->node);
+        remove_ranking(event->node, quiz);
+        break;
+    case RANKING_REMOVE_BATCH:
+        // Each node is logged and removed as if it had been submitted alone
+        for (RankingNode *node = event->node, *next; node; node = next)
+        {
+            next = node->next_removed;
+            RankingEvent removal = {.node = node, .quiz_id = event->quiz_id, .kind = RANKING_REMOVE};
+            apply_ranking_event(quiz, &removal);
+        }
+        break;
+    default:
+        break;
+    }
+    quiz->snapshot_stale = true;
+}
+
+/**
+ * @brief Submits a change to the ranking of a quiz
+ *
+ * The change is applied immediately if the current worker owns the quiz; otherwise it is pushed to the
+ * queue of the owner, which is woken up if it has not been already. Since the changes related to a node
+ * are always submitted by the worker of its client, the owner applies them in the order they were made.
+ * When the queue of the owner is full, the worker consumes its own queue while waiting, so that two workers
+ * submitting changes to each other cannot block forever.
+ *
+ * @param context pointer to the context of the current worker
+ * @param quiz pointer to the quiz whose ranking is changed
+ * @param kind kind of change
+ * @param node pointer to the node the change refers to
+ * @param score new score of the node, for RANKING_SCORE
+ */
+void submit_ranking_event(Context *context, Quiz *quiz, RankingEventKind kind, RankingNode *node, uint16_t score)
+{
+    RankingEvent event = {.node = node, .quiz_id = quiz->id, .score = score, .kind = kind};
+    Context *owner = quiz->owner;
+
+    if (owner == context)
+    {
+        apply_ranking_event(quiz, &event);
+        return;
+    }
+    post_ranking_event(context, owner, &event);
+}
+
+/**
+ * @brief Allocates the lists of the nodes removed from the ranking of each quiz by the disconnections of a worker
+ *
+ * @param context pointer to the context of the worker
+ */
+void init_ranking_removals(Context *context)
+{
+    context->removals = calloc(context->quizzesInfo->total_quizzes, sizeof(RankingNode *));
+    handle_malloc_error(context->removals, "Memory allocation error for the ranking removals");
+}
+
+/**
+ * @brief Queues the removal of a node from the ranking of a quiz, to be submitted at the end of the iteration
+ *
+ * When many clients disconnect at once, the owner of the quiz receives a single event for all of them
+ * instead of one for each node, so its queue does not fill up and it is woken up once.
+ *
+ * @param context pointer to the context of the worker of the client
+ * @param quiz pointer to the quiz whose ranking contains the node
+ * @param node pointer to the node to remove
+ */
+void queue_ranking_removal(Context *context, Quiz *quiz, RankingNode *node)
+{
+    node->next_removed = context->removals[quiz->id];
+    context->removals[quiz->id] = node;
+}
+
+/**
+ * @brief Submits the removals queued during the iteration, with one event for each quiz
+ *
+ * @param context pointer to the context of the worker
+ */
+void submit_ranking_removals(Context *context)
+{
+    QuizzesInfo *quizzesInfo = context->quizzesInfo;
+    for (uint16_t i = 0; i < quizzesInfo->total_quizzes; i++)
+    {
+        if (!context->removals[i])
+            continue;
+        submit_ranking_event(context, quizzesInfo->quizzes[i], RANKING_REMOVE_BATCH, context->removals[i], 0);
+        context->removals[i] = NULL;
+    }
+}
+
+/**
+ * @brief Pushes an event to the queue of another worker and wakes it up, if it has not been already
+ *
+ * @param context pointer to the context of the current worker
+ * @param target pointer to the context of the worker receiving the event
+ * @param event pointer to the event
+ */
+void post_ranking_event(Context *context, Context *target, const RankingEvent *event)
+{
+    while (!push_ranking_event(&target->ranking_queue, event))
+    {
+        wake_worker(target);
+        drain_ranking_events(context);
+        // The target might be paused for a checkpoint of the write-ahead log, waiting for this worker as well
+        pause_for_checkpoint();
+        sched_yield();
+    }
+    if (!__atomic_exchange_n(&target->wake_pending, true, __ATOMIC_ACQ_REL))
+        wake_worker(target);
+}
+
+/**
+ * @brief Applies the changes submitted by the other workers to the rankings owned by the current one
+ *
+ * @param context pointer to the context of the current worker
+ * @return true if at least one change has been applied
+ */
+bool drain_ranking_events(Context *context)
+{
+    RankingEvent event;
+    bool applied = false;
+    while (pop_ranking_event(&context->ranking_queue, &event))
+    {
+        Quiz *quiz = context->quizzesInfo->quizzes[event.quiz_id];
+        switch (event.kind)
+        {
+        case LIVE_QUESTION:
+        case LIVE_RESULTS_OUT:
+        case LIVE_END:
+            deliver_live_frame(context, quiz, event.kind, event.frame);
+            break;
+        case SPECTATOR_UPDATE:
+            deliver_spectator_update(context, quiz, event.frame);
+            break;
+        case RANKING_DELTA_OUT:
+            deliver_ranking_delta(context, event.frame);
+            break;
+        default:
+            apply_ranking_event(quiz, &event);
+            break;
+        }
+        applied = true;
+    }
+    return applied;
+}
+
+/**
+ * @brief Applies the pending changes to the rankings owned by the current worker and publishes their snapshots
+ *
+ * It is called at the end of every iteration of the event loop, so the snapshots read by the other workers
+ * lag behind the rankings by at most one iteration of the owner. The changes of each published ranking are
+ * then pushed to the subscribers, and the spectators are scheduled to receive it. The removals queued by the
+ * disconnections of the iteration are submitted first.
+ *
+ * @param context pointer to the context of the current worker
+ */
+void process_ranking_events(Context *context)
+{
+    QuizzesInfo *quizzesInfo = context->quizzesInfo;
+
+    // Wake-ups requested from now on are for events that might not be consumed by this call
+    __atomic_store_n(&context->wake_pending, false, __ATOMIC_SEQ_CST);
+    submit_ranking_removals(context);
+    drain_ranking_events(context);
+
+    for (uint16_t i = 0; i < quizzesInfo->total_quizzes; i++)
+    {
+        Quiz *quiz = quizzesInfo->quizzes[i];
+        if (quiz->owner != context || !quiz->snapshot_stale)
+            continue;
+        quiz->ranking_version++;
+        RankingSnapshot *snapshot = build_ranking_snapshot(quiz);
+        publish_ranking_snapshot(quiz, snapshot);
+        quiz->snapshot_stale = false;
+        push_ranking_delta(context, quiz, snapshot);
+        schedule_spectator_update(context, quiz);
+    }
+}
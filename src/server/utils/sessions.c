@@ -0,0 +1,349 @@
+#include <arpa/inet.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/random.h>
+#include "utils.h"
+#include "../../common/params.h"
+
+/**
+ * A player that negotiated FEATURE_SESSION_RESUME receives a random token when its nickname is accepted.
+ * If its connection drops, its nickname stays reserved and its nodes stay in the rankings for timeouts.resume_ms:
+ * a new connection presenting the token with MSG_RESUME_SESSION, to any worker, takes them back and receives
+ * the question to answer in a single MSG_SESSION_RESUMED. A player leaving with MSG_DISCONNECT is not kept.
+ */
+
+/**
+ * @brief Initializes an empty session registry
+ *
+ * @param registry pointer to the registry to initialize
+ */
+void init_session_registry(SessionRegistry *registry)
+{
+    memset(registry->buckets, 0, sizeof(registry->buckets));
+    for (int i = 0; i < SESSION_LOCK_STRIPES; i++)
+        pthread_mutex_init(&registry->locks[i], NULL);
+    registry->parked = 0;
+    registry->resumed = registry->expired = 0;
+}
+
+/**
+ * @brief Computes the bucket of a token, whose bytes are already random
+ *
+ * @param token pointer to the SESSION_TOKEN_SIZE bytes of the token
+ * @return index of the bucket of the token
+ */
+size_t session_bucket(const uint8_t *token)
+{
+    uint32_t value;
+    memcpy(&value, token, sizeof(value));
+    return value % SESSION_BUCKETS;
+}
+
+/**
+ * @brief Returns the lock protecting a bucket of the registry
+ */
+pthread_mutex_t *session_lock(SessionRegistry *registry, size_t bucket)
+{
+    return &registry->locks[bucket % SESSION_LOCK_STRIPES];
+}
+
+/**
+ * @brief Sends a client that has just logged in the token with which it can resume its session
+ *
+ * The token is only issued if the client has negotiated FEATURE_SESSION_RESUME and the resumption is enabled.
+ *
+ * @param client pointer to the client
+ * @param context pointer to the structure containing the service context information
+ */
+void issue_session_token(Client *client, Context *context)
+{
+    if (!context->sessions || !context->timeouts.resume_ms || !(client->capabilities.features & FEATURE_SESSION_RESUME))
+        return;
+    if (getrandom(client->session_token, SESSION_TOKEN_SIZE, 0) != SESSION_TOKEN_SIZE)
+        return;
+    client->resumable = true;
+    send_msg(client->socket_fd, MSG_SESSION_TOKEN, (char *)client->session_token, SESSION_TOKEN_SIZE);
+}
+
+/**
+ * @brief Keeps the session of a player whose connection dropped, so that it can be resumed
+ *
+ * The nickname and the rankings of the client are moved to the session, so the disconnection neither releases
+ * the nickname nor removes the nodes from the rankings.
+ *
+ * @param client pointer to the client being disconnected
+ * @param context pointer to the structure containing the service context information
+ * @return true if the session has been kept
+ */
+bool park_client_session(Client *client, Context *context)
+{
+    if (!client->resumable || client->state == LOGIN || client->state == SPECTATING)
+        return false;
+
+    ParkedSession *session = malloc(sizeof(ParkedSession));
+    handle_malloc_error(session, "Memory allocation error for the session of the client");
+    memcpy(session->token, client->session_token, SESSION_TOKEN_SIZE);
+    session->nickname = client->nickname;
+    session->client_rankings = client->client_rankings;
+    session->current_quiz_id = client->current_quiz_id;
+    session->state = client->state;
+    session->expires_ns = get_time_ns() + context->timeouts.resume_ms * 1000000ULL;
+    session->resumed = false;
+    client->nickname = NULL;
+    client->client_rankings = NULL;
+
+    link_parked_session(session, context);
+    if (!timer_pending(&context->session_timer))
+        schedule_timer(&context->timers, &context->session_timer, context->timeouts.resume_ms);
+    return true;
+}
+
+/**
+ * @brief Adds a session to the registry, where it can be found by its token, and to the sessions of a worker
+ *
+ * The grace period is the same for all the sessions, so they expire in the order in which they are parked:
+ * the session is appended to the list of the worker, whose session timer is scheduled by the caller.
+ *
+ * @param session pointer to the session, expiring after the ones already parked by the worker
+ * @param context pointer to the context of the worker parking the session
+ */
+void link_parked_session(ParkedSession *session, Context *context)
+{
+    size_t bucket = session_bucket(session->token);
+    pthread_mutex_t *lock = session_lock(context->sessions, bucket);
+    pthread_mutex_lock(lock);
+    session->next = context->sessions->buckets[bucket];
+    context->sessions->buckets[bucket] = session;
+    pthread_mutex_unlock(lock);
+    __atomic_add_fetch(&context->sessions->parked, 1, __ATOMIC_RELAXED);
+
+    session->next_parked = NULL;
+    if (context->parked_tail)
+        context->parked_tail->next_parked = session;
+    else
+        context->parked_head = session;
+    context->parked_tail = session;
+}
+
+/**
+ * @brief Takes the session with a token out of the registry
+ *
+ * The session is copied under the lock of its bucket, since the worker that parked it deallocates it
+ * when it expires; it is then only marked as resumed.
+ *
+ * @param registry pointer to the registry of the sessions
+ * @param token pointer to the SESSION_TOKEN_SIZE bytes of the token
+ * @param taken pointer in which the session is copied
+ * @return true if the session has been found
+ */
+bool take_parked_session(SessionRegistry *registry, const uint8_t *token, ParkedSession *taken)
+{
+    size_t bucket = session_bucket(token);
+    pthread_mutex_t *lock = session_lock(registry, bucket);
+
+    pthread_mutex_lock(lock);
+    for (ParkedSession **link = &registry->buckets[bucket]; *link; link = &(*link)->next)
+    {
+        ParkedSession *session = *link;
+        if (memcmp(session->token, token, SESSION_TOKEN_SIZE) != 0)
+            continue;
+        *link = session->next;
+        *taken = *session;
+        session->resumed = true;
+        pthread_mutex_unlock(lock);
+
+        __atomic_sub_fetch(&registry->parked, 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&registry->resumed, 1, __ATOMIC_RELAXED);
+        return true;
+    }
+    pthread_mutex_unlock(lock);
+    return false;
+}
+
+/**
+ * @brief Handles the MSG_RESUME_SESSION message with which a new connection resumes the session of a player
+ *
+ * It is accepted instead of the nickname. The client takes back the nickname, the rankings and the quiz
+ * of the session; if the token is unknown or expired, the nickname is requested again.
+ *
+ * @param client pointer to the client that sent the token
+ * @param msg pointer to the received message
+ * @param context pointer to the structure containing the service context information
+ */
+void handle_resume_session(Client *client, Message *msg, Context *context)
+{
+    ParkedSession session;
+    if (client->state != LOGIN)
+        return;
+    if (!context->sessions || !(client->capabilities.features & FEATURE_SESSION_RESUME) ||
+        msg->payload_length != SESSION_TOKEN_SIZE ||
+        !take_parked_session(context->sessions, (const uint8_t *)msg->payload, &session))
+    {
+        char *message = "The session has expired";
+        send_msg(client->socket_fd, MSG_INFO, message, strlen(message));
+        request_client_nickname(client->socket_fd);
+        return;
+    }
+
+    free(client->client_rankings);
+    client->client_rankings = session.client_rankings;
+    client->nickname = session.nickname;
+    memcpy(client->session_token, session.token, SESSION_TOKEN_SIZE);
+    client->resumable = true;
+    client->current_quiz_id = session.current_quiz_id;
+    context->clientsInfo.connected_clients += 1;
+
+    // Go back to the quiz being played, or to the quiz selection
+    set_client_state(client, session.state == PLAYING ? PLAYING : SELECTING_QUIZ);
+    send_session_resumed(client, context);
+}
+
+/**
+ * @brief Sends a resumed client everything it needs to go on in a single MSG_SESSION_RESUMED message
+ *
+ * The payload has this format:
+ * (quiz number, 0 if not playing) (score) (question to answer, or the quiz list if not playing)
+ * The question of a live quiz is sent with the next round instead, so it is left empty.
+ *
+ * @param client pointer to the resumed client
+ * @param context pointer to the structure containing the service context information
+ */
+void send_session_resumed(Client *client, Context *context)
+{
+    QuizzesInfo *quizzesInfo = context->quizzesInfo;
+    uint16_t fields[2] = {0, 0};
+    const char *next = "";
+    size_t next_length = 0;
+
+    if (client->state == PLAYING)
+    {
+        Quiz *quiz = quizzesInfo->quizzes[client->current_quiz_id];
+        RankingNode *node = client->client_rankings[client->current_quiz_id];
+        fields[0] = htons(client->current_quiz_id + 1);
+        fields[1] = htons(node->correct_answers);
+        if (!quiz->live)
+        {
+            next = quiz->questions[node->current_question]->question;
+            next_length = strlen(next);
+            arm_question_deadline(client, context);
+        }
+    }
+    else
+        next = client_quiz_list(client, quizzesInfo, &next_length);
+
+    // Reuse the ranking buffer of the worker, as for the MSG_QUIZ_RESULT messages
+    if (!context->ranking_buffer)
+    {
+        context->ranking_buffer_size = DEFAULT_PAYLOAD_SIZE;
+        context->ranking_buffer = (char *)malloc(context->ranking_buffer_size);
+        handle_malloc_error(context->ranking_buffer, "Error allocating payload");
+    }
+    char *pointer = context->ranking_buffer;
+    ensure_capacity(&context->ranking_buffer, &pointer, &context->ranking_buffer_size,
+                    SESSION_RESUMED_HEADER_SIZE + next_length);
+    memcpy(pointer, fields, sizeof(fields));
+    memcpy(pointer + SESSION_RESUMED_HEADER_SIZE, next, next_length);
+    send_msg(client->socket_fd, MSG_SESSION_RESUMED, context->ranking_buffer, SESSION_RESUMED_HEADER_SIZE + next_length);
+
+    if (client->state == PLAYING && quizzesInfo->quizzes[client->current_quiz_id]->live)
+        join_live_round(client, context);
+}
+
+/**
+ * @brief Expires the sessions parked by a worker whose grace period is over
+ *
+ * It is the callback of the session timer of the worker, rescheduled for the next session to expire.
+ * The sessions resumed meanwhile are only deallocated.
+ *
+ * @param timer pointer to the expired timer
+ * @param context pointer to the structure containing the service context information
+ */
+void expire_parked_sessions(Timer *timer, Context *context)
+{
+    uint64_t now_ns = get_time_ns();
+    while (context->parked_head && context->parked_head->expires_ns <= now_ns)
+    {
+        ParkedSession *session = context->parked_head;
+        context->parked_head = session->next_parked;
+        if (!context->parked_head)
+            context->parked_tail = NULL;
+
+        size_t bucket = session_bucket(session->token);
+        pthread_mutex_t *lock = session_lock(context->sessions, bucket);
+        pthread_mutex_lock(lock);
+        bool resumed = session->resumed;
+        for (ParkedSession **link = &context->sessions->buckets[bucket]; !resumed && *link; link = &(*link)->next)
+        {
+            if (*link != session)
+                continue;
+            *link = session->next;
+            break;
+        }
+        pthread_mutex_unlock(lock);
+
+        if (!resumed)
+        {
+            release_parked_session(session, context);
+            __atomic_sub_fetch(&context->sessions->parked, 1, __ATOMIC_RELAXED);
+            __atomic_add_fetch(&context->sessions->expired, 1, __ATOMIC_RELAXED);
+        }
+        free(session);
+    }
+    if (context->parked_head)
+        schedule_timer(&context->timers, timer, (context->parked_head->expires_ns - now_ns) / 1000000 + 1);
+}
+
+/**
+ * @brief Releases what an expired session kept: its nickname and its nodes in the rankings
+ *
+ * @param session pointer to the session
+ * @param context pointer to the structure containing the service context information
+ */
+void release_parked_session(ParkedSession *session, Context *context)
+{
+    for (uint16_t i = 0; i < context->quizzesInfo->total_quizzes; i++)
+    {
+        if (!session->client_rankings[i])
+            continue;
+        queue_ranking_removal(context, context->quizzesInfo->quizzes[i], session->client_rankings[i]);
+    }
+    release_nickname(context->nicknames, session->nickname);
+    free(session->nickname);
+    free(session->client_rankings);
+}
+
+/**
+ * @brief Deallocates the sessions parked by a worker, when the server terminates
+ *
+ * The nodes of the sessions are deallocated with the rankings, and their nicknames with the registry.
+ *
+ * @param context pointer to the context of the worker
+ */
+void deallocate_parked_sessions(Context *context)
+{
+    while (context->parked_head)
+    {
+        ParkedSession *session = context->parked_head;
+        context->parked_head = session->next_parked;
+        if (!session->resumed)
+        {
+            free(session->nickname);
+            free(session->client_rankings);
+        }
+        free(session);
+    }
+    context->parked_tail = NULL;
+}
+
+/**
+ * @brief Destroys the locks of the registry, once the sessions have been deallocated by their workers
+ *
+ * @param registry pointer to the registry of the sessions
+ */
+void deallocate_session_registry(SessionRegistry *registry)
+{
+    memset(registry->buckets, 0, sizeof(registry->buckets));
+    for (int i = 0; i < SESSION_LOCK_STRIPES; i++)
+        pthread_mutex_destroy(&registry->locks[i]);
+}
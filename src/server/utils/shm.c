@@ -0,0 +1,205 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "utils.h"
+#include "../../common/params.h"
+#include "../../common/shm.h"
+
+// Shared-memory region in which the statistics and the leaderboards are published, NULL if not enabled
+static ShmHeader *shm_region = NULL;
+// Size of the mapping of the region
+static size_t shm_size = 0;
+// Name of the region, unlinked when the server terminates
+static char *shm_name = NULL;
+
+/**
+ * @brief Creates the shared-memory region in which the main thread publishes the statistics and the leaderboards
+ *
+ * An existing region with the same name is reused, so that the readers attached to it keep working
+ * across the restarts and the upgrades of the server.
+ *
+ * @param name name of the POSIX shared-memory object, starting with a slash
+ * @return 1 if the region has been created, -1 in case of error
+ */
+int shm_open_region(const char *name)
+{
+    int fd = shm_open(name, O_CREAT | O_RDWR, 0644);
+    if (fd == -1)
+        return -1;
+    shm_size = sizeof(ShmHeader) + 2 * (size_t)SHM_BUFFER_SIZE;
+    if (ftruncate(fd, shm_size) == -1)
+    {
+        close(fd);
+        return -1;
+    }
+    shm_region = mmap(NULL, shm_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (shm_region == MAP_FAILED)
+    {
+        shm_region = NULL;
+        return -1;
+    }
+
+    // Invalidate the region while the header is rewritten, the readers checking the magic first
+    memset(shm_region->magic, 0, SHM_MAGIC_SIZE);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    shm_region->version = SHM_VERSION;
+    shm_region->header_size = sizeof(ShmHeader);
+    shm_region->buffer_size = SHM_BUFFER_SIZE;
+    shm_region->pid = getpid();
+    shm_region->lengths[0] = shm_region->lengths[1] = 0;
+    __atomic_store_n(&shm_region->started, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&shm_region->sequence, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy(shm_region->magic, SHM_MAGIC, SHM_MAGIC_SIZE);
+
+    shm_name = strdup(name);
+    handle_malloc_error(shm_name, "Memory allocation error for the name of the shared-memory region");
+    return 1;
+}
+
+/**
+ * @brief Appends the leaderboard of a quiz to a publication, read from the last snapshot of its ranking
+ *
+ * Only the first SHM_LEADERBOARD_TOP players are included, fewer if the buffer is full.
+ *
+ * @param buffer position of the leaderboard in the buffer of the publication
+ * @param capacity space left in the buffer
+ * @param quiz pointer to the quiz
+ * @return length of the leaderboard, 0 if it does not fit in the buffer
+ */
+size_t shm_write_leaderboard(char *buffer, size_t capacity, Quiz *quiz)
+{
+    size_t name_length = strlen(quiz->name);
+    if (capacity < sizeof(ShmQuiz) + name_length)
+        return 0;
+
+    RankingSnapshot *snapshot = acquire_ranking_snapshot(quiz);
+    const char *pointer = snapshot->compact, *end = snapshot->compact + snapshot->compact_length;
+    uint64_t total_clients, nickname_length, score;
+    ShmQuiz header = {snapshot->version, snapshot->total_clients, 0, 0, name_length};
+    size_t length = sizeof(ShmQuiz);
+    memcpy(buffer + length, quiz->name, name_length);
+    length += name_length;
+
+    pointer += decode_varint(pointer, end, &total_clients);
+    for (uint32_t i = 0; i < total_clients; i++)
+    {
+        header.completed += snapshot->completed[i] != 0;
+        pointer += decode_varint(pointer, end, &nickname_length);
+        const char *nickname = pointer;
+        pointer += nickname_length;
+        pointer += decode_varint(pointer, end, &score);
+        if (header.shown == SHM_LEADERBOARD_TOP || header.shown < i ||
+            capacity - length < 3 * VARINT_MAX_SIZE + nickname_length)
+            continue;
+        length += encode_varint(buffer + length, nickname_length);
+        memcpy(buffer + length, nickname, nickname_length);
+        length += nickname_length;
+        length += encode_varint(buffer + length, score);
+        length += encode_varint(buffer + length, snapshot->completed[i] != 0);
+        header.shown++;
+    }
+    release_ranking_snapshot(quiz, snapshot);
+    memcpy(buffer, &header, sizeof(ShmQuiz));
+    return length;
+}
+
+/**
+ * @brief Publishes the statistics of the workers and the leaderboards in the shared-memory region
+ *
+ * It is called periodically by the main thread: the statistics are read with relaxed atomic loads and the
+ * leaderboards from the snapshots of the rankings, so publishing costs nothing to the event loops.
+ *
+ * @param workers array of the contexts of the workers
+ * @param total_workers number of workers
+ */
+void shm_publish(Context *workers, unsigned int total_workers)
+{
+    if (!shm_region)
+        return;
+    QuizzesInfo *quizzesInfo = workers[0].quizzesInfo;
+    SessionRegistry *sessions = workers[0].sessions;
+    uint64_t publication = shm_region->sequence + 1;
+    char *buffer = (char *)shm_region + sizeof(ShmHeader) + (publication % 2) * (size_t)SHM_BUFFER_SIZE;
+    ShmStats stats;
+
+    // Tell the readers that the buffer is being overwritten before touching it
+    __atomic_store_n(&shm_region->started, publication, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    memset(&stats, 0, sizeof(stats));
+    stats.published_ns = get_time_ns();
+    stats.total_workers = total_workers;
+    stats.total_quizzes = quizzesInfo->total_quizzes;
+    stats.participants = __atomic_load_n(&workers[0].nicknames->total_nicknames, __ATOMIC_RELAXED);
+    snprintf(stats.backend, sizeof(stats.backend), "%s", workers[0].io->name);
+    if (sessions)
+    {
+        stats.resumption = 1;
+        stats.sessions_parked = __atomic_load_n(&sessions->parked, __ATOMIC_RELAXED);
+        stats.sessions_resumed = __atomic_load_n(&sessions->resumed, __ATOMIC_RELAXED);
+        stats.sessions_expired = __atomic_load_n(&sessions->expired, __ATOMIC_RELAXED);
+    }
+    fill_wal_stats(&stats);
+    fill_memory_stats(&stats, workers, total_workers);
+    fill_rate_stats(&stats, workers, total_workers);
+    fill_overload_stats(&stats, workers, total_workers);
+
+    size_t length = sizeof(ShmStats);
+    for (unsigned int i = 0; i < total_workers; i++)
+    {
+        ShmWorker worker = {__atomic_load_n(&workers[i].clientsInfo.connected_clients, __ATOMIC_RELAXED), 0,
+                            __atomic_load_n(&workers[i].io_stats.syscalls, __ATOMIC_RELAXED),
+                            __atomic_load_n(&workers[i].io_stats.frames_in, __ATOMIC_RELAXED),
+                            __atomic_load_n(&workers[i].io_stats.frames_out, __ATOMIC_RELAXED)};
+        stats.handled_events += __atomic_load_n(&workers[i].handled_events, __ATOMIC_RELAXED);
+        stats.accepted += __atomic_load_n(&workers[i].io_stats.accepted, __ATOMIC_RELAXED);
+        stats.deferred += __atomic_load_n(&workers[i].io_stats.deferred, __ATOMIC_RELAXED);
+        stats.rejected += __atomic_load_n(&workers[i].io_stats.rejected, __ATOMIC_RELAXED);
+        stats.timers_pending += __atomic_load_n(&workers[i].timers.pending, __ATOMIC_RELAXED);
+        stats.timers_expired += __atomic_load_n(&workers[i].timers.expired, __ATOMIC_RELAXED);
+        if (SHM_BUFFER_SIZE - length >= sizeof(ShmWorker))
+        {
+            memcpy(buffer + length, &worker, sizeof(ShmWorker));
+            length += sizeof(ShmWorker);
+        }
+        else
+            stats.total_workers--;
+    }
+
+    for (uint16_t i = 0; i < quizzesInfo->total_quizzes; i++)
+    {
+        size_t written = shm_write_leaderboard(buffer + length, SHM_BUFFER_SIZE - length, quizzesInfo->quizzes[i]);
+        if (written == 0)
+        {
+            stats.total_quizzes = i;
+            break;
+        }
+        length += written;
+    }
+    memcpy(buffer, &stats, sizeof(ShmStats));
+
+    shm_region->lengths[publication % 2] = length;
+    __atomic_store_n(&shm_region->sequence, publication, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Unmaps the shared-memory region
+ *
+ * @param unlink true to remove the region, false if it has been taken over by an upgraded server
+ */
+void shm_close(bool unlink)
+{
+    if (!shm_region)
+        return;
+    munmap(shm_region, shm_size);
+    shm_region = NULL;
+    if (unlink)
+        shm_unlink(shm_name);
+    free(shm_name);
+    shm_name = NULL;
+}
@@ -0,0 +1,183 @@
+#include <arpa/inet.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "utils.h"
+
+/*
+ * The current snapshot of a quiz is published in a single 64-bit word, which holds the address of the snapshot
+ * in its lower 48 bits and the number of readers that have acquired it through the word in the upper 16 bits.
+ * Readers acquire the snapshot with a single atomic increment of the word, so the snapshot cannot be freed
+ * between loading its address and taking the reference.
+ *
+ * When the owner replaces the snapshot, it moves the readers counted in the word to the references of the old
+ * snapshot, and those readers release it by decrementing its references instead of the word:
+ * whoever brings them to zero frees the snapshot.
+ */
+
+// Reference taken by a reader in the upper bits of the word
+#define SNAPSHOT_REFERENCE (1ULL << 48)
+// Bits of the word holding the address of the snapshot
+#define SNAPSHOT_POINTER_MASK (SNAPSHOT_REFERENCE - 1)
+
+/**
+ * @brief Returns the snapshot whose address is stored in a word
+ */
+RankingSnapshot *snapshot_pointer(uint64_t word)
+{
+    return (RankingSnapshot *)(uintptr_t)(word & SNAPSHOT_POINTER_MASK);
+}
+
+/**
+ * @brief Builds a snapshot of the current ranking of a quiz, only from the owner of the quiz
+ *
+ * @param quiz pointer to the quiz
+ * @return pointer to the new snapshot
+ */
+RankingSnapshot *build_ranking_snapshot(Quiz *quiz)
+{
+    // The version 1 protocol counts the users with a uint16_t, so only the first ones fit in its ranking
+    uint32_t listed = quiz->total_clients < UINT16_MAX ? quiz->total_clients : UINT16_MAX;
+    size_t length = sizeof(uint16_t), compact_length = varint_size(quiz->total_clients);
+    uint32_t position = 0;
+    for (RankingNode *current = quiz->ranking_head; current; current = current->next_node)
+    {
+        size_t string_len = strlen(current->nickname);
+        if (position++ < listed)
+            length += sizeof(uint16_t) + string_len + sizeof(uint16_t);
+        compact_length += varint_size(string_len) + string_len + varint_size(current->score);
+    }
+    // The counts follow the completion flags, aligned for their type
+    size_t higher_offset = (length + compact_length + quiz->total_clients + sizeof(uint32_t) - 1) &
+                           ~(sizeof(uint32_t) - 1);
+
+    RankingSnapshot *snapshot = malloc(sizeof(RankingSnapshot) + higher_offset +
+                                       (quiz->total_questions + 1) * sizeof(uint32_t));
+    handle_malloc_error(snapshot, "Memory allocation error for a ranking snapshot");
+    snapshot->references = 0;
+    snapshot->total_clients = quiz->total_clients;
+    snapshot->version = quiz->ranking_version;
+    snapshot->length = length;
+    snapshot->compact = snapshot->data + length;
+    snapshot->compact_length = compact_length;
+    snapshot->completed = snapshot->compact + compact_length;
+    snapshot->higher = (uint32_t *)(snapshot->data + higher_offset);
+    snapshot->max_score = quiz->total_questions;
+    memset(snapshot->higher, 0, (quiz->total_questions + 1) * sizeof(uint32_t));
+
+    char *pointer = snapshot->data, *compact = snapshot->compact;
+    uint16_t net_value = htons(listed);
+    memcpy(pointer, &net_value, sizeof(uint16_t));
+    pointer += sizeof(uint16_t);
+    compact += encode_varint(compact, quiz->total_clients);
+
+    position = 0;
+    for (RankingNode *current = quiz->ranking_head; current; current = current->next_node)
+    {
+        size_t string_len = strlen(current->nickname);
+        if (position < listed)
+        {
+            net_value = htons(string_len);
+            memcpy(pointer, &net_value, sizeof(uint16_t));
+            pointer += sizeof(uint16_t);
+            memcpy(pointer, current->nickname, string_len);
+            pointer += string_len;
+            net_value = htons(current->score);
+            memcpy(pointer, &net_value, sizeof(uint16_t));
+            pointer += sizeof(uint16_t);
+        }
+        compact += encode_varint(compact, string_len);
+        memcpy(compact, current->nickname, string_len);
+        compact += string_len;
+        compact += encode_varint(compact, current->score);
+        snapshot->completed[position++] = current->is_quiz_completed;
+        snapshot->higher[current->score < snapshot->max_score ? current->score : snapshot->max_score]++;
+    }
+
+    // Turn the number of clients with each score into the number of clients with a higher one
+    uint32_t above = 0;
+    for (int score = snapshot->max_score; score >= 0; score--)
+    {
+        uint32_t with_score = snapshot->higher[score];
+        snapshot->higher[score] = above;
+        above += with_score;
+    }
+    return snapshot;
+}
+
+/**
+ * @brief Returns the position that a score would have in the ranking of a snapshot
+ *
+ * @param snapshot pointer to the snapshot
+ * @param score score of the client
+ * @return 1-based position, after the clients with a higher score
+ */
+uint32_t snapshot_rank(RankingSnapshot *snapshot, uint16_t score)
+{
+    return snapshot->higher[score < snapshot->max_score ? score : snapshot->max_score] + 1;
+}
+
+/**
+ * @brief Replaces the current snapshot of a quiz, only from the owner of the quiz
+ *
+ * @param quiz pointer to the quiz
+ * @param snapshot pointer to the new snapshot
+ */
+void publish_ranking_snapshot(Quiz *quiz, RankingSnapshot *snapshot)
+{
+    uint64_t old_word = __atomic_exchange_n(&quiz->snapshot_word, (uint64_t)(uintptr_t)snapshot, __ATOMIC_ACQ_REL);
+    RankingSnapshot *old_snapshot = snapshot_pointer(old_word);
+    if (!old_snapshot)
+        return;
+
+    // Hand the readers still holding the old snapshot over to its own counter
+    int readers = (int)(old_word >> 48);
+    if (__atomic_add_fetch(&old_snapshot->references, readers, __ATOMIC_ACQ_REL) == 0)
+        free(old_snapshot);
+}
+
+/**
+ * @brief Acquires the current snapshot of a quiz, from any thread
+ *
+ * The snapshot must be released with release_ranking_snapshot.
+ *
+ * @param quiz pointer to the quiz
+ * @return pointer to the snapshot
+ */
+RankingSnapshot *acquire_ranking_snapshot(Quiz *quiz)
+{
+    return snapshot_pointer(__atomic_fetch_add(&quiz->snapshot_word, SNAPSHOT_REFERENCE, __ATOMIC_ACQUIRE));
+}
+
+/**
+ * @brief Releases a snapshot obtained with acquire_ranking_snapshot
+ *
+ * @param quiz pointer to the quiz
+ * @param snapshot pointer to the snapshot
+ */
+void release_ranking_snapshot(Quiz *quiz, RankingSnapshot *snapshot)
+{
+    uint64_t word = __atomic_load_n(&quiz->snapshot_word, __ATOMIC_RELAXED);
+
+    // While the snapshot is still the current one, the reference is counted in the word
+    while (snapshot_pointer(word) == snapshot)
+    {
+        if (__atomic_compare_exchange_n(&quiz->snapshot_word, &word, word - SNAPSHOT_REFERENCE, true, __ATOMIC_RELEASE,
+                                        __ATOMIC_RELAXED))
+            return;
+    }
+
+    // Otherwise it has been moved to the counter of the snapshot by the owner
+    if (__atomic_sub_fetch(&snapshot->references, 1, __ATOMIC_ACQ_REL) == 0)
+        free(snapshot);
+}
+
+/**
+ * @brief Deallocates the current snapshot of a quiz, when no reader can hold it anymore
+ *
+ * @param quiz pointer to the quiz
+ */
+void discard_ranking_snapshot(Quiz *quiz)
+{
+    free(snapshot_pointer(quiz->snapshot_word));
+    quiz->snapshot_word = 0;
+}
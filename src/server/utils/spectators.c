@@ -0,0 +1,254 @@
+#include <arpa/inet.h>
+#include "utils.h"
+
+/**
+ * @brief Allocates the spectator lists of a worker, one for each quiz
+ *
+ * @param context pointer to the context of the worker
+ */
+void init_spectators(Context *context)
+{
+    context->spectators = calloc(context->quizzesInfo->total_quizzes, sizeof(SpectatorList));
+    handle_malloc_error(context->spectators, "Memory allocation error for the spectator lists");
+}
+
+/**
+ * @brief Initializes the timer with which the owner of a quiz pushes its ranking to the spectators
+ *
+ * @param quiz pointer to the quiz
+ */
+void init_spectator_timer(Quiz *quiz)
+{
+    quiz->spectators = 0;
+    quiz->spectator_update_ns = 0;
+    init_timer(&quiz->spectator_timer, push_spectator_update, quiz);
+}
+
+/**
+ * @brief Handles the request of a client to watch the rankings of some quizzes instead of playing
+ *
+ * The payload contains the number of quizzes followed by their numbers, each as a uint16_t in network byte order;
+ * no quiz number means every quiz. The spectator receives the current rankings immediately and then
+ * every change, at most update_ms apart for each quiz. It can only be requested before logging in.
+ *
+ * @param client pointer to the client that sent the request
+ * @param msg pointer to the received message
+ * @param context pointer to the structure containing the service context information
+ */
+void handle_spectate(Client *client, Message *msg, Context *context)
+{
+    QuizzesInfo *quizzesInfo = context->quizzesInfo;
+    uint16_t count;
+    char *message;
+
+    if (client->state != LOGIN || msg->payload_length < sizeof(uint16_t))
+    {
+        message = "Invalid spectator request";
+        send_msg(client->socket_fd, MSG_INFO, message, strlen(message));
+        return;
+    }
+    memcpy(&count, msg->payload, sizeof(uint16_t));
+    count = ntohs(count);
+    if (msg->payload_length != (count + 1) * sizeof(uint16_t))
+    {
+        message = "Invalid spectator request";
+        send_msg(client->socket_fd, MSG_INFO, message, strlen(message));
+        return;
+    }
+
+    client->spectator_slots = malloc(quizzesInfo->total_quizzes * sizeof(int));
+    handle_malloc_error(client->spectator_slots, "Memory allocation error for the spectator slots");
+    for (uint16_t i = 0; i < quizzesInfo->total_quizzes; i++)
+        client->spectator_slots[i] = -1;
+
+    unsigned int watched = 0;
+    for (uint16_t i = 0; i < (count ? count : quizzesInfo->total_quizzes); i++)
+    {
+        uint16_t quiz_id = i;
+        if (count)
+        {
+            memcpy(&quiz_id, msg->payload + (i + 1) * sizeof(uint16_t), sizeof(uint16_t));
+            quiz_id = ntohs(quiz_id) - 1;
+        }
+        if (quiz_id >= quizzesInfo->total_quizzes || client->spectator_slots[quiz_id] != -1)
+            continue;
+        add_spectator(client, quizzesInfo->quizzes[quiz_id], context);
+        watched++;
+    }
+
+    if (!watched)
+    {
+        free(client->spectator_slots);
+        client->spectator_slots = NULL;
+        message = "None of the requested quizzes exists";
+        send_msg(client->socket_fd, MSG_INFO, message, strlen(message));
+        return;
+    }
+
+    // Spectators never send anything, so only the keepalive of the socket detects the dead ones
+    cancel_timer(&context->timers, &client->idle_timer);
+    set_client_state(client, SPECTATING);
+    context->clientsInfo.connected_clients += 1;
+}
+
+/**
+ * @brief Subscribes a spectator to the ranking of a quiz and sends the current ranking
+ *
+ * @param client pointer to the spectator
+ * @param quiz pointer to the quiz
+ * @param context pointer to the context of the worker of the spectator
+ */
+void add_spectator(Client *client, Quiz *quiz, Context *context)
+{
+    register_spectator(client, quiz, context);
+    send_ranking_update(client, quiz);
+}
+
+/**
+ * @brief Subscribes a spectator to the ranking of a quiz, without sending it
+ *
+ * @param client pointer to the spectator, whose spectator slots are allocated
+ * @param quiz pointer to the quiz
+ * @param context pointer to the context of the worker of the spectator
+ */
+void register_spectator(Client *client, Quiz *quiz, Context *context)
+{
+    SpectatorList *list = &context->spectators[quiz->id];
+    if (list->count == list->capacity)
+    {
+        list->capacity = list->capacity ? list->capacity * 2 : 16;
+        list->clients = realloc(list->clients, list->capacity * sizeof(Client *));
+        handle_malloc_error(list->clients, "Memory allocation error for a spectator list");
+    }
+    client->spectator_slots[quiz->id] = list->count;
+    list->clients[list->count++] = client;
+    __atomic_add_fetch(&quiz->spectators, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Unsubscribes a spectator from all the quizzes it watches
+ *
+ * The last spectator of each list takes the place of the removed one.
+ *
+ * @param client pointer to the spectator
+ * @param context pointer to the context of the worker of the spectator
+ */
+void remove_spectator(Client *client, Context *context)
+{
+    if (!client->spectator_slots)
+        return;
+    for (uint16_t i = 0; i < context->quizzesInfo->total_quizzes; i++)
+    {
+        int slot = client->spectator_slots[i];
+        if (slot == -1)
+            continue;
+        SpectatorList *list = &context->spectators[i];
+        Client *last = list->clients[--list->count];
+        list->clients[slot] = last;
+        last->spectator_slots[i] = slot;
+        __atomic_sub_fetch(&context->quizzesInfo->quizzes[i]->spectators, 1, __ATOMIC_RELAXED);
+    }
+    free(client->spectator_slots);
+    client->spectator_slots = NULL;
+}
+
+/**
+ * @brief Serializes the last published ranking of a quiz in a MSG_RANKING_UPDATE frame
+ *
+ * The payload contains the quiz number followed by the ranking as in the MSG_RES_RANKING payload.
+ * The frame is keyed by the quiz, so an update still waiting in the output of a connection is replaced by the newer one.
+ *
+ * @param quiz pointer to the quiz
+ * @param references initial number of references of the frame
+ * @return pointer to the new frame
+ */
+SharedFrame *create_ranking_update(Quiz *quiz, unsigned int references)
+{
+    RankingSnapshot *snapshot = acquire_ranking_snapshot(quiz);
+    SharedFrame *frame = allocate_shared_frame(MSG_RANKING_UPDATE, sizeof(uint16_t) + snapshot->length, references);
+    uint16_t quiz_number = htons(quiz->id + 1);
+    memcpy(frame->data + FRAME_HEADER_SIZE, &quiz_number, sizeof(uint16_t));
+    memcpy(frame->data + FRAME_HEADER_SIZE + sizeof(uint16_t), snapshot->data, snapshot->length);
+    release_ranking_snapshot(quiz, snapshot);
+    frame->key = quiz->id + 1;
+    return frame;
+}
+
+/**
+ * @brief Sends the last published ranking of a quiz to a single spectator
+ *
+ * @param client pointer to the spectator
+ * @param quiz pointer to the quiz
+ */
+void send_ranking_update(Client *client, Quiz *quiz)
+{
+    SharedFrame *frame = create_ranking_update(quiz, 1);
+    send_shared_frame(client->socket_fd, frame);
+    release_shared_frame(frame);
+}
+
+/**
+ * @brief Schedules the push of the ranking of a quiz to its spectators, called by the owner after publishing it
+ *
+ * The changes published while a push is scheduled are sent together, so every spectator receives
+ * at most one update of the quiz every update_ms, however often the ranking changes.
+ *
+ * @param context pointer to the context of the owner of the quiz
+ * @param quiz pointer to the quiz
+ */
+void schedule_spectator_update(Context *context, Quiz *quiz)
+{
+    if (!__atomic_load_n(&quiz->spectators, __ATOMIC_RELAXED) || timer_pending(&quiz->spectator_timer))
+        return;
+    uint64_t now_ns = get_time_ns(), due_ns = quiz->spectator_update_ns + context->timeouts.update_ms * 1000000ULL;
+    schedule_timer(&context->timers, &quiz->spectator_timer, due_ns > now_ns ? (due_ns - now_ns) / 1000000 : 0);
+}
+
+/**
+ * @brief Pushes the last published ranking of a quiz to the spectators connected to every worker
+ *
+ * It is the callback of the spectator timer of the quiz, scheduled on the wheel of the owner.
+ * The frame is serialized once and delivered by each worker to its own spectators, as the live broadcasts.
+ *
+ * @param timer pointer to the expired timer
+ * @param context pointer to the context of the owner of the quiz
+ */
+void push_spectator_update(Timer *timer, Context *context)
+{
+    Quiz *quiz = timer->data;
+    quiz->spectator_update_ns = get_time_ns();
+    SharedFrame *frame = create_ranking_update(quiz, context->total_workers);
+    RankingEvent event = {.frame = frame, .quiz_id = quiz->id, .kind = SPECTATOR_UPDATE};
+    for (unsigned int i = 0; i < context->total_workers; i++)
+        if (&context->workers[i] != context)
+            post_ranking_event(context, &context->workers[i], &event);
+    deliver_spectator_update(context, quiz, frame);
+}
+
+/**
+ * @brief Delivers the ranking of a quiz pushed by its owner to the spectators connected to the worker
+ *
+ * @param context pointer to the context of the worker
+ * @param quiz pointer to the quiz
+ * @param frame pointer to the frame, of which the worker holds a reference released here
+ */
+void deliver_spectator_update(Context *context, Quiz *quiz, SharedFrame *frame)
+{
+    SpectatorList *list = &context->spectators[quiz->id];
+    for (size_t i = 0; i < list->count; i++)
+        send_shared_frame(list->clients[i]->socket_fd, frame);
+    release_shared_frame(frame);
+}
+
+/**
+ * @brief Deallocates the spectator lists of a worker
+ *
+ * @param context pointer to the context of the worker
+ */
+void deallocate_spectators(Context *context)
+{
+    for (uint16_t i = 0; i < context->quizzesInfo->total_quizzes; i++)
+        free(context->spectators[i].clients);
+    free(context->spectators);
+    context->spectators = NULL;
+}
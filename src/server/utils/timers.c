@@ -0,0 +1,277 @@
+#include <limits.h>
+#include "utils.h"
+
+// Number of ticks covered by a slot of the given level
+#define TIMER_LEVEL_SPAN(level) (1ULL << ((level) * TIMER_LEVEL_BITS))
+// Mask selecting the index of a slot
+#define TIMER_SLOT_MASK (TIMER_SLOTS - 1)
+// Farthest expiration that can be represented, in ticks from the current one
+#define TIMER_MAX_DELAY (TIMER_LEVEL_SPAN(TIMER_LEVELS) - 1)
+
+/**
+ * @brief Initializes an empty timer wheel
+ *
+ * @param wheel pointer to the wheel
+ * @param now_ns current time, corresponding to tick 0
+ */
+void init_timer_wheel(TimerWheel *wheel, uint64_t now_ns)
+{
+    memset(wheel, 0, sizeof(TimerWheel));
+    wheel->start_ns = now_ns;
+}
+
+/**
+ * @brief Initializes a timer that is not scheduled
+ *
+ * @param timer pointer to the timer
+ * @param callback function invoked when the timer expires
+ * @param data structure the timer refers to, passed back through the timer to the callback
+ */
+void init_timer(Timer *timer, TimerCallback callback, void *data)
+{
+    timer->next = NULL;
+    timer->pprev = NULL;
+    timer->expires = 0;
+    timer->slot = 0;
+    timer->callback = callback;
+    timer->data = data;
+}
+
+/**
+ * @brief Tells if a timer is scheduled
+ */
+bool timer_pending(Timer *timer)
+{
+    return timer->pprev != NULL;
+}
+
+/**
+ * @brief Returns the time left before a scheduled timer expires
+ *
+ * @param wheel pointer to the wheel of the worker
+ * @param timer pointer to the scheduled timer
+ * @param now_ns current time
+ * @return time left in milliseconds, rounded up, 0 if the timer is already due
+ */
+unsigned int timer_remaining_ms(TimerWheel *wheel, Timer *timer, uint64_t now_ns)
+{
+    uint64_t due_ns = wheel->start_ns + timer->expires * TIMER_TICK_MS * 1000000ULL;
+    return due_ns > now_ns ? (due_ns - now_ns + 999999) / 1000000 : 0;
+}
+
+/**
+ * @brief Links a timer in the slot corresponding to its expiration
+ *
+ * The level is chosen by the distance from the current tick: the timers expiring within TIMER_SLOTS ticks
+ * go to level 0, the others to the lowest level whose slots still distinguish their expiration.
+ */
+void link_timer(TimerWheel *wheel, Timer *timer)
+{
+    uint64_t delay = timer->expires - wheel->current_tick;
+    unsigned int level = 0;
+    while (level < TIMER_LEVELS - 1 && delay >= TIMER_LEVEL_SPAN(level + 1))
+        level++;
+
+    unsigned int index = (timer->expires >> (level * TIMER_LEVEL_BITS)) & TIMER_SLOT_MASK;
+    Timer **head = &wheel->slots[level][index];
+    timer->slot = level * TIMER_SLOTS + index;
+    timer->next = *head;
+    if (*head)
+        (*head)->pprev = &timer->next;
+    timer->pprev = head;
+    *head = timer;
+    wheel->occupied[level] |= 1ULL << index;
+}
+
+/**
+ * @brief Unlinks a timer from its slot, updating the bitmap if the slot becomes empty
+ */
+void unlink_timer(TimerWheel *wheel, Timer *timer)
+{
+    *timer->pprev = timer->next;
+    if (timer->next)
+        timer->next->pprev = timer->pprev;
+
+    unsigned int level = timer->slot / TIMER_SLOTS, index = timer->slot % TIMER_SLOTS;
+    if (!wheel->slots[level][index])
+        wheel->occupied[level] &= ~(1ULL << index);
+    timer->next = NULL;
+    timer->pprev = NULL;
+}
+
+/**
+ * @brief Schedules a timer, replacing its previous expiration if it was already scheduled
+ *
+ * @param wheel pointer to the wheel of the worker
+ * @param timer pointer to the timer
+ * @param delay_ms time after which the timer expires, rounded up to the next tick
+ */
+void schedule_timer(TimerWheel *wheel, Timer *timer, unsigned int delay_ms)
+{
+    if (timer->pprev)
+        unlink_timer(wheel, timer);
+    else
+        wheel->pending++;
+
+    uint64_t delay = (delay_ms + TIMER_TICK_MS - 1) / TIMER_TICK_MS;
+    if (delay == 0)
+        delay = 1;
+    if (delay > TIMER_MAX_DELAY)
+        delay = TIMER_MAX_DELAY;
+    timer->expires = wheel->current_tick + delay;
+    link_timer(wheel, timer);
+}
+
+/**
+ * @brief Cancels a timer, if it is scheduled
+ *
+ * @param wheel pointer to the wheel of the worker
+ * @param timer pointer to the timer
+ */
+void cancel_timer(TimerWheel *wheel, Timer *timer)
+{
+    if (!timer->pprev)
+        return;
+    unlink_timer(wheel, timer);
+    wheel->pending--;
+}
+
+/**
+ * @brief Returns the distance from a slot to the next occupied one, wrapping around the level
+ *
+ * @param bitmap bitmap of the occupied slots of the level, not empty
+ * @param index index of the current slot
+ * @return distance between 1 and TIMER_SLOTS
+ */
+unsigned int next_occupied_slot(uint64_t bitmap, unsigned int index)
+{
+    unsigned int shift = (index + 1) & TIMER_SLOT_MASK;
+    uint64_t rotated = shift ? (bitmap >> shift) | (bitmap << (TIMER_SLOTS - shift)) : bitmap;
+    return __builtin_ctzll(rotated) + 1;
+}
+
+/**
+ * @brief Returns the first tick after the current one at which an occupied slot is processed
+ *
+ * For level 0 it is the tick of the slot itself, for the higher levels the tick at which the timers
+ * of the slot are moved to the lower levels: no timer expires before the returned tick.
+ *
+ * @return the tick, or UINT64_MAX if no timer is scheduled
+ */
+uint64_t next_timer_tick(TimerWheel *wheel)
+{
+    uint64_t next = UINT64_MAX;
+    for (unsigned int level = 0; level < TIMER_LEVELS; level++)
+    {
+        if (!wheel->occupied[level])
+            continue;
+        unsigned int bits = level * TIMER_LEVEL_BITS;
+        uint64_t block = wheel->current_tick >> bits;
+        uint64_t tick = (block + next_occupied_slot(wheel->occupied[level], block & TIMER_SLOT_MASK)) << bits;
+        if (tick < next)
+            next = tick;
+    }
+    return next;
+}
+
+/**
+ * @brief Returns the time the event loop can wait before the next timer may expire
+ *
+ * @param wheel pointer to the wheel of the worker
+ * @param now_ns current time
+ * @return timeout in milliseconds, or -1 if no timer is scheduled
+ */
+int next_timer_timeout(TimerWheel *wheel, uint64_t now_ns)
+{
+    uint64_t tick = next_timer_tick(wheel);
+    if (tick == UINT64_MAX)
+        return -1;
+
+    uint64_t due_ns = wheel->start_ns + tick * TIMER_TICK_MS * 1000000ULL;
+    if (due_ns <= now_ns)
+        return 0;
+    uint64_t timeout_ms = (due_ns - now_ns + 999999) / 1000000;
+    return timeout_ms > INT_MAX ? INT_MAX : (int)timeout_ms;
+}
+
+/**
+ * @brief Moves the timers of a slot of a higher level to the lower levels
+ */
+void cascade_timers(TimerWheel *wheel, unsigned int level, unsigned int index)
+{
+    Timer *timer = wheel->slots[level][index];
+    wheel->slots[level][index] = NULL;
+    wheel->occupied[level] &= ~(1ULL << index);
+    while (timer)
+    {
+        Timer *next = timer->next;
+        link_timer(wheel, timer);
+        timer = next;
+    }
+}
+
+/**
+ * @brief Processes a tick: cascades the slots of the higher levels whose span starts at the tick,
+ * then invokes the callbacks of the timers expiring at the tick
+ *
+ * The callbacks may schedule and cancel any timer, including the other ones expiring at the same tick.
+ */
+void process_timer_tick(TimerWheel *wheel, Context *context)
+{
+    uint64_t tick = wheel->current_tick;
+    for (unsigned int level = TIMER_LEVELS - 1; level > 0; level--)
+    {
+        if (tick & (TIMER_LEVEL_SPAN(level) - 1))
+            continue;
+        cascade_timers(wheel, level, (tick >> (level * TIMER_LEVEL_BITS)) & TIMER_SLOT_MASK);
+    }
+
+    // Detach the expiring timers, so that the timers scheduled by the callbacks are never processed now
+    unsigned int index = tick & TIMER_SLOT_MASK;
+    Timer *expiring = wheel->slots[0][index];
+    wheel->slots[0][index] = NULL;
+    wheel->occupied[0] &= ~(1ULL << index);
+    if (expiring)
+        expiring->pprev = &expiring;
+
+    while (expiring)
+    {
+        Timer *timer = expiring;
+        expiring = timer->next;
+        if (expiring)
+            expiring->pprev = &expiring;
+        timer->next = NULL;
+        timer->pprev = NULL;
+        wheel->pending--;
+        wheel->expired++;
+        timer->callback(timer, context);
+    }
+}
+
+/**
+ * @brief Advances the wheel to the current time, expiring the timers that are due
+ *
+ * The ticks in which no slot has to be processed are skipped, so the cost does not depend on the time elapsed.
+ *
+ * @param wheel pointer to the wheel of the worker
+ * @param now_ns current time
+ * @param context pointer to the context of the worker, passed to the callbacks
+ */
+void advance_timers(TimerWheel *wheel, uint64_t now_ns, Context *context)
+{
+    if (now_ns < wheel->start_ns)
+        return;
+    uint64_t target = (now_ns - wheel->start_ns) / (TIMER_TICK_MS * 1000000ULL);
+
+    while (wheel->current_tick < target)
+    {
+        uint64_t next = next_timer_tick(wheel);
+        if (next > target)
+        {
+            wheel->current_tick = target;
+            break;
+        }
+        wheel->current_tick = next;
+        process_timer_tick(wheel, context);
+    }
+}
@@ -0,0 +1,1066 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "utils.h"
+#include "../../common/params.h"
+
+/**
+ * On SIGUSR2 the server executes its binary again, possibly replaced by a new version, and hands over to the new
+ * process the listeners, the sockets of the clients and everything the players depend on, so that no connection
+ * is closed:
+ *
+ * 1. the new server loads the quizzes, then writes one byte on the UNIX socket named by UPGRADE_FD_ENV;
+ * 2. the previous server stops its workers, which complete the operations in flight, applies the changes still
+ *    queued for the rankings and commits the write-ahead log;
+ * 3. it sends a HandoffHeader, the descriptors with SCM_RIGHTS in batches of HANDOFF_FDS_PER_MESSAGE and the
+ *    serialized state, then terminates without sending anything else on the connections;
+ * 4. the new server rebuilds the rankings, the clients and the parked sessions before starting its workers,
+ *    which register the sockets with the data received and not yet consumed and the frames not yet sent.
+ *
+ * The state is a sequence of varints and of strings, encoded as (length + 1) (bytes) so that NULL is 0:
+ * the rankings of the quizzes (see write_handoff_rankings), then for each worker
+ * (next client id) (number of clients) [client] (number of parked sessions) [session].
+ */
+
+// State received from the previous server, kept until every worker has registered its connections
+static HandoffBuffer handoff_state = {NULL, 0, 0, false};
+// Header received from the previous server
+static HandoffHeader handoff_header;
+// Descriptors received from the previous server: the listeners of the workers, then the sockets of the clients
+static int *handoff_fds = NULL;
+// Connections to register, in the order in which they have been handed over
+static HandoffConnection *handoff_connections = NULL;
+// Number of connections to register
+static unsigned int handoff_total_connections = 0;
+// Workers that have not registered their connections yet, updated atomically
+static unsigned int handoff_pending_workers = 0;
+
+/**
+ * @brief Makes room at the end of a state being serialized
+ *
+ * @param buffer pointer to the buffer of the state
+ * @param length number of bytes to make room for
+ */
+void reserve_handoff_space(HandoffBuffer *buffer, size_t length)
+{
+    if (buffer->capacity - buffer->length >= length)
+        return;
+    size_t new_capacity = buffer->capacity ? buffer->capacity : DEFAULT_PAYLOAD_SIZE;
+    while (new_capacity - buffer->length < length)
+        new_capacity *= 2;
+    char *new_data = realloc(buffer->data, new_capacity);
+    handle_malloc_error(new_data, "Memory allocation error for the handed over state");
+    buffer->data = new_data;
+    buffer->capacity = new_capacity;
+}
+
+/**
+ * @brief Appends a varint to a state being serialized
+ */
+void write_handoff_varint(HandoffBuffer *buffer, uint64_t value)
+{
+    reserve_handoff_space(buffer, VARINT_MAX_SIZE);
+    buffer->length += encode_varint(buffer->data + buffer->length, value);
+}
+
+/**
+ * @brief Appends raw bytes to a state being serialized
+ */
+void write_handoff_bytes(HandoffBuffer *buffer, const void *data, size_t length)
+{
+    reserve_handoff_space(buffer, length);
+    memcpy(buffer->data + buffer->length, data, length);
+    buffer->length += length;
+}
+
+/**
+ * @brief Appends a string, possibly NULL, to a state being serialized
+ */
+void write_handoff_string(HandoffBuffer *buffer, const char *string)
+{
+    if (!string)
+    {
+        write_handoff_varint(buffer, 0);
+        return;
+    }
+    size_t length = strlen(string);
+    write_handoff_varint(buffer, length + 1);
+    write_handoff_bytes(buffer, string, length);
+}
+
+/**
+ * @brief Appends the time left before a timer expires, plus one, or 0 if the timer is not scheduled
+ */
+void write_handoff_timer(HandoffBuffer *buffer, TimerWheel *wheel, Timer *timer, uint64_t now_ns)
+{
+    write_handoff_varint(buffer, timer_pending(timer) ? timer_remaining_ms(wheel, timer, now_ns) + 1ULL : 0);
+}
+
+/**
+ * @brief Appends the quizzes in whose ranking a player has a node, as (count) [(quiz index)]
+ *
+ * @param buffer pointer to the buffer of the state
+ * @param client_rankings array of the nodes of the player in each quiz
+ * @param total_quizzes number of quizzes
+ */
+void write_handoff_ranked_quizzes(HandoffBuffer *buffer, RankingNode **client_rankings, uint16_t total_quizzes)
+{
+    uint16_t count = 0;
+    for (uint16_t i = 0; i < total_quizzes; i++)
+        count += client_rankings[i] != NULL;
+    write_handoff_varint(buffer, count);
+    for (uint16_t i = 0; i < total_quizzes; i++)
+        if (client_rankings[i])
+            write_handoff_varint(buffer, i);
+}
+
+/**
+ * @brief Appends the rankings of the quizzes and the state of their live games
+ *
+ * The layout is (number of quizzes), then for each quiz:
+ * (ranking version) (live phase + 1, 0 if not live) [(round word) (sequence) (question) (timer)]
+ * (number of players) [(nickname) (score) (completed | recovered << 1) (question) (correct answers) (round score)]
+ * The version of each ranking is kept, so that the replicas of the subscribers stay valid.
+ *
+ * @param buffer pointer to the buffer of the state
+ * @param quizzesInfo pointer to the quizzes, whose pending changes have been applied
+ * @param now_ns current time
+ */
+void write_handoff_rankings(HandoffBuffer *buffer, QuizzesInfo *quizzesInfo, uint64_t now_ns)
+{
+    write_handoff_varint(buffer, quizzesInfo->total_quizzes);
+    for (uint16_t i = 0; i < quizzesInfo->total_quizzes; i++)
+    {
+        Quiz *quiz = quizzesInfo->quizzes[i];
+        LiveRound *live = quiz->live;
+        write_handoff_varint(buffer, quiz->ranking_version);
+        write_handoff_varint(buffer, live ? live->phase + 1 : 0);
+        if (live)
+        {
+            write_handoff_varint(buffer, live->round_word);
+            write_handoff_varint(buffer, live->sequence);
+            write_handoff_varint(buffer, live->question);
+            write_handoff_timer(buffer, &quiz->owner->timers, &live->timer, now_ns);
+        }
+
+        write_handoff_varint(buffer, quiz->total_clients);
+        for (RankingNode *node = quiz->ranking_head; node; node = node->next_node)
+        {
+            write_handoff_string(buffer, node->nickname);
+            write_handoff_varint(buffer, node->score);
+            write_handoff_varint(buffer, node->is_quiz_completed | node->recovered << 1);
+            write_handoff_varint(buffer, node->current_question);
+            write_handoff_varint(buffer, node->correct_answers);
+            write_handoff_varint(buffer, node->round_score);
+        }
+    }
+}
+
+/**
+ * @brief Appends the part of a buffer of frames not yet sent, gathering the shared frames it references
+ *
+ * @param buffer pointer to the buffer of the state
+ * @param data private frames
+ * @param length length of the private frames
+ * @param segments shared frames inserted among the private ones
+ * @param count number of shared frames
+ * @param skip number of bytes already sent
+ */
+void write_handoff_segments(HandoffBuffer *buffer, const char *data, size_t length, SharedSegment *segments,
+                            size_t count, size_t skip)
+{
+    size_t private_start = 0;
+    for (size_t i = 0; i <= count; i++)
+    {
+        bool last = i == count;
+        size_t private_end = last ? length : segments[i].position;
+        const char *chunks[2] = {data + private_start, last ? NULL : segments[i].frame->data};
+        size_t lengths[2] = {private_end - private_start, last ? 0 : segments[i].frame->length};
+
+        for (int c = 0; c < 2; c++)
+        {
+            if (lengths[c] <= skip)
+            {
+                skip -= lengths[c];
+                continue;
+            }
+            write_handoff_bytes(buffer, chunks[c] + skip, lengths[c] - skip);
+            skip = 0;
+        }
+        private_start = private_end;
+    }
+}
+
+/**
+ * @brief Appends the data received on a connection and not consumed, then the frames not yet sent on it
+ *
+ * Both are encoded as (length) (bytes). The buffers of the connection are left untouched.
+ *
+ * @param buffer pointer to the buffer of the state
+ * @param connection pointer to the connection, NULL if the socket has none
+ */
+void write_handoff_connection(HandoffBuffer *buffer, Connection *connection)
+{
+    if (!connection)
+    {
+        write_handoff_varint(buffer, 0);
+        write_handoff_varint(buffer, 0);
+        return;
+    }
+    write_handoff_varint(buffer, connection->input_length - connection->input_offset);
+    write_handoff_bytes(buffer, connection->input + connection->input_offset,
+                        connection->input_length - connection->input_offset);
+
+    bool sending = connection->sending_offset < connection->sending_total;
+    size_t length = connection->output_length + (sending ? connection->sending_total - connection->sending_offset : 0);
+    for (size_t i = 0; i < connection->shared_count; i++)
+        length += connection->shared[i].frame->length;
+    write_handoff_varint(buffer, length);
+    if (sending)
+        write_handoff_segments(buffer, connection->sending, connection->sending_length, connection->sending_shared,
+                               connection->sending_shared_count, connection->sending_offset);
+    write_handoff_segments(buffer, connection->output, connection->output_length, connection->shared,
+                           connection->shared_count, 0);
+}
+
+/**
+ * @brief Appends a client
+ *
+ * The layout is (id) (state) (quiz + 1) (nickname) (version) (compression) (max frame) (features)
+ * (resumable) [(token)] (idle timer) (question timer) (live) [(backlog) (round) (answered)] (subscriber)
+ * (spectated quizzes) (ranked quizzes) (input) (output), the quizzes being encoded as (count) [(quiz index)].
+ *
+ * @param buffer pointer to the buffer of the state
+ * @param client pointer to the client
+ * @param context pointer to the context of the worker of the client
+ * @param now_ns current time
+ */
+void write_handoff_client(HandoffBuffer *buffer, Client *client, Context *context, uint64_t now_ns)
+{
+    uint16_t total_quizzes = context->quizzesInfo->total_quizzes;
+    write_handoff_varint(buffer, client->id);
+    write_handoff_varint(buffer, client->state);
+    write_handoff_varint(buffer, client->current_quiz_id + 1);
+    write_handoff_string(buffer, client->nickname);
+    write_handoff_varint(buffer, client->capabilities.version);
+    write_handoff_varint(buffer, client->capabilities.compression);
+    write_handoff_varint(buffer, client->capabilities.max_frame);
+    write_handoff_varint(buffer, client->capabilities.features);
+    write_handoff_varint(buffer, client->resumable);
+    if (client->resumable)
+        write_handoff_bytes(buffer, client->session_token, SESSION_TOKEN_SIZE);
+    write_handoff_timer(buffer, &context->timers, &client->idle_timer, now_ns);
+    write_handoff_timer(buffer, &context->timers, &client->question_timer, now_ns);
+    write_handoff_varint(buffer, client->live);
+    if (client->live)
+    {
+        write_handoff_varint(buffer, client->live_backlog);
+        write_handoff_varint(buffer, client->live_round);
+        write_handoff_varint(buffer, client->live_answered);
+    }
+    write_handoff_varint(buffer, client->subscriber_slot != -1);
+
+    uint16_t spectated = 0;
+    for (uint16_t i = 0; client->spectator_slots && i < total_quizzes; i++)
+        spectated += client->spectator_slots[i] != -1;
+    write_handoff_varint(buffer, spectated);
+    for (uint16_t i = 0; client->spectator_slots && i < total_quizzes; i++)
+        if (client->spectator_slots[i] != -1)
+            write_handoff_varint(buffer, i);
+    write_handoff_ranked_quizzes(buffer, client->client_rankings, total_quizzes);
+    write_handoff_connection(buffer, find_connection(client->socket_fd));
+}
+
+/**
+ * @brief Appends a parked session
+ *
+ * The layout is (token) (nickname) (quiz + 1) (state) (time left in ms) (ranked quizzes).
+ *
+ * @param buffer pointer to the buffer of the state
+ * @param session pointer to the session, not resumed
+ * @param total_quizzes number of quizzes
+ * @param now_ns current time
+ */
+void write_handoff_session(HandoffBuffer *buffer, ParkedSession *session, uint16_t total_quizzes, uint64_t now_ns)
+{
+    write_handoff_bytes(buffer, session->token, SESSION_TOKEN_SIZE);
+    write_handoff_string(buffer, session->nickname);
+    write_handoff_varint(buffer, session->current_quiz_id + 1);
+    write_handoff_varint(buffer, session->state);
+    write_handoff_varint(buffer, session->expires_ns > now_ns ? (session->expires_ns - now_ns) / 1000000 : 0);
+    write_handoff_ranked_quizzes(buffer, session->client_rankings, total_quizzes);
+}
+
+/**
+ * @brief Writes a whole buffer to the socket of the upgrade
+ *
+ * @return true on success
+ */
+bool write_handoff_data(int socket_fd, const void *data, size_t length)
+{
+    const char *pointer = data;
+    while (length > 0)
+    {
+        ssize_t written = send(socket_fd, pointer, length, MSG_NOSIGNAL);
+        if (written == -1 && errno == EINTR)
+            continue;
+        if (written <= 0)
+            return false;
+        pointer += written;
+        length -= written;
+    }
+    return true;
+}
+
+/**
+ * @brief Reads a whole buffer from the socket of the upgrade
+ *
+ * @return true on success, false in case of error or if the peer closed the socket
+ */
+bool read_handoff_data(int socket_fd, void *data, size_t length)
+{
+    char *pointer = data;
+    while (length > 0)
+    {
+        ssize_t received = recv(socket_fd, pointer, length, 0);
+        if (received == -1 && errno == EINTR)
+            continue;
+        if (received <= 0)
+        {
+            if (received == 0)
+                errno = ECONNRESET;
+            return false;
+        }
+        pointer += received;
+        length -= received;
+    }
+    return true;
+}
+
+/**
+ * @brief Sends descriptors on the socket of the upgrade, in batches of HANDOFF_FDS_PER_MESSAGE
+ *
+ * Each batch is a message whose data is the number of descriptors it carries, as a uint32_t.
+ *
+ * @param socket_fd descriptor of the socket of the upgrade
+ * @param fds descriptors to send
+ * @param total_fds number of descriptors
+ * @return true on success
+ */
+bool send_handoff_fds(int socket_fd, const int *fds, unsigned int total_fds)
+{
+    union
+    {
+        char buffer[CMSG_SPACE(HANDOFF_FDS_PER_MESSAGE * sizeof(int))];
+        struct cmsghdr align;
+    } control;
+
+    for (unsigned int sent = 0; sent < total_fds;)
+    {
+        uint32_t count = total_fds - sent < HANDOFF_FDS_PER_MESSAGE ? total_fds - sent : HANDOFF_FDS_PER_MESSAGE;
+        struct iovec iov = {&count, sizeof(count)};
+        struct msghdr message = {.msg_iov = &iov, .msg_iovlen = 1, .msg_control = control.buffer,
+                                 .msg_controllen = CMSG_SPACE(count * sizeof(int))};
+        struct cmsghdr *header = CMSG_FIRSTHDR(&message);
+        header->cmsg_level = SOL_SOCKET;
+        header->cmsg_type = SCM_RIGHTS;
+        header->cmsg_len = CMSG_LEN(count * sizeof(int));
+        memcpy(CMSG_DATA(header), fds + sent, count * sizeof(int));
+
+        ssize_t result;
+        do
+            result = sendmsg(socket_fd, &message, MSG_NOSIGNAL);
+        while (result == -1 && errno == EINTR);
+        if (result != sizeof(count))
+            return false;
+        sent += count;
+    }
+    return true;
+}
+
+/**
+ * @brief Receives the descriptors sent with send_handoff_fds
+ *
+ * @param socket_fd descriptor of the socket of the upgrade
+ * @param fds array filled with the descriptors, closed on exec
+ * @param total_fds number of descriptors
+ * @return true on success
+ */
+bool receive_handoff_fds(int socket_fd, int *fds, unsigned int total_fds)
+{
+    union
+    {
+        char buffer[CMSG_SPACE(HANDOFF_FDS_PER_MESSAGE * sizeof(int))];
+        struct cmsghdr align;
+    } control;
+
+    for (unsigned int received = 0; received < total_fds;)
+    {
+        uint32_t count;
+        struct iovec iov = {&count, sizeof(count)};
+        struct msghdr message = {.msg_iov = &iov, .msg_iovlen = 1, .msg_control = control.buffer,
+                                 .msg_controllen = sizeof(control.buffer)};
+        ssize_t result;
+        do
+            result = recvmsg(socket_fd, &message, MSG_WAITALL | MSG_CMSG_CLOEXEC);
+        while (result == -1 && errno == EINTR);
+        if (result == -1)
+            return false;
+
+        struct cmsghdr *header = CMSG_FIRSTHDR(&message);
+        if (result != sizeof(count) || (message.msg_flags & MSG_CTRUNC) || !header ||
+            header->cmsg_level != SOL_SOCKET || header->cmsg_type != SCM_RIGHTS || count > total_fds - received ||
+            header->cmsg_len != CMSG_LEN(count * sizeof(int)))
+        {
+            errno = EPROTO;
+            return false;
+        }
+        memcpy(fds + received, CMSG_DATA(header), count * sizeof(int));
+        received += count;
+    }
+    return true;
+}
+
+/**
+ * @brief Serializes the state of the stopped workers and sends it to the new server, with the descriptors
+ *
+ * @param socket_fd descriptor of the socket of the upgrade
+ * @param workers array of the workers, whose event loops have terminated
+ * @param total_workers number of workers
+ * @param stopped_ns time at which the workers have been stopped
+ * @return true on success
+ */
+bool send_handoff(int socket_fd, Context *workers, unsigned int total_workers, uint64_t stopped_ns)
+{
+    QuizzesInfo *quizzesInfo = workers[0].quizzesInfo;
+    HandoffBuffer state = {NULL, 0, 0, false};
+    uint64_t now_ns = get_time_ns();
+
+    unsigned int total_fds = total_workers;
+    for (unsigned int i = 0; i < total_workers; i++)
+        for (Client *client = workers[i].clientsInfo.clients_head; client; client = client->next_node)
+            total_fds++;
+    int *fds = malloc(total_fds * sizeof(int));
+    handle_malloc_error(fds, "Memory allocation error for the handed over descriptors");
+    unsigned int position = 0;
+    for (unsigned int i = 0; i < total_workers; i++)
+        fds[position++] = workers[i].server_fd;
+
+    write_handoff_rankings(&state, quizzesInfo, now_ns);
+    for (unsigned int i = 0; i < total_workers; i++)
+    {
+        Context *context = &workers[i];
+        unsigned int clients = 0, sessions = 0;
+        for (Client *client = context->clientsInfo.clients_head; client; client = client->next_node)
+            clients++;
+        for (ParkedSession *session = context->parked_head; session; session = session->next_parked)
+            sessions += !session->resumed;
+
+        write_handoff_varint(&state, context->clientsInfo.next_client_id);
+        write_handoff_varint(&state, clients);
+        for (Client *client = context->clientsInfo.clients_head; client; client = client->next_node)
+        {
+            write_handoff_client(&state, client, context, now_ns);
+            fds[position++] = client->socket_fd;
+        }
+        write_handoff_varint(&state, sessions);
+        for (ParkedSession *session = context->parked_head; session; session = session->next_parked)
+            if (!session->resumed)
+                write_handoff_session(&state, session, quizzesInfo->total_quizzes, now_ns);
+    }
+
+    HandoffHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, HANDOFF_MAGIC, sizeof(header.magic));
+    header.version = HANDOFF_VERSION;
+    header.total_workers = total_workers;
+    header.total_fds = total_fds;
+    header.state_length = state.length;
+    header.stopped_ns = stopped_ns;
+    bool sent = write_handoff_data(socket_fd, &header, sizeof(header)) && send_handoff_fds(socket_fd, fds, total_fds) &&
+                write_handoff_data(socket_fd, state.data, state.length);
+    free(fds);
+    free(state.data);
+    return sent;
+}
+
+/**
+ * @brief Executes the binary of the server again, passing it the socket of the upgrade
+ *
+ * The environment is prepared before forking, since the child of a multithreaded process may only
+ * call async-signal-safe functions before the exec.
+ *
+ * @param argv arguments with which the server has been started
+ * @param socket_fd end of the socket of the upgrade inherited by the new server
+ * @return process id of the new server, or -1 in case of error
+ */
+pid_t spawn_upgraded_server(char **argv, int socket_fd)
+{
+    size_t prefix_length = strlen(UPGRADE_FD_ENV), count = 0, total = 0;
+    char variable[DEFAULT_PAYLOAD_SIZE];
+    while (environ[count])
+        count++;
+    char **envp = malloc((count + 2) * sizeof(char *));
+    handle_malloc_error(envp, "Memory allocation error for the environment of the upgraded server");
+    for (size_t i = 0; i < count; i++)
+        if (strncmp(environ[i], UPGRADE_FD_ENV, prefix_length) != 0 || environ[i][prefix_length] != '=')
+            envp[total++] = environ[i];
+    snprintf(variable, sizeof(variable), "%s=%d", UPGRADE_FD_ENV, socket_fd);
+    envp[total++] = variable;
+    envp[total] = NULL;
+
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        // Only the end of the new server survives the exec
+        fcntl(socket_fd, F_SETFD, 0);
+        execvpe(argv[0], argv, envp);
+        _exit(EXIT_FAILURE);
+    }
+    if (pid == -1)
+        perror("Error starting the upgraded server");
+    free(envp);
+    return pid;
+}
+
+/**
+ * @brief Waits for the new server to report that it is ready to receive the connections
+ *
+ * @param socket_fd descriptor of the socket of the upgrade
+ * @return true if the new server is ready within UPGRADE_READY_TIMEOUT_MS
+ */
+bool wait_upgraded_server(int socket_fd)
+{
+    struct pollfd upgrade = {socket_fd, POLLIN, 0};
+    uint64_t deadline_ns = get_time_ns() + UPGRADE_READY_TIMEOUT_MS * 1000000ULL;
+    char ready;
+
+    for (;;)
+    {
+        uint64_t now_ns = get_time_ns();
+        if (now_ns >= deadline_ns)
+            return false;
+        int result = poll(&upgrade, 1, (deadline_ns - now_ns + 999999) / 1000000);
+        if (result == -1 && errno == EINTR)
+            continue;
+        return result == 1 && read(socket_fd, &ready, sizeof(ready)) == sizeof(ready);
+    }
+}
+
+/**
+ * @brief Hands the connections and the state of the server over to a new instance of its binary
+ *
+ * The workers are only stopped once the new server is ready, so a binary that does not start leaves
+ * the server running. From then on the connections belong to the new server: the output still buffered
+ * is handed over with them and discarded here, so that deallocating the workers sends nothing.
+ *
+ * @param argv arguments with which the server has been started, passed to the new server
+ * @param workers array of the running workers
+ * @param total_workers number of workers
+ * @return 1 if the connections have been handed over, 0 if the upgrade has been cancelled and the workers
+ *         are still running, -1 if the handover failed after the workers had been stopped
+ */
+int upgrade_server(char **argv, Context *workers, unsigned int total_workers)
+{
+    int sockets[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sockets) == -1)
+    {
+        perror("Error creating the socket of the upgrade");
+        return 0;
+    }
+    pid_t pid = spawn_upgraded_server(argv, sockets[1]);
+    close(sockets[1]);
+    if (pid == -1 || !wait_upgraded_server(sockets[0]))
+    {
+        printf("The upgraded server did not start, the upgrade is cancelled\n");
+        if (pid != -1)
+        {
+            kill(pid, SIGKILL);
+            waitpid(pid, NULL, 0);
+        }
+        close(sockets[0]);
+        return 0;
+    }
+
+    // Stop the writer of the write-ahead log first, since a checkpoint waits for all the workers
+    uint64_t stopped_ns = get_time_ns();
+    wal_stop();
+    for (unsigned int i = 0; i < total_workers; i++)
+    {
+        workers[i].upgrading = true;
+        stop_worker(&workers[i]);
+    }
+    for (unsigned int i = 0; i < total_workers; i++)
+        pthread_join(workers[i].thread, NULL);
+
+    // Apply and publish the changes still queued for the rankings, then deliver them to the subscribers,
+    // so that the rankings handed over match the versions known to the clients
+    for (unsigned int i = 0; i < total_workers; i++)
+        process_ranking_events(&workers[i]);
+    for (unsigned int i = 0; i < total_workers; i++)
+        drain_ranking_events(&workers[i]);
+    wal_handoff();
+
+    bool sent = send_handoff(sockets[0], workers, total_workers, stopped_ns);
+    close(sockets[0]);
+    if (!sent)
+    {
+        perror("Error handing the connections over to the upgraded server");
+        kill(pid, SIGKILL);
+        waitpid(pid, NULL, 0);
+        return -1;
+    }
+
+    unsigned int handed_over = 0;
+    for (unsigned int i = 0; i < total_workers; i++)
+    {
+        for (Client *client = workers[i].clientsInfo.clients_head; client; client = client->next_node)
+        {
+            Connection *connection = find_connection(client->socket_fd);
+            if (connection)
+                discard_output(connection);
+            handed_over++;
+        }
+    }
+    printf("Handed %u connections over to the upgraded server (pid %d)\n", handed_over, (int)pid);
+    return 1;
+}
+
+/**
+ * @brief Reads a varint from the received state
+ *
+ * @return the value, or 0 if the state is truncated
+ */
+uint64_t read_handoff_varint(HandoffBuffer *buffer)
+{
+    uint64_t value = 0;
+    size_t length = buffer->truncated ? 0 : decode_varint(buffer->data + buffer->length,
+                                                           buffer->data + buffer->capacity, &value);
+    if (length == 0)
+    {
+        buffer->truncated = true;
+        return 0;
+    }
+    buffer->length += length;
+    return value;
+}
+
+/**
+ * @brief Reads raw bytes from the received state
+ *
+ * @return pointer to the bytes in the state, or NULL if the state is truncated
+ */
+const char *read_handoff_bytes(HandoffBuffer *buffer, size_t length)
+{
+    if (buffer->truncated || buffer->capacity - buffer->length < length)
+    {
+        buffer->truncated = true;
+        return NULL;
+    }
+    const char *data = buffer->data + buffer->length;
+    buffer->length += length;
+    return data;
+}
+
+/**
+ * @brief Reads a string from the received state
+ *
+ * @return an allocated copy of the string, or NULL if it was NULL or the state is truncated
+ */
+char *read_handoff_string(HandoffBuffer *buffer)
+{
+    uint64_t length = read_handoff_varint(buffer);
+    if (length == 0)
+        return NULL;
+    const char *data = read_handoff_bytes(buffer, length - 1);
+    if (!data)
+        return NULL;
+    char *string = strndup(data, length - 1);
+    handle_malloc_error(string, "Memory allocation error for the handed over state");
+    return string;
+}
+
+/**
+ * @brief Reads a timer written by write_handoff_timer and schedules it for the time it had left
+ */
+void read_handoff_timer(HandoffBuffer *buffer, TimerWheel *wheel, Timer *timer)
+{
+    uint64_t remaining = read_handoff_varint(buffer);
+    if (remaining)
+        schedule_timer(wheel, timer, remaining - 1);
+}
+
+/**
+ * @brief Reads the quizzes written by write_handoff_ranked_quizzes and links the nodes of a player
+ *
+ * @param buffer pointer to the received state
+ * @param client_rankings array filled with the nodes of the player in each quiz
+ * @param nickname nickname of the player
+ * @param quizzesInfo pointer to the quizzes
+ * @param index nodes of the rankings that belong to a player, by nickname
+ */
+void read_handoff_ranked_quizzes(HandoffBuffer *buffer, RankingNode **client_rankings, const char *nickname,
+                                 QuizzesInfo *quizzesInfo, RecoveryIndex *index)
+{
+    uint64_t count = read_handoff_varint(buffer);
+    for (uint64_t i = 0; i < count && !buffer->truncated; i++)
+    {
+        uint64_t quiz_id = read_handoff_varint(buffer);
+        if (quiz_id >= quizzesInfo->total_quizzes || !nickname)
+        {
+            buffer->truncated = true;
+            return;
+        }
+        client_rankings[quiz_id] = *recovery_slot(index, quizzesInfo->total_quizzes, quiz_id, nickname, strlen(nickname));
+    }
+}
+
+/**
+ * @brief Rebuilds the rankings and the live games written by write_handoff_rankings
+ *
+ * The nodes of the players are indexed by nickname, so that the clients and the sessions find them back.
+ *
+ * @param buffer pointer to the received state
+ * @param quizzesInfo pointer to the quizzes, which must be the ones of the previous server
+ * @param index index filled with the nodes of the players, the recovered ones excluded
+ * @return true on success
+ */
+bool read_handoff_rankings(HandoffBuffer *buffer, QuizzesInfo *quizzesInfo, RecoveryIndex *index)
+{
+    if (read_handoff_varint(buffer) != quizzesInfo->total_quizzes)
+        return false;
+
+    for (uint16_t i = 0; i < quizzesInfo->total_quizzes && !buffer->truncated; i++)
+    {
+        Quiz *quiz = quizzesInfo->quizzes[i];
+        quiz->ranking_version = read_handoff_varint(buffer);
+        uint64_t phase = read_handoff_varint(buffer);
+        if (phase)
+        {
+            uint64_t round_word = read_handoff_varint(buffer);
+            uint64_t sequence = read_handoff_varint(buffer);
+            uint64_t question = read_handoff_varint(buffer);
+            uint64_t remaining = read_handoff_varint(buffer);
+            // A quiz that is no longer played live keeps only its ranking
+            if (quiz->live && question <= quiz->total_questions)
+            {
+                quiz->live->phase = phase - 1;
+                quiz->live->round_word = round_word;
+                quiz->live->sequence = sequence;
+                quiz->live->question = question;
+                if (remaining)
+                    schedule_timer(&quiz->owner->timers, &quiz->live->timer, remaining - 1);
+            }
+        }
+
+        uint64_t total_clients = read_handoff_varint(buffer);
+        for (uint64_t j = 0; j < total_clients && !buffer->truncated; j++)
+        {
+            char *nickname = read_handoff_string(buffer);
+            if (!nickname)
+            {
+                buffer->truncated = true;
+                break;
+            }
+            RankingNode *node = calloc(1, sizeof(RankingNode));
+            handle_malloc_error(node, "Error allocating RankingNode");
+            node->nickname = nickname;
+            node->score = read_handoff_varint(buffer);
+            uint64_t flags = read_handoff_varint(buffer);
+            node->is_quiz_completed = flags & 1;
+            node->recovered = flags & 2;
+            node->current_question = read_handoff_varint(buffer);
+            node->correct_answers = read_handoff_varint(buffer);
+            node->round_score = read_handoff_varint(buffer);
+            insert_ranking_node(quiz, node);
+            quiz->total_clients++;
+            if (node->recovered)
+                quiz->recovered_players++;
+            else
+                *recovery_slot(index, quizzesInfo->total_quizzes, quiz->id, nickname, strlen(nickname)) = node;
+        }
+    }
+    return !buffer->truncated;
+}
+
+/**
+ * @brief Rebuilds a client written by write_handoff_client and adds it to its worker
+ *
+ * The client is linked in the live roster, the subscribers and the spectators of its worker, and its timers
+ * are scheduled for the time they had left; its socket is registered by the worker when it starts.
+ *
+ * @param buffer pointer to the received state
+ * @param context pointer to the context of the worker of the client
+ * @param index nodes of the rankings, by nickname
+ * @param fd descriptor of the socket of the client
+ * @param connection connection filled with the data to register with the socket
+ */
+void read_handoff_client(HandoffBuffer *buffer, Context *context, RecoveryIndex *index, int fd,
+                         HandoffConnection *connection)
+{
+    QuizzesInfo *quizzesInfo = context->quizzesInfo;
+    Client *client = create_client_node(fd, quizzesInfo);
+    client->id = read_handoff_varint(buffer);
+    client->state = read_handoff_varint(buffer);
+    client->current_quiz_id = read_handoff_varint(buffer) - 1;
+    client->nickname = read_handoff_string(buffer);
+    client->capabilities.version = read_handoff_varint(buffer);
+    client->capabilities.compression = read_handoff_varint(buffer);
+    client->capabilities.max_frame = read_handoff_varint(buffer);
+    client->capabilities.features = read_handoff_varint(buffer);
+    client->codec = select_codec(client->capabilities.version);
+    client->resumable = read_handoff_varint(buffer);
+    const char *token = client->resumable ? read_handoff_bytes(buffer, SESSION_TOKEN_SIZE) : NULL;
+    if (token)
+        memcpy(client->session_token, token, SESSION_TOKEN_SIZE);
+    read_handoff_timer(buffer, &context->timers, &client->idle_timer);
+    read_handoff_timer(buffer, &context->timers, &client->question_timer);
+    add_client(client, &context->clientsInfo);
+    if (client->state != LOGIN)
+        context->clientsInfo.connected_clients++;
+    if (client->nickname)
+        claim_nickname(context->nicknames, client->nickname);
+
+    bool playing = client->state == PLAYING && client->current_quiz_id < quizzesInfo->total_quizzes;
+    if (read_handoff_varint(buffer))
+    {
+        uint64_t backlog = read_handoff_varint(buffer);
+        uint64_t round = read_handoff_varint(buffer);
+        uint64_t answered = read_handoff_varint(buffer);
+        if (playing && quizzesInfo->quizzes[client->current_quiz_id]->live)
+        {
+            add_live_participant(client, context);
+            client->live_backlog = backlog;
+            client->live_round = round;
+            client->live_answered = answered;
+        }
+    }
+    if (read_handoff_varint(buffer))
+        add_ranking_subscriber(client, context);
+
+    uint64_t spectated = read_handoff_varint(buffer);
+    for (uint64_t i = 0; i < spectated && !buffer->truncated; i++)
+    {
+        uint64_t quiz_id = read_handoff_varint(buffer);
+        if (quiz_id >= quizzesInfo->total_quizzes)
+        {
+            buffer->truncated = true;
+            break;
+        }
+        if (!client->spectator_slots)
+        {
+            client->spectator_slots = malloc(quizzesInfo->total_quizzes * sizeof(int));
+            handle_malloc_error(client->spectator_slots, "Memory allocation error for the spectator slots");
+            for (uint16_t j = 0; j < quizzesInfo->total_quizzes; j++)
+                client->spectator_slots[j] = -1;
+        }
+        if (client->spectator_slots[quiz_id] == -1)
+            register_spectator(client, quizzesInfo->quizzes[quiz_id], context);
+    }
+    read_handoff_ranked_quizzes(buffer, client->client_rankings, client->nickname, quizzesInfo, index);
+
+    connection->client = client;
+    connection->worker = context->worker_id;
+    connection->input_length = read_handoff_varint(buffer);
+    connection->input = read_handoff_bytes(buffer, connection->input_length);
+    connection->output_length = read_handoff_varint(buffer);
+    connection->output = read_handoff_bytes(buffer, connection->output_length);
+}
+
+/**
+ * @brief Rebuilds a session written by write_handoff_session and parks it on its worker again
+ *
+ * @param buffer pointer to the received state
+ * @param context pointer to the context of the worker that parked the session
+ * @param index nodes of the rankings, by nickname
+ * @param now_ns current time
+ */
+void read_handoff_session(HandoffBuffer *buffer, Context *context, RecoveryIndex *index, uint64_t now_ns)
+{
+    QuizzesInfo *quizzesInfo = context->quizzesInfo;
+    const char *token = read_handoff_bytes(buffer, SESSION_TOKEN_SIZE);
+    char *nickname = read_handoff_string(buffer);
+    if (!token || !nickname)
+    {
+        buffer->truncated = true;
+        free(nickname);
+        return;
+    }
+
+    ParkedSession *session = malloc(sizeof(ParkedSession));
+    handle_malloc_error(session, "Memory allocation error for the session of the client");
+    memcpy(session->token, token, SESSION_TOKEN_SIZE);
+    session->nickname = nickname;
+    session->current_quiz_id = read_handoff_varint(buffer) - 1;
+    session->state = read_handoff_varint(buffer);
+    session->expires_ns = now_ns + read_handoff_varint(buffer) * 1000000ULL;
+    session->resumed = false;
+    session->client_rankings = calloc(quizzesInfo->total_quizzes, sizeof(RankingNode *));
+    handle_malloc_error(session->client_rankings, "Memory allocation error for the session of the client");
+    read_handoff_ranked_quizzes(buffer, session->client_rankings, nickname, quizzesInfo, index);
+
+    // The sessions are dropped if the resumption has been disabled, their players being ranked anyway
+    if (!context->sessions)
+    {
+        free(session->client_rankings);
+        free(session);
+        free(nickname);
+        return;
+    }
+    claim_nickname(context->nicknames, nickname);
+    link_parked_session(session, context);
+}
+
+/**
+ * @brief Tells the server being upgraded that this one is ready, then receives its connections and its state
+ *
+ * @param socket_fd descriptor of the socket of the upgrade, inherited from the previous server
+ * @return number of workers of the previous server, which this one must have as well, or 0 in case of error
+ */
+unsigned int receive_handoff(int socket_fd)
+{
+    char ready = 1;
+    if (!write_handoff_data(socket_fd, &ready, sizeof(ready)) ||
+        !read_handoff_data(socket_fd, &handoff_header, sizeof(handoff_header)))
+        return 0;
+    if (memcmp(handoff_header.magic, HANDOFF_MAGIC, sizeof(handoff_header.magic)) != 0 ||
+        handoff_header.version != HANDOFF_VERSION || handoff_header.total_workers == 0 ||
+        handoff_header.total_fds < handoff_header.total_workers)
+    {
+        errno = EPROTO;
+        return 0;
+    }
+
+    handoff_fds = malloc(handoff_header.total_fds * sizeof(int));
+    handoff_state.data = malloc(handoff_header.state_length ? handoff_header.state_length : 1);
+    handle_malloc_error(handoff_fds, "Memory allocation error for the handed over descriptors");
+    handle_malloc_error(handoff_state.data, "Memory allocation error for the handed over state");
+    handoff_state.capacity = handoff_header.state_length;
+    if (!receive_handoff_fds(socket_fd, handoff_fds, handoff_header.total_fds) ||
+        !read_handoff_data(socket_fd, handoff_state.data, handoff_state.capacity))
+        return 0;
+    close(socket_fd);
+    return handoff_header.total_workers;
+}
+
+/**
+ * @brief Returns the listener socket handed over for a worker
+ *
+ * @param worker index of the worker
+ * @return descriptor of the listener
+ */
+int handoff_listener(unsigned int worker)
+{
+    return handoff_fds[worker];
+}
+
+/**
+ * @brief Rebuilds the rankings, the clients and the parked sessions received from the previous server
+ *
+ * It is called before the workers start, which then register the sockets of their clients with
+ * adopt_handoff_connections. The rankings are published with the versions known to the clients.
+ *
+ * @param workers array of the initialized workers, with the listeners handed over
+ * @param total_workers number of workers, equal to the one of the previous server
+ * @return true on success, false if the state does not match the quizzes or is corrupted
+ */
+bool restore_handoff(Context *workers, unsigned int total_workers)
+{
+    QuizzesInfo *quizzesInfo = workers[0].quizzesInfo;
+    HandoffBuffer *state = &handoff_state;
+    RecoveryIndex index;
+    uint64_t now_ns = get_time_ns();
+    unsigned int position = total_workers;
+
+    memset(&index, 0, sizeof(index));
+    handoff_connections = malloc((handoff_header.total_fds - total_workers + 1) * sizeof(HandoffConnection));
+    handle_malloc_error(handoff_connections, "Memory allocation error for the handed over connections");
+    bool restored = read_handoff_rankings(state, quizzesInfo, &index);
+
+    for (unsigned int i = 0; i < total_workers && restored; i++)
+    {
+        Context *context = &workers[i];
+        context->clientsInfo.next_client_id = read_handoff_varint(state);
+        uint64_t clients = read_handoff_varint(state);
+        for (uint64_t j = 0; j < clients && !state->truncated; j++)
+        {
+            if (position == handoff_header.total_fds)
+            {
+                state->truncated = true;
+                break;
+            }
+            read_handoff_client(state, context, &index, handoff_fds[position],
+                                &handoff_connections[handoff_total_connections++]);
+            position++;
+        }
+
+        uint64_t sessions = read_handoff_varint(state);
+        for (uint64_t j = 0; j < sessions && !state->truncated; j++)
+            read_handoff_session(state, context, &index, now_ns);
+        if (context->parked_head)
+            schedule_timer(&context->timers, &context->session_timer,
+                           (context->parked_head->expires_ns - now_ns) / 1000000 + 1);
+        restored = !state->truncated;
+    }
+    deallocate_recovery_index(&index);
+
+    for (uint16_t i = 0; i < quizzesInfo->total_quizzes; i++)
+    {
+        Quiz *quiz = quizzesInfo->quizzes[i];
+        publish_ranking_snapshot(quiz, build_ranking_snapshot(quiz));
+        quiz->snapshot_stale = false;
+    }
+    handoff_pending_workers = total_workers;
+    return restored && position == handoff_header.total_fds;
+}
+
+/**
+ * @brief Registers the connections handed over to a worker, when it starts
+ *
+ * The frames the previous server had not sent are sent first, then the data it had received and not consumed
+ * is handled as if it had just arrived. The last worker releases the state and reports the pause of the upgrade.
+ *
+ * @param context pointer to the context of the worker, whose backend is initialized
+ */
+void adopt_handoff_connections(Context *context)
+{
+    if (!handoff_connections)
+        return;
+
+    for (unsigned int i = 0; i < handoff_total_connections; i++)
+    {
+        HandoffConnection *handoff = &handoff_connections[i];
+        if (handoff->worker != context->worker_id)
+            continue;
+        Client *client = handoff->client;
+        context->io->watch(context, client->socket_fd);
+        Connection *connection = find_connection(client->socket_fd);
+        if (handoff->output_length)
+            connection_transport.send(client->socket_fd, handoff->output, handoff->output_length);
+        if (handoff->input_length)
+        {
+            memcpy(reserve_input(connection, handoff->input_length), handoff->input, handoff->input_length);
+            connection->input_length += handoff->input_length;
+            handle_client(client, context);
+        }
+    }
+
+    if (__atomic_sub_fetch(&handoff_pending_workers, 1, __ATOMIC_ACQ_REL) > 0)
+        return;
+    printf("Upgrade completed: %u connections taken over, the workers were paused for %.1f ms\n",
+           handoff_total_connections, (get_time_ns() - handoff_header.stopped_ns) / 1e6);
+    free(handoff_connections);
+    handoff_connections = NULL;
+    free(handoff_fds);
+    handoff_fds = NULL;
+    free(handoff_state.data);
+    handoff_state.data = NULL;
+}
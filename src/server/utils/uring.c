@@ -0,0 +1,803 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include "utils.h"
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#endif
+
+// The backend needs the multishot receives and the provided buffer rings of Linux 6.0
+#ifdef IORING_RECV_MULTISHOT
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+// Number of entries of the submission queue, the completion queue is twice as large
+#define URING_ENTRIES 1024
+// Number of buffers provided to the kernel for the receives, must be a power of two
+#define URING_BUFFERS 512
+// Size of each provided buffer
+#define URING_BUFFER_SIZE 4096
+// Identifier of the group of the provided buffers
+#define URING_BUFFER_GROUP 0
+// Bits of the user data of a request that encode its operation, the others hold the address of the connection
+#define URING_OPERATION_MASK 7ULL
+
+/**
+ * @brief Operation of a request submitted to the ring, stored in the user data together with the connection
+ */
+typedef enum UringOperation
+{
+    URING_ACCEPT, /**< Multishot accept on the listener of the worker. */
+    URING_WAKE,   /**< Read of the wake-up descriptor of the worker. */
+    URING_RECV,   /**< Multishot receive into the provided buffers. */
+    URING_SEND,   /**< Send of the sending buffer of a connection. */
+    URING_CANCEL  /**< Cancellation of the receive of a released connection, or of the operations to hand over. */
+} UringOperation;
+
+/**
+ * @brief State of the io_uring backend of a worker
+ */
+typedef struct UringState
+{
+    int ring_fd;                           /**< File descriptor of the ring. */
+    void *sq_ring;                         /**< Mapping of the submission queue ring. */
+    size_t sq_ring_size;                   /**< Size of the mapping of the submission queue ring. */
+    void *cq_ring;                         /**< Mapping of the completion queue ring, equal to sq_ring if shared. */
+    size_t cq_ring_size;                   /**< Size of the mapping of the completion queue ring. */
+    struct io_uring_sqe *sqes;             /**< Submission queue entries. */
+    size_t sqes_size;                      /**< Size of the mapping of the entries. */
+    unsigned int *sq_head;                 /**< Head of the submission queue, advanced by the kernel. */
+    unsigned int *sq_tail;                 /**< Tail of the submission queue, advanced by the worker. */
+    unsigned int sq_mask;                  /**< Mask applied to the positions of the submission queue. */
+    unsigned int sq_entries;               /**< Number of entries of the submission queue. */
+    unsigned int sq_local_tail;            /**< Tail including the entries prepared but not published yet. */
+    unsigned int to_submit;                /**< Entries prepared since the last submission. */
+    unsigned int *cq_head;                 /**< Head of the completion queue, advanced by the worker. */
+    unsigned int *cq_tail;                 /**< Tail of the completion queue, advanced by the kernel. */
+    unsigned int cq_mask;                  /**< Mask applied to the positions of the completion queue. */
+    struct io_uring_cqe *cqes;             /**< Completion queue entries. */
+    struct io_uring_buf_ring *buffer_ring; /**< Ring through which the buffers are provided to the kernel. */
+    char *buffers;                         /**< Memory of the provided buffers. */
+    unsigned short buffer_tail;            /**< Tail of the buffer ring, published after each batch of completions. */
+    int *accepted;                         /**< Connections accepted by the kernel and not yet registered. */
+    size_t accepted_next;                  /**< Position of the next connection to register. */
+    size_t accepted_count;                 /**< Number of connections in the array. */
+    size_t accepted_capacity;              /**< Allocated size of the array. */
+    uint64_t wake_value;                   /**< Destination of the reads of the wake-up descriptor. */
+    bool accept_multishot;                 /**< False if the kernel does not support multishot accepts. */
+    bool recv_multishot;                   /**< False if the kernel does not support multishot receives. */
+    bool accept_armed;                     /**< An accept is in flight on the listener. */
+    bool accepts_paused;                   /**< The accepts are paused by the overload controller, nothing is rearmed. */
+    bool quiescing;                        /**< The connections are being handed over: nothing is rearmed or chained. */
+    Connection *released;                  /**< Released connections still referenced by operations in flight. */
+} UringState;
+
+/**
+ * @brief Issues the io_uring_enter system call
+ */
+int uring_enter(int ring_fd, unsigned int to_submit, unsigned int min_complete, unsigned int flags, void *arg,
+                size_t arg_size)
+{
+    return syscall(__NR_io_uring_enter, ring_fd, to_submit, min_complete, flags, arg, arg_size);
+}
+
+/**
+ * @brief Creates a ring and maps its queues
+ *
+ * The ring is only used by the thread that creates it, which lets the kernel defer the completion work
+ * until the thread waits for it.
+ *
+ * @param state pointer to the state in which the ring is stored
+ * @return 0 on success, -1 if io_uring is not available
+ */
+int uring_setup(UringState *state)
+{
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    params.flags = IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN | IORING_SETUP_SUBMIT_ALL;
+    state->ring_fd = syscall(__NR_io_uring_setup, URING_ENTRIES, &params);
+    if (state->ring_fd < 0 && errno == EINVAL)
+    {
+        // Older kernels do not know the flags
+        memset(&params, 0, sizeof(params));
+        state->ring_fd = syscall(__NR_io_uring_setup, URING_ENTRIES, &params);
+    }
+    if (state->ring_fd < 0)
+        return -1;
+
+    state->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+    state->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        if (state->cq_ring_size > state->sq_ring_size)
+            state->sq_ring_size = state->cq_ring_size;
+        state->cq_ring_size = state->sq_ring_size;
+    }
+    state->sq_ring = mmap(NULL, state->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                          state->ring_fd, IORING_OFF_SQ_RING);
+    if (state->sq_ring == MAP_FAILED)
+        return -1;
+    state->cq_ring = state->sq_ring;
+    if (!(params.features & IORING_FEAT_SINGLE_MMAP))
+    {
+        state->cq_ring = mmap(NULL, state->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                              state->ring_fd, IORING_OFF_CQ_RING);
+        if (state->cq_ring == MAP_FAILED)
+            return -1;
+    }
+    state->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    state->sqes = mmap(NULL, state->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, state->ring_fd,
+                       IORING_OFF_SQES);
+    if (state->sqes == MAP_FAILED)
+        return -1;
+
+    char *sq_ring = state->sq_ring, *cq_ring = state->cq_ring;
+    state->sq_head = (unsigned int *)(sq_ring + params.sq_off.head);
+    state->sq_tail = (unsigned int *)(sq_ring + params.sq_off.tail);
+    state->sq_mask = *(unsigned int *)(sq_ring + params.sq_off.ring_mask);
+    state->sq_entries = params.sq_entries;
+    state->sq_local_tail = *state->sq_tail;
+    state->to_submit = 0;
+    // Each position of the submission queue always refers to the entry with the same index
+    unsigned int *sq_array = (unsigned int *)(sq_ring + params.sq_off.array);
+    for (unsigned int i = 0; i < params.sq_entries; i++)
+        sq_array[i] = i;
+    state->cq_head = (unsigned int *)(cq_ring + params.cq_off.head);
+    state->cq_tail = (unsigned int *)(cq_ring + params.cq_off.tail);
+    state->cq_mask = *(unsigned int *)(cq_ring + params.cq_off.ring_mask);
+    state->cqes = (struct io_uring_cqe *)(cq_ring + params.cq_off.cqes);
+    return 0;
+}
+
+/**
+ * @brief Returns a buffer to the kernel, which is published with the next batch of completions
+ *
+ * Only the fields of the entry are written, since the tail of the ring overlays the reserved field of the first one.
+ */
+void uring_recycle_buffer(UringState *state, unsigned short buffer_id)
+{
+    struct io_uring_buf *buffer = &state->buffer_ring->bufs[state->buffer_tail & (URING_BUFFERS - 1)];
+    buffer->addr = (uintptr_t)(state->buffers + (size_t)buffer_id * URING_BUFFER_SIZE);
+    buffer->len = URING_BUFFER_SIZE;
+    buffer->bid = buffer_id;
+    state->buffer_tail++;
+}
+
+/**
+ * @brief Registers the ring of the buffers used by the receives and provides all of them
+ *
+ * @param state pointer to the state of the backend
+ * @return 0 on success, -1 if the kernel does not support provided buffer rings
+ */
+int uring_setup_buffers(UringState *state)
+{
+    struct io_uring_buf_reg registration;
+
+    if (posix_memalign((void **)&state->buffer_ring, sysconf(_SC_PAGESIZE), URING_BUFFERS * sizeof(struct io_uring_buf)))
+        return -1;
+    memset(state->buffer_ring, 0, URING_BUFFERS * sizeof(struct io_uring_buf));
+    memset(&registration, 0, sizeof(registration));
+    registration.ring_addr = (uintptr_t)state->buffer_ring;
+    registration.ring_entries = URING_BUFFERS;
+    registration.bgid = URING_BUFFER_GROUP;
+    if (syscall(__NR_io_uring_register, state->ring_fd, IORING_REGISTER_PBUF_RING, &registration, 1) < 0)
+        return -1;
+
+    state->buffers = malloc((size_t)URING_BUFFERS * URING_BUFFER_SIZE);
+    handle_malloc_error(state->buffers, "Memory allocation error for the io_uring buffers");
+    state->buffer_tail = 0;
+    for (unsigned short i = 0; i < URING_BUFFERS; i++)
+        uring_recycle_buffer(state, i);
+    __atomic_store_n(&state->buffer_ring->tail, state->buffer_tail, __ATOMIC_RELEASE);
+    return 0;
+}
+
+/**
+ * @brief Unmaps the ring and deallocates the buffers
+ */
+void uring_teardown(UringState *state)
+{
+    if (state->ring_fd >= 0)
+        close(state->ring_fd);
+    if (state->sqes && state->sqes != MAP_FAILED)
+        munmap(state->sqes, state->sqes_size);
+    if (state->cq_ring && state->cq_ring != MAP_FAILED && state->cq_ring != state->sq_ring)
+        munmap(state->cq_ring, state->cq_ring_size);
+    if (state->sq_ring && state->sq_ring != MAP_FAILED)
+        munmap(state->sq_ring, state->sq_ring_size);
+    free(state->buffer_ring);
+    free(state->buffers);
+}
+
+/**
+ * @brief Tells if the kernel supports the io_uring features used by the backend
+ *
+ * @return true if a ring with a provided buffer ring can be created
+ */
+bool uring_supported()
+{
+    UringState state;
+    memset(&state, 0, sizeof(state));
+    bool supported = uring_setup(&state) == 0 && uring_setup_buffers(&state) == 0;
+    uring_teardown(&state);
+    return supported;
+}
+
+/**
+ * @brief Publishes the prepared entries and enters the kernel, optionally waiting for a completion
+ *
+ * The time limit of the wait is passed to the same system call as an extended argument.
+ *
+ * @param context pointer to the context of the worker
+ * @param wait true to wait for at least one completion
+ * @param timeout_ms maximum time to wait in milliseconds, -1 to wait without limit
+ * @return result of io_uring_enter, 0 if the wait timed out
+ */
+int uring_submit(Context *context, bool wait, int timeout_ms)
+{
+    UringState *state = context->io_state;
+    struct __kernel_timespec timeout = {.tv_sec = timeout_ms / 1000, .tv_nsec = (timeout_ms % 1000) * 1000000LL};
+    struct io_uring_getevents_arg arg = {.ts = (uintptr_t)&timeout};
+    bool timed = wait && timeout_ms >= 0;
+
+    __atomic_store_n(state->sq_tail, state->sq_local_tail, __ATOMIC_RELEASE);
+    int result = uring_enter(state->ring_fd, state->to_submit, wait ? 1 : 0,
+                             IORING_ENTER_GETEVENTS | (timed ? IORING_ENTER_EXT_ARG : 0), timed ? &arg : NULL,
+                             timed ? sizeof(arg) : 0);
+    count_io(&context->io_stats.syscalls, 1);
+    if (result < 0 && errno == ETIME)
+        return 0;
+    if (result >= 0)
+        state->to_submit -= (unsigned int)result < state->to_submit ? (unsigned int)result : state->to_submit;
+    return result;
+}
+
+/**
+ * @brief Returns a cleared submission queue entry, submitting the prepared ones if the queue is full
+ */
+struct io_uring_sqe *uring_get_sqe(Context *context)
+{
+    UringState *state = context->io_state;
+    while (state->sq_local_tail - __atomic_load_n(state->sq_head, __ATOMIC_ACQUIRE) >= state->sq_entries)
+        uring_submit(context, false, -1);
+
+    struct io_uring_sqe *sqe = &state->sqes[state->sq_local_tail & state->sq_mask];
+    memset(sqe, 0, sizeof(*sqe));
+    state->sq_local_tail++;
+    state->to_submit++;
+    return sqe;
+}
+
+/**
+ * @brief Submits the accept of the connections arriving on the listener
+ */
+void uring_arm_accept(Context *context)
+{
+    UringState *state = context->io_state;
+    struct io_uring_sqe *sqe = uring_get_sqe(context);
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = context->server_fd;
+    sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+    sqe->ioprio = state->accept_multishot ? IORING_ACCEPT_MULTISHOT : 0;
+    sqe->user_data = URING_ACCEPT;
+    state->accept_armed = true;
+}
+
+/**
+ * @brief Submits the read of the wake-up descriptor, which consumes the notifications without a system call
+ */
+void uring_arm_wake(Context *context)
+{
+    UringState *state = context->io_state;
+    struct io_uring_sqe *sqe = uring_get_sqe(context);
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = context->wake_fd;
+    sqe->addr = (uintptr_t)&state->wake_value;
+    sqe->len = sizeof(state->wake_value);
+    sqe->user_data = URING_WAKE;
+}
+
+/**
+ * @brief Submits the receive of the data of a connection into the provided buffers
+ */
+void uring_arm_recv(Context *context, Connection *connection)
+{
+    UringState *state = context->io_state;
+    struct io_uring_sqe *sqe = uring_get_sqe(context);
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = connection->fd;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_BUFFER_GROUP;
+    sqe->ioprio = state->recv_multishot ? IORING_RECV_MULTISHOT : 0;
+    sqe->user_data = (uintptr_t)connection | URING_RECV;
+    connection->operations++;
+}
+
+/**
+ * @brief Submits the send of the pending part of the sending buffer of a connection
+ *
+ * The output containing shared frames is sent with a vectored send, whose pieces are kept in the connection
+ * until the send completes.
+ */
+void uring_arm_send(Context *context, Connection *connection)
+{
+    struct io_uring_sqe *sqe = uring_get_sqe(context);
+    int pieces = fill_send_iov(connection, connection->iov, SEND_IOV_MAX);
+    sqe->fd = connection->fd;
+    if (pieces == 1)
+    {
+        sqe->opcode = IORING_OP_SEND;
+        sqe->addr = (uintptr_t)connection->iov[0].iov_base;
+        sqe->len = connection->iov[0].iov_len;
+    }
+    else
+    {
+        memset(&connection->message, 0, sizeof(connection->message));
+        connection->message.msg_iov = connection->iov;
+        connection->message.msg_iovlen = pieces;
+        sqe->opcode = IORING_OP_SENDMSG;
+        sqe->addr = (uintptr_t)&connection->message;
+        sqe->len = 1;
+    }
+    sqe->msg_flags = MSG_NOSIGNAL;
+    sqe->user_data = (uintptr_t)connection | URING_SEND;
+    connection->operations++;
+    connection->send_in_flight = true;
+}
+
+/**
+ * @brief Submits the cancellation of the requests with some user data
+ */
+void uring_cancel(Context *context, uint64_t user_data)
+{
+    struct io_uring_sqe *sqe = uring_get_sqe(context);
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->addr = user_data;
+    sqe->user_data = URING_CANCEL;
+}
+
+/**
+ * @brief Creates the ring of the worker and submits the accept and the read of the wake-up descriptor
+ *
+ * @param context pointer to the context of the worker
+ */
+void uring_init(Context *context)
+{
+    UringState *state = calloc(1, sizeof(UringState));
+    handle_malloc_error(state, "Memory allocation error for the io_uring backend");
+    context->io_state = state;
+    if (uring_setup(state) == -1 || uring_setup_buffers(state) == -1)
+    {
+        perror("Error creating the io_uring instance of a worker");
+        exit(EXIT_FAILURE);
+    }
+    state->accept_multishot = true;
+    state->recv_multishot = true;
+    uring_arm_accept(context);
+    uring_arm_wake(context);
+}
+
+/**
+ * @brief Starts receiving the data of a new client
+ *
+ * @param context pointer to the context of the worker
+ * @param fd file descriptor of the socket of the client
+ */
+void uring_watch(Context *context, int fd)
+{
+    Connection *connection = open_connection(context, fd);
+    configure_client_socket(fd);
+    uring_arm_recv(context, connection);
+}
+
+/**
+ * @brief Stops handling the socket of a client before it is closed
+ *
+ * The output still buffered is sent if the kernel accepts it without blocking. The receive in flight is cancelled,
+ * and the connection is deallocated once the kernel has completed all the operations that reference it.
+ *
+ * @param context pointer to the context of the worker
+ * @param fd file descriptor of the socket of the client
+ */
+void uring_unwatch(Context *context, int fd)
+{
+    UringState *state = context->io_state;
+    Connection *connection = find_connection(fd);
+    if (!connection)
+        return;
+
+    if (!connection->send_in_flight && !connection->error && take_output(connection))
+    {
+        send_pending_output(connection);
+        count_io(&context->io_stats.syscalls, 1);
+    }
+    release_connection(connection);
+
+    if (connection->operations == 0)
+    {
+        free_connection(connection);
+        return;
+    }
+    uring_cancel(context, (uintptr_t)connection | URING_RECV);
+    connection->next_flush = state->released;
+    state->released = connection;
+}
+
+/**
+ * @brief Deallocates a released connection once no operation references it anymore
+ */
+void uring_collect(UringState *state, Connection *connection)
+{
+    if (!connection->released || connection->operations > 0)
+        return;
+    for (Connection **link = &state->released; *link; link = &(*link)->next_flush)
+    {
+        if (*link == connection)
+        {
+            *link = connection->next_flush;
+            break;
+        }
+    }
+    free_connection(connection);
+}
+
+/**
+ * @brief Handles the completion of a receive, moving the data from the provided buffer to the input of the connection
+ */
+void uring_complete_recv(Context *context, Connection *connection, struct io_uring_cqe *cqe)
+{
+    UringState *state = context->io_state;
+    bool more = cqe->flags & IORING_CQE_F_MORE;
+
+    if (cqe->flags & IORING_CQE_F_BUFFER)
+    {
+        unsigned short buffer_id = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+        if (cqe->res > 0 && !connection->released)
+        {
+            memcpy(reserve_input(connection, cqe->res), state->buffers + (size_t)buffer_id * URING_BUFFER_SIZE, cqe->res);
+            connection->input_length += cqe->res;
+        }
+        uring_recycle_buffer(state, buffer_id);
+    }
+    if (!more)
+        connection->operations--;
+    if (connection->released)
+        return;
+
+    bool rearm = !more;
+    if (cqe->res > 0)
+        connection->ready = true;
+    else if (cqe->res == 0)
+    {
+        connection->closed = true;
+        connection->ready = true;
+        rearm = false;
+    }
+    else if (cqe->res == -EINVAL && state->recv_multishot)
+        state->recv_multishot = false;
+    else if (cqe->res == -ECANCELED && state->quiescing)
+        rearm = false;
+    else if (cqe->res != -ENOBUFS && cqe->res != -EINTR)
+    {
+        connection->error = -cqe->res;
+        connection->ready = true;
+        rearm = false;
+    }
+    if (rearm && !state->quiescing)
+        uring_arm_recv(context, connection);
+}
+
+/**
+ * @brief Handles the completion of a send, chaining the rest of the output of the connection
+ */
+void uring_complete_send(Context *context, Connection *connection, struct io_uring_cqe *cqe)
+{
+    UringState *state = context->io_state;
+    connection->operations--;
+    connection->send_in_flight = false;
+    // A send cancelled for the handover has sent nothing, its output is handed over with the connection
+    if (connection->released || (cqe->res == -ECANCELED && state->quiescing))
+        return;
+
+    if (cqe->res < 0)
+    {
+        // The output is discarded, the error is reported by the next receive
+        connection->error = -cqe->res;
+        discard_output(connection);
+        connection->ready = true;
+        return;
+    }
+    connection->sending_offset += cqe->res;
+    if (!state->quiescing && take_output(connection))
+        uring_arm_send(context, connection);
+}
+
+/**
+ * @brief Handles a completion of the ring
+ */
+void uring_complete(Context *context, struct io_uring_cqe *cqe)
+{
+    UringState *state = context->io_state;
+    UringOperation operation = cqe->user_data & URING_OPERATION_MASK;
+    Connection *connection = (Connection *)(uintptr_t)(cqe->user_data & ~URING_OPERATION_MASK);
+
+    switch (operation)
+    {
+    case URING_ACCEPT:
+        if (cqe->res >= 0)
+        {
+            if (state->accepted_count == state->accepted_capacity)
+            {
+                state->accepted_capacity = state->accepted_capacity ? state->accepted_capacity * 2 : 16;
+                state->accepted = realloc(state->accepted, state->accepted_capacity * sizeof(int));
+                handle_malloc_error(state->accepted, "Memory allocation error for the accepted connections");
+            }
+            state->accepted[state->accepted_count++] = cqe->res;
+        }
+        else if (cqe->res == -EINVAL && state->accept_multishot)
+            state->accept_multishot = false;
+        else if (cqe->res != -EAGAIN && cqe->res != -EINTR && cqe->res != -ECONNABORTED && cqe->res != -ECANCELED)
+            flight_record(FLIGHT_ERROR, FLIGHT_ERROR_ACCEPT, 0, -cqe->res, 0);
+        if (!(cqe->flags & IORING_CQE_F_MORE))
+        {
+            state->accept_armed = false;
+            if (!state->quiescing && !state->accepts_paused)
+                uring_arm_accept(context);
+        }
+        break;
+    case URING_WAKE:
+        uring_arm_wake(context);
+        break;
+    case URING_RECV:
+        uring_complete_recv(context, connection, cqe);
+        uring_collect(state, connection);
+        break;
+    case URING_SEND:
+        uring_complete_send(context, connection, cqe);
+        uring_collect(state, connection);
+        break;
+    case URING_CANCEL:
+        break;
+    }
+}
+
+/**
+ * @brief Processes the completions posted by the kernel and returns the consumed buffers to it
+ *
+ * @param context pointer to the context of the worker
+ * @return number of completions processed
+ */
+int uring_reap(Context *context)
+{
+    UringState *state = context->io_state;
+    unsigned int head = *state->cq_head;
+    int completions = 0;
+    unsigned int tail = __atomic_load_n(state->cq_tail, __ATOMIC_ACQUIRE);
+    for (; head != tail; head++, completions++)
+        uring_complete(context, &state->cqes[head & state->cq_mask]);
+    __atomic_store_n(state->cq_head, head, __ATOMIC_RELEASE);
+    __atomic_store_n(&state->buffer_ring->tail, state->buffer_tail, __ATOMIC_RELEASE);
+    return completions;
+}
+
+/**
+ * @brief Submits the prepared requests and waits for completions with a single system call
+ *
+ * The completions are processed before returning: the received data is moved to the input of the connections,
+ * the accepted connections are queued and the sends are chained.
+ *
+ * @param context pointer to the context of the worker
+ * @param timeout_ms maximum time to wait in milliseconds, -1 to wait without limit
+ * @return number of completions, 0 if interrupted or timed out, -1 in case of error
+ */
+int uring_wait(Context *context, int timeout_ms)
+{
+    UringState *state = context->io_state;
+    bool completed = *state->cq_head != __atomic_load_n(state->cq_tail, __ATOMIC_ACQUIRE);
+
+    // Keep the connections left over by the accept budget of the previous iteration
+    if (state->accepted_next > 0)
+    {
+        state->accepted_count -= state->accepted_next;
+        memmove(state->accepted, state->accepted + state->accepted_next, state->accepted_count * sizeof(int));
+        state->accepted_next = 0;
+    }
+    bool pending = completed || (state->accepted_count > 0 && !state->accepts_paused);
+
+    if (!pending || state->to_submit)
+    {
+        if (uring_submit(context, !pending, timeout_ms) < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY)
+            return -1;
+    }
+
+    return uring_reap(context);
+}
+
+/**
+ * @brief Tells if a descriptor has pending activity after the last wait
+ *
+ * The wake-up descriptor is never reported, since its notifications are consumed by the ring.
+ *
+ * @param context pointer to the context of the worker
+ * @param fd file descriptor to check
+ */
+bool uring_is_ready(Context *context, int fd)
+{
+    UringState *state = context->io_state;
+    if (fd == context->server_fd)
+        return state->accepted_next < state->accepted_count;
+    if (fd == context->wake_fd)
+        return false;
+    Connection *connection = find_connection(fd);
+    return connection && connection->ready;
+}
+
+/**
+ * @brief Returns the next connection accepted by the kernel and not yet registered
+ *
+ * @param context pointer to the context of the worker
+ * @return file descriptor of the connection, or -1 with errno set to EAGAIN if none is left
+ */
+int uring_accept(Context *context)
+{
+    UringState *state = context->io_state;
+    if (state->accepted_next == state->accepted_count)
+    {
+        errno = EAGAIN;
+        return -1;
+    }
+    return state->accepted[state->accepted_next++];
+}
+
+/**
+ * @brief Marks the data received on a connection as seen, since it has already been moved to its input
+ *
+ * @param context pointer to the context of the worker
+ * @param fd file descriptor of the socket of the client
+ */
+void uring_receive(Context *context, int fd)
+{
+    Connection *connection = find_connection(fd);
+    if (connection)
+        connection->ready = false;
+}
+
+/**
+ * @brief Prepares a send for each connection with buffered output, submitted with the next wait
+ *
+ * @param context pointer to the context of the worker
+ */
+void uring_flush(Context *context)
+{
+    Connection *connection = context->flush_head;
+    context->flush_head = NULL;
+    while (connection)
+    {
+        Connection *next = connection->next_flush;
+        connection->flush_queued = false;
+        connection->next_flush = NULL;
+        // A send in flight chains the rest of the output when it completes
+        if (!connection->send_in_flight && take_output(connection))
+            uring_arm_send(context, connection);
+        connection = next;
+    }
+}
+
+/**
+ * @brief Destroys the ring of the worker and deallocates the connections it still referenced
+ *
+ * @param context pointer to the context of the worker
+ */
+void uring_destroy(Context *context)
+{
+    UringState *state = context->io_state;
+    if (!state)
+        return;
+    uring_teardown(state);
+    while (state->released)
+    {
+        Connection *next = state->released->next_flush;
+        free_connection(state->released);
+        state->released = next;
+    }
+    free(state->accepted);
+    free(state);
+    context->io_state = NULL;
+}
+
+/**
+ * @brief Tells if the accept or an operation of a client connection is still in flight
+ *
+ * The requests not yet submitted are not counted, since the read of the wake-up descriptor never completes.
+ */
+bool uring_busy(Context *context)
+{
+    UringState *state = context->io_state;
+    if (state->accept_armed)
+        return true;
+    for (Client *client = context->clientsInfo.clients_head; client; client = client->next_node)
+    {
+        Connection *connection = find_connection(client->socket_fd);
+        if (connection && connection->operations > 0)
+            return true;
+    }
+    return false;
+}
+
+/**
+ * @brief Cancels the accept, the receives and the sends in flight and waits for their completions
+ *
+ * The data received before the cancellation is moved to the input of the connections, and the output not sent
+ * stays in their buffers, so that both are handed over with the connections.
+ *
+ * @param context pointer to the context of the worker
+ * @return true if connections accepted by the kernel are left to register, which must then be quiesced again
+ */
+bool uring_quiesce(Context *context)
+{
+    UringState *state = context->io_state;
+    state->quiescing = true;
+    if (state->accept_armed)
+        uring_cancel(context, URING_ACCEPT);
+    for (Client *client = context->clientsInfo.clients_head; client; client = client->next_node)
+    {
+        Connection *connection = find_connection(client->socket_fd);
+        if (!connection || connection->operations == 0)
+            continue;
+        uring_cancel(context, (uintptr_t)connection | URING_RECV);
+        if (connection->send_in_flight)
+            uring_cancel(context, (uintptr_t)connection | URING_SEND);
+    }
+
+    while (uring_busy(context))
+    {
+        if (uring_submit(context, true, -1) < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY)
+        {
+            perror("Error completing the operations of the io_uring instance");
+            break;
+        }
+        uring_reap(context);
+    }
+    return state->accepted_next < state->accepted_count;
+}
+
+// I/O backend based on io_uring: one system call for each iteration of the event loop submits the sends
+// and collects the accepted connections and the received data
+/**
+ * @brief Stops or resumes the accepts on the listener, so that the new connections wait in the listen queue
+ *
+ * The multishot accept is cancelled, and the connections it has already accepted wait to be registered.
+ *
+ * @param context pointer to the context of the worker
+ * @param paused true to stop accepting, false to resume
+ */
+void uring_pause_accepts(Context *context, bool paused)
+{
+    UringState *state = context->io_state;
+    state->accepts_paused = paused;
+    if (paused && state->accept_armed)
+        uring_cancel(context, URING_ACCEPT);
+    else if (!paused && !state->accept_armed && !state->quiescing)
+        uring_arm_accept(context);
+}
+
+const IoBackend uring_backend = {"io_uring", uring_init, uring_watch, uring_unwatch, uring_wait, uring_is_ready,
+                                 uring_accept, uring_receive, uring_flush, uring_destroy, uring_quiesce,
+                                 uring_pause_accepts};
+
+#else
+
+/**
+ * @brief Tells if the kernel supports the io_uring features used by the backend, never without the kernel headers
+ */
+bool uring_supported()
+{
+    return false;
+}
+
+// Placeholder of the io_uring backend, never selected since uring_supported returns false
+const IoBackend uring_backend = {"io_uring"};
+
+#endif
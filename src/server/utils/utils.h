@@ -9,7 +9,13 @@
 #include <string.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <pthread.h>
+#include <sys/socket.h>
 #include "../../common/common.h"
+#include "../../common/probes.h"
+#include "../../common/flight.h"
+#include "../../common/wal.h"
+#include "../../common/shm.h"
 
 /**
  * @brief Indicates the state of a given Client
@@ -21,9 +27,60 @@ typedef enum ClientState
     LOGIN,          /**< The client is logging in. */
     LOGGED_IN,      /**< The client has successfully logged in. */
     SELECTING_QUIZ, /**< The client is selecting a quiz. */
-    PLAYING         /**< The client is participating in a quiz. */
+    PLAYING,        /**< The client is participating in a quiz. */
+    SPECTATING,     /**< The client follows the rankings of quizzes without playing. */
+    CLIENT_STATES_COUNT /**< Number of client states, not a valid state. */
 } ClientState;
 
+/**
+ * @brief Classes of requests whose rate is limited for each client
+ */
+typedef enum RateClass
+{
+    RATE_ANSWERS,      /**< Answers to the questions of the quizzes. */
+    RATE_RANKINGS,     /**< Requests of the rankings, answered from a cache beyond the limit. */
+    RATE_QUIZ_LISTS,   /**< Requests of the list of quizzes. */
+    RATE_NICKNAMES,    /**< Nicknames proposed and sessions resumed, the attempts to log in. */
+    RATE_CLASSES_COUNT /**< Number of classes, not a valid class. */
+} RateClass;
+
+struct Context;
+struct Timer;
+
+/**
+ * @brief Function invoked by the timer wheel when a timer expires
+ */
+typedef void (*TimerCallback)(struct Timer *timer, struct Context *context);
+
+/**
+ * @brief Timer of the timer wheel of a worker
+ *
+ * The timer is embedded in the structure it refers to and linked in a slot of the wheel, so scheduling
+ * and cancelling it never allocate memory.
+ */
+typedef struct Timer
+{
+    struct Timer *next;     /**< Next timer of the same slot. */
+    struct Timer **pprev;   /**< Link pointing to this timer, NULL if the timer is not scheduled. */
+    uint64_t expires;       /**< Tick of the wheel at which the timer expires. */
+    unsigned int slot;      /**< Index of the slot containing the timer, counting the slots of all the levels. */
+    TimerCallback callback; /**< Function invoked when the timer expires. */
+    void *data;             /**< Structure the timer refers to. */
+} Timer;
+
+struct Client;
+struct QuizzesInfo;
+
+/**
+ * @brief Encoders of the binary payloads of a version of the protocol, selected for each client by the negotiation
+ */
+typedef struct ProtocolCodec
+{
+    uint8_t version;                                                           /**< Version of the protocol. */
+    size_t (*encode_ranking)(struct Context *context);                         /**< Serializes the ranking of every quiz in the ranking buffer. */
+    const char *(*quiz_list)(struct QuizzesInfo *quizzesInfo, size_t *length); /**< Returns the serialized list of quizzes. */
+} ProtocolCodec;
+
 /**
  * @brief Represents a client connected to the server
  *
@@ -33,11 +90,34 @@ typedef enum ClientState
  */
 typedef struct Client
 {
+    uint32_t id;                          /**< Unique identifier of the connection. */
     int socket_fd;                        /**< File descriptor of the client's socket. */
     char *nickname;                       /**< Client's nickname. */
     ClientState state;                    /**< Current state of the client. */
     struct RankingNode **client_rankings; /**< Array of the client's rankings in each available quiz. */
+    char *input_buffer;                   /**< Buffer reused to receive the payloads of the client's messages. */
+    size_t input_buffer_size;             /**< Allocated size of the input buffer. */
     unsigned int current_quiz_id;         /**< ID of the quiz in which the client is participating. (-1 if not participating in any quiz) */
+    Timer idle_timer;                     /**< Disconnects the client if it does not log in, or stays silent, for too long. */
+    Timer question_timer;                 /**< Deadline to answer the current question, if enabled. */
+    Timer throttle_timer;                 /**< Resumes the requests of the client delayed by their rate limit. */
+    uint64_t rate_full_ns[RATE_CLASSES_COUNT]; /**< Time at which the bucket of each class of requests is full again, see take_rate_token. */
+    bool throttled;                       /**< The next request of the client is delayed by its rate limit. */
+    bool waiting;                         /**< The client is in the waiting room of its overloaded worker. */
+    struct Client *waiting_prev;          /**< Previous client of the waiting room. */
+    struct Client *waiting_next;          /**< Next client of the waiting room, admitted after this one. */
+    bool live;                            /**< The client is in the live round roster of its current quiz. */
+    unsigned int live_backlog;            /**< Live questions delivered to the client and not yet responded to. */
+    uint32_t live_round;                  /**< Sequence number of the last live round whose question was delivered to the client. */
+    uint32_t live_answered;               /**< Sequence number of the last live round the client has answered. */
+    struct Client *live_prev;             /**< Previous participant of the same live quiz on the worker. */
+    struct Client *live_next;             /**< Next participant of the same live quiz on the worker. */
+    int *spectator_slots;                 /**< Position of the spectator in the spectator list of each quiz, -1 if not subscribed; NULL for the players. */
+    int subscriber_slot;                  /**< Position of the client in the ranking subscribers of its worker, -1 if not subscribed. */
+    Capabilities capabilities;            /**< Capabilities negotiated with the client, see handle_hello. */
+    uint8_t session_token[SESSION_TOKEN_SIZE]; /**< Token with which the client can resume its session after a disconnection. */
+    bool resumable;                       /**< A token has been issued and the session is kept if the connection drops. */
+    const ProtocolCodec *codec;           /**< Encoders of the version of the protocol negotiated with the client. */
     struct Client *prev_node;             /**< Pointer to the previous client in the client list. */
     struct Client *next_node;             /**< Pointer to the next client in the list. */
 } Client;
@@ -56,6 +136,9 @@ typedef struct ClientsInfo
     struct Client *clients_tail;    /**< Pointer to the last client in the list. */
     unsigned int connected_clients; /**< Total number of currently connected clients. */
     int max_fd;                     /**< Maximum file descriptor value among the clients. */
+    bool max_fd_stale;              /**< The client with the maximum file descriptor has been released, so it must be recomputed. */
+    struct Client *closing_head;    /**< Clients disconnected during the current iteration, released at its end and linked by next_node. */
+    uint32_t next_client_id;        /**< Identifier assigned to the next accepted connection. */
 } ClientsInfo;
 
 /**
@@ -71,21 +154,89 @@ typedef struct QuizQuestion
     int total_answers; /**< Total number of possible answers. */
 } QuizQuestion;
 
+/**
+ * @brief Immutable copy of the ranking of a quiz, published by the owner of the quiz
+ *
+ * The data contains the ranking serialized as in the MSG_RES_RANKING payload of the version 1 protocol,
+ * (number of users) [(name length) (name) (score)], limited to the first UINT16_MAX users, then the whole ranking
+ * encoded with varints for the version 2 protocol, (number of users) [(name length) (name) (score)],
+ * followed by one completion flag for each user and by the number of users above each score.
+ */
+typedef struct RankingSnapshot
+{
+    int references;         /**< References released after the snapshot has been replaced, see snapshots.c. */
+    uint32_t total_clients; /**< Number of clients in the ranking. */
+    uint32_t version;       /**< Version of the ranking, see Quiz. */
+    size_t length;          /**< Length of the serialized ranking of the version 1 protocol. */
+    char *compact;          /**< Ranking encoded for the version 2 protocol. */
+    size_t compact_length;  /**< Length of the ranking encoded for the version 2 protocol. */
+    char *completed;        /**< Completion flag of each client, in ranking order. */
+    uint32_t *higher;       /**< Number of clients with a higher score, for each score up to the number of questions. */
+    uint16_t max_score;     /**< Highest score indexing the higher array. */
+    char data[];            /**< Serialized rankings followed by the completion flags. */
+} RankingSnapshot;
+
+/**
+ * @brief Phase of the live game of a quiz
+ */
+typedef enum LivePhase
+{
+    LIVE_IDLE,    /**< No game is running: the first participant starts the lobby. */
+    LIVE_LOBBY,   /**< The game starts when the lobby closes, leaving time to the other players to join. */
+    LIVE_OPEN,    /**< A question has been broadcast and the answers are collected until the deadline. */
+    LIVE_RESULTS  /**< The results of the round have been broadcast, the next question follows shortly. */
+} LivePhase;
+
+/**
+ * @brief Live game of a quiz played in synchronized rounds
+ *
+ * The game is run by the owner of the quiz, which broadcasts each question to all the participants, closes the
+ * round at the deadline and broadcasts its results. Only the round word is read by the other workers,
+ * to accept the answers of their clients while the round is open.
+ */
+typedef struct LiveRound
+{
+    uint64_t round_word;  /**< Sequence number of the open round in the high half, index of its question plus one in the low half (0 when closed). */
+    uint32_t sequence;    /**< Sequence number of the last round opened, used by the owner only. */
+    uint16_t question;    /**< Index of the next question to broadcast, used by the owner only. */
+    LivePhase phase;      /**< Current phase of the game, used by the owner only. */
+    Timer timer;          /**< Timer of the owner ending the current phase. */
+} LiveRound;
+
 /**
  * @brief Contains information related to a quiz
  *
  * This structure contains information regarding a quiz,
  * including the name, the questions, and pointers to the head and tail of the doubly linked list
  * representing the quiz ranking.
+ *
+ * The ranking list is owned by exactly one worker, the only one allowed to modify and read it:
+ * the other workers submit their changes to the owner through its ranking queue
+ * and read the snapshots the owner publishes.
  */
 typedef struct Quiz
 {
+    uint16_t id;                      /**< Index of the quiz in the array of available quizzes. */
     char *name;                       /**< Name of the quiz. */
     QuizQuestion **questions;         /**< Array of pointers to the quiz questions. */
     uint16_t total_questions;         /**< Total number of questions in the quiz. */
-    uint16_t total_clients;           /**< Number of clients in the ranking. */
+    uint32_t total_clients;           /**< Number of clients in the ranking. */
     struct RankingNode *ranking_head; /**< Pointer to the head of the ranking list. */
     struct RankingNode *ranking_tail; /**< Pointer to the tail of the ranking list. */
+    struct Context *owner;            /**< Worker that owns the ranking of the quiz. */
+    bool snapshot_stale;              /**< The ranking has changed since the last snapshot, used by the owner only. */
+    uint64_t snapshot_word;           /**< Current RankingSnapshot and number of readers holding it, see snapshots.c. */
+    LiveRound *live;                  /**< Live game of the quiz, NULL if the quiz is played at each client's pace. */
+    unsigned int spectators;          /**< Spectators of the quiz connected to all the workers, updated atomically. */
+    Timer spectator_timer;            /**< Timer of the owner pushing the changed ranking to the spectators. */
+    uint64_t spectator_update_ns;     /**< Time of the last ranking pushed to the spectators, used by the owner only. */
+    uint32_t ranking_version;         /**< Number of snapshots published, which identifies the version of the ranking. */
+    char *delta_left;                 /**< Nicknames removed since the last snapshot, serialized as (length) (name), used by the owner only. */
+    size_t delta_left_length;         /**< Length of the removed nicknames. */
+    size_t delta_left_capacity;       /**< Allocated size of the removed nicknames. */
+    uint16_t delta_left_count;        /**< Number of removed nicknames. */
+    unsigned int delta_batches;       /**< Changes pushed to the subscribers, a full ranking being pushed periodically instead. */
+    uint32_t recovered_players;       /**< Nodes of the ranking replayed from the write-ahead log, whose clients are gone. */
 } Quiz;
 
 /**
@@ -96,49 +247,653 @@ typedef struct Quiz
  */
 typedef struct QuizzesInfo
 {
-    Quiz **quizzes;         /**< Array of pointers to the available quizzes. */
-    uint16_t total_quizzes; /**< Total number of available quizzes. */
+    Quiz **quizzes;              /**< Array of pointers to the available quizzes. */
+    uint16_t total_quizzes;      /**< Total number of available quizzes. */
+    char *quiz_list_payload;     /**< Serialized list of quizzes, built when the quizzes are loaded. */
+    size_t quiz_list_length;     /**< Length of the serialized list of quizzes. */
+    char *quiz_list_compact;     /**< List of quizzes encoded for the version 2 protocol. */
+    size_t quiz_list_compact_length; /**< Length of the list of quizzes encoded for the version 2 protocol. */
+    unsigned int subscribers;    /**< Clients subscribed to the ranking changes on all the workers, updated atomically. */
 } QuizzesInfo;
 
+// Number of buckets of the nickname registry
+#define NICKNAME_BUCKETS 16384
+// Number of locks protecting the buckets of the nickname registry
+#define NICKNAME_LOCK_STRIPES 64
+
+/**
+ * @brief Nickname stored in the registry
+ */
+typedef struct NicknameEntry
+{
+    char *nickname;             /**< Nickname in use. */
+    struct NicknameEntry *next; /**< Next entry of the same bucket. */
+} NicknameEntry;
+
+/**
+ * @brief Registry of the nicknames in use, shared by all the workers
+ *
+ * The nicknames are kept in a hash table with a fixed number of buckets. Each lock protects the buckets
+ * whose index is congruent to it modulo NICKNAME_LOCK_STRIPES, so logins handled by different workers
+ * rarely wait for each other.
+ */
+typedef struct NicknameRegistry
+{
+    NicknameEntry *buckets[NICKNAME_BUCKETS];     /**< Chains of the entries of each bucket. */
+    pthread_mutex_t locks[NICKNAME_LOCK_STRIPES]; /**< Locks of the buckets. */
+    unsigned int total_nicknames;                 /**< Number of nicknames in use, updated atomically. */
+} NicknameRegistry;
+
+// Number of buckets of the session registry
+#define SESSION_BUCKETS 16384
+// Number of locks protecting the buckets of the session registry
+#define SESSION_LOCK_STRIPES 64
+
+/**
+ * @brief Session of a player whose connection dropped, kept until it is resumed or its grace period expires
+ *
+ * The session is linked both in a bucket of the registry, where it is found by its token, and in the list of
+ * the sessions parked by a worker, in order of expiration. A resumed session is only unlinked from its bucket:
+ * the worker that parked it deallocates it when it expires.
+ */
+typedef struct ParkedSession
+{
+    uint8_t token[SESSION_TOKEN_SIZE];    /**< Token presented by the client to resume the session. */
+    char *nickname;                       /**< Nickname of the player, still reserved in the nickname registry. */
+    struct RankingNode **client_rankings; /**< Nodes of the player in the rankings of each quiz, still ranked. */
+    unsigned int current_quiz_id;         /**< Quiz the player was playing. */
+    ClientState state;                    /**< State of the player when the connection dropped. */
+    uint64_t expires_ns;                  /**< Time at which the session expires. */
+    bool resumed;                         /**< The session has been taken by a new connection, under the lock of its bucket. */
+    struct ParkedSession *next;           /**< Next session of the same bucket. */
+    struct ParkedSession *next_parked;    /**< Next session parked by the same worker, expiring later. */
+} ParkedSession;
+
+/**
+ * @brief Registry of the sessions waiting to be resumed, shared by all the workers
+ *
+ * The sessions are kept in a hash table indexed by their random token, so a client reconnecting to any worker
+ * finds its session in constant time. The locks are striped as in the NicknameRegistry.
+ */
+typedef struct SessionRegistry
+{
+    ParkedSession *buckets[SESSION_BUCKETS];     /**< Chains of the sessions of each bucket. */
+    pthread_mutex_t locks[SESSION_LOCK_STRIPES]; /**< Locks of the buckets. */
+    unsigned int parked;                         /**< Number of sessions waiting to be resumed, updated atomically. */
+    uint64_t resumed;                            /**< Number of sessions resumed, updated atomically. */
+    uint64_t expired;                            /**< Number of sessions expired, updated atomically. */
+} SessionRegistry;
+
 /**
  * @brief Node of the ranking list for a quiz
  *
  * This structure represents a node in the doubly linked ranking list of quiz participants,
  * containing information about the client, the score, the quiz completion status,
  * and pointers to the previous and next nodes in the list.
+ *
+ * The node is shared by two workers: current_question and correct_answers are only used by the worker
+ * of the client, while the other fields belong to the owner of the quiz once the node has been inserted.
+ * The nickname is copied, since the client may be deallocated before the owner removes the node.
  */
 typedef struct RankingNode
 {
-    Client *client;                /**< Pointer to the client associated with this node. */
-    uint16_t score;                /**< Score obtained by the client in the quiz. */
-    bool is_quiz_completed;        /**< Indicates if the client has completed the quiz. */
-    unsigned int current_question; /**< ID of the question the client needs to answer. */
-    struct RankingNode *prev_node; /**< Pointer to the previous node in the ranking list. */
-    struct RankingNode *next_node; /**< Pointer to the next node in the ranking list. */
+    char *nickname;                   /**< Nickname of the client associated with this node. */
+    uint16_t score;                   /**< Score obtained by the client in the quiz, as known by the owner. */
+    bool is_quiz_completed;           /**< Indicates if the client has completed the quiz. */
+    unsigned int current_question;    /**< ID of the question the client needs to answer. */
+    uint16_t correct_answers;         /**< Correct answers given by the client, as known by its worker. */
+    uint16_t round_score;             /**< Score at the end of the previous live round, used by the owner only. */
+    uint32_t changed_version;         /**< Version of the ranking in which the node was last inserted or moved, used by the owner only. */
+    bool recovered;                   /**< The node was replayed from the write-ahead log and has no client. */
+    struct RankingNode *prev_node;    /**< Pointer to the previous node in the ranking list. */
+    struct RankingNode *next_node;    /**< Pointer to the next node in the ranking list. */
+    struct RankingNode *next_removed; /**< Next node removed from the same ranking in the current iteration, used by the worker of the client. */
 } RankingNode;
 
 /**
- * @brief Global context of the server application
+ * @brief Kind of change submitted to the owner of a quiz ranking
+ */
+typedef enum RankingEventKind
+{
+    RANKING_INSERT,      /**< A client has started the quiz: the node is inserted at the tail of the ranking. */
+    RANKING_SCORE,       /**< The score of a client has changed: the node is repositioned. */
+    RANKING_COMPLETE,    /**< A client has completed the quiz. */
+    RANKING_REMOVE,      /**< A client has disconnected: the node is removed and deallocated. */
+    LIVE_QUESTION,       /**< The owner asks the worker to deliver a live question to its participants. */
+    LIVE_RESULTS_OUT,    /**< The owner asks the worker to deliver the results of a live round to its participants. */
+    LIVE_END,            /**< The owner asks the worker to deliver the end of the live game and release its participants. */
+    SPECTATOR_UPDATE,    /**< The owner asks the worker to deliver the ranking of a quiz to its spectators. */
+    RANKING_DELTA_OUT,   /**< The owner asks the worker to deliver the changes of the ranking of a quiz to its subscribers. */
+    RANKING_REMOVE_BATCH /**< Clients have disconnected: the nodes linked by next_removed are removed and deallocated. */
+} RankingEventKind;
+
+/**
+ * @brief Frame serialized once and referenced by the output of many connections
+ *
+ * The frame is deallocated when the last reference is released; the references are counted atomically,
+ * since the connections referencing a broadcast frame belong to different workers.
+ */
+typedef struct SharedFrame
+{
+    unsigned int references; /**< Number of references to the frame. */
+    uint32_t key;            /**< Frames with the same non-zero key replace each other in the output not yet sent. */
+    size_t length;           /**< Length of the frame, header included. */
+    char data[];             /**< Header and payload of the frame. */
+} SharedFrame;
+
+/**
+ * @brief Change submitted to the owner of a quiz ranking
+ */
+typedef struct RankingEvent
+{
+    RankingNode *node;     /**< Node the change refers to. */
+    SharedFrame *frame;    /**< Frame to deliver, for the live events; the event holds one of its references. */
+    uint16_t quiz_id;      /**< Quiz whose ranking contains the node. */
+    uint16_t score;        /**< New score of the node, for RANKING_SCORE. */
+    RankingEventKind kind; /**< Kind of change. */
+} RankingEvent;
+
+// Number of events that can be waiting in the ranking queue of a worker, must be a power of two
+#define RANKING_QUEUE_CAPACITY 4096
+// Size of a cache line, used to keep the producer and consumer indexes of a queue apart
+#define CACHE_LINE_SIZE 64
+
+/**
+ * @brief Slot of a ranking queue
+ */
+typedef struct RankingQueueSlot
+{
+    size_t sequence;    /**< Position the slot is ready for, see queues.c. */
+    RankingEvent event; /**< Event stored in the slot. */
+} RankingQueueSlot;
+
+/**
+ * @brief Bounded lock-free queue with many producers and a single consumer
+ *
+ * Every worker receives the changes to the rankings it owns through its queue.
+ */
+typedef struct RankingQueue
+{
+    RankingQueueSlot *slots;              /**< Ring of slots. */
+    size_t mask;                          /**< Number of slots minus one. */
+    char padding_head[CACHE_LINE_SIZE];   /**< Keeps head on a different cache line than the fields above. */
+    size_t head;                          /**< Position of the next event to consume, used by the consumer only. */
+    char padding_tail[CACHE_LINE_SIZE];   /**< Keeps tail on a different cache line than head. */
+    size_t tail;                          /**< Position of the next slot to fill, shared by the producers. */
+    char padding_end[CACHE_LINE_SIZE];    /**< Keeps tail on a different cache line than the following fields. */
+} RankingQueue;
+
+/**
+ * @brief Allocation counters of a scope of the server
+ */
+typedef struct AllocStats
+{
+    uint64_t allocations; /**< Number of calls to malloc, calloc and realloc. */
+    uint64_t frees;       /**< Number of calls to free with a non-NULL pointer. */
+    uint64_t bytes;       /**< Total number of bytes requested. */
+} AllocStats;
+
+// Scope of the allocations not performed by a message handler
+#define ALLOC_SCOPE_OTHER MSG_TYPES_COUNT
+// Number of scopes to which allocations are attributed
+#define ALLOC_SCOPES_COUNT (MSG_TYPES_COUNT + 1)
+
+// Duration of a tick of the timer wheels
+#define TIMER_TICK_MS 10
+// Number of bits of the tick selecting the slot of a level of the timer wheels
+#define TIMER_LEVEL_BITS 6
+// Number of slots of each level of the timer wheels
+#define TIMER_SLOTS (1 << TIMER_LEVEL_BITS)
+// Number of levels of the timer wheels, covering TIMER_SLOTS^TIMER_LEVELS ticks (about 46 hours)
+#define TIMER_LEVELS 4
+
+/**
+ * @brief Hierarchical timer wheel of a worker
+ *
+ * Level 0 has a slot for each of the next TIMER_SLOTS ticks, while each slot of the higher levels covers
+ * TIMER_SLOTS times the span of a slot of the level below: its timers are moved to the lower levels
+ * when the wheel reaches the span of the slot. Scheduling, cancelling and expiring a timer are O(1),
+ * and the bitmaps of the occupied slots give the time of the next expiration without scanning the timers.
+ */
+typedef struct TimerWheel
+{
+    Timer *slots[TIMER_LEVELS][TIMER_SLOTS]; /**< Lists of the timers of each slot. */
+    uint64_t occupied[TIMER_LEVELS];         /**< Bitmap of the non-empty slots of each level. */
+    uint64_t current_tick;                   /**< Last tick processed. */
+    uint64_t start_ns;                       /**< Time corresponding to tick 0. */
+    uint64_t pending;                        /**< Number of scheduled timers, read by the dashboard. */
+    uint64_t expired;                        /**< Number of expired timers, read by the dashboard. */
+} TimerWheel;
+
+/**
+ * @brief Timeouts applied by a worker to its clients, in milliseconds, 0 if disabled
+ */
+typedef struct Timeouts
+{
+    unsigned int login_ms;    /**< Time given to a new client to choose a valid nickname. */
+    unsigned int idle_ms;     /**< Time after which a silent client is disconnected. */
+    unsigned int question_ms; /**< Time given to answer each question. */
+    unsigned int round_ms;    /**< Time given to answer the questions of the live quizzes, and duration of their lobby. */
+    unsigned int update_ms;   /**< Minimum interval between two rankings of a quiz pushed to the spectators. */
+    unsigned int resume_ms;   /**< Time for which the session of a dropped player can be resumed, 0 to disable the resumption. */
+} Timeouts;
+
+/**
+ * @brief Rate at which a client can send the requests of a class
+ */
+typedef struct RateLimit
+{
+    uint32_t rate;  /**< Requests per second, 0 if unlimited. */
+    uint32_t burst; /**< Requests that can be sent at once after a pause. */
+} RateLimit;
+
+/**
+ * @brief Limits applied by a worker to the resources used by each of its clients, 0 if disabled
+ */
+typedef struct ClientLimits
+{
+    size_t memory_budget;                 /**< Memory a client can use for its connection buffers, its output and its nickname. */
+    RateLimit rates[RATE_CLASSES_COUNT];  /**< Rate of each class of requests. */
+} ClientLimits;
+
+/**
+ * @brief Memory used by the clients of a worker, measured periodically, and the clients disconnected for abusing it
+ */
+typedef struct MemoryStats
+{
+    uint64_t bytes[CLIENT_STATES_COUNT];   /**< Memory used by the clients in each state at the last measurement. */
+    uint32_t clients[CLIENT_STATES_COUNT]; /**< Clients in each state at the last measurement. */
+    uint64_t oversized;                    /**< Clients disconnected for announcing a frame larger than allowed. */
+    uint64_t over_budget;                  /**< Clients disconnected for exceeding their memory budget. */
+} MemoryStats;
+
+/**
+ * @brief Ranking of every quiz serialized for a version of the protocol, sent to the clients over their rate limit
+ */
+typedef struct RankingCache
+{
+    SharedFrame *frame; /**< MSG_RES_RANKING frame, NULL until the first request over the limit. */
+    uint64_t built_ns;  /**< Time at which the frame has been serialized. */
+} RankingCache;
+
+/**
+ * @brief Stages in which an overloaded worker sheds load, each one including the previous ones
+ */
+typedef enum OverloadStage
+{
+    OVERLOAD_NONE,            /**< The worker keeps up with its clients. */
+    OVERLOAD_CACHED_RANKINGS, /**< The rankings are only sent from the cache, and the dashboard is refreshed less often. */
+    OVERLOAD_WAITING_ROOM,    /**< The new clients wait in the waiting room before being asked for a nickname. */
+    OVERLOAD_ACCEPTS_PAUSED,  /**< The new connections are left in the listen queue. */
+    OVERLOAD_STAGES_COUNT     /**< Number of stages, not a valid stage. */
+} OverloadStage;
+
+/**
+ * @brief Signals above which a worker enters a stage of overload, 0 if the signal is not used
+ */
+typedef struct OverloadThreshold
+{
+    uint32_t lag_us;      /**< Smoothed duration of the iterations of the event loop, in microseconds. */
+    uint32_t queue_depth; /**< Ranking events waiting for the worker and connections waiting for space in the kernel buffers. */
+} OverloadThreshold;
+
+/**
+ * @brief Overload controller of a worker: the signals it watches, its stage and its waiting room
+ */
+typedef struct OverloadState
+{
+    OverloadThreshold thresholds[OVERLOAD_STAGES_COUNT]; /**< Thresholds of each stage, the first one is not used. */
+    OverloadStage stage;                     /**< Current stage, read by the main thread. */
+    uint64_t lag_ns;                         /**< Smoothed duration of the iterations, read by the dashboard. */
+    uint64_t queue_depth;                    /**< Queue depth at the last iteration, read by the dashboard. */
+    uint64_t changed_ns;                     /**< Time of the last change of stage. */
+    uint64_t updated_ns;                     /**< Time of the last update of the signals. */
+    uint64_t entered[OVERLOAD_STAGES_COUNT]; /**< Times each stage has been entered, read by the dashboard. */
+    uint64_t cached_rankings;                /**< Rankings sent from the cache because of the overload, read by the dashboard. */
+    struct Client *waiting_head;             /**< First client of the waiting room, the next one admitted. */
+    struct Client *waiting_tail;             /**< Last client of the waiting room. */
+    uint32_t total_waiting;                  /**< Clients in the waiting room, read by the dashboard. */
+    uint64_t admitted;                       /**< Clients admitted from the waiting room, read by the dashboard. */
+    Timer waiting_timer;                     /**< Sends their position to the clients of the waiting room. */
+} OverloadState;
+
+// Maximum number of connections accepted by a worker in a single iteration, so that a burst does not starve its clients
+#define ACCEPT_BUDGET 64
+// Maximum number of clients admitted from the waiting room in a single iteration, so that the overload does not come back at once
+#define ADMISSION_BUDGET 16
+// Minimum free space made available in the input buffer of a connection before receiving
+#define RECEIVE_CHUNK_SIZE 4096
+// Maximum number of buffers passed to the kernel by a single send of a connection
+#define SEND_IOV_MAX 16
+
+/**
+ * @brief Shared frame inserted in the output of a connection
+ */
+typedef struct SharedSegment
+{
+    SharedFrame *frame; /**< Frame to send, of which the connection holds a reference. */
+    size_t position;    /**< Position in the private output before which the frame is sent. */
+} SharedSegment;
+
+/**
+ * @brief Buffers of a client connection of the server
+ *
+ * The data received on the socket is accumulated in the input buffer, from which the frames are handed out
+ * only once they are complete, while the frames sent during an iteration of the event loop are coalesced
+ * in the output buffer and sent together at the end of the iteration.
+ * The frames being sent by the kernel are moved to a separate buffer, which is never reallocated while in use.
+ * The broadcast frames are not copied: the output records a reference to the shared frame and its position
+ * among the private frames, and the kernel gathers the pieces with a single vectored send.
+ */
+typedef struct Connection
+{
+    int fd;                          /**< File descriptor of the socket. */
+    struct Context *worker;          /**< Worker handling the connection. */
+    char *input;                     /**< Data received and not yet consumed. */
+    size_t input_offset;             /**< Position of the first byte not yet consumed. */
+    size_t input_length;             /**< Number of valid bytes in the input buffer. */
+    size_t input_capacity;           /**< Allocated size of the input buffer. */
+    size_t frame_remaining;          /**< Bytes of the frame being consumed that have not been read yet. */
+    char *output;                    /**< Frames sent by the handlers and not yet passed to the kernel. */
+    size_t output_length;            /**< Number of valid bytes in the output buffer. */
+    size_t output_capacity;          /**< Allocated size of the output buffer. */
+    char *sending;                   /**< Frames passed to the kernel. */
+    size_t sending_offset;           /**< Position of the first byte not yet accepted by the kernel, counting the shared frames. */
+    size_t sending_length;           /**< Number of valid bytes in the sending buffer. */
+    size_t sending_capacity;         /**< Allocated size of the sending buffer. */
+    size_t sending_total;            /**< Number of bytes to send, including the shared frames. */
+    SharedSegment *shared;           /**< Shared frames inserted in the output buffer. */
+    size_t shared_count;             /**< Number of shared frames in the output buffer. */
+    size_t shared_capacity;          /**< Allocated size of the array of the shared frames of the output. */
+    SharedSegment *sending_shared;   /**< Shared frames of the sending buffer. */
+    size_t sending_shared_count;     /**< Number of shared frames of the sending buffer. */
+    size_t sending_shared_capacity;  /**< Allocated size of the array of the shared frames being sent. */
+    struct iovec iov[SEND_IOV_MAX];  /**< Pieces of the send in flight, when the backend sends asynchronously. */
+    struct msghdr message;           /**< Message of the send in flight, referencing iov. */
+    bool flush_queued;               /**< The connection is in the flush list of its worker. */
+    bool send_in_flight;             /**< A send submitted to the kernel has not completed yet. */
+    bool ready;                      /**< Data or an error has been received, or reported by epoll, since the last receive. */
+    bool write_blocked;              /**< The epoll backend waits for the socket to become writable to send the rest of the output. */
+    bool closed;                     /**< The peer has closed the connection. */
+    int error;                       /**< Error of the last operation on the socket, 0 if none. */
+    unsigned int operations;         /**< Asynchronous operations of the kernel still referencing the connection. */
+    bool released;                   /**< The connection has been closed and is deallocated once operations is 0. */
+    struct Connection *next_flush;   /**< Next connection in the flush list, or in the list of released connections. */
+} Connection;
+
+/**
+ * @brief Counters of the I/O performed by a worker
+ */
+typedef struct IoStats
+{
+    uint64_t syscalls;   /**< System calls issued to wait, accept, receive and send. */
+    uint64_t frames_in;  /**< Frames received from the clients. */
+    uint64_t frames_out; /**< Frames sent to the clients. */
+    uint64_t accepted;   /**< Connections accepted on the listener. */
+    uint64_t deferred;   /**< Iterations in which the accept budget left connections in the listen queue. */
+    uint64_t rejected;   /**< Connections closed at once, since their descriptor could not be monitored by select. */
+} IoStats;
+
+/**
+ * @brief Backend used by the event loop to wait for activity on the sockets and to exchange data with the clients
+ *
+ * The backend keeps track of the file descriptors to monitor and tells the event loop of a worker which of them are ready;
+ * it moves the received data to the input buffers of the connections and sends the output buffers.
+ * The server uses the io_uring backend when supported by the kernel and the epoll one otherwise, unless another is requested,
+ * while the simulation harness installs a backend that never touches the kernel, since its connections are not real sockets.
+ */
+typedef struct IoBackend
+{
+    const char *name;                                  /**< Name of the backend. */
+    void (*init)(struct Context *context);             /**< Initializes the state of the backend from the worker thread, monitoring the listener and the wake-up descriptor. */
+    void (*watch)(struct Context *context, int fd);    /**< Starts monitoring the socket of a client. */
+    void (*unwatch)(struct Context *context, int fd);  /**< Stops monitoring the socket of a client, before it is closed. */
+    int (*wait)(struct Context *context, int timeout_ms); /**< Waits for activity for at most timeout_ms (-1 for no limit), returns the number of ready descriptors, 0 on timeout, or -1. */
+    bool (*is_ready)(struct Context *context, int fd); /**< Tells if a descriptor is ready after the last wait. */
+    int (*accept)(struct Context *context);            /**< Returns a connection accepted on the listener, or -1 with errno set to EAGAIN if none is left. */
+    void (*receive)(struct Context *context, int fd);  /**< Moves the data received on the socket of a client to its input buffer. */
+    void (*flush)(struct Context *context);            /**< Sends the output buffered on the connections of the worker. */
+    void (*destroy)(struct Context *context);          /**< Deallocates the state of the backend. */
+    bool (*quiesce)(struct Context *context);          /**< Stops accepting and receiving and completes the operations in flight, before the connections are handed over; returns true if accepted connections are left to register. */
+    void (*pause_accepts)(struct Context *context, bool paused); /**< Stops or resumes accepting, the new connections waiting in the listen queue meanwhile. */
+} IoBackend;
+
+/**
+ * @brief Spectators of a quiz connected to a worker
+ */
+typedef struct SpectatorList
+{
+    Client **clients; /**< Array of the spectators, each storing its position in spectator_slots. */
+    size_t count;     /**< Number of spectators. */
+    size_t capacity;  /**< Allocated size of the array. */
+} SpectatorList;
+
+/**
+ * @brief Strings of a frame of the version 2 protocol, each stored once and referenced by its index
+ *
+ * The strings are encoded as in the frame, [(length) (string)], and found through an open addressing table
+ * of their indexes hashed with FNV-1a. The table is kept by the worker and emptied for each frame.
+ */
+typedef struct StringTable
+{
+    char *data;          /**< Encoded strings, in order of insertion. */
+    size_t length;       /**< Length of the encoded strings. */
+    size_t size;         /**< Allocated size of the data. */
+    uint32_t *offsets;   /**< Offset in the data of the characters of each string. */
+    uint32_t *lengths;   /**< Length of each string. */
+    uint32_t count;      /**< Number of strings. */
+    uint32_t capacity;   /**< Allocated size of the offsets and lengths arrays. */
+    uint32_t *slots;     /**< Index + 1 of the string hashed to each slot, 0 if the slot is empty. */
+    uint32_t slot_count; /**< Number of slots, a power of two larger than twice the number of strings. */
+} StringTable;
+
+/**
+ * @brief Records of the write-ahead log appended by a worker and not yet written to the file
+ *
+ * The worker appends to data, while the writer thread swaps it with spare under the lock and writes the records
+ * outside of it, so the worker never waits for the disk.
+ */
+typedef struct WalBuffer
+{
+    pthread_mutex_t lock; /**< Protects data and length from the writer thread. */
+    char *data;           /**< Records appended since the last commit. */
+    size_t length;        /**< Length of the records. */
+    size_t size;          /**< Allocated size of the data. */
+    char *spare;          /**< Buffer written by the writer thread, swapped with data at each commit. */
+    size_t spare_size;    /**< Allocated size of the spare buffer. */
+} WalBuffer;
+
+/**
+ * @brief Nodes rebuilt from the snapshot and the write-ahead log, indexed by nickname and quiz
+ */
+typedef struct RecoveryIndex
+{
+    StringTable names;   /**< Nicknames of the players recovered so far. */
+    RankingNode **nodes; /**< Node of each nickname in each quiz, NULL if not in the ranking. */
+    uint64_t *sequences; /**< Sequence number of the change that set the score of each node, to order ties. */
+    size_t capacity;     /**< Allocated number of nodes and sequence numbers. */
+    uint64_t sequence;   /**< Sequence number of the last change recovered. */
+} RecoveryIndex;
+
+/**
+ * @brief Node of a recovered ranking with the sequence number ordering it among the nodes with the same score
+ */
+typedef struct RecoveredEntry
+{
+    RankingNode *node; /**< Recovered node. */
+    uint64_t sequence; /**< Sequence number of the change that set its score. */
+} RecoveredEntry;
+
+/**
+ * @brief Context of a worker of the server
  *
- * This structure groups all information related to the server's state and allows
+ * Each worker runs its own event loop in a thread, with its own listener socket and the clients it has accepted.
+ * The quizzes and the nickname registry are shared by all the workers.
+ * This structure groups all information related to the worker's state and allows
  * for easy transfer of information through function calls.
  */
 typedef struct Context
 {
-    ClientsInfo clientsInfo; /**< Information about connected clients. */
-    QuizzesInfo quizzesInfo; /**< Information about available quizzes. */
-    fd_set readfds;          /**< Set of file descriptors managed by select with sockets ready for reading. */
-    fd_set masterfds;        /**< Master set of file descriptors. */
-    int server_fd;           /**< File descriptor of the server's listener socket. */
+    unsigned int worker_id;      /**< Index of the worker. */
+    unsigned int total_workers;  /**< Number of workers of the server. */
+    ClientsInfo clientsInfo;     /**< Information about the clients connected to the worker. */
+    QuizzesInfo *quizzesInfo;    /**< Information about available quizzes, shared by the workers. */
+    NicknameRegistry *nicknames; /**< Nicknames in use, shared by the workers. */
+    SessionRegistry *sessions;   /**< Sessions waiting to be resumed, shared by the workers; NULL to disable the resumption. */
+    ParkedSession *parked_head;  /**< Sessions parked by the worker, in order of expiration. */
+    ParkedSession *parked_tail;  /**< Last session parked by the worker. */
+    Timer session_timer;         /**< Expires the first session parked by the worker. */
+    char *ranking_buffer;        /**< Buffer reused to serialize the rankings. */
+    size_t ranking_buffer_size;  /**< Allocated size of the ranking buffer. */
+    char *entries_buffer;        /**< Buffer reused to encode the entries of the rankings of the version 2 protocol. */
+    size_t entries_buffer_size;  /**< Allocated size of the entries buffer. */
+    StringTable strings;         /**< String table reused to encode the rankings of the version 2 protocol. */
+    WalBuffer wal;               /**< Changes to the rankings owned by the worker waiting to be logged. */
+    fd_set readfds;              /**< Set of file descriptors managed by select with sockets ready for reading. */
+    fd_set masterfds;            /**< Master set of file descriptors. */
+    fd_set writefds;             /**< Set of file descriptors managed by select with sockets ready for writing. */
+    fd_set master_writefds;      /**< Sockets whose output is waiting for space in the kernel buffers. */
+    unsigned int blocked_writes; /**< Number of sockets waiting for room in the kernel buffers to send their output. */
+    void *io_state;              /**< Private state of the I/O backend. */
+    Connection *flush_head;      /**< Connections with output to send at the end of the iteration. */
+    IoStats io_stats;            /**< Counters of the I/O performed by the worker, read by the dashboard. */
+    int server_fd;               /**< File descriptor of the worker's listener socket. */
+    int wake_fd;                 /**< Event file descriptor used by other threads to wake the worker up. */
+    bool wake_pending;           /**< A wake-up has been requested and the worker has not consumed its queue yet. */
+    bool stop_requested;         /**< Set by the main thread to stop the event loop. */
+    bool upgrading;              /**< The event loop is stopped to hand the connections over to an upgraded server. */
+    RankingQueue ranking_queue;  /**< Changes submitted by the other workers to the rankings owned by this one. */
+    TimerWheel timers;           /**< Timers of the clients of the worker. */
+    Client **live_rosters;       /**< Participants connected to the worker of the live game of each quiz. */
+    RankingNode **removals;      /**< Nodes removed from the ranking of each quiz in the current iteration, submitted at its end. */
+    struct Context *workers;     /**< Array of the contexts of all the workers, to which the live rounds are broadcast. */
+    SpectatorList *spectators;   /**< Spectators connected to the worker, for each quiz. */
+    Client **subscribers;        /**< Clients connected to the worker subscribed to the ranking changes. */
+    size_t total_subscribers;    /**< Number of subscribers. */
+    size_t subscribers_capacity; /**< Allocated size of the subscribers array. */
+    Timeouts timeouts;           /**< Timeouts applied to the clients of the worker. */
+    ClientLimits limits;         /**< Limits on the resources used by each client of the worker. */
+    Timer memory_timer;          /**< Measures the memory used by the clients and enforces their budget. */
+    MemoryStats memory_stats;    /**< Memory used by the clients of the worker, read by the dashboard. */
+    RankingCache ranking_cache[PROTOCOL_LATEST]; /**< Rankings sent to the clients over their rate limit, per protocol version. */
+    uint64_t throttled[RATE_CLASSES_COUNT]; /**< Requests of each class over the rate limit of their client, read by the dashboard. */
+    OverloadState overload;      /**< Overload controller of the worker. */
+    uint64_t handled_events;     /**< Number of connections and messages handled, read by the dashboard. */
+    const IoBackend *io;         /**< Backend used to wait for activity on the sockets. */
+    pthread_t thread;            /**< Thread running the event loop of the worker. */
 } Context;
 
+/**
+ * @brief Connection handed over by the server being upgraded, registered by its worker when the worker starts
+ */
+typedef struct HandoffConnection
+{
+    Client *client;       /**< Client restored from the handed over state. */
+    unsigned int worker;  /**< Index of the worker of the client. */
+    const char *input;    /**< Data received by the previous server and not consumed yet, pointing into the state. */
+    size_t input_length;  /**< Length of the data not consumed. */
+    const char *output;   /**< Frames the previous server had not sent yet, pointing into the state. */
+    size_t output_length; /**< Length of the frames not sent. */
+} HandoffConnection;
+
+/**
+ * @brief Buffer in which the state handed over to an upgraded server is serialized, or from which it is read
+ *
+ * The state is only exchanged between two processes on the same machine, so the values are encoded as varints
+ * only to keep it compact, in the order described in upgrade.c.
+ */
+typedef struct HandoffBuffer
+{
+    char *data;      /**< Serialized state. */
+    size_t length;   /**< Bytes written, or position of the next byte to read. */
+    size_t capacity; /**< Allocated size when writing, length of the state when reading. */
+    bool truncated;  /**< A read has gone past the end of the state. */
+} HandoffBuffer;
+
+// Magic number opening the header of the state handed over to an upgraded server
+#define HANDOFF_MAGIC "TQUP"
+// Version of the layout of the handed over state
+#define HANDOFF_VERSION 1
+
+/**
+ * @brief Fixed header preceding the descriptors and the state sent to the upgraded server
+ */
+typedef struct HandoffHeader
+{
+    char magic[4];          /**< HANDOFF_MAGIC. */
+    uint32_t version;       /**< HANDOFF_VERSION, changed whenever the layout of the state changes. */
+    uint32_t total_workers; /**< Number of workers of the previous server, whose listeners come first. */
+    uint32_t total_fds;     /**< Number of descriptors sent: the listeners, then the sockets of the clients. */
+    uint64_t state_length;  /**< Length of the serialized state following the descriptors. */
+    uint64_t stopped_ns;    /**< Time at which the previous server stopped its workers, on the monotonic clock. */
+} HandoffHeader;
+
 // Client list
 
 void handle_new_client_connection(Context *context);
+Client *register_client(int client_fd, Context *context);
+void handle_client_disconnection(Client *client, Context *context);
+void release_disconnected_clients(Context *context);
+void request_client_nickname(int client_fd);
 void handle_client(Client *client, Context *context);
+void handle_client_requests(Client *client, Context *context);
+int handle_client_message(Client *client, Message *message, int res, Context *context);
+char *reject_client_request(Client *client, MessageType type);
+void set_client_state(Client *client, ClientState state);
+void ensure_capacity(char **payload, char **pointer, size_t *buffer_size, size_t extra_size);
+void send_quiz_list(Client *client, QuizzesInfo *quizzesInfo);
+void send_ranking(Client *client, Context *context);
+size_t encode_ranking_v1(Context *context);
+void send_client_prompt(Client *client, Context *context);
+bool verify_quiz_answer(char *answer, QuizQuestion *question);
+void advance_quiz(Client *client, Context *context);
+void leave_quiz(Client *client, Context *context);
+void send_quiz_result(Client *client, bool correct, Context *context);
+void arm_question_deadline(Client *client, Context *context);
+void handle_idle_timeout(Timer *timer, Context *context);
+void handle_question_timeout(Timer *timer, Context *context);
+void handle_sent_frame(int fd, MessageType type, const char *payload, size_t payload_length);
+void serialize_quiz_list(QuizzesInfo *quizzesInfo);
 void init_clients_info(ClientsInfo *clientsInfo);
+Client *create_client_node(int client_fd, QuizzesInfo *quizzesInfo);
+void add_client(Client *node, ClientsInfo *clientsInfo);
+void remove_client(Client *node, ClientsInfo *clientsInfo);
+void free_client(Client *node);
 void deallocate_clients(ClientsInfo *clientsInfo);
 
+// Nickname registry
+
+void init_nickname_registry(NicknameRegistry *registry);
+bool claim_nickname(NicknameRegistry *registry, const char *nickname);
+void release_nickname(NicknameRegistry *registry, const char *nickname);
+void list_nicknames(NicknameRegistry *registry);
+void deallocate_nickname_registry(NicknameRegistry *registry);
+
+// Session resumption
+
+void init_session_registry(SessionRegistry *registry);
+size_t session_bucket(const uint8_t *token);
+pthread_mutex_t *session_lock(SessionRegistry *registry, size_t bucket);
+void issue_session_token(Client *client, Context *context);
+bool park_client_session(Client *client, Context *context);
+void link_parked_session(ParkedSession *session, Context *context);
+bool take_parked_session(SessionRegistry *registry, const uint8_t *token, ParkedSession *taken);
+void handle_resume_session(Client *client, Message *msg, Context *context);
+void send_session_resumed(Client *client, Context *context);
+void expire_parked_sessions(Timer *timer, Context *context);
+void release_parked_session(ParkedSession *session, Context *context);
+void deallocate_parked_sessions(Context *context);
+void deallocate_session_registry(SessionRegistry *registry);
+
+// Workers
+
+void init_worker(Context *context, unsigned int worker_id, unsigned int total_workers, QuizzesInfo *quizzesInfo,
+                 NicknameRegistry *nicknames, SessionRegistry *sessions, const IoBackend *io);
+void *run_worker(void *arg);
+void wake_worker(Context *context);
+void stop_worker(Context *context);
+void deallocate_worker(Context *context);
+
 // Quiz
 
 int load_quizzes_from_directory(const char *directory_path, QuizzesInfo *quizzesInfo);
@@ -146,7 +901,7 @@ void deallocate_quizzes(QuizzesInfo *quizzesInfo);
 
 // Dashboard
 
-void show_dashboard(Context *context);
+void show_dashboard(Context *workers, unsigned int total_workers);
 void enable_raw_mode();
 void disable_raw_mode();
 
@@ -156,8 +911,290 @@ RankingNode *create_ranking_node(Client *client);
 void insert_ranking_node(Quiz *quiz, RankingNode *node);
 void list_rankings(Quiz *quiz);
 void list_completed_rankings(Quiz *quiz);
+unsigned int ranking_position(RankingNode *node);
 void update_ranking(RankingNode *node, Quiz *quiz);
 void remove_ranking(RankingNode *node, Quiz *quiz);
+void init_ranking_removals(Context *context);
+void queue_ranking_removal(Context *context, Quiz *quiz, RankingNode *node);
+void submit_ranking_removals(Context *context);
 void deallocate_rankings(Quiz *quiz);
+void submit_ranking_event(Context *context, Quiz *quiz, RankingEventKind kind, RankingNode *node, uint16_t score);
+void post_ranking_event(Context *context, Context *target, const RankingEvent *event);
+bool drain_ranking_events(Context *context);
+void process_ranking_events(Context *context);
+
+// Ranking queues
+
+void init_ranking_queue(RankingQueue *queue, size_t capacity);
+bool push_ranking_event(RankingQueue *queue, const RankingEvent *event);
+bool pop_ranking_event(RankingQueue *queue, RankingEvent *event);
+void deallocate_ranking_queue(RankingQueue *queue);
+size_t ranking_queue_depth(RankingQueue *queue);
+
+// Ranking snapshots
+
+RankingSnapshot *build_ranking_snapshot(Quiz *quiz);
+void publish_ranking_snapshot(Quiz *quiz, RankingSnapshot *snapshot);
+RankingSnapshot *acquire_ranking_snapshot(Quiz *quiz);
+void release_ranking_snapshot(Quiz *quiz, RankingSnapshot *snapshot);
+uint32_t snapshot_rank(RankingSnapshot *snapshot, uint16_t score);
+void discard_ranking_snapshot(Quiz *quiz);
+
+// I/O backends
+
+extern const IoBackend select_backend;
+extern const IoBackend epoll_backend;
+extern const IoBackend uring_backend;
+bool uring_supported();
+bool select_send(Context *context, Connection *connection);
+void select_receive(Context *context, int fd);
+
+// Connections
+
+extern const Transport connection_transport;
+void init_connection_table();
+void deallocate_connection_table();
+Connection *open_connection(Context *context, int fd);
+Connection *find_connection(int fd);
+void release_connection(Connection *connection);
+void free_connection(Connection *connection);
+char *reserve_input(Connection *connection, size_t length);
+void queue_flush(Connection *connection);
+bool take_output(Connection *connection);
+void count_io(uint64_t *counter, uint64_t amount);
+void count_sent_frame(int fd);
+void configure_client_socket(int fd);
+void release_shared_segments(SharedSegment *segments, size_t *count);
+void discard_output(Connection *connection);
+int fill_send_iov(Connection *connection, struct iovec *iov, int max_pieces);
+ssize_t send_pending_output(Connection *connection);
+SharedFrame *allocate_shared_frame(MessageType type, size_t payload_length, unsigned int references);
+SharedFrame *create_shared_frame(MessageType type, const char *payload, size_t payload_length, unsigned int references);
+void release_shared_frame(SharedFrame *frame);
+void send_shared_frame(int fd, SharedFrame *frame);
+size_t connection_memory(Connection *connection);
+bool frame_oversized(Connection *connection);
+int next_frame_type(Connection *connection);
+
+// Client limits
+
+void init_client_limits(ClientLimits *limits);
+uint32_t request_payload_limit(MessageType type);
+size_t client_memory(Client *client, Context *context);
+void check_memory_budget(Connection *connection);
+void start_memory_sweep(Context *context);
+void sweep_client_memory(Timer *timer, Context *context);
+void disconnect_abusive_client(Client *client, int error, Context *context);
+void show_memory_stats(Context *workers, unsigned int total_workers);
+void fill_memory_stats(ShmStats *stats, Context *workers, unsigned int total_workers);
+RateClass request_rate_class(MessageType type);
+uint64_t rate_token_delay(Client *client, RateClass rate_class, Context *context);
+bool take_rate_token(Client *client, RateClass rate_class, Context *context);
+bool throttle_next_request(Client *client, Context *context);
+void resume_throttled_client(Timer *timer, Context *context);
+void handle_ranking_request(Client *client, Context *context);
+void send_cached_ranking(Client *client, Context *context);
+void deallocate_ranking_cache(Context *context);
+bool parse_rate_limit(const char *arg, ClientLimits *limits);
+void show_rate_stats(Context *workers, unsigned int total_workers);
+void fill_rate_stats(ShmStats *stats, Context *workers, unsigned int total_workers);
+
+// Overload control
+
+void init_overload_thresholds(OverloadThreshold *thresholds);
+void init_overload(Context *context);
+bool parse_overload_threshold(const char *arg, OverloadThreshold *thresholds);
+bool overload_signals_above(OverloadThreshold *threshold, uint64_t lag_ns, uint64_t queue_depth, unsigned int divisor);
+void update_overload(Context *context, uint64_t busy_ns);
+void set_overload_stage(Context *context, OverloadStage stage);
+void enter_waiting_room(Client *client, Context *context);
+void leave_waiting_room(Client *client, Context *context);
+void admit_waiting_clients(Context *context, unsigned int count);
+void send_waiting_position(Client *client, uint32_t position);
+void send_waiting_positions(Timer *timer, Context *context);
+OverloadStage worst_overload_stage(Context *workers, unsigned int total_workers);
+void show_overload_stats(Context *workers, unsigned int total_workers);
+void fill_overload_stats(ShmStats *stats, Context *workers, unsigned int total_workers);
+
+// Live rounds
+
+void enable_live_quiz(Quiz *quiz);
+void init_live_rosters(Context *context);
+void join_live_round(Client *client, Context *context);
+void add_live_participant(Client *client, Context *context);
+void leave_live_round(Client *client, Context *context);
+void handle_live_answer(Client *client, char *answer, Context *context);
+void deliver_live_frame(Context *context, Quiz *quiz, RankingEventKind kind, SharedFrame *frame);
+void broadcast_live_frame(Context *context, Quiz *quiz, RankingEventKind kind, MessageType type, char *payload,
+                          size_t payload_length);
+void start_live_game(Quiz *quiz);
+void open_live_round(Context *context, Quiz *quiz);
+void close_live_round(Context *context, Quiz *quiz);
+void handle_live_timer(Timer *timer, Context *context);
+void deallocate_live_quiz(Quiz *quiz);
+
+// Spectators
+
+void init_spectators(Context *context);
+void init_spectator_timer(Quiz *quiz);
+void handle_spectate(Client *client, Message *msg, Context *context);
+void add_spectator(Client *client, Quiz *quiz, Context *context);
+void register_spectator(Client *client, Quiz *quiz, Context *context);
+void remove_spectator(Client *client, Context *context);
+SharedFrame *create_ranking_update(Quiz *quiz, unsigned int references);
+void send_ranking_update(Client *client, Quiz *quiz);
+void schedule_spectator_update(Context *context, Quiz *quiz);
+void push_spectator_update(Timer *timer, Context *context);
+void deliver_spectator_update(Context *context, Quiz *quiz, SharedFrame *frame);
+void deallocate_spectators(Context *context);
+
+// Protocol versions
+
+void init_client_protocol(Client *client);
+const ProtocolCodec *select_codec(uint8_t version);
+void handle_hello(Client *client, Message *msg);
+bool send_bounded_msg(Client *client, MessageType type, char *payload, size_t payload_length);
+void serialize_compact_quiz_list(QuizzesInfo *quizzesInfo);
+const char *quiz_list_v1(QuizzesInfo *quizzesInfo, size_t *length);
+const char *quiz_list_v2(QuizzesInfo *quizzesInfo, size_t *length);
+const char *client_quiz_list(Client *client, QuizzesInfo *quizzesInfo, size_t *length);
+void grow_string_slots(StringTable *table);
+uint32_t intern_string(StringTable *table, const char *string, uint32_t length);
+size_t encode_ranking_v2(Context *context);
+void reset_string_table(StringTable *table);
+void deallocate_string_table(StringTable *table);
+
+// Ranking deltas
+
+void record_left_player(Quiz *quiz, RankingNode *node);
+void subscribe_rankings(Client *client, Context *context);
+void add_ranking_subscriber(Client *client, Context *context);
+void unsubscribe_rankings(Client *client, Context *context);
+SharedFrame *create_ranking_resync(Quiz *quiz, RankingSnapshot *snapshot, unsigned int references);
+void push_ranking_delta(Context *context, Quiz *quiz, RankingSnapshot *snapshot);
+void deliver_ranking_delta(Context *context, SharedFrame *frame);
+void deallocate_ranking_deltas(Quiz *quiz);
+
+// Timers
+
+void init_timer_wheel(TimerWheel *wheel, uint64_t now_ns);
+void init_timer(Timer *timer, TimerCallback callback, void *data);
+void schedule_timer(TimerWheel *wheel, Timer *timer, unsigned int delay_ms);
+void cancel_timer(TimerWheel *wheel, Timer *timer);
+bool timer_pending(Timer *timer);
+unsigned int timer_remaining_ms(TimerWheel *wheel, Timer *timer, uint64_t now_ns);
+int next_timer_timeout(TimerWheel *wheel, uint64_t now_ns);
+void advance_timers(TimerWheel *wheel, uint64_t now_ns, Context *context);
+
+// Allocation statistics
+
+bool alloc_stats_enabled();
+int alloc_stats_enter(int scope);
+AllocStats alloc_stats_get(int scope);
+AllocStats alloc_stats_total();
+void show_alloc_stats();
+
+// Capture
+
+int capture_open(const char *path);
+void capture_close();
+void capture_connect(Client *client);
+void capture_outbound(int fd, MessageType type, const char *payload, size_t payload_length);
+void capture_inbound(Client *client, Message *msg);
+void capture_disconnect(Client *client);
+
+// Write-ahead log
+
+int prepare_wal_paths(const char *path);
+int wal_open(const char *path, QuizzesInfo *quizzesInfo);
+int wal_adopt(const char *path, QuizzesInfo *quizzesInfo);
+void wal_start(Context *workers, unsigned int total_workers);
+void wal_stop();
+void wal_close();
+void wal_handoff();
+uint32_t wal_checksum(uint32_t hash, const char *data, size_t length);
+size_t encode_wal_record(char *buffer, WalRecordKind kind, uint16_t quiz_id, uint16_t score, const char *nickname,
+                         uint16_t nickname_length);
+void encode_wal_header(char *header, uint16_t generation);
+RankingNode *create_recovered_node(const char *nickname, uint16_t nickname_length);
+RankingNode **recovery_slot(RecoveryIndex *index, uint16_t total_quizzes, uint16_t quiz_id, const char *nickname,
+                            uint16_t nickname_length);
+int compare_recovered_entries(const void *a, const void *b);
+void sort_recovered_rankings(QuizzesInfo *quizzesInfo, RecoveryIndex *index);
+size_t replay_wal(const char *data, size_t length, QuizzesInfo *quizzesInfo, RecoveryIndex *index, uint64_t *events);
+char *read_whole_file(int fd, size_t size);
+int load_state_snapshot(QuizzesInfo *quizzesInfo, RecoveryIndex *index, uint16_t *generation, uint64_t *offset);
+int recover_wal(size_t size, QuizzesInfo *quizzesInfo);
+void deallocate_recovery_index(RecoveryIndex *index);
+void init_wal_buffer(WalBuffer *buffer);
+void log_ranking_event(Quiz *quiz, const RankingEvent *event);
+bool write_wal_data(int fd, const char *data, size_t length);
+bool write_wal_buffers();
+void commit_wal();
+void append_snapshot_data(int fd, const char *data, size_t length);
+bool write_state_snapshot(int fd, QuizzesInfo *quizzesInfo, uint16_t generation, uint64_t offset);
+void run_snapshot_child(uint16_t generation, uint64_t offset, int report_fd);
+bool fork_state_snapshot(uint64_t offset);
+void truncate_wal(uint64_t offset);
+void finish_state_snapshot(bool wait);
+void take_checkpoint();
+void pause_for_checkpoint();
+void *run_wal_writer(void *arg);
+void show_wal_stats();
+void fill_wal_stats(ShmStats *stats);
+void discard_recovered_player(Quiz *quiz, RankingNode *node);
+void deallocate_wal_buffer(WalBuffer *buffer);
+
+// Upgrade
+
+void reserve_handoff_space(HandoffBuffer *buffer, size_t length);
+void write_handoff_varint(HandoffBuffer *buffer, uint64_t value);
+void write_handoff_bytes(HandoffBuffer *buffer, const void *data, size_t length);
+void write_handoff_string(HandoffBuffer *buffer, const char *string);
+void write_handoff_timer(HandoffBuffer *buffer, TimerWheel *wheel, Timer *timer, uint64_t now_ns);
+void write_handoff_ranked_quizzes(HandoffBuffer *buffer, RankingNode **client_rankings, uint16_t total_quizzes);
+void write_handoff_rankings(HandoffBuffer *buffer, QuizzesInfo *quizzesInfo, uint64_t now_ns);
+void write_handoff_segments(HandoffBuffer *buffer, const char *data, size_t length, SharedSegment *segments,
+                            size_t count, size_t skip);
+void write_handoff_connection(HandoffBuffer *buffer, Connection *connection);
+void write_handoff_client(HandoffBuffer *buffer, Client *client, Context *context, uint64_t now_ns);
+void write_handoff_session(HandoffBuffer *buffer, ParkedSession *session, uint16_t total_quizzes, uint64_t now_ns);
+bool write_handoff_data(int socket_fd, const void *data, size_t length);
+bool read_handoff_data(int socket_fd, void *data, size_t length);
+bool send_handoff_fds(int socket_fd, const int *fds, unsigned int total_fds);
+bool receive_handoff_fds(int socket_fd, int *fds, unsigned int total_fds);
+bool send_handoff(int socket_fd, Context *workers, unsigned int total_workers, uint64_t stopped_ns);
+pid_t spawn_upgraded_server(char **argv, int socket_fd);
+bool wait_upgraded_server(int socket_fd);
+int upgrade_server(char **argv, Context *workers, unsigned int total_workers);
+uint64_t read_handoff_varint(HandoffBuffer *buffer);
+const char *read_handoff_bytes(HandoffBuffer *buffer, size_t length);
+char *read_handoff_string(HandoffBuffer *buffer);
+void read_handoff_timer(HandoffBuffer *buffer, TimerWheel *wheel, Timer *timer);
+void read_handoff_ranked_quizzes(HandoffBuffer *buffer, RankingNode **client_rankings, const char *nickname,
+                                 QuizzesInfo *quizzesInfo, RecoveryIndex *index);
+bool read_handoff_rankings(HandoffBuffer *buffer, QuizzesInfo *quizzesInfo, RecoveryIndex *index);
+void read_handoff_client(HandoffBuffer *buffer, Context *context, RecoveryIndex *index, int fd,
+                         HandoffConnection *connection);
+void read_handoff_session(HandoffBuffer *buffer, Context *context, RecoveryIndex *index, uint64_t now_ns);
+unsigned int receive_handoff(int socket_fd);
+int handoff_listener(unsigned int worker);
+bool restore_handoff(Context *workers, unsigned int total_workers);
+void adopt_handoff_connections(Context *context);
+
+// Shared-memory publication
+
+int shm_open_region(const char *name);
+size_t shm_write_leaderboard(char *buffer, size_t capacity, Quiz *quiz);
+void shm_publish(Context *workers, unsigned int total_workers);
+void shm_close(bool unlink);
+
+// Flight recorder
+
+void flight_init(const char *dump_path);
+uint64_t flight_clock();
+uint64_t flight_monotonic_ns();
+void flight_record(FlightEventKind kind, uint16_t type, uint32_t conn, uint32_t a, uint64_t b);
+void flight_dump();
 
 #endif // SERVER_UTILS_H
@@ -0,0 +1,1192 @@
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include "utils.h"
+#include "../../common/params.h"
+
+/**
+ * The write-ahead log records every change applied to the rankings, so that they survive a crash of the server.
+ * The owner of a quiz appends the records of its changes to the buffer of its worker, without system calls;
+ * a writer thread commits the buffers of all the workers every WAL_COMMIT_MS, with one write for each buffer
+ * and a single fdatasync for all of them. The replies are not delayed until the commit, so a crash loses
+ * at most the changes of the last WAL_COMMIT_MS.
+ *
+ * Once the log exceeds WAL_SNAPSHOT_BYTES, the writer thread pauses the workers between two iterations, writes
+ * their buffers and forks: the child serializes the rankings from its copy-on-write image of the memory while
+ * the workers resume. When the snapshot is durable, the records it covers are dropped by copying the rest of
+ * the log to a new generation of the file. A snapshot is also taken when the log is closed.
+ *
+ * On startup the snapshot is loaded and the log replayed to rebuild the rankings. The clients of the recovered
+ * players are gone, so their nodes stay in the rankings until a client with the same nickname starts the quiz again.
+ */
+
+// File descriptor of the log, -1 when the log is disabled
+static int wal_fd = -1;
+// Set while the workers append their changes to their buffers
+static bool wal_running = false;
+// Quizzes whose rankings are logged
+static QuizzesInfo *wal_quizzes = NULL;
+// Workers whose buffers are committed
+static Context *wal_workers = NULL;
+static unsigned int wal_total_workers = 0;
+// Writer thread, woken up by wal_cond when it has to stop
+static pthread_t wal_thread;
+static bool wal_thread_started = false;
+static pthread_mutex_t wal_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wal_cond = PTHREAD_COND_INITIALIZER;
+static bool wal_stopping = false;
+// Paths of the files, prepared in advance since the child writing the snapshot cannot allocate memory
+static char wal_path[PATH_MAX], wal_temp_path[PATH_MAX], snapshot_path[PATH_MAX], snapshot_temp_path[PATH_MAX],
+    snapshot_dir_path[PATH_MAX];
+// Generation of the log, incremented modulo 2^16 each time it is truncated, and its length
+static uint16_t wal_generation = 0;
+static uint64_t wal_length = 0;
+// Set by the writer thread to pause the workers, which wait on checkpoint_cond and are counted by checkpoint_paused
+static bool checkpoint_pending = false;
+static unsigned int checkpoint_paused = 0;
+static pthread_cond_t checkpoint_cond = PTHREAD_COND_INITIALIZER;
+// Child writing the snapshot, -1 if none, with the offset of the log it covers and the pipe on which it reports
+static pid_t snapshot_pid = -1;
+static uint64_t snapshot_offset = 0;
+static int snapshot_report_fd = -1;
+// Buffer in which the child serializes the snapshot, with the bytes written and their checksum
+static char snapshot_buffer[WAL_BUFFER_SIZE];
+static size_t snapshot_buffered = 0;
+static uint64_t snapshot_written = 0;
+static uint32_t snapshot_checksum = 0;
+static bool snapshot_failed = false;
+// Statistics shown by the dashboard and printed when the log is closed
+static uint64_t wal_commits = 0, wal_bytes = 0, snapshots_taken = 0, last_fork_ns = 0, last_snapshot_bytes = 0,
+                last_snapshot_ns = 0;
+
+/**
+ * @brief Computes the 32-bit FNV-1a hash of some bytes, used as the checksum of the records and of the snapshots
+ *
+ * @param hash hash of the preceding bytes, or WAL_CHECKSUM_SEED
+ * @param data pointer to the bytes
+ * @param length number of bytes
+ * @return hash of the preceding bytes followed by the new ones
+ */
+uint32_t wal_checksum(uint32_t hash, const char *data, size_t length)
+{
+    for (size_t i = 0; i < length; i++)
+        hash = (hash ^ (uint8_t)data[i]) * 16777619u;
+    return hash;
+}
+
+/**
+ * @brief Serializes a change to a ranking in a log record, as described in wal.h
+ *
+ * @param buffer pointer to the buffer in which the record is written, with room for the whole record
+ * @param kind kind of change
+ * @param quiz_id index of the quiz
+ * @param score score of the player after the change
+ * @param nickname pointer to the nickname of the player, not necessarily terminated
+ * @param nickname_length length of the nickname
+ * @return length of the record
+ */
+size_t encode_wal_record(char *buffer, WalRecordKind kind, uint16_t quiz_id, uint16_t score, const char *nickname,
+                         uint16_t nickname_length)
+{
+    uint16_t fields[3] = {htons(quiz_id + 1), htons(score), htons(nickname_length)};
+    size_t length = WAL_RECORD_HEADER_SIZE + nickname_length;
+
+    buffer[0] = kind;
+    memcpy(buffer + sizeof(uint8_t), fields, sizeof(fields));
+    memcpy(buffer + WAL_RECORD_HEADER_SIZE, nickname, nickname_length);
+    uint32_t checksum = htonl(wal_checksum(WAL_CHECKSUM_SEED, buffer, length));
+    memcpy(buffer + length, &checksum, sizeof(uint32_t));
+    return length + WAL_CHECKSUM_SIZE;
+}
+
+/**
+ * @brief Serializes the header of a log file, as described in wal.h
+ *
+ * @param header pointer to the buffer of WAL_FILE_HEADER_SIZE bytes in which the header is written
+ * @param generation generation of the log
+ */
+void encode_wal_header(char *header, uint16_t generation)
+{
+    uint16_t fields[2] = {htons(WAL_VERSION), htons(generation)};
+    memcpy(header, WAL_MAGIC, WAL_MAGIC_SIZE);
+    memcpy(header + WAL_MAGIC_SIZE, fields, sizeof(fields));
+}
+
+/**
+ * @brief Creates the node of a player recovered from the log
+ *
+ * @param nickname pointer to the nickname of the player, not necessarily terminated
+ * @param nickname_length length of the nickname
+ * @return pointer to the new node
+ */
+RankingNode *create_recovered_node(const char *nickname, uint16_t nickname_length)
+{
+    RankingNode *node = calloc(1, sizeof(RankingNode));
+    handle_malloc_error(node, "Error allocating RankingNode");
+    node->nickname = strndup(nickname, nickname_length);
+    handle_malloc_error(node->nickname, "Error allocating RankingNode");
+    node->recovered = true;
+    return node;
+}
+
+/**
+ * @brief Returns the slot of the node of a player in a quiz while the rankings are recovered
+ *
+ * Each nickname is interned in a string table and has a slot for every quiz.
+ *
+ * @param index pointer to the nodes recovered so far
+ * @param total_quizzes number of quizzes
+ * @param quiz_id index of the quiz
+ * @param nickname pointer to the nickname of the player, not necessarily terminated
+ * @param nickname_length length of the nickname
+ * @return pointer to the slot, which contains NULL if the player is not in the ranking
+ */
+RankingNode **recovery_slot(RecoveryIndex *index, uint16_t total_quizzes, uint16_t quiz_id, const char *nickname,
+                            uint16_t nickname_length)
+{
+    uint32_t name = intern_string(&index->names, nickname, nickname_length);
+    if ((size_t)index->names.capacity * total_quizzes > index->capacity)
+    {
+        size_t new_capacity = (size_t)index->names.capacity * total_quizzes;
+        index->nodes = realloc(index->nodes, new_capacity * sizeof(RankingNode *));
+        index->sequences = realloc(index->sequences, new_capacity * sizeof(uint64_t));
+        handle_malloc_error(index->nodes, "Memory allocation error for the recovery of the rankings");
+        handle_malloc_error(index->sequences, "Memory allocation error for the recovery of the rankings");
+        memset(index->nodes + index->capacity, 0, (new_capacity - index->capacity) * sizeof(RankingNode *));
+        index->capacity = new_capacity;
+    }
+    return &index->nodes[(size_t)name * total_quizzes + quiz_id];
+}
+
+/**
+ * @brief Compares two recovered nodes by decreasing score, then by the order in which they reached it
+ *
+ * @param a pointer to the first RecoveredEntry
+ * @param b pointer to the second RecoveredEntry
+ * @return negative if the first node comes first in the ranking, positive otherwise
+ */
+int compare_recovered_entries(const void *a, const void *b)
+{
+    const RecoveredEntry *first = a, *second = b;
+    if (first->node->score != second->node->score)
+        return first->node->score > second->node->score ? -1 : 1;
+    return first->sequence < second->sequence ? -1 : first->sequence > second->sequence;
+}
+
+/**
+ * @brief Orders the recovered rankings by score
+ *
+ * The scores are replayed without moving the nodes, which would scan the ranking for each record. Sorting
+ * by decreasing score, then by the sequence number of the change that set the score, gives the order that
+ * update_ranking would have produced, since a node moves behind the nodes that reached its score before it.
+ *
+ * @param quizzesInfo pointer to the quizzes whose rankings are recovered
+ * @param index pointer to the recovered nodes
+ */
+void sort_recovered_rankings(QuizzesInfo *quizzesInfo, RecoveryIndex *index)
+{
+    uint16_t total_quizzes = quizzesInfo->total_quizzes;
+    RecoveredEntry *entries = malloc((index->names.count ? index->names.count : 1) * sizeof(RecoveredEntry));
+    handle_malloc_error(entries, "Memory allocation error for the recovery of the rankings");
+
+    for (uint16_t i = 0; i < total_quizzes; i++)
+    {
+        Quiz *quiz = quizzesInfo->quizzes[i];
+        size_t count = 0;
+        for (uint32_t name = 0; name < index->names.count; name++)
+        {
+            size_t slot = (size_t)name * total_quizzes + i;
+            if (!index->nodes[slot])
+                continue;
+            entries[count].node = index->nodes[slot];
+            entries[count++].sequence = index->sequences[slot];
+        }
+        qsort(entries, count, sizeof(RecoveredEntry), compare_recovered_entries);
+
+        quiz->ranking_head = quiz->ranking_tail = NULL;
+        for (size_t j = 0; j < count; j++)
+        {
+            entries[j].node->prev_node = entries[j].node->next_node = NULL;
+            insert_ranking_node(quiz, entries[j].node);
+        }
+    }
+    free(entries);
+}
+
+/**
+ * @brief Applies the records of a log to the rankings of the quizzes
+ *
+ * The replay stops at the first record that is incomplete or does not match its checksum, which is the
+ * part of the log being written when the server crashed. The rankings must then be ordered with
+ * sort_recovered_rankings, and are published by their owners at the first iteration of the workers.
+ *
+ * @param data pointer to the records, without the file header
+ * @param length length of the records
+ * @param quizzesInfo pointer to the quizzes whose rankings are rebuilt
+ * @param index pointer to the nodes recovered so far, from the snapshot
+ * @param events pointer to the counter of the applied records, incremented for each of them
+ * @return length of the valid records
+ */
+size_t replay_wal(const char *data, size_t length, QuizzesInfo *quizzesInfo, RecoveryIndex *index, uint64_t *events)
+{
+    uint16_t total_quizzes = quizzesInfo->total_quizzes;
+    const char *pointer = data, *end = data + length;
+
+    while ((size_t)(end - pointer) >= WAL_RECORD_HEADER_SIZE + WAL_CHECKSUM_SIZE)
+    {
+        uint8_t kind = pointer[0];
+        uint16_t fields[3];
+        uint32_t checksum;
+        memcpy(fields, pointer + sizeof(uint8_t), sizeof(fields));
+        uint16_t quiz_number = ntohs(fields[0]), score = ntohs(fields[1]), nickname_length = ntohs(fields[2]);
+        size_t record_length = WAL_RECORD_HEADER_SIZE + nickname_length;
+        if ((size_t)(end - pointer) < record_length + WAL_CHECKSUM_SIZE)
+            break;
+        memcpy(&checksum, pointer + record_length, sizeof(uint32_t));
+        if (ntohl(checksum) != wal_checksum(WAL_CHECKSUM_SEED, pointer, record_length) || kind > WAL_LEAVE ||
+            quiz_number == 0 || quiz_number > total_quizzes)
+            break;
+
+        Quiz *quiz = quizzesInfo->quizzes[quiz_number - 1];
+        const char *nickname = pointer + WAL_RECORD_HEADER_SIZE;
+        RankingNode **node = recovery_slot(index, total_quizzes, quiz->id, nickname, nickname_length);
+
+        switch (kind)
+        {
+        case WAL_JOIN:
+            // A player joining again replaces the node left by a previous crash, as discard_recovered_player does
+            if (*node)
+                remove_ranking(*node, quiz);
+            *node = create_recovered_node(nickname, nickname_length);
+            quiz->total_clients += 1;
+            insert_ranking_node(quiz, *node);
+            index->sequences[node - index->nodes] = ++index->sequence;
+            break;
+        case WAL_SCORE:
+            if (!*node)
+                break;
+            // The node is moved by sort_recovered_rankings once the whole log has been replayed
+            (*node)->score = (*node)->correct_answers = score;
+            index->sequences[node - index->nodes] = ++index->sequence;
+            break;
+        case WAL_COMPLETE:
+            if (!*node)
+                break;
+            (*node)->is_quiz_completed = true;
+            (*node)->current_question = quiz->total_questions;
+            break;
+        case WAL_LEAVE:
+            if (!*node)
+                break;
+            remove_ranking(*node, quiz);
+            *node = NULL;
+            break;
+        }
+        (*events)++;
+        pointer += record_length + WAL_CHECKSUM_SIZE;
+    }
+    return pointer - data;
+}
+
+/**
+ * @brief Reads a whole file
+ *
+ * @param fd file descriptor of the file
+ * @param size size of the file
+ * @return pointer to the content, to be deallocated by the caller, or NULL in case of error
+ */
+char *read_whole_file(int fd, size_t size)
+{
+    size_t read_length = 0;
+    char *data = malloc(size ? size : 1);
+    handle_malloc_error(data, "Memory allocation error for the recovery of the rankings");
+    while (read_length < size)
+    {
+        ssize_t result = pread(fd, data + read_length, size - read_length, read_length);
+        if (result <= 0)
+        {
+            free(data);
+            return NULL;
+        }
+        read_length += result;
+    }
+    return data;
+}
+
+/**
+ * @brief Loads the rankings saved in the snapshot, if any
+ *
+ * @param quizzesInfo pointer to the quizzes whose rankings are rebuilt
+ * @param index pointer to the nodes recovered, to which the players of the snapshot are added
+ * @param generation pointer in which the generation of the log covered by the snapshot is stored
+ * @param offset pointer in which the offset of the log covered by the snapshot is stored
+ * @return 1 if the snapshot has been loaded, 0 if there is no snapshot, -1 in case of error
+ */
+int load_state_snapshot(QuizzesInfo *quizzesInfo, RecoveryIndex *index, uint16_t *generation, uint64_t *offset)
+{
+    struct stat file_stat;
+    int fd = open(snapshot_path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+        return errno == ENOENT ? 0 : -1;
+    char *data = fstat(fd, &file_stat) == -1 ? NULL : read_whole_file(fd, file_stat.st_size);
+    close(fd);
+    if (!data)
+        return -1;
+
+    size_t size = file_stat.st_size;
+    uint16_t fields[4];
+    uint32_t offset_words[2], checksum;
+    int result = -1;
+    errno = EINVAL;
+    if (size < SNAPSHOT_HEADER_SIZE + WAL_CHECKSUM_SIZE || memcmp(data, SNAPSHOT_MAGIC, SNAPSHOT_MAGIC_SIZE) != 0)
+    {
+        free(data);
+        return -1;
+    }
+    memcpy(&checksum, data + size - WAL_CHECKSUM_SIZE, sizeof(uint32_t));
+    memcpy(fields, data + SNAPSHOT_MAGIC_SIZE, 2 * sizeof(uint16_t));
+    memcpy(offset_words, data + SNAPSHOT_MAGIC_SIZE + 2 * sizeof(uint16_t), sizeof(offset_words));
+    memcpy(&fields[2], data + SNAPSHOT_HEADER_SIZE - sizeof(uint16_t), sizeof(uint16_t));
+    if (ntohl(checksum) != wal_checksum(WAL_CHECKSUM_SEED, data, size - WAL_CHECKSUM_SIZE) ||
+        ntohs(fields[0]) != SNAPSHOT_VERSION || ntohs(fields[2]) != quizzesInfo->total_quizzes)
+    {
+        free(data);
+        return -1;
+    }
+    *generation = ntohs(fields[1]);
+    *offset = (uint64_t)ntohl(offset_words[0]) << 32 | ntohl(offset_words[1]);
+
+    const char *pointer = data + SNAPSHOT_HEADER_SIZE, *end = data + size - WAL_CHECKSUM_SIZE;
+    uint16_t i;
+    for (i = 0; i < quizzesInfo->total_quizzes; i++)
+    {
+        Quiz *quiz = quizzesInfo->quizzes[i];
+        uint64_t players, nickname_length, score, progress;
+        size_t consumed = decode_varint(pointer, end, &players);
+        if (!consumed)
+            break;
+        pointer += consumed;
+        for (; players > 0; players--)
+        {
+            if (!(consumed = decode_varint(pointer, end, &nickname_length)) || nickname_length > UINT16_MAX ||
+                (size_t)(end - pointer - consumed) < nickname_length)
+                break;
+            const char *nickname = pointer + consumed;
+            pointer = nickname + nickname_length;
+            if (!(consumed = decode_varint(pointer, end, &score)))
+                break;
+            pointer += consumed;
+            if (!(consumed = decode_varint(pointer, end, &progress)))
+                break;
+            pointer += consumed;
+
+            RankingNode *node = create_recovered_node(nickname, nickname_length);
+            node->score = node->correct_answers = score;
+            node->current_question = progress >> 1;
+            node->is_quiz_completed = progress & 1;
+            quiz->total_clients += 1;
+            insert_ranking_node(quiz, node);
+            RankingNode **slot = recovery_slot(index, quizzesInfo->total_quizzes, quiz->id, nickname, nickname_length);
+            *slot = node;
+            index->sequences[slot - index->nodes] = ++index->sequence;
+        }
+        if (players > 0)
+            break;
+    }
+    if (i == quizzesInfo->total_quizzes && pointer == end)
+        result = 1;
+    free(data);
+    return result;
+}
+
+/**
+ * @brief Rebuilds the rankings from the snapshot and the records of the log, and truncates the incomplete records
+ *
+ * The snapshot covers the log up to an offset of a generation: the log is replayed from that offset if it is
+ * still of the same generation, or from its start if it has already been truncated.
+ *
+ * @param size size of the log file
+ * @param quizzesInfo pointer to the quizzes whose rankings are rebuilt
+ * @return 1 if the rankings have been recovered, -1 in case of error
+ */
+int recover_wal(size_t size, QuizzesInfo *quizzesInfo)
+{
+    uint64_t start_ns = get_time_ns(), events = 0, covered_offset = 0;
+    uint16_t fields[2], covered_generation;
+    RecoveryIndex index;
+    memset(&index, 0, sizeof(RecoveryIndex));
+
+    char *data = read_whole_file(wal_fd, size);
+    if (!data)
+        return -1;
+    if (size >= WAL_FILE_HEADER_SIZE)
+        memcpy(fields, data + WAL_MAGIC_SIZE, sizeof(fields));
+    if (size < WAL_FILE_HEADER_SIZE || memcmp(data, WAL_MAGIC, WAL_MAGIC_SIZE) != 0 || ntohs(fields[0]) != WAL_VERSION)
+    {
+        free(data);
+        errno = EINVAL;
+        return -1;
+    }
+    wal_generation = ntohs(fields[1]);
+
+    int loaded = load_state_snapshot(quizzesInfo, &index, &covered_generation, &covered_offset);
+    size_t start = WAL_FILE_HEADER_SIZE;
+    if (loaded == 1 && covered_generation == wal_generation)
+        start = covered_offset;
+    if (loaded == -1 || (loaded == 1 && covered_generation == wal_generation &&
+                         (covered_offset < WAL_FILE_HEADER_SIZE || covered_offset > size)) ||
+        (loaded == 1 && covered_generation != wal_generation && (uint16_t)(covered_generation + 1) != wal_generation))
+    {
+        if (loaded != -1)
+            errno = EINVAL;
+        free(data);
+        deallocate_recovery_index(&index);
+        return -1;
+    }
+
+    size_t valid = start + replay_wal(data + start, size - start, quizzesInfo, &index, &events);
+    free(data);
+    sort_recovered_rankings(quizzesInfo, &index);
+    deallocate_recovery_index(&index);
+
+    uint32_t players = 0;
+    for (uint16_t i = 0; i < quizzesInfo->total_quizzes; i++)
+    {
+        Quiz *quiz = quizzesInfo->quizzes[i];
+        quiz->recovered_players = quiz->total_clients;
+        quiz->snapshot_stale = true;
+        players += quiz->recovered_players;
+    }
+    if (valid < size)
+    {
+        printf("Discarding %zu bytes of incomplete records at the end of the write-ahead log\n", size - valid);
+        if (ftruncate(wal_fd, valid) == -1)
+            return -1;
+    }
+    if (lseek(wal_fd, valid, SEEK_SET) == -1)
+        return -1;
+    wal_length = valid;
+
+    if (loaded)
+        printf("Recovered %u players from %s and %llu events of the log in %.1f ms\n", players, snapshot_path,
+               (unsigned long long)events, (get_time_ns() - start_ns) / 1e6);
+    else
+        printf("Recovered %u players from %llu events of the log in %.1f ms\n", players, (unsigned long long)events,
+               (get_time_ns() - start_ns) / 1e6);
+    return 1;
+}
+
+/**
+ * @brief Deallocates the index of the nodes recovered, which stay in the rankings
+ *
+ * @param index pointer to the index
+ */
+void deallocate_recovery_index(RecoveryIndex *index)
+{
+    deallocate_string_table(&index->names);
+    free(index->nodes);
+    free(index->sequences);
+}
+
+/**
+ * @brief Prepares the paths of the log, of the snapshot and of their temporary files
+ *
+ * @param path path of the log
+ * @return 0 on success, -1 if the path is too long
+ */
+int prepare_wal_paths(const char *path)
+{
+    if (snprintf(snapshot_temp_path, sizeof(snapshot_temp_path), "%s.snap.tmp", path) >= (int)sizeof(snapshot_temp_path))
+    {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    snprintf(wal_path, sizeof(wal_path), "%s", path);
+    snprintf(wal_temp_path, sizeof(wal_temp_path), "%s.tmp", path);
+    snprintf(snapshot_path, sizeof(snapshot_path), "%s.snap", path);
+    const char *separator = strrchr(path, '/');
+    if (separator)
+        snprintf(snapshot_dir_path, sizeof(snapshot_dir_path), "%.*s", (int)(separator - path + 1), path);
+    else
+        snprintf(snapshot_dir_path, sizeof(snapshot_dir_path), ".");
+    return 0;
+}
+
+/**
+ * @brief Opens the write-ahead log and rebuilds the rankings from its snapshot and its records
+ *
+ * A new log is created if the file is empty or does not exist. The incomplete records at the end of the log
+ * are truncated, so that the following records are appended after the valid ones. The snapshot is stored
+ * next to the log, in a file with the same name followed by ".snap".
+ * It must be called after the quizzes are loaded and before the workers are started.
+ *
+ * @param path path of the log
+ * @param quizzesInfo pointer to the quizzes whose rankings are rebuilt
+ * @return 1 if the log has been opened, -1 in case of error
+ */
+int wal_open(const char *path, QuizzesInfo *quizzesInfo)
+{
+    char header[WAL_FILE_HEADER_SIZE];
+    struct stat file_stat;
+    int result;
+
+    if (prepare_wal_paths(path) == -1)
+        return -1;
+    wal_quizzes = quizzesInfo;
+    wal_generation = 0;
+
+    wal_fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (wal_fd == -1)
+        return -1;
+    if (fstat(wal_fd, &file_stat) == -1)
+        result = -1;
+    else if (file_stat.st_size > 0)
+        result = recover_wal(file_stat.st_size, quizzesInfo);
+    else
+    {
+        encode_wal_header(header, wal_generation);
+        result = write(wal_fd, header, sizeof(header)) == sizeof(header) && fdatasync(wal_fd) == 0 ? 1 : -1;
+        wal_length = sizeof(header);
+    }
+
+    if (result == -1)
+    {
+        close(wal_fd);
+        wal_fd = -1;
+    }
+    return result;
+}
+
+/**
+ * @brief Reopens the log handed over by the server being upgraded, whose rankings have been received with it
+ *
+ * The previous server has committed all its records before the handoff, so the log already matches the rankings
+ * and is not replayed: the new records are appended after the existing ones.
+ *
+ * @param path path of the log
+ * @param quizzesInfo pointer to the quizzes whose rankings are logged
+ * @return 1 if the log has been opened, -1 in case of error
+ */
+int wal_adopt(const char *path, QuizzesInfo *quizzesInfo)
+{
+    char header[WAL_FILE_HEADER_SIZE];
+    uint16_t fields[2];
+    struct stat file_stat;
+
+    if (prepare_wal_paths(path) == -1)
+        return -1;
+    wal_quizzes = quizzesInfo;
+    wal_fd = open(path, O_RDWR | O_CLOEXEC);
+    if (wal_fd == -1)
+        return -1;
+    if (fstat(wal_fd, &file_stat) == -1 || pread(wal_fd, header, sizeof(header), 0) != sizeof(header) ||
+        lseek(wal_fd, 0, SEEK_END) == -1)
+    {
+        close(wal_fd);
+        wal_fd = -1;
+        return -1;
+    }
+    memcpy(fields, header + WAL_MAGIC_SIZE, sizeof(fields));
+    if (memcmp(header, WAL_MAGIC, WAL_MAGIC_SIZE) != 0 || ntohs(fields[0]) != WAL_VERSION)
+    {
+        close(wal_fd);
+        wal_fd = -1;
+        errno = EINVAL;
+        return -1;
+    }
+    wal_generation = ntohs(fields[1]);
+    wal_length = file_stat.st_size;
+    return 1;
+}
+
+/**
+ * @brief Initializes the log buffer of a worker, allocated only when the log is enabled
+ *
+ * @param buffer pointer to the buffer
+ */
+void init_wal_buffer(WalBuffer *buffer)
+{
+    pthread_mutex_init(&buffer->lock, NULL);
+    buffer->data = buffer->spare = NULL;
+    buffer->length = buffer->size = buffer->spare_size = 0;
+}
+
+/**
+ * @brief Starts the writer thread committing the log buffers of the workers
+ *
+ * The buffers are allocated here, so that appending a record does not allocate memory unless a buffer
+ * fills up between two commits. It must be called after wal_open and before the workers are started.
+ *
+ * @param workers array of the workers
+ * @param total_workers number of workers
+ */
+void wal_start(Context *workers, unsigned int total_workers)
+{
+    if (wal_fd == -1)
+        return;
+    wal_workers = workers;
+    wal_total_workers = total_workers;
+    for (unsigned int i = 0; i < total_workers; i++)
+    {
+        WalBuffer *buffer = &workers[i].wal;
+        buffer->size = buffer->spare_size = WAL_BUFFER_SIZE;
+        buffer->data = malloc(buffer->size);
+        buffer->spare = malloc(buffer->spare_size);
+        handle_malloc_error(buffer->data, "Memory allocation error for the write-ahead log");
+        handle_malloc_error(buffer->spare, "Memory allocation error for the write-ahead log");
+    }
+    wal_stopping = false;
+    if (pthread_create(&wal_thread, NULL, run_wal_writer, NULL) != 0)
+    {
+        printf("Error creating the thread of the write-ahead log\n");
+        exit(EXIT_FAILURE);
+    }
+    wal_thread_started = true;
+    wal_running = true;
+}
+
+/**
+ * @brief Appends the record of a change applied to a ranking to the log buffer of the owner of the quiz
+ *
+ * It is called by the owner before applying the change, since a removed node is deallocated.
+ *
+ * @param quiz pointer to the quiz whose ranking is changed
+ * @param event pointer to the change
+ */
+void log_ranking_event(Quiz *quiz, const RankingEvent *event)
+{
+    static const WalRecordKind record_kinds[] = {
+        [RANKING_INSERT] = WAL_JOIN,
+        [RANKING_SCORE] = WAL_SCORE,
+        [RANKING_COMPLETE] = WAL_COMPLETE,
+        [RANKING_REMOVE] = WAL_LEAVE,
+    };
+    if (!wal_running || event->kind > RANKING_REMOVE)
+        return;
+
+    RankingNode *node = event->node;
+    uint16_t nickname_length = strlen(node->nickname);
+    uint16_t score = event->kind == RANKING_SCORE ? event->score : node->score;
+    WalBuffer *buffer = &quiz->owner->wal;
+
+    pthread_mutex_lock(&buffer->lock);
+    char *pointer = buffer->data + buffer->length;
+    ensure_capacity(&buffer->data, &pointer, &buffer->size, WAL_RECORD_HEADER_SIZE + nickname_length + WAL_CHECKSUM_SIZE);
+    buffer->length += encode_wal_record(pointer, record_kinds[event->kind], quiz->id, score, node->nickname,
+                                        nickname_length);
+    pthread_mutex_unlock(&buffer->lock);
+}
+
+/**
+ * @brief Writes a whole buffer to a file, retrying the partial writes
+ *
+ * @param fd file descriptor of the file
+ * @param data pointer to the data
+ * @param length length of the data
+ * @return true if the data has been written
+ */
+bool write_wal_data(int fd, const char *data, size_t length)
+{
+    while (length > 0)
+    {
+        ssize_t written = write(fd, data, length);
+        if (written == -1 && errno == EINTR)
+            continue;
+        if (written <= 0)
+            return false;
+        data += written;
+        length -= written;
+    }
+    return true;
+}
+
+/**
+ * @brief Writes to the log the records appended by all the workers since the previous call
+ *
+ * Each buffer is swapped with its spare under the lock, so the workers keep appending while the records
+ * are written.
+ *
+ * @return true if some records have been written
+ */
+bool write_wal_buffers()
+{
+    bool written = false;
+    for (unsigned int i = 0; i < wal_total_workers; i++)
+    {
+        WalBuffer *buffer = &wal_workers[i].wal;
+        pthread_mutex_lock(&buffer->lock);
+        char *records = buffer->data;
+        size_t length = buffer->length, size = buffer->size;
+        buffer->data = buffer->spare;
+        buffer->size = buffer->spare_size;
+        buffer->length = 0;
+        buffer->spare = records;
+        buffer->spare_size = size;
+        pthread_mutex_unlock(&buffer->lock);
+
+        if (length == 0)
+            continue;
+        if (!write_wal_data(wal_fd, records, length))
+        {
+            perror("Error writing the write-ahead log");
+            continue;
+        }
+        wal_length += length;
+        __atomic_store_n(&wal_bytes, wal_bytes + length, __ATOMIC_RELAXED);
+        written = true;
+    }
+    return written;
+}
+
+/**
+ * @brief Commits the records appended by all the workers since the previous commit
+ *
+ * The records of all the workers are made durable with a single fdatasync.
+ */
+void commit_wal()
+{
+    if (!write_wal_buffers())
+        return;
+    if (fdatasync(wal_fd) == -1)
+        perror("Error synchronizing the write-ahead log");
+    __atomic_store_n(&wal_commits, wal_commits + 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Appends bytes to the snapshot being written by the child, writing the buffer to the file when it is full
+ *
+ * Only async-signal-safe functions are used, since the child of a multithreaded process cannot allocate memory
+ * or take the locks held by the other threads at the time of the fork.
+ *
+ * @param fd file descriptor of the snapshot
+ * @param data pointer to the bytes
+ * @param length number of bytes
+ */
+void append_snapshot_data(int fd, const char *data, size_t length)
+{
+    while (length > 0)
+    {
+        if (snapshot_buffered == sizeof(snapshot_buffer))
+        {
+            snapshot_failed |= !write_wal_data(fd, snapshot_buffer, snapshot_buffered);
+            snapshot_written += snapshot_buffered;
+            snapshot_buffered = 0;
+        }
+        size_t chunk = sizeof(snapshot_buffer) - snapshot_buffered;
+        if (chunk > length)
+            chunk = length;
+        memcpy(snapshot_buffer + snapshot_buffered, data, chunk);
+        snapshot_checksum = wal_checksum(snapshot_checksum, data, chunk);
+        snapshot_buffered += chunk;
+        data += chunk;
+        length -= chunk;
+    }
+}
+
+/**
+ * @brief Serializes the rankings of every quiz in a snapshot, as described in wal.h
+ *
+ * @param fd file descriptor of the snapshot
+ * @param quizzesInfo pointer to the quizzes
+ * @param generation generation of the log covered by the snapshot
+ * @param offset offset of the log covered by the snapshot
+ * @return true if the snapshot has been written
+ */
+bool write_state_snapshot(int fd, QuizzesInfo *quizzesInfo, uint16_t generation, uint64_t offset)
+{
+    char header[SNAPSHOT_HEADER_SIZE], varints[3 * VARINT_MAX_SIZE];
+    uint16_t fields[2] = {htons(SNAPSHOT_VERSION), htons(generation)};
+    uint32_t offset_words[2] = {htonl(offset >> 32), htonl(offset & 0xFFFFFFFF)};
+    uint16_t total_quizzes = htons(quizzesInfo->total_quizzes);
+
+    snapshot_buffered = 0;
+    snapshot_written = 0;
+    snapshot_checksum = WAL_CHECKSUM_SEED;
+    snapshot_failed = false;
+    memcpy(header, SNAPSHOT_MAGIC, SNAPSHOT_MAGIC_SIZE);
+    memcpy(header + SNAPSHOT_MAGIC_SIZE, fields, sizeof(fields));
+    memcpy(header + SNAPSHOT_MAGIC_SIZE + sizeof(fields), offset_words, sizeof(offset_words));
+    memcpy(header + SNAPSHOT_HEADER_SIZE - sizeof(uint16_t), &total_quizzes, sizeof(uint16_t));
+    append_snapshot_data(fd, header, sizeof(header));
+
+    for (uint16_t i = 0; i < quizzesInfo->total_quizzes; i++)
+    {
+        Quiz *quiz = quizzesInfo->quizzes[i];
+        uint64_t players = 0;
+        for (RankingNode *node = quiz->ranking_head; node; node = node->next_node)
+            players++;
+        append_snapshot_data(fd, varints, encode_varint(varints, players));
+        for (RankingNode *node = quiz->ranking_head; node; node = node->next_node)
+        {
+            size_t nickname_length = strlen(node->nickname);
+            append_snapshot_data(fd, varints, encode_varint(varints, nickname_length));
+            append_snapshot_data(fd, node->nickname, nickname_length);
+            size_t length = encode_varint(varints, node->score);
+            length += encode_varint(varints + length, (uint64_t)node->current_question << 1 | node->is_quiz_completed);
+            append_snapshot_data(fd, varints, length);
+        }
+    }
+
+    uint32_t checksum = htonl(snapshot_checksum);
+    snapshot_failed |= !write_wal_data(fd, snapshot_buffer, snapshot_buffered);
+    snapshot_failed |= !write_wal_data(fd, (char *)&checksum, sizeof(uint32_t));
+    snapshot_written += snapshot_buffered + sizeof(uint32_t);
+    return !snapshot_failed;
+}
+
+/**
+ * @brief Body of the child writing a snapshot, which reports the bytes written and the time taken on a pipe
+ *
+ * The snapshot is written to a temporary file renamed once durable, so that a crash never leaves a partial one.
+ *
+ * @param generation generation of the log covered by the snapshot
+ * @param offset offset of the log covered by the snapshot
+ * @param report_fd file descriptor of the pipe to the parent
+ */
+void run_snapshot_child(uint16_t generation, uint64_t offset, int report_fd)
+{
+    uint64_t start_ns = flight_monotonic_ns();
+    int fd = open(snapshot_temp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1 || !write_state_snapshot(fd, wal_quizzes, generation, offset) || fsync(fd) == -1 ||
+        rename(snapshot_temp_path, snapshot_path) == -1)
+        _exit(EXIT_FAILURE);
+    close(fd);
+    // The rename must be durable before the log is truncated
+    int dir_fd = open(snapshot_dir_path, O_RDONLY);
+    if (dir_fd == -1 || fsync(dir_fd) == -1)
+        _exit(EXIT_FAILURE);
+    close(dir_fd);
+
+    uint64_t report[2] = {snapshot_written, flight_monotonic_ns() - start_ns};
+    _exit(write_wal_data(report_fd, (char *)report, sizeof(report)) ? EXIT_SUCCESS : EXIT_FAILURE);
+}
+
+/**
+ * @brief Forks a child writing a snapshot of the rankings as they are at the time of the call
+ *
+ * The rankings must not be changing: the workers are paused or terminated.
+ *
+ * @param offset offset of the log covered by the snapshot, which includes all the changes applied to the rankings
+ * @return true if the child has been started
+ */
+bool fork_state_snapshot(uint64_t offset)
+{
+    int report[2];
+    if (pipe(report) == -1)
+        return false;
+
+    uint64_t start_ns = flight_monotonic_ns();
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        close(report[0]);
+        run_snapshot_child(wal_generation, offset, report[1]);
+    }
+    __atomic_store_n(&last_fork_ns, flight_monotonic_ns() - start_ns, __ATOMIC_RELAXED);
+    close(report[1]);
+    if (pid == -1)
+    {
+        close(report[0]);
+        return false;
+    }
+    snapshot_pid = pid;
+    snapshot_offset = offset;
+    snapshot_report_fd = report[0];
+    return true;
+}
+
+/**
+ * @brief Drops the records of the log covered by the snapshot
+ *
+ * The records following the snapshot are copied to a new generation of the log, which replaces the old one.
+ * If the server crashes before, the old generation is replayed from the offset covered by the snapshot.
+ *
+ * @param offset offset of the log covered by the snapshot
+ */
+void truncate_wal(uint64_t offset)
+{
+    char header[WAL_FILE_HEADER_SIZE];
+    uint16_t generation = wal_generation + 1;
+    int fd = open(wal_temp_path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd == -1)
+    {
+        perror("Error truncating the write-ahead log");
+        return;
+    }
+
+    encode_wal_header(header, generation);
+    bool written = write_wal_data(fd, header, sizeof(header));
+    char *records = malloc(WAL_BUFFER_SIZE);
+    handle_malloc_error(records, "Memory allocation error for the truncation of the write-ahead log");
+    for (uint64_t position = offset; written && position < wal_length;)
+    {
+        ssize_t length = pread(wal_fd, records, WAL_BUFFER_SIZE, position);
+        written = length > 0 && write_wal_data(fd, records, length);
+        position += length;
+    }
+    free(records);
+    if (!written || fdatasync(fd) == -1 || rename(wal_temp_path, wal_path) == -1)
+    {
+        perror("Error truncating the write-ahead log");
+        close(fd);
+        unlink(wal_temp_path);
+        return;
+    }
+
+    close(wal_fd);
+    wal_fd = fd;
+    wal_generation = generation;
+    wal_length = WAL_FILE_HEADER_SIZE + wal_length - offset;
+}
+
+/**
+ * @brief Collects the child writing a snapshot, if any, and truncates the log once the snapshot is durable
+ *
+ * @param wait true to wait for the child to terminate, false to return if it is still running
+ */
+void finish_state_snapshot(bool wait)
+{
+    uint64_t report[2];
+    int status;
+    if (snapshot_pid == -1)
+        return;
+    pid_t result = waitpid(snapshot_pid, &status, wait ? 0 : WNOHANG);
+    if (result == 0)
+        return;
+
+    bool written = result == snapshot_pid && WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS &&
+                   read(snapshot_report_fd, report, sizeof(report)) == sizeof(report);
+    close(snapshot_report_fd);
+    snapshot_pid = -1;
+    if (!written)
+    {
+        printf("Error writing the snapshot of the rankings\n");
+        return;
+    }
+    __atomic_store_n(&last_snapshot_bytes, report[0], __ATOMIC_RELAXED);
+    __atomic_store_n(&last_snapshot_ns, report[1], __ATOMIC_RELAXED);
+    __atomic_store_n(&snapshots_taken, snapshots_taken + 1, __ATOMIC_RELAXED);
+    truncate_wal(snapshot_offset);
+}
+
+/**
+ * @brief Pauses the workers, writes their records to the log and forks the child writing the snapshot
+ *
+ * The workers pause at the end of an iteration, or while waiting for space in a ranking queue, where the
+ * rankings and the log match; they are released as soon as the child is forked.
+ */
+void take_checkpoint()
+{
+    pthread_mutex_lock(&wal_lock);
+    __atomic_store_n(&checkpoint_pending, true, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&wal_lock);
+    for (unsigned int i = 0; i < wal_total_workers; i++)
+        wake_worker(&wal_workers[i]);
+
+    pthread_mutex_lock(&wal_lock);
+    while (checkpoint_paused < wal_total_workers)
+        pthread_cond_wait(&checkpoint_cond, &wal_lock);
+    write_wal_buffers();
+    if (!fork_state_snapshot(wal_length))
+        perror("Error forking the snapshot of the rankings");
+    __atomic_store_n(&checkpoint_pending, false, __ATOMIC_RELEASE);
+    pthread_cond_broadcast(&checkpoint_cond);
+    pthread_mutex_unlock(&wal_lock);
+
+    if (fdatasync(wal_fd) == -1)
+        perror("Error synchronizing the write-ahead log");
+}
+
+/**
+ * @brief Waits until the checkpoint requested by the writer thread, if any, has forked its snapshot
+ *
+ * It is called by the workers at the end of every iteration and while waiting for space in a ranking queue.
+ */
+void pause_for_checkpoint()
+{
+    if (!__atomic_load_n(&checkpoint_pending, __ATOMIC_ACQUIRE))
+        return;
+    pthread_mutex_lock(&wal_lock);
+    checkpoint_paused++;
+    pthread_cond_broadcast(&checkpoint_cond);
+    while (checkpoint_pending)
+        pthread_cond_wait(&checkpoint_cond, &wal_lock);
+    checkpoint_paused--;
+    pthread_mutex_unlock(&wal_lock);
+}
+
+/**
+ * @brief Body of the writer thread, which commits the log every WAL_COMMIT_MS and takes the snapshots
+ *
+ * @param arg unused
+ * @return NULL
+ */
+void *run_wal_writer(void *arg)
+{
+    pthread_mutex_lock(&wal_lock);
+    while (!wal_stopping)
+    {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += WAL_COMMIT_MS * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L)
+        {
+            deadline.tv_sec += 1;
+            deadline.tv_nsec -= 1000000000L;
+        }
+        pthread_cond_timedwait(&wal_cond, &wal_lock, &deadline);
+        pthread_mutex_unlock(&wal_lock);
+
+        commit_wal();
+        if (snapshot_pid != -1)
+            finish_state_snapshot(false);
+        else if (wal_length - WAL_FILE_HEADER_SIZE >= WAL_SNAPSHOT_BYTES)
+            take_checkpoint();
+        pthread_mutex_lock(&wal_lock);
+    }
+    pthread_mutex_unlock(&wal_lock);
+    return NULL;
+}
+
+/**
+ * @brief Stops the writer thread, after the checkpoint it might be taking
+ *
+ * It must be called while the workers are still running, since a checkpoint waits for them to pause.
+ * The workers keep appending to their buffers, committed by wal_close.
+ */
+void wal_stop()
+{
+    if (!wal_thread_started)
+        return;
+    pthread_mutex_lock(&wal_lock);
+    wal_stopping = true;
+    pthread_cond_signal(&wal_cond);
+    pthread_mutex_unlock(&wal_lock);
+    pthread_join(wal_thread, NULL);
+    wal_thread_started = false;
+}
+
+/**
+ * @brief Commits the last records, saves a snapshot of the rankings and closes the log
+ *
+ * The snapshot lets the next start skip the replay of the log. It must be called after the workers have terminated.
+ */
+void wal_close()
+{
+    if (wal_fd == -1)
+        return;
+    wal_stop();
+    commit_wal();
+    wal_running = false;
+
+    finish_state_snapshot(true);
+    if (wal_length > WAL_FILE_HEADER_SIZE)
+    {
+        if (fork_state_snapshot(wal_length))
+            finish_state_snapshot(true);
+        else
+            perror("Error forking the snapshot of the rankings");
+    }
+    printf("Write-ahead log: %llu bytes in %llu group commits, %llu snapshots\n", (unsigned long long)wal_bytes,
+           (unsigned long long)wal_commits, (unsigned long long)snapshots_taken);
+    if (snapshots_taken)
+        printf("Last snapshot: fork %.1f us, %llu bytes written in %.1f ms (%.1f MB/s)\n", last_fork_ns / 1e3,
+               (unsigned long long)last_snapshot_bytes, last_snapshot_ns / 1e6,
+               last_snapshot_ns ? last_snapshot_bytes * 1e3 / last_snapshot_ns : 0.0);
+    close(wal_fd);
+    wal_fd = -1;
+}
+
+/**
+ * @brief Commits the last records and closes the log without a snapshot, before handing it over to a new server
+ *
+ * The snapshot being written, if any, is completed first, since it truncates the log. It must be called after the
+ * workers have terminated.
+ */
+void wal_handoff()
+{
+    if (wal_fd == -1)
+        return;
+    wal_stop();
+    commit_wal();
+    wal_running = false;
+    finish_state_snapshot(true);
+    close(wal_fd);
+    wal_fd = -1;
+}
+
+/**
+ * @brief Displays the activity of the write-ahead log and of its snapshots, if enabled
+ */
+void show_wal_stats()
+{
+    if (wal_fd == -1)
+        return;
+    uint64_t bytes = __atomic_load_n(&last_snapshot_bytes, __ATOMIC_RELAXED);
+    uint64_t elapsed_ns = __atomic_load_n(&last_snapshot_ns, __ATOMIC_RELAXED);
+    printf("Log: %llu KB in %llu commits, %llu snapshots (fork %.1f us, %.1f MB/s)\n",
+           (unsigned long long)__atomic_load_n(&wal_bytes, __ATOMIC_RELAXED) / 1024,
+           (unsigned long long)__atomic_load_n(&wal_commits, __ATOMIC_RELAXED),
+           (unsigned long long)__atomic_load_n(&snapshots_taken, __ATOMIC_RELAXED),
+           __atomic_load_n(&last_fork_ns, __ATOMIC_RELAXED) / 1e3, elapsed_ns ? bytes * 1e3 / elapsed_ns : 0.0);
+}
+
+/**
+ * @brief Copies the activity of the write-ahead log and of its snapshots to a publication of the statistics
+ *
+ * @param stats pointer to the statistics being published, left untouched if the log is not enabled
+ */
+void fill_wal_stats(ShmStats *stats)
+{
+    if (wal_fd == -1)
+        return;
+    stats->wal_enabled = 1;
+    stats->wal_bytes = __atomic_load_n(&wal_bytes, __ATOMIC_RELAXED);
+    stats->wal_commits = __atomic_load_n(&wal_commits, __ATOMIC_RELAXED);
+    stats->wal_snapshots = __atomic_load_n(&snapshots_taken, __ATOMIC_RELAXED);
+    stats->wal_fork_ns = __atomic_load_n(&last_fork_ns, __ATOMIC_RELAXED);
+    stats->snapshot_bytes = __atomic_load_n(&last_snapshot_bytes, __ATOMIC_RELAXED);
+    stats->snapshot_ns = __atomic_load_n(&last_snapshot_ns, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Removes from a ranking the node recovered from the log with the nickname of a player starting the quiz
+ *
+ * It is called by the owner before inserting the node of the player, only while recovered nodes are left.
+ *
+ * @param quiz pointer to the quiz
+ * @param node pointer to the node being inserted
+ */
+void discard_recovered_player(Quiz *quiz, RankingNode *node)
+{
+    for (RankingNode *current = quiz->ranking_head; current; current = current->next_node)
+    {
+        if (!current->recovered || strcmp(current->nickname, node->nickname) != 0)
+            continue;
+        record_left_player(quiz, current);
+        remove_ranking(current, quiz);
+        quiz->recovered_players--;
+        return;
+    }
+}
+
+/**
+ * @brief Deallocates the log buffer of a worker
+ *
+ * @param buffer pointer to the buffer
+ */
+void deallocate_wal_buffer(WalBuffer *buffer)
+{
+    free(buffer->data);
+    free(buffer->spare);
+    buffer->data = buffer->spare = NULL;
+    pthread_mutex_destroy(&buffer->lock);
+}
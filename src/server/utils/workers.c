@@ -0,0 +1,240 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include "utils.h"
+#include "../../common/params.h"
+
+/**
+ * @brief Initializes the context of a worker
+ *
+ * The listener socket is not created here: the server opens one for each worker,
+ * while the simulation harness does not need any.
+ * The worker becomes the owner of the rankings of the quizzes whose id, modulo the number of workers,
+ * is equal to its index.
+ *
+ * @param context pointer to the context to initialize
+ * @param worker_id index of the worker
+ * @param total_workers number of workers of the server
+ * @param quizzesInfo pointer to the quizzes shared by the workers
+ * @param nicknames pointer to the nickname registry shared by the workers
+ * @param sessions pointer to the session registry shared by the workers, NULL to disable the resumption
+ * @param io backend used to wait for activity on the sockets, initialized by the worker thread
+ */
+void init_worker(Context *context, unsigned int worker_id, unsigned int total_workers, QuizzesInfo *quizzesInfo,
+                 NicknameRegistry *nicknames, SessionRegistry *sessions, const IoBackend *io)
+{
+    context->worker_id = worker_id;
+    context->total_workers = total_workers;
+    context->quizzesInfo = quizzesInfo;
+    context->nicknames = nicknames;
+    context->sessions = sessions;
+    context->parked_head = context->parked_tail = NULL;
+    context->ranking_buffer = NULL;
+    context->ranking_buffer_size = 0;
+    context->entries_buffer = NULL;
+    context->entries_buffer_size = 0;
+    memset(&context->strings, 0, sizeof(StringTable));
+    init_wal_buffer(&context->wal);
+    context->server_fd = -1;
+    context->stop_requested = false;
+    context->upgrading = false;
+    context->wake_pending = false;
+    context->handled_events = 0;
+    context->io_state = NULL;
+    context->flush_head = NULL;
+    memset(&context->io_stats, 0, sizeof(context->io_stats));
+    init_clients_info(&context->clientsInfo);
+    init_ranking_queue(&context->ranking_queue, RANKING_QUEUE_CAPACITY);
+    init_timer_wheel(&context->timers, get_time_ns());
+    context->timeouts.login_ms = LOGIN_TIMEOUT_MS;
+    context->timeouts.idle_ms = IDLE_TIMEOUT_MS;
+    context->timeouts.question_ms = QUESTION_TIMEOUT_MS;
+    context->timeouts.round_ms = LIVE_ROUND_MS;
+    context->timeouts.update_ms = 1000 / SPECTATOR_UPDATES_PER_S;
+    context->timeouts.resume_ms = SESSION_GRACE_MS;
+    init_timer(&context->session_timer, expire_parked_sessions, NULL);
+    init_client_limits(&context->limits);
+    init_timer(&context->memory_timer, sweep_client_memory, NULL);
+    memset(&context->memory_stats, 0, sizeof(context->memory_stats));
+    memset(context->ranking_cache, 0, sizeof(context->ranking_cache));
+    memset(context->throttled, 0, sizeof(context->throttled));
+    init_overload(context);
+    context->workers = NULL;
+    init_live_rosters(context);
+    init_ranking_removals(context);
+    init_spectators(context);
+    context->subscribers = NULL;
+    context->total_subscribers = context->subscribers_capacity = 0;
+
+    for (uint16_t i = 0; i < quizzesInfo->total_quizzes; i++)
+        if (i % total_workers == worker_id)
+            quizzesInfo->quizzes[i]->owner = context;
+
+    context->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (context->wake_fd == -1)
+    {
+        perror("Error creating the wake-up descriptor of a worker");
+        exit(EXIT_FAILURE);
+    }
+
+    context->io = io;
+}
+
+/**
+ * @brief Wakes up a worker blocked waiting for activity
+ *
+ * @param context pointer to the context of the worker
+ */
+void wake_worker(Context *context)
+{
+    uint64_t value = 1;
+    if (write(context->wake_fd, &value, sizeof(value)) == -1 && errno != EAGAIN)
+        perror("Error waking up a worker");
+}
+
+/**
+ * @brief Asks a worker to terminate its event loop
+ *
+ * @param context pointer to the context of the worker
+ */
+void stop_worker(Context *context)
+{
+    __atomic_store_n(&context->stop_requested, true, __ATOMIC_RELEASE);
+    wake_worker(context);
+}
+
+/**
+ * @brief Event loop of a worker
+ *
+ * The worker accepts the connections arriving on its own listener socket and handles
+ * the messages of the clients it has accepted, until stop_worker is called.
+ * When it is stopped for an upgrade, its connections are left in a state that can be handed over.
+ *
+ * @param arg pointer to the context of the worker
+ * @return NULL
+ */
+void *run_worker(void *arg)
+{
+    Context *context = arg;
+    Client *client, *next;
+    uint64_t wake_ticks, wake_ns;
+    int activity, timeout_ms;
+
+    context->io->init(context);
+    // Register the connections handed over by the server this one replaces, if it is an upgrade
+    adopt_handoff_connections(context);
+    start_memory_sweep(context);
+
+    while (!__atomic_load_n(&context->stop_requested, __ATOMIC_ACQUIRE))
+    {
+        PROBE0(loop__start);
+        // Wait for activity no longer than the next timer expiration, without waiting if clients are left to release
+        timeout_ms = context->clientsInfo.closing_head ? 0 : next_timer_timeout(&context->timers, get_time_ns());
+        activity = context->io->wait(context, timeout_ms);
+        wake_ticks = flight_clock();
+        wake_ns = get_time_ns();
+        PROBE1(loop__wake, activity);
+
+        // Check for errors while waiting for activity
+        if (activity < 0)
+        {
+            flight_record(FLIGHT_ERROR, FLIGHT_ERROR_WAIT, context->worker_id, errno, 0);
+            perror("Waiting for activity failed");
+            exit(EXIT_FAILURE);
+        }
+
+        // Expire the timers that are due, before the clients they refer to are handled
+        advance_timers(&context->timers, wake_ns, context);
+
+        // Consume the wake-up notifications
+        if (context->io->is_ready(context, context->wake_fd))
+        {
+            uint64_t value;
+            if (read(context->wake_fd, &value, sizeof(value)) == -1 && errno != EAGAIN)
+                perror("Error reading the wake-up descriptor");
+            count_io(&context->io_stats.syscalls, 1);
+        }
+
+        // Handle a new connection from a user on the worker, unless the overload controller paused the accepts
+        if (context->overload.stage < OVERLOAD_ACCEPTS_PAUSED && context->io->is_ready(context, context->server_fd))
+            handle_new_client_connection(context);
+
+        // Loop through the client list to handle requests on their respective sockets
+        client = context->clientsInfo.clients_head;
+        while (client)
+        {
+            next = client->next_node;
+            if (context->io->is_ready(context, client->socket_fd))
+                handle_client(client, context);
+            client = next;
+        }
+
+        // Release the clients disconnected during the iteration, then apply the changes submitted to the rankings
+        // owned by the worker, including their removals, and publish them
+        release_disconnected_clients(context);
+        process_ranking_events(context);
+        // Shed or restore load according to the time taken by the iteration, admitting the clients of the waiting room
+        update_overload(context, get_time_ns() - wake_ns);
+        // Send the frames coalesced during the iteration
+        context->io->flush(context);
+        // Let the write-ahead log fork its snapshot while the rankings match the log, if it is taking one
+        pause_for_checkpoint();
+
+        __atomic_store_n(&context->handled_events, context->handled_events + activity, __ATOMIC_RELAXED);
+        flight_record(FLIGHT_LOOP, context->worker_id, 0, activity, flight_clock() - wake_ticks);
+        PROBE0(loop__end);
+    }
+
+    // Before a handover, complete the operations in flight and register the connections already accepted
+    // The clients of the waiting room are admitted, to be handed over as any client logging in
+    if (context->upgrading)
+    {
+        while (context->io->quiesce(context))
+            handle_new_client_connection(context);
+        admit_waiting_clients(context, context->overload.total_waiting);
+    }
+    // The clients disconnected by the last iteration are not handed over, and their nodes leave the rankings
+    release_disconnected_clients(context);
+    submit_ranking_removals(context);
+    return NULL;
+}
+
+/**
+ * @brief Deallocates the clients and the buffers of a worker and closes its descriptors
+ *
+ * The changes still waiting in the queue of the worker are applied first, so that the nodes they refer to
+ * are part of the rankings when the quizzes are deallocated.
+ *
+ * @param context pointer to the context of the worker
+ */
+void deallocate_worker(Context *context)
+{
+    drain_ranking_events(context);
+    deallocate_ranking_queue(&context->ranking_queue);
+    // Release the connections of the clients still connected, then the backend that might reference them
+    release_disconnected_clients(context);
+    for (Client *client = context->clientsInfo.clients_head; client; client = client->next_node)
+        context->io->unwatch(context, client->socket_fd);
+    context->io->destroy(context);
+    deallocate_clients(&context->clientsInfo);
+    deallocate_parked_sessions(context);
+    free(context->ranking_buffer);
+    context->ranking_buffer = NULL;
+    free(context->entries_buffer);
+    context->entries_buffer = NULL;
+    deallocate_string_table(&context->strings);
+    deallocate_ranking_cache(context);
+    deallocate_wal_buffer(&context->wal);
+    free(context->live_rosters);
+    context->live_rosters = NULL;
+    free(context->removals);
+    context->removals = NULL;
+    deallocate_spectators(context);
+    free(context->subscribers);
+    context->subscribers = NULL;
+    if (context->server_fd != -1)
+        close(context->server_fd);
+    close(context->wake_fd);
+}
@@ -0,0 +1,394 @@
+#include <fcntl.h>
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include "../common/common.h"
+#include "../common/params.h"
+#include "../common/shm.h"
+
+// Default interval between two refreshes of the screen
+#define TOP_REFRESH_MS 1000
+// Attempts to copy a publication before giving up until the next refresh
+#define TOP_READ_ATTEMPTS 16
+
+// Names of the client states of the server, in the order of the memory statistics
+static const char *state_names[SHM_CLIENT_STATES] = {"login", "logged in", "selecting", "playing", "spectating"};
+// Names of the classes of requests limited by the server, in the order of ShmStats.throttled
+static const char *rate_names[SHM_RATE_CLASSES] = {"answers", "rankings", "quiz-lists", "nicknames"};
+// Names of the stages of overload of the server, in the order of ShmStats.overload_entered
+static const char *stage_names[SHM_OVERLOAD_STAGES] = {"none", "cached rankings", "waiting room", "accepts paused"};
+
+/**
+ * @brief Shared-memory region of the server, mapped read-only
+ */
+typedef struct TopRegion
+{
+    const ShmHeader *header; /**< Header of the region, NULL if not attached. */
+    size_t size;             /**< Size of the mapping. */
+} TopRegion;
+
+/**
+ * @brief Prints the command line options accepted by the viewer
+ *
+ * @param program_name name of the executable
+ */
+void print_usage(const char *program_name)
+{
+    printf("Usage: %s [-i milliseconds] [-n refreshes] [shm_name]\n", program_name);
+    printf("  -i milliseconds  interval between two refreshes (default %d)\n", TOP_REFRESH_MS);
+    printf("  -n refreshes     exit after the given number of refreshes, printed without clearing the screen\n");
+    printf("  shm_name         shared-memory region given to the server with -m (default %s)\n", SHM_NAME);
+}
+
+/**
+ * @brief Maps the shared-memory region of the server read-only
+ *
+ * @param region pointer to the region to attach
+ * @param name name of the POSIX shared-memory object
+ * @return true if the region exists and has a compatible layout
+ */
+bool attach_region(TopRegion *region, const char *name)
+{
+    struct stat status;
+    int fd = shm_open(name, O_RDONLY, 0);
+    if (fd == -1)
+        return false;
+    if (fstat(fd, &status) == -1 || (size_t)status.st_size < sizeof(ShmHeader))
+    {
+        close(fd);
+        return false;
+    }
+    void *mapping = mmap(NULL, status.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED)
+        return false;
+
+    region->header = mapping;
+    region->size = status.st_size;
+    const ShmHeader *header = region->header;
+    if (memcmp(header->magic, SHM_MAGIC, SHM_MAGIC_SIZE) != 0 || header->version != SHM_VERSION ||
+        header->header_size != sizeof(ShmHeader) || header->header_size + 2 * (size_t)header->buffer_size > region->size)
+    {
+        munmap(mapping, region->size);
+        region->header = NULL;
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Unmaps the shared-memory region
+ */
+void detach_region(TopRegion *region)
+{
+    if (!region->header)
+        return;
+    munmap((void *)region->header, region->size);
+    region->header = NULL;
+}
+
+/**
+ * @brief Copies the last complete publication of the server
+ *
+ * The copy is retried if the server has started overwriting the buffer while it was being read.
+ *
+ * @param region pointer to the attached region
+ * @param copy buffer of region->header->buffer_size bytes receiving the publication
+ * @return length of the publication, 0 if none is available or the server publishes too fast
+ */
+size_t read_publication(TopRegion *region, char *copy)
+{
+    const ShmHeader *header = region->header;
+    for (int attempt = 0; attempt < TOP_READ_ATTEMPTS; attempt++)
+    {
+        uint64_t sequence = __atomic_load_n(&header->sequence, __ATOMIC_ACQUIRE);
+        if (sequence == 0)
+            return 0;
+        size_t length = header->lengths[sequence % 2];
+        if (length > header->buffer_size)
+            continue;
+        memcpy(copy, (const char *)header + header->header_size + (sequence % 2) * (size_t)header->buffer_size, length);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        // The copy is consistent unless the server has started the next publication in the same buffer
+        if (__atomic_load_n(&header->started, __ATOMIC_RELAXED) < sequence + 2)
+            return length;
+    }
+    return 0;
+}
+
+/**
+ * @brief Reads the entry of a player from a leaderboard
+ *
+ * @return pointer to the following entry, NULL if the entry is truncated
+ */
+const char *read_entry(const char *pointer, const char *end, const char **nickname, uint64_t *nickname_length,
+                       uint64_t *score, uint64_t *completed)
+{
+    size_t length = decode_varint(pointer, end, nickname_length);
+    if (length == 0 || (uint64_t)(end - pointer - length) < *nickname_length)
+        return NULL;
+    pointer += length;
+    *nickname = pointer;
+    pointer += *nickname_length;
+    if ((length = decode_varint(pointer, end, score)) == 0)
+        return NULL;
+    pointer += length;
+    if ((length = decode_varint(pointer, end, completed)) == 0)
+        return NULL;
+    return pointer + length;
+}
+
+/**
+ * @brief Prints the statistics of the server and of its workers, as the dashboard of the server does
+ *
+ * @param stats statistics of the publication
+ * @param workers statistics of the workers, copied out of the publication
+ * @param previous statistics of the previous publication displayed, to compute the accept rate
+ */
+void print_stats(const ShmStats *stats, const ShmWorker *workers, const ShmStats *previous)
+{
+    printf("Workers (%u):", stats->total_workers);
+    for (uint32_t i = 0; i < stats->total_workers; i++)
+        printf(" %u", workers[i].clients);
+    printf("\n");
+
+    printf("Syscalls/frame (%.*s):", (int)sizeof(stats->backend), stats->backend);
+    for (uint32_t i = 0; i < stats->total_workers; i++)
+    {
+        uint64_t frames = workers[i].frames_in + workers[i].frames_out;
+        printf(" %.2f", frames ? (double)workers[i].syscalls / frames : 0.0);
+    }
+    printf("\n");
+
+    double rate = previous->published_ns && stats->published_ns > previous->published_ns &&
+                          stats->accepted >= previous->accepted
+                      ? (stats->accepted - previous->accepted) * 1e9 / (stats->published_ns - previous->published_ns)
+                      : 0.0;
+    printf("Accepted: %llu (%.0f/s), budget exhausted %llu times, %llu rejected over the select limit\n",
+           (unsigned long long)stats->accepted, rate, (unsigned long long)stats->deferred,
+           (unsigned long long)stats->rejected);
+    printf("Timers: %llu pending, %llu expired\n", (unsigned long long)stats->timers_pending,
+           (unsigned long long)stats->timers_expired);
+
+    uint64_t memory = 0;
+    uint32_t clients = 0;
+    for (int s = 0; s < SHM_CLIENT_STATES; s++)
+    {
+        memory += stats->memory_bytes[s];
+        clients += stats->memory_clients[s];
+    }
+    printf("Memory: %llu KB for %u clients (", (unsigned long long)memory / 1024, clients);
+    for (int s = 0; s < SHM_CLIENT_STATES; s++)
+        printf("%s%s %llu", s ? ", " : "", state_names[s], (unsigned long long)stats->memory_bytes[s] / 1024);
+    printf(" KB), dropped %llu oversized frames, %llu over budget\n", (unsigned long long)stats->frames_oversized,
+           (unsigned long long)stats->memory_exceeded);
+    printf("Throttled:");
+    for (int c = 0; c < SHM_RATE_CLASSES; c++)
+        printf("%s %s %llu", c ? "," : "", rate_names[c], (unsigned long long)stats->throttled[c]);
+    printf("\n");
+    printf("Overload: stage %s, loop lag %.2f ms, queue depth %llu, %u waiting, %llu admitted, %llu cached rankings\n",
+           stats->overload_stage < SHM_OVERLOAD_STAGES ? stage_names[stats->overload_stage] : "unknown",
+           stats->loop_lag_ns / 1e6, (unsigned long long)stats->queue_depth, stats->waiting,
+           (unsigned long long)stats->admitted, (unsigned long long)stats->cached_rankings);
+    printf("Overload stages:");
+    for (int s = 1; s < SHM_OVERLOAD_STAGES; s++)
+        printf("%s %s at %.1f ms/%u queued, entered %llu times", s > 1 ? "," : "", stage_names[s],
+               stats->overload_lag_us[s] / 1e3, stats->overload_queue[s], (unsigned long long)stats->overload_entered[s]);
+    printf("\n");
+    if (stats->wal_enabled)
+        printf("Log: %llu KB in %llu commits, %llu snapshots (fork %.1f us, %.1f MB/s)\n",
+               (unsigned long long)stats->wal_bytes / 1024, (unsigned long long)stats->wal_commits,
+               (unsigned long long)stats->wal_snapshots, stats->wal_fork_ns / 1e3,
+               stats->snapshot_ns ? stats->snapshot_bytes * 1e3 / stats->snapshot_ns : 0.0);
+}
+
+/**
+ * @brief Prints the scores of the players shown in a leaderboard, or the ones who completed the quiz
+ *
+ * @param quiz fixed part of the leaderboard
+ * @param entries entries of the players, following the name of the quiz
+ * @param end end of the publication
+ * @param completed_only true to print only the nicknames of the players who completed the quiz
+ */
+void print_leaderboard(const ShmQuiz *quiz, const char *entries, const char *end, bool completed_only)
+{
+    const char *pointer = entries, *nickname;
+    uint64_t nickname_length, score, completed;
+    uint32_t printed = 0;
+
+    for (uint32_t i = 0; i < quiz->shown && pointer; i++)
+    {
+        pointer = read_entry(pointer, end, &nickname, &nickname_length, &score, &completed);
+        if (!pointer || (completed_only && !completed))
+            continue;
+        if (completed_only)
+            printf("- %.*s\n", (int)nickname_length, nickname);
+        else
+            printf("- %.*s %llu\n", (int)nickname_length, nickname, (unsigned long long)score);
+        printed++;
+    }
+    uint32_t total = completed_only ? quiz->completed : quiz->total_players;
+    if (total > printed)
+        printf("... and %u more\n", total - printed);
+    else if (!printed)
+        printf("------\n");
+}
+
+/**
+ * @brief Prints a publication of the server in the layout of its dashboard
+ *
+ * @param data copy of the publication
+ * @param length length of the publication
+ * @param pid process id of the server
+ * @param previous statistics of the previous publication displayed, updated with the ones of this publication
+ * @return false if the publication is malformed
+ */
+bool print_publication(const char *data, size_t length, uint32_t pid, ShmStats *previous)
+{
+    const char *end = data + length;
+    ShmStats stats;
+    if (length < sizeof(ShmStats))
+        return false;
+    memcpy(&stats, data, sizeof(ShmStats));
+    if ((length - sizeof(ShmStats)) / sizeof(ShmWorker) < stats.total_workers)
+        return false;
+
+    ShmWorker *workers = malloc((stats.total_workers + 1) * sizeof(ShmWorker));
+    ShmQuiz *quizzes = malloc((stats.total_quizzes + 1) * sizeof(ShmQuiz));
+    const char **names = malloc((stats.total_quizzes + 1) * sizeof(char *));
+    const char **entries = malloc((stats.total_quizzes + 1) * sizeof(char *));
+    handle_malloc_error(workers, "Memory allocation error for the statistics of the workers");
+    handle_malloc_error(quizzes, "Memory allocation error for the leaderboards");
+    handle_malloc_error(names, "Memory allocation error for the leaderboards");
+    handle_malloc_error(entries, "Memory allocation error for the leaderboards");
+    memcpy(workers, data + sizeof(ShmStats), stats.total_workers * sizeof(ShmWorker));
+
+    // Locate the leaderboards, whose entries have a variable length
+    const char *pointer = data + sizeof(ShmStats) + stats.total_workers * sizeof(ShmWorker);
+    bool valid = true;
+    for (uint16_t i = 0; i < stats.total_quizzes && valid; i++)
+    {
+        valid = (size_t)(end - pointer) >= sizeof(ShmQuiz);
+        if (!valid)
+            break;
+        memcpy(&quizzes[i], pointer, sizeof(ShmQuiz));
+        pointer += sizeof(ShmQuiz);
+        valid = (size_t)(end - pointer) >= quizzes[i].name_length;
+        names[i] = pointer;
+        pointer += valid ? quizzes[i].name_length : 0;
+        entries[i] = pointer;
+        const char *nickname;
+        uint64_t nickname_length, score, completed;
+        for (uint32_t j = 0; j < quizzes[i].shown && valid; j++)
+            valid = (pointer = read_entry(pointer, end, &nickname, &nickname_length, &score, &completed)) != NULL;
+    }
+
+    if (valid)
+    {
+        printf("Trivia Quiz (server %u, published %.0f ms ago)\n", pid,
+               get_time_ns() > stats.published_ns ? (get_time_ns() - stats.published_ns) / 1e6 : 0.0);
+        printf("+++++++++++++++++++++++++++\n");
+        printf("Quizzes:\n");
+        for (uint16_t i = 0; i < stats.total_quizzes; i++)
+            printf("%d - %.*s\n", i + 1, quizzes[i].name_length, names[i]);
+        print_stats(&stats, workers, previous);
+        printf("+++++++++++++++++++++++++++\n");
+        printf("\nParticipants (%u)\n", stats.participants);
+        if (stats.resumption && (stats.sessions_parked || stats.sessions_resumed || stats.sessions_expired))
+            printf("Sessions waiting to be resumed: %u (%llu resumed, %llu expired)\n", stats.sessions_parked,
+                   (unsigned long long)stats.sessions_resumed, (unsigned long long)stats.sessions_expired);
+        for (uint16_t i = 0; i < stats.total_quizzes; i++)
+        {
+            printf("\nScore for Quiz %d\n", i + 1);
+            print_leaderboard(&quizzes[i], entries[i], end, false);
+        }
+        for (uint16_t i = 0; i < stats.total_quizzes; i++)
+        {
+            printf("\nQuiz %d completed\n", i + 1);
+            print_leaderboard(&quizzes[i], entries[i], end, true);
+        }
+        *previous = stats;
+    }
+    free(workers);
+    free(quizzes);
+    free(names);
+    free(entries);
+    return valid;
+}
+
+int main(int argc, char **argv)
+{
+    const char *name = SHM_NAME;
+    unsigned long interval_ms = TOP_REFRESH_MS, refreshes = 0;
+    TopRegion region = {NULL, 0};
+    ShmStats previous;
+    char *copy = NULL;
+    uint32_t pid = 0;
+    int option;
+
+    while ((option = getopt(argc, argv, "i:n:h")) != -1)
+    {
+        switch (option)
+        {
+        case 'i':
+            interval_ms = strtoul(optarg, NULL, 10);
+            if (interval_ms == 0)
+            {
+                print_usage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'n':
+            refreshes = strtoul(optarg, NULL, 10);
+            break;
+        default:
+            print_usage(argv[0]);
+            exit(option == 'h' ? EXIT_SUCCESS : EXIT_FAILURE);
+        }
+    }
+    if (optind < argc)
+        name = argv[optind];
+
+    memset(&previous, 0, sizeof(previous));
+    for (unsigned long refresh = 0; refreshes == 0 || refresh < refreshes; refresh++)
+    {
+        if (refresh > 0)
+        {
+            struct timespec delay = {interval_ms / 1000, (interval_ms % 1000) * 1000000L};
+            nanosleep(&delay, NULL);
+        }
+        // Attach again when the region is replaced, for instance by a server started with another layout
+        if (region.header && memcmp(region.header->magic, SHM_MAGIC, SHM_MAGIC_SIZE) != 0)
+            detach_region(&region);
+        if (!region.header && !attach_region(&region, name))
+        {
+            printf("No server is publishing in %s\n", name);
+            continue;
+        }
+        if (region.header->pid != pid)
+        {
+            // A new server does not continue the counters of the previous one
+            pid = region.header->pid;
+            memset(&previous, 0, sizeof(previous));
+            free(copy);
+            copy = malloc(region.header->buffer_size);
+            handle_malloc_error(copy, "Memory allocation error for the copy of the publication");
+        }
+
+        size_t length = read_publication(&region, copy);
+        if (!refreshes)
+            printf("\033[H\033[2J");
+        if (length == 0 || !print_publication(copy, length, pid, &previous))
+            printf("The server %u has not published its statistics yet\n", pid);
+        fflush(stdout);
+    }
+    detach_region(&region);
+    free(copy);
+    return 0;
+}